@@ -0,0 +1,1644 @@
+#include "assetindex.h"
+
+#include "perceptualhash.h"
+
+#include <QFile>
+#include <QSet>
+#include <QMutexLocker>
+#include <QReadLocker>
+#include <QSaveFile>
+#include <QWriteLocker>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <type_traits>
+
+namespace {
+constexpr quint32 sortOrderBit(FilterOptions::SortOrder sortOrder)
+{
+    return 1u << sortOrder;
+}
+
+// Orders that read the capture time; the camera order breaks ties by it.
+constexpr quint32 kDateSortOrders = sortOrderBit(FilterOptions::SortByDateDesc)
+    | sortOrderBit(FilterOptions::SortByDateAsc) | sortOrderBit(FilterOptions::SortByCameraMake);
+constexpr quint32 kIsoSortOrders = sortOrderBit(FilterOptions::SortByIsoDesc) | sortOrderBit(FilterOptions::SortByIsoAsc);
+
+// Mirrors the camera clause of MetadataCache::filterWhereClause.
+bool cameraMatches(const QString &make, const QString &model, const QString &filter)
+{
+    if (make.isEmpty() && model.isEmpty()) {
+        return false;
+    }
+
+    const QString combined = make + QLatin1Char(' ') + model;
+    if (combined == filter) {
+        return true;
+    }
+
+    const QStringList parts = filter.split(QLatin1Char(' '), Qt::SkipEmptyParts);
+    if (parts.size() >= 2) {
+        return make == parts.first() && model == parts.mid(1).join(QLatin1Char(' '));
+    }
+    return make == filter || model == filter;
+}
+
+// Snapshot file layout, in host byte order (the file is a local cache and
+// is rebuilt when it does not validate):
+//   SnapshotHeader
+//   SnapshotRow[rowCount]
+//   quint32[2 * cameraCount]   make and model string of each camera id
+//   quint32[lensCount]         string of each lens id
+//   quint32[2 * tagCount]      name string and posting count of each tag
+//   quint32[postingCount]      rows of every tag, concatenated
+//   quint32[stringCount + 1]   offsets into the UTF-8 string data
+//   string data
+// Strings are interned, so repeated file names, formats and camera names are
+// stored and decoded once. String 0 is the empty string.
+constexpr quint32 kSnapshotMagic = 0x504e5341; // "ASNP"
+constexpr quint32 kSnapshotVersion = 3;
+
+struct SnapshotHeader
+{
+    quint32 magic = kSnapshotMagic;
+    quint32 version = kSnapshotVersion;
+    quint32 rowCount = 0;
+    quint32 cameraCount = 0;
+    quint32 lensCount = 0;
+    quint32 tagCount = 0;
+    quint32 postingCount = 0;
+    quint32 stringCount = 0;
+    quint64 stringBytes = 0;
+};
+
+struct SnapshotRow
+{
+    qint64 id;
+    qint64 captureEpoch;
+    quint64 perceptualHash;
+    quint32 photoNumber;
+    quint32 fileName;
+    quint32 originalPath;
+    quint32 previewPath;
+    quint32 format;
+    qint32 width;
+    qint32 height;
+    qint32 iso;
+    quint32 cameraId;
+    quint32 lensId;
+    quint32 marks;
+};
+
+class SnapshotStrings
+{
+public:
+    SnapshotStrings()
+    {
+        m_offsets.append(0);
+        intern(QString());
+    }
+
+    quint32 intern(const QString &value)
+    {
+        auto it = m_lookup.constFind(value);
+        if (it != m_lookup.constEnd()) {
+            return it.value();
+        }
+        const quint32 index = quint32(m_offsets.size() - 1);
+        m_data.append(value.toUtf8());
+        m_offsets.append(quint32(m_data.size()));
+        m_lookup.insert(value, index);
+        return index;
+    }
+
+    const QVector<quint32> &offsets() const { return m_offsets; }
+    const QByteArray &data() const { return m_data; }
+
+private:
+    QHash<QString, quint32> m_lookup;
+    QVector<quint32> m_offsets;
+    QByteArray m_data;
+};
+
+template <typename T>
+void appendRaw(QByteArray &out, const T *values, qsizetype count)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    out.append(reinterpret_cast<const char *>(values), count * qsizetype(sizeof(T)));
+}
+
+// Bounds-checked sequential reads from the mapped file.
+class SnapshotReader
+{
+public:
+    SnapshotReader(const uchar *data, qint64 size)
+        : m_data(data)
+        , m_size(size)
+    {
+    }
+
+    template <typename T>
+    bool read(T *values, qint64 count)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const qint64 bytes = count * qint64(sizeof(T));
+        if (count < 0 || bytes > m_size - m_pos) {
+            return false;
+        }
+        std::memcpy(values, m_data + m_pos, size_t(bytes));
+        m_pos += bytes;
+        return true;
+    }
+
+    qint64 remaining() const { return m_size - m_pos; }
+
+    const uchar *take(qint64 bytes)
+    {
+        if (bytes < 0 || bytes > m_size - m_pos) {
+            return nullptr;
+        }
+        const uchar *start = m_data + m_pos;
+        m_pos += bytes;
+        return start;
+    }
+
+    bool atEnd() const { return m_pos == m_size; }
+
+private:
+    const uchar *m_data;
+    qint64 m_size;
+    qint64 m_pos = 0;
+};
+}
+
+bool AssetIndex::isLoaded() const
+{
+    QReadLocker locker(&m_lock);
+    return m_loaded;
+}
+
+int AssetIndex::size() const
+{
+    QReadLocker locker(&m_lock);
+    return m_columns.ids.size();
+}
+
+quint64 AssetIndex::reset()
+{
+    QWriteLocker locker(&m_lock);
+    m_columns = Columns();
+    m_loaded = false;
+    m_reloading = false;
+    m_pendingUpdates.clear();
+    m_collections.clear();
+    {
+        QMutexLocker permutationLocker(&m_permutationMutex);
+        m_permutations.clear();
+        m_permutationRanks.clear();
+    }
+    {
+        QMutexLocker similarityLocker(&m_similarityMutex);
+        m_similarityIndex.reset();
+    }
+    {
+        QMutexLocker burstLocker(&m_burstMutex);
+        m_burstLeaders.reset();
+    }
+    return ++m_generation;
+}
+
+quint64 AssetIndex::beginReload()
+{
+    QWriteLocker locker(&m_lock);
+    m_reloading = m_loaded;
+    m_pendingUpdates.clear();
+    return ++m_generation;
+}
+
+bool AssetIndex::load(quint64 generation,
+                      const QVector<LibraryAsset> &assets,
+                      const QVector<AssetMetadata> &metadata,
+                      bool *changed)
+{
+    // Build outside the lock; only the swap blocks readers.
+    Columns columns;
+    initialize(columns);
+
+    const int count = assets.size();
+    columns.ids.reserve(count);
+    columns.captureEpoch.reserve(count);
+    columns.iso.reserve(count);
+    columns.cameraId.reserve(count);
+    columns.lensId.reserve(count);
+    columns.perceptualHash.reserve(count);
+    columns.marks.reserve(count);
+    columns.rows.reserve(count);
+    columns.rowById.reserve(count);
+
+    for (const LibraryAsset &asset : assets) {
+        const int row = ensureRow(columns, asset.id);
+        columns.rows[row] = asset;
+        columns.perceptualHash[row] = asset.perceptualHash;
+        setMarks(columns, row, asset.marks);
+    }
+
+    for (const AssetMetadata &meta : metadata) {
+        const int row = columns.rowById.value(meta.assetId, -1);
+        if (row >= 0) {
+            setMetadata(columns, row, meta);
+        }
+    }
+    buildBurstOrder(columns);
+
+    QWriteLocker locker(&m_lock);
+    if (generation != m_generation) {
+        return false;
+    }
+
+    for (const Update &update : std::as_const(m_pendingUpdates)) {
+        update(columns);
+    }
+    m_pendingUpdates.clear();
+
+    if (changed) {
+        *changed = m_loaded && !sameContents(m_columns, columns);
+    }
+
+    m_columns = std::move(columns);
+    m_loaded = true;
+    m_reloading = false;
+    rebuildCollections();
+
+    QMutexLocker permutationLocker(&m_permutationMutex);
+    m_permutations.clear();
+    m_permutationRanks.clear();
+    QMutexLocker similarityLocker(&m_similarityMutex);
+    m_similarityIndex.reset();
+    QMutexLocker burstLocker(&m_burstMutex);
+    m_burstLeaders.reset();
+    return true;
+}
+
+void AssetIndex::upsertAsset(const LibraryAsset &asset)
+{
+    apply([asset](Columns &columns) {
+        const int row = ensureRow(columns, asset.id);
+        if (columns.rows.at(row).fileName != asset.fileName) {
+            columns.staleSortOrders |= sortOrderBit(FilterOptions::SortByFileName);
+        }
+        columns.rows[row] = asset;
+        // Assets are written before their preview exists; keep a hash the
+        // row already has rather than clearing it.
+        columns.rows[row].perceptualHash = columns.perceptualHash.at(row);
+        columns.rows[row].marks = columns.marks.at(row);
+        if (asset.perceptualHash != 0) {
+            setPerceptualHash(columns, row, asset.perceptualHash);
+        }
+        if (asset.marks != 0) {
+            setMarks(columns, row, asset.marks);
+        }
+    });
+}
+
+void AssetIndex::updatePreview(qint64 assetId,
+                               const QString &previewRelativePath,
+                               int width,
+                               int height,
+                               quint64 perceptualHash)
+{
+    apply([assetId, previewRelativePath, width, height, perceptualHash](Columns &columns) {
+        const int row = columns.rowById.value(assetId, -1);
+        if (row < 0) {
+            return;
+        }
+        LibraryAsset &asset = columns.rows[row];
+        asset.previewRelativePath = previewRelativePath;
+        asset.width = width;
+        asset.height = height;
+        setPerceptualHash(columns, row, perceptualHash);
+    });
+}
+
+void AssetIndex::updatePerceptualHashes(const QVector<QPair<qint64, quint64>> &hashes)
+{
+    apply([hashes](Columns &columns) {
+        for (const auto &entry : hashes) {
+            const int row = columns.rowById.value(entry.first, -1);
+            if (row >= 0) {
+                setPerceptualHash(columns, row, entry.second);
+            }
+        }
+    });
+}
+
+void AssetIndex::updateMetadata(const AssetMetadata &metadata)
+{
+    apply([metadata](Columns &columns) {
+        const int row = columns.rowById.value(metadata.assetId, -1);
+        if (row >= 0) {
+            setMetadata(columns, row, metadata);
+        }
+    });
+}
+
+void AssetIndex::updateMarks(const QVector<qint64> &assetIds, quint8 fieldMask, quint8 bits)
+{
+    apply([assetIds, fieldMask, bits](Columns &columns) {
+        for (qint64 assetId : assetIds) {
+            const int row = columns.rowById.value(assetId, -1);
+            if (row >= 0) {
+                setMarks(columns, row, AssetMarks::withField(columns.marks.at(row), fieldMask, bits));
+            }
+        }
+    });
+}
+
+QVector<LibraryAsset> AssetIndex::query(const FilterOptions &options, const QVector<qint64> *searchMatches) const
+{
+    QReadLocker locker(&m_lock);
+    QVector<int> sizes;
+    const QVector<int> rows = matchingRowsInOrder(options, searchMatches, &sizes);
+
+    QVector<LibraryAsset> result;
+    result.reserve(rows.size());
+    for (int i = 0; i < rows.size(); ++i) {
+        result.append(m_columns.rows.at(rows.at(i)));
+        if (i < sizes.size()) {
+            result.last().stackSize = sizes.at(i);
+        }
+    }
+    return result;
+}
+
+QVector<qint64> AssetIndex::queryIds(const FilterOptions &options,
+                                     const QVector<qint64> *searchMatches,
+                                     QHash<qint64, int> *stackSizes) const
+{
+    QReadLocker locker(&m_lock);
+    QVector<int> sizes;
+    const QVector<int> rows = matchingRowsInOrder(options, searchMatches, stackSizes ? &sizes : nullptr);
+
+    QVector<qint64> result;
+    result.reserve(rows.size());
+    for (int i = 0; i < rows.size(); ++i) {
+        const qint64 assetId = m_columns.ids.at(rows.at(i));
+        result.append(assetId);
+        if (i < sizes.size() && sizes.at(i) > 1) {
+            stackSizes->insert(assetId, sizes.at(i));
+        }
+    }
+    return result;
+}
+
+LibraryAsset AssetIndex::asset(qint64 assetId) const
+{
+    QReadLocker locker(&m_lock);
+    const int row = m_columns.rowById.value(assetId, -1);
+    return row >= 0 ? m_columns.rows.at(row) : LibraryAsset();
+}
+
+QVector<LibraryAsset> AssetIndex::assets(const QVector<qint64> &assetIds) const
+{
+    QReadLocker locker(&m_lock);
+    QVector<LibraryAsset> result;
+    result.reserve(assetIds.size());
+    for (qint64 assetId : assetIds) {
+        const int row = m_columns.rowById.value(assetId, -1);
+        if (row >= 0) {
+            result.append(m_columns.rows.at(row));
+        }
+    }
+    return result;
+}
+
+QVector<qint64> AssetIndex::similarAssetIds(qint64 assetId, int maxDistance) const
+{
+    QReadLocker locker(&m_lock);
+    const QVector<int> rows = similarRows(assetId, maxDistance);
+
+    QVector<qint64> result;
+    result.reserve(rows.size());
+    for (int row : rows) {
+        result.append(m_columns.ids.at(row));
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+void AssetIndex::setCollection(qint64 collectionId, const FilterOptions &rule)
+{
+    QWriteLocker locker(&m_lock);
+    Collection &collection = m_collections[collectionId];
+    collection.rule = rule;
+    collection.rows.clear();
+    if (!m_loaded) {
+        // Filled in by the load.
+        return;
+    }
+    const QVector<quint8> mask = filterMask(rule, nullptr);
+    for (int row = 0; row < mask.size(); ++row) {
+        if (mask.at(row)) {
+            collection.rows.add(quint32(row));
+        }
+    }
+}
+
+void AssetIndex::removeCollection(qint64 collectionId)
+{
+    QWriteLocker locker(&m_lock);
+    m_collections.remove(collectionId);
+}
+
+int AssetIndex::collectionSize(qint64 collectionId) const
+{
+    QReadLocker locker(&m_lock);
+    const auto it = m_collections.constFind(collectionId);
+    return it != m_collections.constEnd() ? int(it->rows.cardinality()) : 0;
+}
+
+QHash<QString, int> AssetIndex::tagCounts() const
+{
+    QReadLocker locker(&m_lock);
+    QHash<QString, int> counts;
+    counts.reserve(m_columns.tagLookup.size());
+    for (auto it = m_columns.tagLookup.constBegin(); it != m_columns.tagLookup.constEnd(); ++it) {
+        const int count = int(m_columns.tagRows.at(it.value()).cardinality());
+        if (count > 0) {
+            counts.insert(it.key(), count);
+        }
+    }
+    return counts;
+}
+
+void AssetIndex::apply(const Update &update)
+{
+    QWriteLocker locker(&m_lock);
+    if (!m_loaded) {
+        // A load is in flight; replay once its snapshot is installed.
+        m_pendingUpdates.append(update);
+        return;
+    }
+
+    const quint64 hashRevision = m_columns.hashRevision;
+    const quint64 burstRevision = m_columns.burstRevision;
+    m_columns.staleSortOrders = 0;
+    update(m_columns);
+    updateCollections();
+    if (m_reloading) {
+        // Also replay onto the contents replacing these.
+        m_pendingUpdates.append(update);
+    }
+
+    // Previews, hashes and marks are not sort keys, so the writes an import
+    // or a rating makes most often keep every cached order.
+    if (m_columns.staleSortOrders != 0) {
+        QMutexLocker permutationLocker(&m_permutationMutex);
+        for (int sortOrder = FilterOptions::SortByDateDesc; sortOrder <= FilterOptions::SortByFileName; ++sortOrder) {
+            if (m_columns.staleSortOrders & sortOrderBit(FilterOptions::SortOrder(sortOrder))) {
+                m_permutations.remove(sortOrder);
+                m_permutationRanks.remove(sortOrder);
+            }
+        }
+    }
+    if (m_columns.hashRevision != hashRevision) {
+        QMutexLocker similarityLocker(&m_similarityMutex);
+        m_similarityIndex.reset();
+    }
+    if (m_columns.burstRevision != burstRevision) {
+        QMutexLocker burstLocker(&m_burstMutex);
+        m_burstLeaders.reset();
+    }
+}
+
+bool AssetIndex::writeSnapshot(const QString &path, QString *errorMessage) const
+{
+    QByteArray data;
+    {
+        QReadLocker locker(&m_lock);
+        if (!m_loaded) {
+            if (errorMessage) {
+                *errorMessage = QStringLiteral("The asset index is not loaded.");
+            }
+            return false;
+        }
+        data = encodeSnapshot(m_columns);
+    }
+
+    // QSaveFile renames into place, so a reader never maps a partial file.
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Failed to write asset snapshot %1: %2").arg(path, file.errorString());
+        }
+        return false;
+    }
+    return true;
+}
+
+bool AssetIndex::loadSnapshot(quint64 generation, const QString &path, QString *errorMessage)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (errorMessage) {
+            *errorMessage = file.errorString();
+        }
+        return false;
+    }
+
+    const qint64 size = file.size();
+    const uchar *data = size > 0 ? file.map(0, size) : nullptr;
+    if (!data) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Failed to map asset snapshot %1").arg(path);
+        }
+        return false;
+    }
+
+    Columns columns;
+    const bool decoded = decodeSnapshot(data, size, columns, errorMessage);
+    file.unmap(const_cast<uchar *>(data));
+    if (!decoded) {
+        return false;
+    }
+
+    QWriteLocker locker(&m_lock);
+    if (generation != m_generation) {
+        return false;
+    }
+
+    for (const Update &update : std::as_const(m_pendingUpdates)) {
+        update(columns);
+    }
+    m_pendingUpdates.clear();
+
+    m_columns = std::move(columns);
+    m_loaded = true;
+    rebuildCollections();
+
+    QMutexLocker permutationLocker(&m_permutationMutex);
+    m_permutations.clear();
+    m_permutationRanks.clear();
+    QMutexLocker similarityLocker(&m_similarityMutex);
+    m_similarityIndex.reset();
+    QMutexLocker burstLocker(&m_burstMutex);
+    m_burstLeaders.reset();
+    return true;
+}
+
+QByteArray AssetIndex::encodeSnapshot(const Columns &columns)
+{
+    SnapshotStrings strings;
+
+    const int rowCount = columns.ids.size();
+    QVector<SnapshotRow> rows(rowCount);
+    for (int row = 0; row < rowCount; ++row) {
+        const LibraryAsset &asset = columns.rows.at(row);
+        SnapshotRow &out = rows[row];
+        out.id = columns.ids.at(row);
+        out.captureEpoch = columns.captureEpoch.at(row);
+        out.perceptualHash = columns.perceptualHash.at(row);
+        out.photoNumber = strings.intern(asset.photoNumber);
+        out.fileName = strings.intern(asset.fileName);
+        out.originalPath = strings.intern(asset.originalRelativePath);
+        out.previewPath = strings.intern(asset.previewRelativePath);
+        out.format = strings.intern(asset.format);
+        out.width = asset.width;
+        out.height = asset.height;
+        out.iso = columns.iso.at(row);
+        out.cameraId = columns.cameraId.at(row);
+        out.lensId = columns.lensId.at(row);
+        out.marks = columns.marks.at(row);
+    }
+
+    QVector<quint32> cameras;
+    cameras.reserve(columns.cameras.size() * 2);
+    for (const auto &camera : columns.cameras) {
+        cameras.append(strings.intern(camera.first));
+        cameras.append(strings.intern(camera.second));
+    }
+
+    QVector<quint32> lenses;
+    lenses.reserve(columns.lenses.size());
+    for (const QString &lens : columns.lenses) {
+        lenses.append(strings.intern(lens));
+    }
+
+    QVector<QString> tagNames(columns.tagRows.size());
+    for (auto it = columns.tagLookup.constBegin(); it != columns.tagLookup.constEnd(); ++it) {
+        tagNames[it.value()] = it.key();
+    }
+    QVector<quint32> tags;
+    QVector<quint32> postings;
+    tags.reserve(tagNames.size() * 2);
+    for (int tag = 0; tag < tagNames.size(); ++tag) {
+        const QVector<quint32> tagRows = columns.tagRows.at(tag).toVector();
+        tags.append(strings.intern(tagNames.at(tag)));
+        tags.append(quint32(tagRows.size()));
+        postings.append(tagRows);
+    }
+
+    SnapshotHeader header;
+    header.rowCount = quint32(rowCount);
+    header.cameraCount = quint32(columns.cameras.size());
+    header.lensCount = quint32(columns.lenses.size());
+    header.tagCount = quint32(tagNames.size());
+    header.postingCount = quint32(postings.size());
+    header.stringCount = quint32(strings.offsets().size() - 1);
+    header.stringBytes = quint64(strings.data().size());
+
+    QByteArray out;
+    out.reserve(qsizetype(sizeof(header)) + rows.size() * qsizetype(sizeof(SnapshotRow))
+                + (cameras.size() + lenses.size() + tags.size() + postings.size() + strings.offsets().size())
+                      * qsizetype(sizeof(quint32))
+                + strings.data().size());
+    appendRaw(out, &header, 1);
+    appendRaw(out, rows.constData(), rows.size());
+    appendRaw(out, cameras.constData(), cameras.size());
+    appendRaw(out, lenses.constData(), lenses.size());
+    appendRaw(out, tags.constData(), tags.size());
+    appendRaw(out, postings.constData(), postings.size());
+    appendRaw(out, strings.offsets().constData(), strings.offsets().size());
+    out.append(strings.data());
+    return out;
+}
+
+bool AssetIndex::decodeSnapshot(const uchar *data, qint64 size, Columns &columns, QString *errorMessage)
+{
+    const auto fail = [errorMessage](const QString &reason) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Invalid asset snapshot: %1").arg(reason);
+        }
+        return false;
+    };
+
+    SnapshotReader reader(data, size);
+    SnapshotHeader header;
+    if (!reader.read(&header, 1)) {
+        return fail(QStringLiteral("truncated header"));
+    }
+    if (header.magic != kSnapshotMagic || header.version != kSnapshotVersion) {
+        return fail(QStringLiteral("unknown format"));
+    }
+    if (header.cameraCount == 0 || header.lensCount == 0 || header.stringCount == 0) {
+        return fail(QStringLiteral("missing dictionaries"));
+    }
+
+    // The counts decide the allocations below, so a damaged one must fail
+    // here rather than throw bad_alloc. Each term is below 2^38, so the
+    // sum cannot overflow.
+    const quint64 tableBytes = quint64(header.rowCount) * sizeof(SnapshotRow)
+        + quint64(header.cameraCount) * 2 * sizeof(quint32)
+        + quint64(header.lensCount) * sizeof(quint32)
+        + quint64(header.tagCount) * 2 * sizeof(quint32)
+        + quint64(header.postingCount) * sizeof(quint32)
+        + (quint64(header.stringCount) + 1) * sizeof(quint32);
+    const quint64 available = quint64(reader.remaining());
+    if (header.stringBytes > available || tableBytes != available - header.stringBytes) {
+        return fail(QStringLiteral("table sizes do not match the file"));
+    }
+
+    QVector<SnapshotRow> rows(qsizetype(header.rowCount));
+    QVector<quint32> cameras(qsizetype(header.cameraCount) * 2);
+    QVector<quint32> lenses(qsizetype(header.lensCount));
+    QVector<quint32> tags(qsizetype(header.tagCount) * 2);
+    QVector<quint32> postings(qsizetype(header.postingCount));
+    QVector<quint32> offsets(qsizetype(header.stringCount) + 1);
+    if (!reader.read(rows.data(), rows.size())
+        || !reader.read(cameras.data(), cameras.size())
+        || !reader.read(lenses.data(), lenses.size())
+        || !reader.read(tags.data(), tags.size())
+        || !reader.read(postings.data(), postings.size())
+        || !reader.read(offsets.data(), offsets.size())) {
+        return fail(QStringLiteral("truncated tables"));
+    }
+    const uchar *stringData = reader.take(qint64(header.stringBytes));
+    if (!stringData || !reader.atEnd() || offsets.constLast() != header.stringBytes) {
+        return fail(QStringLiteral("bad string data"));
+    }
+
+    // Decode each distinct string once; rows share the QString data.
+    QVector<QString> strings(qsizetype(header.stringCount));
+    for (quint32 i = 0; i < header.stringCount; ++i) {
+        const quint32 begin = offsets.at(i);
+        const quint32 end = offsets.at(i + 1);
+        if (begin > end || end > header.stringBytes) {
+            return fail(QStringLiteral("bad string offsets"));
+        }
+        strings[i] = QString::fromUtf8(reinterpret_cast<const char *>(stringData) + begin, qsizetype(end - begin));
+    }
+    const auto string = [&strings](quint32 index, bool *ok) {
+        if (index >= quint32(strings.size())) {
+            *ok = false;
+            return QString();
+        }
+        return strings.at(index);
+    };
+
+    bool ok = true;
+    for (quint32 id = 0; id < header.cameraCount; ++id) {
+        const QPair<QString, QString> camera(string(cameras.at(id * 2), &ok), string(cameras.at(id * 2 + 1), &ok));
+        columns.cameras.append(camera);
+        if (id > 0) {
+            columns.cameraLookup.insert(camera, id);
+        }
+    }
+    for (quint32 id = 0; id < header.lensCount; ++id) {
+        const QString lens = string(lenses.at(id), &ok);
+        columns.lenses.append(lens);
+        if (id > 0) {
+            columns.lensLookup.insert(lens, id);
+        }
+    }
+
+    const int rowCount = int(header.rowCount);
+    columns.ids.reserve(rowCount);
+    columns.captureEpoch.reserve(rowCount);
+    columns.iso.reserve(rowCount);
+    columns.cameraId.reserve(rowCount);
+    columns.lensId.reserve(rowCount);
+    columns.perceptualHash.reserve(rowCount);
+    columns.marks.reserve(rowCount);
+    columns.rows.reserve(rowCount);
+    columns.rowById.reserve(rowCount);
+    columns.tagsByRow.resize(rowCount);
+    for (int row = 0; row < rowCount; ++row) {
+        const SnapshotRow &in = rows.at(row);
+        if (in.cameraId >= header.cameraCount || in.lensId >= header.lensCount || columns.rowById.contains(in.id)
+            || in.marks > 0xff || !AssetMarks::isValid(quint8(in.marks))) {
+            return fail(QStringLiteral("bad row %1").arg(row));
+        }
+        LibraryAsset asset;
+        asset.id = in.id;
+        asset.photoNumber = string(in.photoNumber, &ok);
+        asset.fileName = string(in.fileName, &ok);
+        asset.originalRelativePath = string(in.originalPath, &ok);
+        asset.previewRelativePath = string(in.previewPath, &ok);
+        asset.format = string(in.format, &ok);
+        asset.width = in.width;
+        asset.height = in.height;
+        asset.perceptualHash = in.perceptualHash;
+        asset.marks = quint8(in.marks);
+
+        columns.ids.append(in.id);
+        columns.captureEpoch.append(in.captureEpoch);
+        columns.iso.append(in.iso);
+        columns.cameraId.append(in.cameraId);
+        columns.lensId.append(in.lensId);
+        columns.perceptualHash.append(in.perceptualHash);
+        columns.marks.append(asset.marks);
+        columns.rows.append(asset);
+        columns.rowById.insert(in.id, row);
+        addMarkPostings(columns, row);
+    }
+
+    qsizetype posting = 0;
+    columns.tagRows.resize(qsizetype(header.tagCount));
+    for (quint32 tag = 0; tag < header.tagCount; ++tag) {
+        const quint32 count = tags.at(tag * 2 + 1);
+        if (count > quint32(postings.size() - posting)) {
+            return fail(QStringLiteral("bad postings"));
+        }
+        columns.tagLookup.insert(string(tags.at(tag * 2), &ok), int(tag));
+        RoaringBitmap &tagRows = columns.tagRows[tag];
+        for (quint32 i = 0; i < count; ++i) {
+            const quint32 row = postings.at(posting++);
+            if (row >= header.rowCount) {
+                return fail(QStringLiteral("bad postings"));
+            }
+            tagRows.add(row);
+            columns.tagsByRow[row].append(int(tag));
+        }
+    }
+
+    if (!ok) {
+        return fail(QStringLiteral("bad string index"));
+    }
+    buildBurstOrder(columns);
+    return true;
+}
+
+// Compares what the two indexes answer queries with. Camera, lens and tag
+// ids are compared by value since their numbering depends on load order.
+bool AssetIndex::sameContents(const Columns &a, const Columns &b)
+{
+    if (a.ids != b.ids || a.captureEpoch != b.captureEpoch || a.iso != b.iso || a.perceptualHash != b.perceptualHash
+        || a.marks != b.marks) {
+        return false;
+    }
+
+    QVector<QString> tagNames(a.tagRows.size());
+    for (auto it = a.tagLookup.constBegin(); it != a.tagLookup.constEnd(); ++it) {
+        tagNames[it.value()] = it.key();
+    }
+
+    for (int row = 0; row < a.ids.size(); ++row) {
+        const LibraryAsset &assetA = a.rows.at(row);
+        const LibraryAsset &assetB = b.rows.at(row);
+        if (assetA.photoNumber != assetB.photoNumber
+            || assetA.fileName != assetB.fileName
+            || assetA.originalRelativePath != assetB.originalRelativePath
+            || assetA.previewRelativePath != assetB.previewRelativePath
+            || assetA.format != assetB.format
+            || assetA.width != assetB.width
+            || assetA.height != assetB.height
+            || a.cameras.at(a.cameraId.at(row)) != b.cameras.at(b.cameraId.at(row))
+            || a.lenses.at(a.lensId.at(row)) != b.lenses.at(b.lensId.at(row))) {
+            return false;
+        }
+
+        const QVector<int> &rowTagsA = a.tagsByRow.at(row);
+        const QVector<int> &rowTagsB = b.tagsByRow.at(row);
+        if (rowTagsA.size() != rowTagsB.size()) {
+            return false;
+        }
+        for (int tag : rowTagsA) {
+            const int other = b.tagLookup.value(tagNames.at(tag), -1);
+            if (other < 0 || !rowTagsB.contains(other)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Caller holds m_lock for reading. With collapseBursts, stackSizes (when
+// given) receives the number of matching frames behind each returned row.
+QVector<int> AssetIndex::matchingRowsInOrder(const FilterOptions &options,
+                                             const QVector<qint64> *searchMatches,
+                                             QVector<int> *stackSizes) const
+{
+    QVector<int> result;
+    if (options.collectionId >= 0) {
+        const auto it = m_collections.constFind(options.collectionId);
+        if (it != m_collections.constEnd()) {
+            result = collectionRowsInOrder(it.value(), options, searchMatches);
+        }
+    } else {
+        const QVector<quint8> mask = filterMask(options, searchMatches);
+        const quint8 *maskData = mask.constData();
+        const QVector<int> order = permutation(options.sortOrder);
+        result.reserve(order.size());
+        for (int row : order) {
+            if (maskData[row]) {
+                result.append(row);
+            }
+        }
+    }
+
+    if (options.collapseBursts && options.burstGapMsecs > 0) {
+        collapseBursts(result, options.burstGapMsecs, stackSizes);
+    }
+    return result;
+}
+
+// One byte per row, set when the row passes every filter in options.
+// Caller holds m_lock for reading.
+QVector<quint8> AssetIndex::filterMask(const FilterOptions &options, const QVector<qint64> *searchMatches) const
+{
+    const Columns &columns = m_columns;
+    const int count = columns.ids.size();
+
+    // One byte per row, narrowed by a separate tight pass per predicate so
+    // each loop runs over a single contiguous column.
+    QVector<quint8> mask(count, 1);
+    quint8 *maskData = mask.data();
+
+    if (options.isoMin > 0 || options.isoMax > 0) {
+        const qint32 *iso = columns.iso.constData();
+        const qint32 low = options.isoMin > 0 ? options.isoMin : 1;
+        const qint32 high = options.isoMax > 0 ? options.isoMax : std::numeric_limits<qint32>::max();
+        for (int i = 0; i < count; ++i) {
+            maskData[i] &= static_cast<quint8>((iso[i] >= low) & (iso[i] <= high));
+        }
+    }
+
+    if (!options.cameraMake.isEmpty()) {
+        QVector<quint8> cameraMatch(columns.cameras.size(), 0);
+        for (int id = 1; id < columns.cameras.size(); ++id) {
+            const auto &camera = columns.cameras.at(id);
+            cameraMatch[id] = cameraMatches(camera.first, camera.second, options.cameraMake) ? 1 : 0;
+        }
+        const quint8 *match = cameraMatch.constData();
+        const quint32 *cameraId = columns.cameraId.constData();
+        for (int i = 0; i < count; ++i) {
+            maskData[i] &= match[cameraId[i]];
+        }
+    }
+
+    if (!options.tags.isEmpty() || !options.excludedTags.isEmpty()) {
+        const RoaringBitmap tagged = tagFilterRows(columns, options);
+        QVector<quint8> tagMask(count, 0);
+        quint8 *tagMaskData = tagMask.data();
+        tagged.forEach([tagMaskData](quint32 row) {
+            tagMaskData[row] = 1;
+        });
+        for (int i = 0; i < count; ++i) {
+            maskData[i] &= tagMaskData[i];
+        }
+    }
+
+    if (options.filtersOnMarks()) {
+        const RoaringBitmap marked = markFilterRows(columns, options);
+        QVector<quint8> markMask(count, 0);
+        quint8 *markMaskData = markMask.data();
+        marked.forEach([markMaskData](quint32 row) {
+            markMaskData[row] = 1;
+        });
+        for (int i = 0; i < count; ++i) {
+            maskData[i] &= markMaskData[i];
+        }
+    }
+
+    if (!options.lens.isEmpty()) {
+        const quint32 wanted = columns.lensLookup.value(options.lens, 0);
+        const quint32 *lensId = columns.lensId.constData();
+        for (int i = 0; i < count; ++i) {
+            maskData[i] &= static_cast<quint8>(wanted != 0 && lensId[i] == wanted);
+        }
+    }
+
+    if (searchMatches) {
+        QVector<quint8> searchMask(count, 0);
+        for (qint64 assetId : *searchMatches) {
+            const int row = columns.rowById.value(assetId, -1);
+            if (row >= 0) {
+                searchMask[row] = 1;
+            }
+        }
+        const quint8 *searchMaskData = searchMask.constData();
+        for (int i = 0; i < count; ++i) {
+            maskData[i] &= searchMaskData[i];
+        }
+    }
+
+    if (options.similarToAssetId >= 0) {
+        QVector<quint8> similarMask(count, 0);
+        for (int row : similarRows(options.similarToAssetId, options.similarityThreshold)) {
+            similarMask[row] = 1;
+        }
+        const quint8 *similarMaskData = similarMask.constData();
+        for (int i = 0; i < count; ++i) {
+            maskData[i] &= similarMaskData[i];
+        }
+    }
+
+    return mask;
+}
+
+// A collection's members, narrowed by the other filters and sorted, at a
+// cost that follows the collection's size rather than the catalog's: rows
+// are checked one by one and ordered by their position in the cached sort
+// permutation. Caller holds m_lock for reading.
+QVector<int> AssetIndex::collectionRowsInOrder(const Collection &collection,
+                                               const FilterOptions &options,
+                                               const QVector<qint64> *searchMatches) const
+{
+    QSet<int> searchRows;
+    if (searchMatches) {
+        searchRows.reserve(searchMatches->size());
+        for (qint64 assetId : *searchMatches) {
+            const int row = m_columns.rowById.value(assetId, -1);
+            if (row >= 0) {
+                searchRows.insert(row);
+            }
+        }
+    }
+    const QVector<int> similar = options.similarToAssetId >= 0
+        ? similarRows(options.similarToAssetId, options.similarityThreshold)
+        : QVector<int>();
+
+    QVector<int> result;
+    result.reserve(int(collection.rows.cardinality()));
+    collection.rows.forEach([&](quint32 value) {
+        const int row = int(value);
+        if (!rowMatchesRule(m_columns, row, options)) {
+            return;
+        }
+        if (searchMatches && !searchRows.contains(row)) {
+            return;
+        }
+        if (options.similarToAssetId >= 0 && !std::binary_search(similar.cbegin(), similar.cend(), row)) {
+            return;
+        }
+        result.append(row);
+    });
+
+    const QVector<int> rank = permutationRank(options.sortOrder);
+    std::sort(result.begin(), result.end(), [&rank](int a, int b) {
+        return rank.at(a) < rank.at(b);
+    });
+    return result;
+}
+
+// Keeps the first row of each burst in rows, which are in sort order, and
+// drops the later ones; stackSizes (when given) receives how many rows each
+// kept one stands for. Caller holds m_lock for reading.
+void AssetIndex::collapseBursts(QVector<int> &rows, int gapMsecs, QVector<int> *stackSizes) const
+{
+    const QSharedPointer<const BurstLeaders> leaders = burstLeaders(gapMsecs);
+    const int *leaderData = leaders->constData();
+    QHash<int, int> slotByLeader;
+    slotByLeader.reserve(rows.size());
+    QVector<int> kept;
+    QVector<int> sizes;
+    kept.reserve(rows.size());
+    sizes.reserve(rows.size());
+    for (int row : std::as_const(rows)) {
+        const auto it = slotByLeader.constFind(leaderData[row]);
+        if (it == slotByLeader.constEnd()) {
+            slotByLeader.insert(leaderData[row], kept.size());
+            kept.append(row);
+            sizes.append(1);
+        } else {
+            ++sizes[it.value()];
+        }
+    }
+    rows = std::move(kept);
+    if (stackSizes) {
+        *stackSizes = std::move(sizes);
+    }
+}
+
+// Combines the tag postings: OR (or AND) of the requested tags, minus the
+// union of the excluded ones. Caller holds m_lock for reading.
+RoaringBitmap AssetIndex::tagFilterRows(const Columns &columns, const FilterOptions &options)
+{
+    RoaringBitmap result;
+    if (options.tags.isEmpty()) {
+        for (int row = 0; row < columns.ids.size(); ++row) {
+            result.add(quint32(row));
+        }
+    } else {
+        const bool matchAll = options.tagMatch == FilterOptions::MatchAllTags;
+        bool first = true;
+        for (const QString &tag : options.tags) {
+            const int tagIndex = columns.tagLookup.value(tag, -1);
+            if (tagIndex < 0) {
+                if (matchAll) {
+                    return RoaringBitmap();
+                }
+                continue;
+            }
+            const RoaringBitmap &rows = columns.tagRows.at(tagIndex);
+            if (first) {
+                result = rows;
+                first = false;
+            } else if (matchAll) {
+                result &= rows;
+            } else {
+                result |= rows;
+            }
+        }
+    }
+
+    for (const QString &tag : options.excludedTags) {
+        const int tagIndex = columns.tagLookup.value(tag, -1);
+        if (tagIndex >= 0) {
+            result -= columns.tagRows.at(tagIndex);
+        }
+    }
+    return result;
+}
+
+// Intersects the requested rating, flag and label postings; a field that
+// is not filtered on does not take part. Caller holds m_lock for reading.
+RoaringBitmap AssetIndex::markFilterRows(const Columns &columns, const FilterOptions &options)
+{
+    std::optional<RoaringBitmap> result;
+    const auto intersect = [&result](RoaringBitmap rows) {
+        if (result) {
+            *result &= rows;
+        } else {
+            result = std::move(rows);
+        }
+    };
+
+    if (options.minRating > 0) {
+        RoaringBitmap rated;
+        for (int stars = qMin(options.minRating, AssetMarks::kMaxRating); stars <= AssetMarks::kMaxRating; ++stars) {
+            rated |= columns.ratingRows.at(stars);
+        }
+        intersect(std::move(rated));
+    }
+
+    switch (options.flagFilter) {
+    case FilterOptions::AnyFlag:
+        break;
+    case FilterOptions::PickedOnly:
+        intersect(columns.flagRows.at(AssetMarks::Picked));
+        break;
+    case FilterOptions::UnflaggedOnly:
+        intersect(columns.flagRows.at(AssetMarks::Unflagged));
+        break;
+    case FilterOptions::RejectedOnly:
+        intersect(columns.flagRows.at(AssetMarks::Rejected));
+        break;
+    case FilterOptions::HideRejected:
+        intersect(columns.flagRows.at(AssetMarks::Unflagged) | columns.flagRows.at(AssetMarks::Picked));
+        break;
+    }
+
+    if (options.colorLabels != 0) {
+        RoaringBitmap labelled;
+        for (int label = 0; label < AssetMarks::kLabelCount; ++label) {
+            if (options.colorLabels & (1u << label)) {
+                labelled |= columns.labelRows.at(label);
+            }
+        }
+        intersect(std::move(labelled));
+    }
+
+    return result ? *result : RoaringBitmap();
+}
+
+// The predicate half of filterMask() for a single row: ISO, camera, lens,
+// tags and marks. Search text and similarity are left to the caller.
+bool AssetIndex::rowMatchesRule(const Columns &columns, int row, const FilterOptions &rule)
+{
+    if (rule.isoMin > 0 || rule.isoMax > 0) {
+        const qint32 iso = columns.iso.at(row);
+        const qint32 low = rule.isoMin > 0 ? rule.isoMin : 1;
+        const qint32 high = rule.isoMax > 0 ? rule.isoMax : std::numeric_limits<qint32>::max();
+        if (iso < low || iso > high) {
+            return false;
+        }
+    }
+
+    if (!rule.cameraMake.isEmpty()) {
+        const quint32 cameraId = columns.cameraId.at(row);
+        const auto &camera = columns.cameras.at(cameraId);
+        if (cameraId == 0 || !cameraMatches(camera.first, camera.second, rule.cameraMake)) {
+            return false;
+        }
+    }
+
+    if (!rule.lens.isEmpty()) {
+        const quint32 wanted = columns.lensLookup.value(rule.lens, 0);
+        if (wanted == 0 || columns.lensId.at(row) != wanted) {
+            return false;
+        }
+    }
+
+    const QVector<int> &rowTags = columns.tagsByRow.at(row);
+    if (!rule.tags.isEmpty()) {
+        const bool matchAll = rule.tagMatch == FilterOptions::MatchAllTags;
+        bool any = false;
+        for (const QString &tag : rule.tags) {
+            const int tagIndex = columns.tagLookup.value(tag, -1);
+            const bool has = tagIndex >= 0 && rowTags.contains(tagIndex);
+            if (matchAll && !has) {
+                return false;
+            }
+            any = any || has;
+        }
+        if (!any) {
+            return false;
+        }
+    }
+    for (const QString &tag : rule.excludedTags) {
+        const int tagIndex = columns.tagLookup.value(tag, -1);
+        if (tagIndex >= 0 && rowTags.contains(tagIndex)) {
+            return false;
+        }
+    }
+
+    if (rule.filtersOnMarks()) {
+        const quint8 marks = columns.marks.at(row);
+        if (AssetMarks::rating(marks) < rule.minRating) {
+            return false;
+        }
+        const AssetMarks::Flag flag = AssetMarks::flag(marks);
+        switch (rule.flagFilter) {
+        case FilterOptions::AnyFlag:
+            break;
+        case FilterOptions::PickedOnly:
+            if (flag != AssetMarks::Picked) {
+                return false;
+            }
+            break;
+        case FilterOptions::UnflaggedOnly:
+            if (flag != AssetMarks::Unflagged) {
+                return false;
+            }
+            break;
+        case FilterOptions::RejectedOnly:
+            if (flag != AssetMarks::Rejected) {
+                return false;
+            }
+            break;
+        case FilterOptions::HideRejected:
+            if (flag == AssetMarks::Rejected) {
+                return false;
+            }
+            break;
+        }
+        if (rule.colorLabels != 0 && !(rule.colorLabels & (1u << AssetMarks::colorLabel(marks)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Caller holds m_lock for reading.
+QVector<int> AssetIndex::permutation(FilterOptions::SortOrder sortOrder) const
+{
+    QMutexLocker locker(&m_permutationMutex);
+    auto it = m_permutations.constFind(sortOrder);
+    if (it != m_permutations.constEnd()) {
+        return it.value();
+    }
+
+    const QVector<int> order = buildPermutation(m_columns, sortOrder);
+    m_permutations.insert(sortOrder, order);
+    return order;
+}
+
+// Inverse of permutation(): the position of each row in that order.
+// Caller holds m_lock for reading.
+QVector<int> AssetIndex::permutationRank(FilterOptions::SortOrder sortOrder) const
+{
+    {
+        QMutexLocker locker(&m_permutationMutex);
+        auto it = m_permutationRanks.constFind(sortOrder);
+        if (it != m_permutationRanks.constEnd()) {
+            return it.value();
+        }
+    }
+
+    const QVector<int> order = permutation(sortOrder);
+    QVector<int> rank(order.size());
+    for (int i = 0; i < order.size(); ++i) {
+        rank[order.at(i)] = i;
+    }
+    QMutexLocker locker(&m_permutationMutex);
+    m_permutationRanks.insert(sortOrder, rank);
+    return rank;
+}
+
+// Full evaluation of every collection, after the rows were replaced.
+// Caller holds m_lock for writing.
+void AssetIndex::rebuildCollections()
+{
+    m_columns.changedRows.clear();
+    for (auto it = m_collections.begin(); it != m_collections.end(); ++it) {
+        Collection &collection = it.value();
+        collection.rows.clear();
+        const QVector<quint8> mask = filterMask(collection.rule, nullptr);
+        for (int row = 0; row < mask.size(); ++row) {
+            if (mask.at(row)) {
+                collection.rows.add(quint32(row));
+            }
+        }
+    }
+}
+
+// Re-evaluates only the rows written since the last call. Caller holds
+// m_lock for writing.
+void AssetIndex::updateCollections()
+{
+    QVector<int> &changed = m_columns.changedRows;
+    if (changed.isEmpty()) {
+        return;
+    }
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+    for (auto it = m_collections.begin(); it != m_collections.end(); ++it) {
+        Collection &collection = it.value();
+        for (int row : std::as_const(changed)) {
+            if (rowMatchesRule(m_columns, row, collection.rule)) {
+                collection.rows.add(quint32(row));
+            } else {
+                collection.rows.remove(quint32(row));
+            }
+        }
+    }
+    changed.clear();
+}
+
+// Caller holds m_lock for reading.
+QSharedPointer<const PerceptualHashIndex> AssetIndex::similarityIndex() const
+{
+    QMutexLocker locker(&m_similarityMutex);
+    if (!m_similarityIndex) {
+        m_similarityIndex = QSharedPointer<const PerceptualHashIndex>::create(m_columns.perceptualHash);
+    }
+    return m_similarityIndex;
+}
+
+// Caller holds m_lock for reading.
+QVector<int> AssetIndex::similarRows(qint64 assetId, int maxDistance) const
+{
+    const int row = m_columns.rowById.value(assetId, -1);
+    if (row < 0 || m_columns.perceptualHash.at(row) == 0) {
+        return {};
+    }
+    return similarityIndex()->rowsWithin(m_columns.perceptualHash.at(row), maxDistance);
+}
+
+// Caller holds m_lock for reading.
+QSharedPointer<const AssetIndex::BurstLeaders> AssetIndex::burstLeaders(int gapMsecs) const
+{
+    QMutexLocker locker(&m_burstMutex);
+    if (!m_burstLeaders || m_burstGapMsecs != gapMsecs) {
+        m_burstLeaders = QSharedPointer<const BurstLeaders>::create(buildBurstLeaders(m_columns, gapMsecs));
+        m_burstGapMsecs = gapMsecs;
+    }
+    return m_burstLeaders;
+}
+
+void AssetIndex::initialize(Columns &columns)
+{
+    // Camera and lens id 0 stand for "no data".
+    columns.cameras.append(qMakePair(QString(), QString()));
+    columns.lenses.append(QString());
+}
+
+int AssetIndex::ensureRow(Columns &columns, qint64 assetId)
+{
+    if (columns.cameras.isEmpty()) {
+        initialize(columns);
+    }
+
+    const auto it = columns.rowById.constFind(assetId);
+    if (it != columns.rowById.constEnd()) {
+        return it.value();
+    }
+
+    // A new row belongs somewhere in every order.
+    columns.staleSortOrders = ~0u;
+    const int row = columns.ids.size();
+    columns.ids.append(assetId);
+    columns.captureEpoch.append(0);
+    columns.iso.append(0);
+    columns.cameraId.append(0);
+    columns.lensId.append(0);
+    columns.perceptualHash.append(0);
+    columns.marks.append(0);
+    addMarkPostings(columns, row);
+    columns.tagsByRow.append(QVector<int>());
+    columns.changedRows.append(row);
+    LibraryAsset asset;
+    asset.id = assetId;
+    columns.rows.append(asset);
+    columns.rowById.insert(assetId, row);
+    return row;
+}
+
+void AssetIndex::setMetadata(Columns &columns, int row, const AssetMetadata &metadata)
+{
+    const quint32 oldCameraId = columns.cameraId.at(row);
+    const qint64 oldEpoch = columns.captureEpoch.at(row);
+    columns.changedRows.append(row);
+
+    if (columns.iso.at(row) != metadata.iso) {
+        columns.staleSortOrders |= kIsoSortOrders;
+    }
+    columns.iso[row] = metadata.iso;
+    columns.captureEpoch[row] = metadata.captureDate.isValid() ? metadata.captureDate.toMSecsSinceEpoch() : 0;
+    if (columns.captureEpoch.at(row) != oldEpoch) {
+        columns.staleSortOrders |= kDateSortOrders;
+    }
+
+    quint32 cameraId = 0;
+    if (!metadata.cameraMake.isEmpty() || !metadata.cameraModel.isEmpty()) {
+        const QPair<QString, QString> key(metadata.cameraMake, metadata.cameraModel);
+        auto it = columns.cameraLookup.constFind(key);
+        if (it == columns.cameraLookup.constEnd()) {
+            cameraId = columns.cameras.size();
+            columns.cameras.append(key);
+            columns.cameraLookup.insert(key, cameraId);
+        } else {
+            cameraId = it.value();
+        }
+    }
+    columns.cameraId[row] = cameraId;
+    if (cameraId != oldCameraId) {
+        columns.staleSortOrders |= sortOrderBit(FilterOptions::SortByCameraMake);
+    }
+    if (cameraId != oldCameraId || columns.captureEpoch.at(row) != oldEpoch) {
+        moveBurstKey(columns, row, oldCameraId, oldEpoch);
+    }
+
+    quint32 lensId = 0;
+    if (!metadata.lens.isEmpty()) {
+        auto it = columns.lensLookup.constFind(metadata.lens);
+        if (it == columns.lensLookup.constEnd()) {
+            lensId = columns.lenses.size();
+            columns.lenses.append(metadata.lens);
+            columns.lensLookup.insert(metadata.lens, lensId);
+        } else {
+            lensId = it.value();
+        }
+    }
+    columns.lensId[row] = lensId;
+
+    QVector<int> &rowTags = columns.tagsByRow[row];
+    for (int tag : std::as_const(rowTags)) {
+        columns.tagRows[tag].remove(quint32(row));
+    }
+    rowTags.clear();
+    for (const QString &tagName : metadata.tags) {
+        int tag = columns.tagLookup.value(tagName, -1);
+        if (tag < 0) {
+            tag = columns.tagRows.size();
+            columns.tagRows.append(RoaringBitmap());
+            columns.tagLookup.insert(tagName, tag);
+        }
+        if (!rowTags.contains(tag)) {
+            columns.tagRows[tag].add(quint32(row));
+            rowTags.append(tag);
+        }
+    }
+}
+
+void AssetIndex::setPerceptualHash(Columns &columns, int row, quint64 hash)
+{
+    if (columns.perceptualHash.at(row) == hash) {
+        return;
+    }
+    columns.perceptualHash[row] = hash;
+    columns.rows[row].perceptualHash = hash;
+    ++columns.hashRevision;
+}
+
+// Files a row that was just appended under its marks.
+void AssetIndex::addMarkPostings(Columns &columns, int row)
+{
+    const quint8 marks = columns.marks.at(row);
+    columns.ratingRows[AssetMarks::rating(marks)].add(quint32(row));
+    columns.flagRows[AssetMarks::flag(marks)].add(quint32(row));
+    columns.labelRows[AssetMarks::colorLabel(marks)].add(quint32(row));
+}
+
+void AssetIndex::setMarks(Columns &columns, int row, quint8 marks)
+{
+    if (!AssetMarks::isValid(marks)) {
+        marks = 0;
+    }
+    columns.rows[row].marks = marks;
+    const quint8 old = columns.marks.at(row);
+    if (old == marks) {
+        return;
+    }
+
+    const quint32 value = quint32(row);
+    columns.ratingRows[AssetMarks::rating(old)].remove(value);
+    columns.flagRows[AssetMarks::flag(old)].remove(value);
+    columns.labelRows[AssetMarks::colorLabel(old)].remove(value);
+    columns.marks[row] = marks;
+    addMarkPostings(columns, row);
+    columns.changedRows.append(row);
+}
+
+void AssetIndex::buildBurstOrder(Columns &columns)
+{
+    columns.burstOrder.clear();
+    for (int row = 0; row < columns.ids.size(); ++row) {
+        if (columns.cameraId.at(row) != 0 && columns.captureEpoch.at(row) != 0) {
+            columns.burstOrder.append({columns.cameraId.at(row), columns.captureEpoch.at(row), row});
+        }
+    }
+    std::sort(columns.burstOrder.begin(), columns.burstOrder.end());
+    columns.burstOrderBuilt = true;
+    ++columns.burstRevision;
+}
+
+// Moves row's entry in the burst time index after its camera or capture
+// time changed: a binary search for each position rather than a re-sort.
+void AssetIndex::moveBurstKey(Columns &columns, int row, quint32 oldCameraId, qint64 oldEpoch)
+{
+    if (!columns.burstOrderBuilt) {
+        // load() sorts everything at once when it is done.
+        return;
+    }
+
+    QVector<BurstKey> &order = columns.burstOrder;
+    if (oldCameraId != 0 && oldEpoch != 0) {
+        const BurstKey oldKey{oldCameraId, oldEpoch, row};
+        const auto it = std::lower_bound(order.begin(), order.end(), oldKey);
+        if (it != order.end() && it->row == row) {
+            order.erase(it);
+        }
+    }
+
+    const BurstKey newKey{columns.cameraId.at(row), columns.captureEpoch.at(row), row};
+    if (newKey.cameraId != 0 && newKey.captureEpoch != 0) {
+        order.insert(std::lower_bound(order.begin(), order.end(), newKey), newKey);
+    }
+    ++columns.burstRevision;
+}
+
+// One pass over the burst time index: a frame joins the burst of the frame
+// before it when both come from the same camera and were taken at most
+// gapMsecs apart.
+AssetIndex::BurstLeaders AssetIndex::buildBurstLeaders(const Columns &columns, int gapMsecs)
+{
+    BurstLeaders leaders(columns.ids.size());
+    std::iota(leaders.begin(), leaders.end(), 0);
+
+    const BurstKey *keys = columns.burstOrder.constData();
+    for (int i = 1; i < columns.burstOrder.size(); ++i) {
+        const BurstKey &previous = keys[i - 1];
+        const BurstKey &current = keys[i];
+        if (current.cameraId == previous.cameraId && current.captureEpoch - previous.captureEpoch <= gapMsecs) {
+            leaders[current.row] = leaders.at(previous.row);
+        }
+    }
+    return leaders;
+}
+
+QVector<int> AssetIndex::buildPermutation(const Columns &columns, FilterOptions::SortOrder sortOrder)
+{
+    const int count = columns.ids.size();
+    QVector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+
+    const qint64 *ids = columns.ids.constData();
+    const qint64 *epoch = columns.captureEpoch.constData();
+    const qint32 *iso = columns.iso.constData();
+
+    switch (sortOrder) {
+    case FilterOptions::SortByDateDesc:
+        std::sort(order.begin(), order.end(), [&](int a, int b) {
+            const bool hasA = epoch[a] != 0;
+            const bool hasB = epoch[b] != 0;
+            if (hasA != hasB) {
+                return hasA;
+            }
+            if (epoch[a] != epoch[b]) {
+                return epoch[a] > epoch[b];
+            }
+            return ids[a] > ids[b];
+        });
+        break;
+    case FilterOptions::SortByDateAsc:
+        std::sort(order.begin(), order.end(), [&](int a, int b) {
+            const bool hasA = epoch[a] != 0;
+            const bool hasB = epoch[b] != 0;
+            if (hasA != hasB) {
+                return hasA;
+            }
+            if (epoch[a] != epoch[b]) {
+                return epoch[a] < epoch[b];
+            }
+            return ids[a] < ids[b];
+        });
+        break;
+    case FilterOptions::SortByIsoDesc:
+        std::sort(order.begin(), order.end(), [&](int a, int b) {
+            if (iso[a] != iso[b]) {
+                return iso[a] > iso[b];
+            }
+            return ids[a] > ids[b];
+        });
+        break;
+    case FilterOptions::SortByIsoAsc:
+        std::sort(order.begin(), order.end(), [&](int a, int b) {
+            if (iso[a] != iso[b]) {
+                return iso[a] < iso[b];
+            }
+            return ids[a] < ids[b];
+        });
+        break;
+    case FilterOptions::SortByCameraMake: {
+        // Rank the camera dictionary once so rows compare as integers.
+        QVector<int> byName(columns.cameras.size());
+        std::iota(byName.begin(), byName.end(), 0);
+        std::sort(byName.begin(), byName.end(), [&](int a, int b) {
+            return columns.cameras.at(a) < columns.cameras.at(b);
+        });
+        QVector<int> rank(columns.cameras.size());
+        for (int i = 0; i < byName.size(); ++i) {
+            rank[byName.at(i)] = i;
+        }
+        const quint32 *cameraId = columns.cameraId.constData();
+        std::sort(order.begin(), order.end(), [&](int a, int b) {
+            const int rankA = rank.at(cameraId[a]);
+            const int rankB = rank.at(cameraId[b]);
+            if (rankA != rankB) {
+                return rankA < rankB;
+            }
+            if (epoch[a] != epoch[b]) {
+                return epoch[a] > epoch[b];
+            }
+            return ids[a] > ids[b];
+        });
+        break;
+    }
+    case FilterOptions::SortByFileName:
+        std::sort(order.begin(), order.end(), [&](int a, int b) {
+            const int cmp = columns.rows.at(a).fileName.compare(columns.rows.at(b).fileName);
+            if (cmp != 0) {
+                return cmp < 0;
+            }
+            return ids[a] < ids[b];
+        });
+        break;
+    }
+
+    return order;
+}
@@ -0,0 +1,226 @@
+#ifndef ASSETINDEX_H
+#define ASSETINDEX_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QReadWriteLock>
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <array>
+#include <functional>
+
+#include "assetmarks.h"
+#include "librarymanager.h"
+#include "metadatacache.h"
+#include "roaringbitmap.h"
+
+class PerceptualHashIndex;
+
+// In-memory, struct-of-arrays copy of the columns the library grid filters
+// and sorts on. It is loaded once per library in the background and then kept
+// current from write notifications, so changing a filter never goes back to
+// SQLite. All methods are thread-safe.
+class AssetIndex
+{
+public:
+    AssetIndex() = default;
+
+    bool isLoaded() const;
+    int size() const;
+
+    // Drops all data and invalidates any load in flight. Returns the
+    // generation a subsequent load() must present to be accepted.
+    quint64 reset();
+
+    // Like reset(), but keeps answering queries from the current contents
+    // until the matching load() replaces them.
+    quint64 beginReload();
+
+    // Replaces the index contents. Updates received since reset() or
+    // beginReload() are replayed on top, so rows written while the load ran
+    // are not lost. When changed is given it is set if a loaded index held
+    // different data than the one replacing it.
+    bool load(quint64 generation,
+              const QVector<LibraryAsset> &assets,
+              const QVector<AssetMetadata> &metadata,
+              bool *changed = nullptr);
+
+    // Compact binary copy of the index, so a library can be browsed before
+    // the databases have been read. loadSnapshot() maps the file and installs
+    // its contents as a loaded index.
+    bool writeSnapshot(const QString &path, QString *errorMessage = nullptr) const;
+    bool loadSnapshot(quint64 generation, const QString &path, QString *errorMessage = nullptr);
+
+    void upsertAsset(const LibraryAsset &asset);
+    void updatePreview(qint64 assetId,
+                       const QString &previewRelativePath,
+                       int width,
+                       int height,
+                       quint64 perceptualHash);
+    void updatePerceptualHashes(const QVector<QPair<qint64, quint64>> &hashes);
+    void updateMetadata(const AssetMetadata &metadata);
+    // Sets the AssetMarks field selected by fieldMask to bits on each asset.
+    void updateMarks(const QVector<qint64> &assetIds, quint8 fieldMask, quint8 bits);
+
+    // FilterOptions::searchText is answered by the metadata cache's search
+    // index; pass its matches as searchMatches to intersect with them. With
+    // FilterOptions::collapseBursts, queryIds() reports the number of
+    // matching frames behind each collapsed burst in stackSizes (bursts of
+    // one are left out).
+    QVector<LibraryAsset> query(const FilterOptions &options,
+                                const QVector<qint64> *searchMatches = nullptr) const;
+    QVector<qint64> queryIds(const FilterOptions &options,
+                             const QVector<qint64> *searchMatches = nullptr,
+                             QHash<qint64, int> *stackSizes = nullptr) const;
+    LibraryAsset asset(qint64 assetId) const;
+    QVector<LibraryAsset> assets(const QVector<qint64> &assetIds) const;
+
+    // Assets whose perceptual hash is within maxDistance bits of assetId's,
+    // assetId included, in ascending id order. Empty when assetId has no
+    // hash yet.
+    QVector<qint64> similarAssetIds(qint64 assetId, int maxDistance) const;
+
+    // Smart collections: saved rules whose members are kept as a bitmap of
+    // rows. Membership is evaluated in full when a collection is set and
+    // when the index loads; afterwards only rows whose metadata, tags or
+    // marks change are re-evaluated. Only the predicate fields of rule are
+    // used, not its sort order, search text, similarity or bursts.
+    void setCollection(qint64 collectionId, const FilterOptions &rule);
+    void removeCollection(qint64 collectionId);
+    int collectionSize(qint64 collectionId) const;
+
+    // Number of assets carrying each tag, read straight off the postings.
+    QHash<QString, int> tagCounts() const;
+
+private:
+    // Entry of the burst time index.
+    struct BurstKey
+    {
+        quint32 cameraId;
+        qint64 captureEpoch;
+        int row;
+
+        bool operator<(const BurstKey &other) const
+        {
+            if (cameraId != other.cameraId) {
+                return cameraId < other.cameraId;
+            }
+            if (captureEpoch != other.captureEpoch) {
+                return captureEpoch < other.captureEpoch;
+            }
+            return row < other.row;
+        }
+    };
+
+    // Row -> first row of its burst, itself when the row is not part of one.
+    using BurstLeaders = QVector<int>;
+
+    struct Columns
+    {
+        QVector<qint64> ids;
+        QVector<qint64> captureEpoch; // msecs since epoch, 0 when unknown
+        QVector<qint32> iso;          // 0 when unknown
+        QVector<quint32> cameraId;    // index into cameras, 0 when unknown
+        QVector<quint32> lensId;      // index into lenses, 0 when unknown
+        QVector<LibraryAsset> rows;
+        QHash<qint64, int> rowById;
+
+        QVector<QPair<QString, QString>> cameras; // (make, model)
+        QHash<QPair<QString, QString>, quint32> cameraLookup;
+        QVector<QString> lenses;
+        QHash<QString, quint32> lensLookup;
+        QHash<QString, int> tagLookup;
+        QVector<RoaringBitmap> tagRows;     // posting list of rows per tag
+        QVector<QVector<int>> tagsByRow;    // inverse, to clear a row's tags
+        QVector<quint64> perceptualHash;    // 0 when not hashed yet
+        QVector<quint8> marks;              // packed AssetMarks
+        // Rows per rating, flag and colour label value; every row is in
+        // exactly one bitmap of each.
+        std::array<RoaringBitmap, AssetMarks::kRatingCount> ratingRows;
+        std::array<RoaringBitmap, AssetMarks::kFlagCount> flagRows;
+        std::array<RoaringBitmap, AssetMarks::kLabelCount> labelRows;
+        quint64 hashRevision = 0;           // bumped when any hash changes
+        // Bit per FilterOptions::SortOrder whose sort keys an update wrote;
+        // apply() drops just those permutations.
+        quint32 staleSortOrders = 0;
+        // Rows with both a camera and a capture time, sorted by camera, then
+        // time. Built in one sort once loaded, then kept sorted row by row.
+        QVector<BurstKey> burstOrder;
+        bool burstOrderBuilt = false;
+        quint64 burstRevision = 0;          // bumped when burstOrder changes
+        // Rows written since collections were last brought up to date.
+        QVector<int> changedRows;
+    };
+
+    struct Collection
+    {
+        FilterOptions rule;
+        RoaringBitmap rows;
+    };
+    using Update = std::function<void(Columns &)>;
+
+    void apply(const Update &update);
+    QVector<int> matchingRowsInOrder(const FilterOptions &options,
+                                     const QVector<qint64> *searchMatches,
+                                     QVector<int> *stackSizes = nullptr) const;
+    QVector<quint8> filterMask(const FilterOptions &options, const QVector<qint64> *searchMatches) const;
+    QVector<int> collectionRowsInOrder(const Collection &collection,
+                                       const FilterOptions &options,
+                                       const QVector<qint64> *searchMatches) const;
+    void collapseBursts(QVector<int> &rows, int gapMsecs, QVector<int> *stackSizes) const;
+    QVector<int> permutation(FilterOptions::SortOrder sortOrder) const;
+    QVector<int> permutationRank(FilterOptions::SortOrder sortOrder) const;
+    void rebuildCollections();
+    void updateCollections();
+    QSharedPointer<const PerceptualHashIndex> similarityIndex() const;
+    QVector<int> similarRows(qint64 assetId, int maxDistance) const;
+    QSharedPointer<const BurstLeaders> burstLeaders(int gapMsecs) const;
+
+    static void initialize(Columns &columns);
+    static int ensureRow(Columns &columns, qint64 assetId);
+    static void setMetadata(Columns &columns, int row, const AssetMetadata &metadata);
+    static void setPerceptualHash(Columns &columns, int row, quint64 hash);
+    static void addMarkPostings(Columns &columns, int row);
+    static void setMarks(Columns &columns, int row, quint8 marks);
+    static RoaringBitmap markFilterRows(const Columns &columns, const FilterOptions &options);
+    static bool rowMatchesRule(const Columns &columns, int row, const FilterOptions &rule);
+    static void buildBurstOrder(Columns &columns);
+    static void moveBurstKey(Columns &columns, int row, quint32 oldCameraId, qint64 oldEpoch);
+    static BurstLeaders buildBurstLeaders(const Columns &columns, int gapMsecs);
+    static RoaringBitmap tagFilterRows(const Columns &columns, const FilterOptions &options);
+    static QVector<int> buildPermutation(const Columns &columns, FilterOptions::SortOrder sortOrder);
+    static bool sameContents(const Columns &a, const Columns &b);
+    static QByteArray encodeSnapshot(const Columns &columns);
+    static bool decodeSnapshot(const uchar *data, qint64 size, Columns &columns, QString *errorMessage);
+
+    mutable QReadWriteLock m_lock;
+    Columns m_columns;
+    bool m_loaded = false;
+    bool m_reloading = false;
+    quint64 m_generation = 0;
+    QVector<Update> m_pendingUpdates;
+    QHash<qint64, Collection> m_collections;
+
+    // Sort permutations are built lazily per sort order and dropped on any
+    // write. Guarded separately so readers can fill the cache.
+    mutable QMutex m_permutationMutex;
+    mutable QHash<int, QVector<int>> m_permutations;
+    mutable QHash<int, QVector<int>> m_permutationRanks; // row -> position
+
+    // Built on the first similarity query and kept until a hash changes.
+    mutable QMutex m_similarityMutex;
+    mutable QSharedPointer<const PerceptualHashIndex> m_similarityIndex;
+
+    // Bursts for the last gap asked for, kept until a capture time or
+    // camera changes.
+    mutable QMutex m_burstMutex;
+    mutable int m_burstGapMsecs = -1;
+    mutable QSharedPointer<const BurstLeaders> m_burstLeaders;
+};
+
+#endif // ASSETINDEX_H
@@ -0,0 +1,61 @@
+#ifndef ASSETMARKS_H
+#define ASSETMARKS_H
+
+#include <QtGlobal>
+
+// Star rating, pick/reject flag and colour label of an asset, packed into
+// one byte so a whole library's marks fit in a small column:
+//   bits 0-2  rating, 0 to 5 stars
+//   bits 3-4  flag
+//   bits 5-7  colour label
+// 0 is an unmarked asset.
+namespace AssetMarks {
+
+enum Flag {
+    Unflagged = 0,
+    Picked = 1,
+    Rejected = 2
+};
+
+enum ColorLabel {
+    NoLabel = 0,
+    Red,
+    Yellow,
+    Green,
+    Blue,
+    Purple
+};
+
+constexpr int kMaxRating = 5;
+constexpr int kRatingCount = kMaxRating + 1;
+constexpr int kFlagCount = 3;
+constexpr int kLabelCount = Purple + 1;
+
+// Bits each field occupies in the packed byte.
+constexpr quint8 kRatingMask = 0x07;
+constexpr quint8 kFlagMask = 0x18;
+constexpr quint8 kLabelMask = 0xe0;
+
+inline int rating(quint8 marks) { return marks & kRatingMask; }
+inline Flag flag(quint8 marks) { return Flag((marks & kFlagMask) >> 3); }
+inline ColorLabel colorLabel(quint8 marks) { return ColorLabel((marks & kLabelMask) >> 5); }
+
+// False for bytes with a field out of range, e.g. from a damaged database.
+inline bool isValid(quint8 marks)
+{
+    return rating(marks) <= kMaxRating && (marks & kFlagMask) >> 3 < kFlagCount && (marks & kLabelMask) >> 5 < kLabelCount;
+}
+
+inline quint8 ratingBits(int stars) { return quint8(qBound(0, stars, kMaxRating)); }
+inline quint8 flagBits(Flag value) { return quint8(value << 3) & kFlagMask; }
+inline quint8 labelBits(ColorLabel value) { return quint8(value << 5) & kLabelMask; }
+
+// Replaces the field selected by fieldMask with bits, keeping the others.
+inline quint8 withField(quint8 marks, quint8 fieldMask, quint8 bits)
+{
+    return quint8((marks & ~fieldMask) | (bits & fieldMask));
+}
+
+} // namespace AssetMarks
+
+#endif // ASSETMARKS_H
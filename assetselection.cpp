@@ -0,0 +1,94 @@
+#include "assetselection.h"
+
+bool AssetSelection::holds(qint64 assetId) const
+{
+    return fitsBitmap(assetId) ? m_ids.contains(quint32(assetId)) : m_wideIds.contains(assetId);
+}
+
+void AssetSelection::add(qint64 assetId)
+{
+    if (fitsBitmap(assetId)) {
+        m_ids.add(quint32(assetId));
+    } else {
+        m_wideIds.insert(assetId);
+    }
+}
+
+void AssetSelection::remove(qint64 assetId)
+{
+    if (fitsBitmap(assetId)) {
+        m_ids.remove(quint32(assetId));
+    } else {
+        m_wideIds.remove(assetId);
+    }
+}
+
+bool AssetSelection::contains(qint64 assetId) const
+{
+    return holds(assetId) != m_inverted;
+}
+
+qint64 AssetSelection::count(qint64 resultSize) const
+{
+    const qint64 ids = qint64(m_ids.cardinality()) + m_wideIds.size();
+    return m_inverted ? qMax<qint64>(0, resultSize - ids) : ids;
+}
+
+void AssetSelection::select(qint64 assetId)
+{
+    if (m_inverted) {
+        remove(assetId);
+    } else {
+        add(assetId);
+    }
+}
+
+void AssetSelection::deselect(qint64 assetId)
+{
+    if (m_inverted) {
+        add(assetId);
+    } else {
+        remove(assetId);
+    }
+}
+
+void AssetSelection::clear()
+{
+    m_ids.clear();
+    m_wideIds.clear();
+    m_inverted = false;
+}
+
+void AssetSelection::selectAll()
+{
+    m_ids.clear();
+    m_wideIds.clear();
+    m_inverted = true;
+}
+
+void AssetSelection::invert()
+{
+    m_inverted = !m_inverted;
+}
+
+AssetSelection &AssetSelection::operator-=(const AssetSelection &other)
+{
+    // With A and B the bitmaps: A - B, A & B, not (A | B) and B - A for the
+    // four combinations of explicit and complemented operands. The side sets
+    // follow the same rules.
+    if (!m_inverted && !other.m_inverted) {
+        m_ids -= other.m_ids;
+        m_wideIds.subtract(other.m_wideIds);
+    } else if (!m_inverted) {
+        m_ids &= other.m_ids;
+        m_wideIds.intersect(other.m_wideIds);
+    } else if (!other.m_inverted) {
+        m_ids |= other.m_ids;
+        m_wideIds.unite(other.m_wideIds);
+    } else {
+        m_ids = other.m_ids - m_ids;
+        m_wideIds = QSet<qint64>(other.m_wideIds).subtract(m_wideIds);
+        m_inverted = false;
+    }
+    return *this;
+}
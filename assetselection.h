@@ -0,0 +1,72 @@
+#ifndef ASSETSELECTION_H
+#define ASSETSELECTION_H
+
+#include <QSet>
+#include <QVector>
+#include <QtGlobal>
+
+#include "roaringbitmap.h"
+
+#include <algorithm>
+
+// Selected assets of one grid result. Assets picked one by one are a bitmap
+// of their ids; select-all and invert switch to the complement, "every
+// asset of the result except these", so neither visits the assets however
+// large the result is. Asset ids are SQLite rowids, which stay far below
+// 2^32 in practice; the rare id that does not fit the bitmap is kept in a
+// side set instead of being truncated into another asset's id.
+class AssetSelection
+{
+public:
+    bool isInverted() const { return m_inverted; }
+    // True when nothing is selected whatever the result holds.
+    bool isEmpty() const { return !m_inverted && m_ids.isEmpty(); }
+    bool contains(qint64 assetId) const;
+    // Selected assets out of a result of resultSize. A complement assumes
+    // the assets it leaves out are part of the result.
+    qint64 count(qint64 resultSize) const;
+
+    void select(qint64 assetId);
+    void deselect(qint64 assetId);
+    void clear();
+    void selectAll();
+    void invert();
+    // Deselects everything selected in other.
+    AssetSelection &operator-=(const AssetSelection &other);
+
+    // Calls visitor(assetId) for every selected asset without building a
+    // list: in ascending id order for an explicit selection, and in the
+    // order of resultIds, which only a complement reads, otherwise.
+    template<typename Visitor>
+    void forEach(const QVector<qint64> &resultIds, Visitor visitor) const
+    {
+        if (!m_inverted) {
+            m_ids.forEach([&visitor](quint32 assetId) { visitor(qint64(assetId)); });
+            if (!m_wideIds.isEmpty()) {
+                QList<qint64> wideIds = m_wideIds.values();
+                std::sort(wideIds.begin(), wideIds.end());
+                for (qint64 assetId : std::as_const(wideIds)) {
+                    visitor(assetId);
+                }
+            }
+            return;
+        }
+        for (qint64 assetId : resultIds) {
+            if (!holds(assetId)) {
+                visitor(assetId);
+            }
+        }
+    }
+
+private:
+    static bool fitsBitmap(qint64 assetId) { return assetId >= 0 && assetId <= qint64(0xffffffffu); }
+    bool holds(qint64 assetId) const;
+    void add(qint64 assetId);
+    void remove(qint64 assetId);
+
+    RoaringBitmap m_ids; // selected, or left out of a complement
+    QSet<qint64> m_wideIds; // the same for ids outside the bitmap's range
+    bool m_inverted = false;
+};
+
+#endif // ASSETSELECTION_H
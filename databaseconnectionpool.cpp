@@ -0,0 +1,328 @@
+#include "databaseconnectionpool.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSqlError>
+#include <QUuid>
+
+namespace {
+constexpr int kMaxCachedStatements = 64;
+// Copies of one statement text that may be active at once. More than this
+// means a caller stopped reading without finish() rather than nesting.
+constexpr int kMaxActiveCopies = 4;
+
+const char *const kConnectionPragmas[] = {
+    "PRAGMA journal_mode = WAL",
+    "PRAGMA synchronous = NORMAL",
+    "PRAGMA mmap_size = 268435456",   // 256 MB
+    "PRAGMA cache_size = -65536",     // 64 MB, negative values are KiB
+    "PRAGMA temp_store = MEMORY",
+    "PRAGMA busy_timeout = 5000",
+};
+}
+
+DatabaseConnectionPool &DatabaseConnectionPool::instance()
+{
+    static DatabaseConnectionPool pool;
+    return pool;
+}
+
+DatabaseConnectionPool::ThreadConnections::~ThreadConnections()
+{
+    // Runs on the owning thread when it exits.
+    for (ThreadConnection *connection : std::as_const(byPath)) {
+        dropConnection(connection);
+    }
+    byPath.clear();
+}
+
+bool DatabaseConnectionPool::configureConnection(QSqlDatabase &database, QString *errorMessage)
+{
+    if (!database.isOpen()) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Cannot configure a closed database connection");
+        }
+        return false;
+    }
+
+    QSqlQuery pragma(database);
+    for (const char *statement : kConnectionPragmas) {
+        if (!pragma.exec(QString::fromLatin1(statement))) {
+            // A pragma the SQLite build does not support is not fatal.
+            qWarning() << "Failed to apply" << statement << ":" << pragma.lastError();
+        }
+        pragma.finish();
+    }
+    return true;
+}
+
+QSqlDatabase DatabaseConnectionPool::connection(const QString &databasePath, QString *errorMessage)
+{
+    ThreadConnection *connection = threadConnection(databasePath, errorMessage);
+    if (!connection) {
+        return QSqlDatabase();
+    }
+    return QSqlDatabase::database(connection->connectionName, false);
+}
+
+QSqlQuery *DatabaseConnectionPool::cachedQuery(const QString &databasePath, const QString &sql, QString *errorMessage)
+{
+    ThreadConnection *connection = threadConnection(databasePath, errorMessage);
+    if (!connection) {
+        return nullptr;
+    }
+    return cachedQuery(connection, sql, errorMessage);
+}
+
+QSqlQuery *DatabaseConnectionPool::cachedQuery(const QSqlDatabase &database, const QString &sql, QString *errorMessage)
+{
+    ThreadConnection *connection = ownedConnection(database, errorMessage);
+    if (!connection) {
+        return nullptr;
+    }
+    return cachedQuery(connection, sql, errorMessage);
+}
+
+QSqlQuery *DatabaseConnectionPool::cachedQuery(ThreadConnection *connection, const QString &sql, QString *errorMessage)
+{
+    const auto cached = connection->statements.find(sql);
+    if (cached != connection->statements.end()) {
+        // An active copy may still be stepped by a caller further up the
+        // stack, so only an idle one is handed out again.
+        CachedStatement *oldest = nullptr;
+        for (CachedStatement &entry : cached.value()) {
+            if (!entry.query->isActive()) {
+                entry.lastUsed = ++connection->useClock;
+                return entry.query;
+            }
+            if (!oldest || entry.lastUsed < oldest->lastUsed) {
+                oldest = &entry;
+            }
+        }
+        if (cached->size() >= kMaxActiveCopies) {
+            qWarning() << "Statement left active without finish(), resetting it:" << sql;
+            oldest->query->finish();
+            oldest->lastUsed = ++connection->useClock;
+            return oldest->query;
+        }
+    }
+
+    while (connection->statementCount >= kMaxCachedStatements && evictLeastRecentlyUsed(connection)) {
+    }
+
+    auto *query = new QSqlQuery(QSqlDatabase::database(connection->connectionName, false));
+    query->setForwardOnly(true);
+    if (!query->prepare(sql)) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Failed to prepare statement: %1").arg(query->lastError().text());
+        }
+        delete query;
+        return nullptr;
+    }
+
+    connection->statements[sql].append(CachedStatement{query, ++connection->useClock});
+    ++connection->statementCount;
+    return query;
+}
+
+// Deletes the idle statement used longest ago; false when every cached
+// statement is active.
+bool DatabaseConnectionPool::evictLeastRecentlyUsed(ThreadConnection *connection)
+{
+    QString victimSql;
+    int victimIndex = -1;
+    quint64 victimUse = 0;
+    for (auto it = connection->statements.constBegin(); it != connection->statements.constEnd(); ++it) {
+        for (int i = 0; i < it->size(); ++i) {
+            const CachedStatement &entry = it->at(i);
+            if (!entry.query->isActive() && (victimIndex < 0 || entry.lastUsed < victimUse)) {
+                victimSql = it.key();
+                victimIndex = i;
+                victimUse = entry.lastUsed;
+            }
+        }
+    }
+    if (victimIndex < 0) {
+        return false;
+    }
+
+    auto it = connection->statements.find(victimSql);
+    delete it->at(victimIndex).query;
+    it->removeAt(victimIndex);
+    if (it->isEmpty()) {
+        connection->statements.erase(it);
+    }
+    --connection->statementCount;
+    return true;
+}
+
+void DatabaseConnectionPool::clearStatements(ThreadConnection *connection)
+{
+    for (const QVector<CachedStatement> &entries : std::as_const(connection->statements)) {
+        for (const CachedStatement &entry : entries) {
+            delete entry.query;
+        }
+    }
+    connection->statements.clear();
+    connection->statementCount = 0;
+}
+
+bool DatabaseConnectionPool::attachDatabase(const QString &databasePath,
+                                            const QString &schemaName,
+                                            const QString &attachedPath,
+                                            QString *errorMessage)
+{
+    ThreadConnection *connection = threadConnection(databasePath, errorMessage);
+    if (!connection) {
+        return false;
+    }
+
+    const QString attachedKey = normalizedPath(attachedPath);
+    const auto existing = connection->attachments.constFind(schemaName);
+    if (existing != connection->attachments.constEnd() && existing.value() == attachedKey) {
+        return true;
+    }
+
+    // Statements prepared against the old schema would keep it locked.
+    clearStatements(connection);
+
+    QSqlDatabase db = QSqlDatabase::database(connection->connectionName, false);
+    QSqlQuery query(db);
+    if (existing != connection->attachments.constEnd()) {
+        if (!query.exec(QStringLiteral("DETACH DATABASE %1").arg(schemaName))) {
+            qWarning() << "Failed to detach" << schemaName << ":" << query.lastError();
+        }
+        connection->attachments.remove(schemaName);
+    }
+
+    query.prepare(QStringLiteral("ATTACH DATABASE ? AS %1").arg(schemaName));
+    query.addBindValue(attachedPath);
+    if (!query.exec()) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Failed to attach %1: %2").arg(schemaName, query.lastError().text());
+        }
+        return false;
+    }
+
+    connection->attachments.insert(schemaName, attachedKey);
+    return true;
+}
+
+void DatabaseConnectionPool::releaseDatabase(const QString &databasePath)
+{
+    const QString key = normalizedPath(databasePath);
+    {
+        QMutexLocker locker(&m_mutex);
+        m_generations[key] = m_generations.value(key, 0) + 1;
+    }
+
+    if (!m_threadConnections.hasLocalData()) {
+        return;
+    }
+
+    ThreadConnections *connections = m_threadConnections.localData();
+    if (ThreadConnection *connection = connections->byPath.take(key)) {
+        dropConnection(connection);
+    }
+}
+
+DatabaseConnectionPool::ThreadConnection *DatabaseConnectionPool::threadConnection(const QString &databasePath, QString *errorMessage)
+{
+    if (databasePath.isEmpty()) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Database path is empty");
+        }
+        return nullptr;
+    }
+
+    if (!m_threadConnections.hasLocalData()) {
+        m_threadConnections.setLocalData(new ThreadConnections);
+    }
+    ThreadConnections *connections = m_threadConnections.localData();
+
+    const QString key = normalizedPath(databasePath);
+    const quint64 generation = currentGeneration(key);
+
+    ThreadConnection *connection = connections->byPath.value(key, nullptr);
+    if (connection && connection->generation != generation) {
+        connections->byPath.remove(key);
+        dropConnection(connection);
+        connection = nullptr;
+    }
+
+    if (connection) {
+        return connection;
+    }
+
+    const QString connectionName = QStringLiteral("pool_%1").arg(QUuid::createUuid().toString(QUuid::Id128));
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
+        db.setDatabaseName(databasePath);
+        if (!db.open()) {
+            if (errorMessage) {
+                *errorMessage = QStringLiteral("Failed to open pooled connection: %1").arg(db.lastError().text());
+            }
+            db = QSqlDatabase();
+            QSqlDatabase::removeDatabase(connectionName);
+            return nullptr;
+        }
+        configureConnection(db);
+    }
+
+    connection = new ThreadConnection;
+    connection->connectionName = connectionName;
+    connection->generation = generation;
+    connections->byPath.insert(key, connection);
+    return connection;
+}
+
+DatabaseConnectionPool::ThreadConnection *DatabaseConnectionPool::ownedConnection(const QSqlDatabase &database, QString *errorMessage)
+{
+    const QString connectionName = database.connectionName();
+    if (m_threadConnections.hasLocalData()) {
+        for (ThreadConnection *connection : std::as_const(m_threadConnections.localData()->byPath)) {
+            if (connection->connectionName == connectionName) {
+                return connection;
+            }
+        }
+    }
+
+    if (errorMessage) {
+        *errorMessage = QStringLiteral("Connection %1 is not pooled on this thread").arg(connectionName);
+    }
+    return nullptr;
+}
+
+quint64 DatabaseConnectionPool::currentGeneration(const QString &databasePath) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_generations.value(databasePath, 0);
+}
+
+void DatabaseConnectionPool::dropConnection(ThreadConnection *connection)
+{
+    if (!connection) {
+        return;
+    }
+
+    // Statements must be released before the connection can be removed.
+    clearStatements(connection);
+
+    const QString connectionName = connection->connectionName;
+    delete connection;
+
+    {
+        QSqlDatabase db = QSqlDatabase::database(connectionName, false);
+        if (db.isOpen()) {
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+QString DatabaseConnectionPool::normalizedPath(const QString &databasePath)
+{
+    return QDir::cleanPath(QFileInfo(databasePath).absoluteFilePath());
+}
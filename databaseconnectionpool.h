@@ -0,0 +1,95 @@
+#ifndef DATABASECONNECTIONPOOL_H
+#define DATABASECONNECTIONPOOL_H
+
+#include <QHash>
+#include <QMutex>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QString>
+#include <QThreadStorage>
+#include <QVector>
+
+// Hands out one SQLite connection per (thread, database file) and keeps it
+// open for the lifetime of the thread. QtConcurrent workers come from the
+// global thread pool, so background queries reuse a warm, already configured
+// connection instead of paying addDatabase/open/PRAGMA on every call.
+class DatabaseConnectionPool
+{
+public:
+    static DatabaseConnectionPool &instance();
+
+    // Returns the calling thread's connection to databasePath, opening and
+    // configuring it on first use. The returned handle must only be used on
+    // the calling thread.
+    QSqlDatabase connection(const QString &databasePath, QString *errorMessage = nullptr);
+
+    // Returns a statement prepared on the calling thread's connection. The
+    // statement is cached by its SQL text, so later calls only rebind values.
+    // Callers must call finish() once they are done reading results: a
+    // statement still active is never reset or evicted, and a nested call
+    // for the same text gets a second copy instead. Inactive statements are
+    // evicted least recently used first, so a pointer stays valid while a
+    // caller prepares a few others; SQL built from filter values does not
+    // belong here, as every variant would take a slot.
+    QSqlQuery *cachedQuery(const QString &databasePath, const QString &sql, QString *errorMessage = nullptr);
+    // Same, for a connection this pool handed to the calling thread, such as
+    // the one a DatabaseWriter passes to its commands.
+    QSqlQuery *cachedQuery(const QSqlDatabase &database, const QString &sql, QString *errorMessage = nullptr);
+
+    // Attaches attachedPath to the calling thread's connection to databasePath
+    // under schemaName so a single statement can join across both files.
+    // Attaching the same file again is a no-op; attaching a different file
+    // under an existing name replaces it and drops the cached statements.
+    bool attachDatabase(const QString &databasePath,
+                        const QString &schemaName,
+                        const QString &attachedPath,
+                        QString *errorMessage = nullptr);
+
+    // Invalidates every thread's connection to databasePath. The calling
+    // thread's connection is closed immediately; other threads drop theirs the
+    // next time they ask for one.
+    void releaseDatabase(const QString &databasePath);
+
+    // Applies the pragmas every connection to a library database should use.
+    static bool configureConnection(QSqlDatabase &database, QString *errorMessage = nullptr);
+
+private:
+    DatabaseConnectionPool() = default;
+
+    struct CachedStatement
+    {
+        QSqlQuery *query = nullptr;
+        quint64 lastUsed = 0;
+    };
+
+    struct ThreadConnection
+    {
+        QString connectionName;
+        quint64 generation = 0;
+        QHash<QString, QVector<CachedStatement>> statements; // by SQL text
+        int statementCount = 0;
+        quint64 useClock = 0;
+        QHash<QString, QString> attachments; // schema name -> normalized path
+    };
+
+    struct ThreadConnections
+    {
+        ~ThreadConnections();
+        QHash<QString, ThreadConnection *> byPath;
+    };
+
+    ThreadConnection *threadConnection(const QString &databasePath, QString *errorMessage);
+    ThreadConnection *ownedConnection(const QSqlDatabase &database, QString *errorMessage);
+    static QSqlQuery *cachedQuery(ThreadConnection *connection, const QString &sql, QString *errorMessage);
+    quint64 currentGeneration(const QString &databasePath) const;
+    static void dropConnection(ThreadConnection *connection);
+    static void clearStatements(ThreadConnection *connection);
+    static bool evictLeastRecentlyUsed(ThreadConnection *connection);
+    static QString normalizedPath(const QString &databasePath);
+
+    mutable QMutex m_mutex;
+    QHash<QString, quint64> m_generations;
+    QThreadStorage<ThreadConnections *> m_threadConnections;
+};
+
+#endif // DATABASECONNECTIONPOOL_H
@@ -0,0 +1,149 @@
+#include "databasewriter.h"
+
+#include "databaseconnectionpool.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QThread>
+#include <QVector>
+
+namespace {
+// Bounds how long one burst of commands holds the write lock.
+constexpr size_t kMaxBatchSize = 512;
+}
+
+DatabaseWriter::DatabaseWriter(const QString &databasePath)
+    : m_databasePath(databasePath)
+{
+    m_thread = QThread::create([this]() {
+        run();
+    });
+    m_thread->setObjectName(QStringLiteral("DatabaseWriter"));
+    m_thread->start();
+}
+
+DatabaseWriter::~DatabaseWriter()
+{
+    stop();
+    delete m_thread;
+}
+
+QString DatabaseWriter::databasePath() const
+{
+    return m_databasePath;
+}
+
+QFuture<bool> DatabaseWriter::submit(Command command)
+{
+    PendingCommand pending;
+    pending.command = std::move(command);
+    pending.promise.start();
+    QFuture<bool> future = pending.promise.future();
+
+    QMutexLocker locker(&m_mutex);
+    if (m_stopping) {
+        pending.promise.addResult(false);
+        pending.promise.finish();
+        return future;
+    }
+
+    m_queue.push_back(std::move(pending));
+    ++m_submitted;
+    m_queueChanged.wakeOne();
+    return future;
+}
+
+void DatabaseWriter::flush()
+{
+    QMutexLocker locker(&m_mutex);
+    const quint64 target = m_submitted;
+    while (m_completed < target) {
+        m_batchDone.wait(&m_mutex);
+    }
+}
+
+void DatabaseWriter::stop()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_queueChanged.wakeOne();
+    }
+    m_thread->wait();
+}
+
+void DatabaseWriter::run()
+{
+    // The pooled connection belongs to this thread and is closed when it
+    // exits.
+    QString connectionError;
+    QSqlDatabase database = DatabaseConnectionPool::instance().connection(m_databasePath, &connectionError);
+    if (!database.isOpen()) {
+        qWarning() << "Database writer failed to open" << m_databasePath << ":" << connectionError;
+    }
+
+    forever {
+        std::deque<PendingCommand> batch;
+        {
+            QMutexLocker locker(&m_mutex);
+            while (m_queue.empty() && !m_stopping) {
+                m_queueChanged.wait(&m_mutex);
+            }
+            if (m_queue.empty()) {
+                break;
+            }
+            // Everything that queued up during the last commit goes into the
+            // next transaction.
+            while (!m_queue.empty() && batch.size() < kMaxBatchSize) {
+                batch.push_back(std::move(m_queue.front()));
+                m_queue.pop_front();
+            }
+        }
+
+        runBatch(database, batch);
+
+        QMutexLocker locker(&m_mutex);
+        m_completed += batch.size();
+        m_batchDone.wakeAll();
+    }
+}
+
+void DatabaseWriter::runBatch(QSqlDatabase &database, std::deque<PendingCommand> &batch)
+{
+    QVector<bool> results(int(batch.size()), false);
+    bool committed = false;
+
+    if (database.isOpen() && database.transaction()) {
+        QSqlQuery savepoint(database);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (!savepoint.exec(QStringLiteral("SAVEPOINT command"))) {
+                qWarning() << "Failed to open savepoint:" << savepoint.lastError();
+                continue;
+            }
+
+            QString errorMessage;
+            results[int(i)] = batch[i].command(database, &errorMessage);
+            if (!results[int(i)]) {
+                qWarning() << "Database write failed:" << errorMessage;
+                savepoint.exec(QStringLiteral("ROLLBACK TO command"));
+            }
+            savepoint.exec(QStringLiteral("RELEASE command"));
+        }
+        savepoint.finish();
+
+        committed = database.commit();
+        if (!committed) {
+            qWarning() << "Failed to commit database writes:" << database.lastError();
+            database.rollback();
+        }
+    } else {
+        qWarning() << "Failed to begin database write transaction:" << database.lastError();
+    }
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        batch[i].promise.addResult(committed && results.at(int(i)));
+        batch[i].promise.finish();
+    }
+}
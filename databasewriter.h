@@ -0,0 +1,69 @@
+#ifndef DATABASEWRITER_H
+#define DATABASEWRITER_H
+
+#include <QFuture>
+#include <QMutex>
+#include <QPromise>
+#include <QSqlDatabase>
+#include <QString>
+#include <QWaitCondition>
+
+#include <deque>
+#include <functional>
+
+class QThread;
+
+// Owns the one connection that writes to a database and runs write commands
+// on a dedicated thread, in submission order. Commands that queue up while a
+// transaction commits are grouped into the next one, each inside its own
+// savepoint so a failing command is rolled back alone. Callers never wait on
+// fsync unless they choose to wait on the returned future.
+class DatabaseWriter
+{
+public:
+    // Runs on the writer thread inside an open transaction. It must not begin
+    // or commit transactions itself.
+    using Command = std::function<bool(QSqlDatabase &database, QString *errorMessage)>;
+
+    explicit DatabaseWriter(const QString &databasePath);
+    ~DatabaseWriter();
+
+    DatabaseWriter(const DatabaseWriter &) = delete;
+    DatabaseWriter &operator=(const DatabaseWriter &) = delete;
+
+    QString databasePath() const;
+
+    // The future finishes with true once the transaction holding command has
+    // committed, or with false if the command or the commit failed.
+    QFuture<bool> submit(Command command);
+
+    // Blocks until everything submitted so far has been committed.
+    void flush();
+
+    // Runs what is already queued, then stops the thread. Commands submitted
+    // afterwards fail immediately.
+    void stop();
+
+private:
+    struct PendingCommand
+    {
+        Command command;
+        QPromise<bool> promise;
+    };
+
+    void run();
+    void runBatch(QSqlDatabase &database, std::deque<PendingCommand> &batch);
+
+    const QString m_databasePath;
+    QThread *m_thread = nullptr;
+
+    QMutex m_mutex; // guards everything below
+    QWaitCondition m_queueChanged;
+    QWaitCondition m_batchDone;
+    std::deque<PendingCommand> m_queue;
+    quint64 m_submitted = 0;
+    quint64 m_completed = 0;
+    bool m_stopping = false;
+};
+
+#endif // DATABASEWRITER_H
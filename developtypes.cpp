@@ -2,9 +2,85 @@
 
 #include <QJsonDocument>
 #include <QJsonValue>
+#include <QtAlgorithms>
+#include <QtEndian>
+
+#include <cstring>
 
 namespace {
 
+constexpr int kAdjustmentFieldCount = 20;
+static_assert(sizeof(DevelopAdjustments) == kAdjustmentFieldCount * sizeof(double),
+              "DevelopAdjustments must stay a flat array of doubles for the binary encoding");
+
+constexpr char kBinaryTag = char(0xAD); // JSON payloads start with '{'
+constexpr char kBinaryVersion = 1;
+constexpr int kBinaryHeaderSize = 6;
+constexpr quint32 kAllFields = (1u << kAdjustmentFieldCount) - 1;
+
+QByteArray encodeFields(const double *from, const double *to)
+{
+    quint32 mask = 0;
+    for (int i = 0; i < kAdjustmentFieldCount; ++i) {
+        if (to[i] != from[i]) {
+            mask |= 1u << i;
+        }
+    }
+
+    QByteArray out(kBinaryHeaderSize + int(qPopulationCount(mask)) * int(sizeof(double)), Qt::Uninitialized);
+    char *cursor = out.data();
+    cursor[0] = kBinaryTag;
+    cursor[1] = kBinaryVersion;
+    qToLittleEndian(mask, cursor + 2);
+    cursor += kBinaryHeaderSize;
+    for (int i = 0; i < kAdjustmentFieldCount; ++i) {
+        if (mask & (1u << i)) {
+            quint64 bits;
+            std::memcpy(&bits, &to[i], sizeof(bits));
+            qToLittleEndian(bits, cursor);
+            cursor += sizeof(bits);
+        }
+    }
+    return out;
+}
+
+bool isBinaryPayload(const QByteArray &data)
+{
+    return data.size() >= kBinaryHeaderSize && data.at(0) == kBinaryTag;
+}
+
+// Overwrites the fields present in data.
+bool decodeFields(const QByteArray &data, double *values)
+{
+    if (!isBinaryPayload(data) || data.at(1) != kBinaryVersion) {
+        return false;
+    }
+
+    const char *cursor = data.constData();
+    const quint32 mask = qFromLittleEndian<quint32>(cursor + 2);
+    if ((mask & ~kAllFields) != 0
+        || data.size() != kBinaryHeaderSize + int(qPopulationCount(mask)) * int(sizeof(double))) {
+        return false;
+    }
+    cursor += kBinaryHeaderSize;
+
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    if (mask == kAllFields) {
+        std::memcpy(values, cursor, kAdjustmentFieldCount * sizeof(double));
+        return true;
+    }
+#endif
+
+    for (int i = 0; i < kAdjustmentFieldCount; ++i) {
+        if (mask & (1u << i)) {
+            const quint64 bits = qFromLittleEndian<quint64>(cursor);
+            std::memcpy(&values[i], &bits, sizeof(bits));
+            cursor += sizeof(bits);
+        }
+    }
+    return true;
+}
+
 constexpr double clampValue(double value, double minValue, double maxValue)
 {
     if (value < minValue) {
@@ -99,9 +175,7 @@ DevelopAdjustments adjustmentsFromJson(const QJsonObject &json)
 
 QByteArray serializeAdjustments(const DevelopAdjustments &adjustments)
 {
-    const QJsonObject json = adjustmentsToJson(adjustments);
-    QJsonDocument doc(json);
-    return doc.toJson(QJsonDocument::Compact);
+    return serializeAdjustmentsDelta(defaultDevelopAdjustments(), adjustments);
 }
 
 DevelopAdjustments deserializeAdjustments(const QByteArray &data)
@@ -110,6 +184,14 @@ DevelopAdjustments deserializeAdjustments(const QByteArray &data)
         return defaultDevelopAdjustments();
     }
 
+    if (isBinaryPayload(data)) {
+        DevelopAdjustments adjustments = defaultDevelopAdjustments();
+        if (!applyAdjustmentsDelta(adjustments, data)) {
+            return defaultDevelopAdjustments();
+        }
+        return adjustments;
+    }
+
     QJsonParseError error;
     const QJsonDocument doc = QJsonDocument::fromJson(data, &error);
     if (error.error != QJsonParseError::NoError || !doc.isObject()) {
@@ -118,4 +200,22 @@ DevelopAdjustments deserializeAdjustments(const QByteArray &data)
     return adjustmentsFromJson(doc.object());
 }
 
+QByteArray serializeAdjustmentsDelta(const DevelopAdjustments &from, const DevelopAdjustments &to)
+{
+    double fromValues[kAdjustmentFieldCount];
+    double toValues[kAdjustmentFieldCount];
+    std::memcpy(fromValues, &from, sizeof(fromValues));
+    std::memcpy(toValues, &to, sizeof(toValues));
+    return encodeFields(fromValues, toValues);
+}
 
+bool applyAdjustmentsDelta(DevelopAdjustments &adjustments, const QByteArray &delta)
+{
+    double values[kAdjustmentFieldCount];
+    std::memcpy(values, &adjustments, sizeof(values));
+    if (!decodeFields(delta, values)) {
+        return false;
+    }
+    std::memcpy(&adjustments, values, sizeof(values));
+    return true;
+}
@@ -74,7 +74,17 @@ struct DevelopAdjustments
 DevelopAdjustments defaultDevelopAdjustments();
 QJsonObject adjustmentsToJson(const DevelopAdjustments &adjustments);
 DevelopAdjustments adjustmentsFromJson(const QJsonObject &json);
+// Storage form: a six byte header (format tag, version, little-endian mask
+// of the fields present) followed by those fields as little-endian doubles
+// in declaration order. Fields at their default are omitted, so untouched
+// assets cost six bytes. deserializeAdjustments() also reads the JSON text
+// earlier versions stored.
 QByteArray serializeAdjustments(const DevelopAdjustments &adjustments);
 DevelopAdjustments deserializeAdjustments(const QByteArray &data);
 
+// The fields that differ between two states, in the same format.
+// Applying the delta to from yields to.
+QByteArray serializeAdjustmentsDelta(const DevelopAdjustments &from, const DevelopAdjustments &to);
+bool applyAdjustmentsDelta(DevelopAdjustments &adjustments, const QByteArray &delta);
+
 #endif // DEVELOPTYPES_H
\ No newline at end of file
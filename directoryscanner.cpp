@@ -0,0 +1,246 @@
+#include "directoryscanner.h"
+
+#include <QAtomicInt>
+#include <QDir>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include <QThread>
+#include <QThreadPool>
+
+#ifdef Q_OS_UNIX
+#include <dirent.h>
+#include <sys/stat.h>
+#else
+#include <QDirIterator>
+#include <QFileInfo>
+#endif
+
+namespace {
+// How often matches collected by the workers are handed to the receiver.
+constexpr int kDeliveryIntervalMsecs = 50;
+
+// Never deleted, so nothing ever waits on a worker stuck on a hung share.
+QThreadPool *scannerPool()
+{
+    static QThreadPool *const pool = [] {
+        auto *threadPool = new QThreadPool;
+        // Listing is dominated by I/O latency, especially on network shares,
+        // so more workers than cores pay off.
+        threadPool->setMaxThreadCount(qBound(4, QThread::idealThreadCount() * 2, 16));
+        return threadPool;
+    }();
+    return pool;
+}
+
+QString childPath(const QString &directory, const QString &name)
+{
+    return directory.endsWith(QLatin1Char('/')) ? directory + name : directory + QLatin1Char('/') + name;
+}
+
+bool hasWantedExtension(const QString &fileName, const QSet<QString> &extensions)
+{
+    const int dot = fileName.lastIndexOf(QLatin1Char('.'));
+    return dot > 0 && extensions.contains(fileName.mid(dot + 1).toLower());
+}
+
+// Lists one directory without recursing. Stops early once cancelled is set.
+void listDirectory(const QString &path,
+                   const QSet<QString> &extensions,
+                   const QAtomicInt &cancelled,
+                   QStringList *matches,
+                   QStringList *subdirectories)
+{
+#ifdef Q_OS_UNIX
+    const QByteArray encodedPath = QFile::encodeName(path);
+    DIR *dir = ::opendir(encodedPath.constData());
+    if (!dir) {
+        return;
+    }
+
+    while (const dirent *entry = ::readdir(dir)) {
+        if (cancelled.loadRelaxed()) {
+            break;
+        }
+        // ".", ".." and hidden entries.
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN || type == DT_LNK) {
+            // Some file systems do not fill d_type, so lstat() tells links
+            // apart. A linked file is found, but a linked directory is never
+            // entered and link cycles cannot trap the walk.
+            struct stat info;
+            const QByteArray fullPath = encodedPath + '/' + entry->d_name;
+            if (::lstat(fullPath.constData(), &info) != 0) {
+                continue;
+            }
+            const bool link = S_ISLNK(info.st_mode);
+            if (link && ::stat(fullPath.constData(), &info) != 0) {
+                continue;
+            }
+            if (S_ISREG(info.st_mode)) {
+                type = DT_REG;
+            } else if (S_ISDIR(info.st_mode) && !link) {
+                type = DT_DIR;
+            } else {
+                continue;
+            }
+        }
+
+        if (type == DT_DIR) {
+            subdirectories->append(childPath(path, QFile::decodeName(entry->d_name)));
+        } else if (type == DT_REG) {
+            const QString fileName = QFile::decodeName(entry->d_name);
+            if (hasWantedExtension(fileName, extensions)) {
+                matches->append(childPath(path, fileName));
+            }
+        }
+    }
+    ::closedir(dir);
+#else
+    // The platform listing already carries the entry type, so QFileInfo
+    // answers isDir() without another call.
+    QDirIterator it(path, QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
+    while (it.hasNext() && !cancelled.loadRelaxed()) {
+        it.next();
+        const QFileInfo info = it.fileInfo();
+        if (info.isDir()) {
+            if (!info.isSymLink()) {
+                subdirectories->append(info.filePath());
+            }
+        } else if (hasWantedExtension(info.fileName(), extensions)) {
+            matches->append(info.filePath());
+        }
+    }
+#endif
+}
+}
+
+struct DirectoryScanner::ScanState
+{
+    QThreadPool *pool = nullptr;
+    QSet<QString> extensions; // lower case, without the dot
+    QAtomicInt cancelled = 0;
+    // Directories queued or being listed; the walk is over at zero.
+    QAtomicInt pendingDirectories = 0;
+
+    QMutex mutex; // guards everything below
+    QStringList found;
+    bool done = false;
+};
+
+DirectoryScanner::DirectoryScanner(QObject *parent)
+    : QObject(parent)
+{
+    m_deliveryTimer.setInterval(kDeliveryIntervalMsecs);
+    connect(&m_deliveryTimer, &QTimer::timeout, this, &DirectoryScanner::deliverFound);
+}
+
+DirectoryScanner::~DirectoryScanner()
+{
+    cancel();
+}
+
+void DirectoryScanner::start(const QString &root, const QStringList &nameFilters)
+{
+    cancel();
+
+    auto state = QSharedPointer<ScanState>::create();
+    state->pool = scannerPool();
+    for (const QString &filter : nameFilters) {
+        if (filter.startsWith(QLatin1String("*."))) {
+            state->extensions.insert(filter.mid(2).toLower());
+        }
+    }
+    m_state = state;
+
+    const QString path = QDir::cleanPath(root);
+    state->pendingDirectories.ref();
+    state->pool->start([state, path]() {
+        scanDirectory(state, path);
+    });
+    m_deliveryTimer.start();
+}
+
+void DirectoryScanner::cancel()
+{
+    if (!m_state) {
+        return;
+    }
+
+    // Running and queued workers notice the flag and return; they share the
+    // state, so nothing has to wait for them here.
+    m_state->cancelled.storeRelaxed(1);
+    m_deliveryTimer.stop();
+    m_state.reset();
+    emit finished(true);
+}
+
+bool DirectoryScanner::isRunning() const
+{
+    return !m_state.isNull();
+}
+
+void DirectoryScanner::deliverFound()
+{
+    if (!m_state) {
+        m_deliveryTimer.stop();
+        return;
+    }
+
+    QStringList batch;
+    bool done = false;
+    {
+        QMutexLocker locker(&m_state->mutex);
+        batch.swap(m_state->found);
+        done = m_state->done;
+    }
+
+    if (!batch.isEmpty()) {
+        emit filesFound(batch);
+        // The receiver may have cancelled.
+        if (!m_state) {
+            return;
+        }
+    }
+
+    if (done) {
+        m_deliveryTimer.stop();
+        m_state.reset();
+        emit finished(false);
+    }
+}
+
+void DirectoryScanner::scanDirectory(const QSharedPointer<ScanState> &state, const QString &path)
+{
+    QStringList matches;
+    QStringList subdirectories;
+    if (!state->cancelled.loadRelaxed()) {
+        listDirectory(path, state->extensions, state->cancelled, &matches, &subdirectories);
+    }
+
+    if (!matches.isEmpty()) {
+        QMutexLocker locker(&state->mutex);
+        state->found += matches;
+    }
+
+    if (!state->cancelled.loadRelaxed()) {
+        for (const QString &subdirectory : std::as_const(subdirectories)) {
+            state->pendingDirectories.ref();
+            state->pool->start([state, subdirectory]() {
+                scanDirectory(state, subdirectory);
+            });
+        }
+    }
+
+    // Children were counted before this directory is released, so zero
+    // means the whole tree has been listed.
+    if (!state->pendingDirectories.deref()) {
+        QMutexLocker locker(&state->mutex);
+        state->done = true;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef DIRECTORYSCANNER_H
+#define DIRECTORYSCANNER_H
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+
+// Walks a directory tree on a thread pool shared by all scanners, one task
+// per directory, so sibling subtrees are listed in parallel and a slow share
+// does not hold up the rest. Entries are classified from the directory
+// listing itself (readdir's d_type on POSIX) and only lstat()ed when the file
+// system does not report a type. Matches are delivered in batches on the scanner's
+// thread while the walk continues.
+class DirectoryScanner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DirectoryScanner(QObject *parent = nullptr);
+    // Cancels the walk without waiting: a worker still listing a directory,
+    // say on a hung share, finishes on its own.
+    ~DirectoryScanner() override;
+
+    // Finds files below root whose names match nameFilters ("*.ext"
+    // patterns, compared case-insensitively). Hidden entries and symlinked
+    // directories are skipped. A scan already running is cancelled first.
+    void start(const QString &root, const QStringList &nameFilters);
+    void cancel();
+    bool isRunning() const;
+
+signals:
+    void filesFound(const QStringList &filePaths);
+    // Emitted once per start(), after the last filesFound().
+    void finished(bool cancelled);
+
+private:
+    struct ScanState;
+
+    void deliverFound();
+    static void scanDirectory(const QSharedPointer<ScanState> &state, const QString &path);
+
+    QTimer m_deliveryTimer;
+    QSharedPointer<ScanState> m_state;
+};
+
+#endif // DIRECTORYSCANNER_H
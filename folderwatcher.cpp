@@ -0,0 +1,282 @@
+#include "folderwatcher.h"
+
+#include "imageloader.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QQueue>
+#include <QtConcurrent>
+
+namespace {
+// Quiet period before dirty directories are listed. A hot folder file is
+// reported after two listings, so it shows up within roughly twice this.
+constexpr int kDebounceMsecs = 200;
+}
+
+FolderWatcher::FolderWatcher(QObject *parent)
+    : QObject(parent)
+{
+    m_debounce.setSingleShot(true);
+    m_debounce.setInterval(kDebounceMsecs);
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, &FolderWatcher::handleDirectoryChanged);
+    connect(&m_debounce, &QTimer::timeout, this, &FolderWatcher::rescanDirtyDirectories);
+}
+
+void FolderWatcher::watchTree(const QString &root, TreeKind kind)
+{
+    const QString path = QDir::cleanPath(QFileInfo(root).absoluteFilePath());
+    if (root.isEmpty() || m_directories.contains(path)) {
+        return;
+    }
+
+    const quint64 generation = m_generation;
+    const QStringList filters = nameFilters(kind);
+    QtConcurrent::run([path, filters]() {
+        return scanTree(path, filters);
+    }).then(this, [this, generation, kind](const QVector<DirectoryScan> &scans) {
+        if (generation == m_generation) {
+            addScannedTree(scans, kind, true);
+        }
+    });
+}
+
+void FolderWatcher::unwatchAll()
+{
+    ++m_generation;
+    m_debounce.stop();
+    m_dirty.clear();
+    const QStringList directories = m_watcher.directories();
+    if (!directories.isEmpty()) {
+        m_watcher.removePaths(directories);
+    }
+    m_directories.clear();
+}
+
+void FolderWatcher::handleDirectoryChanged(const QString &path)
+{
+    if (!m_directories.contains(path)) {
+        return;
+    }
+    m_dirty.insert(path);
+    m_debounce.start();
+}
+
+void FolderWatcher::rescanDirtyDirectories()
+{
+    // One listing pass at a time; whatever turns dirty meanwhile is picked
+    // up when it finishes.
+    if (m_scanRunning || m_dirty.isEmpty()) {
+        return;
+    }
+
+    QVector<QPair<QString, QStringList>> work;
+    work.reserve(m_dirty.size());
+    for (const QString &path : std::as_const(m_dirty)) {
+        const auto it = m_directories.constFind(path);
+        if (it != m_directories.cend()) {
+            work.append(qMakePair(path, nameFilters(it->kind)));
+        }
+    }
+    m_dirty.clear();
+    m_scanRunning = true;
+
+    const quint64 generation = m_generation;
+    QtConcurrent::run([work]() {
+        QVector<DirectoryScan> scans;
+        scans.reserve(work.size());
+        for (const auto &entry : work) {
+            scans.append(scanDirectory(entry.first, entry.second));
+        }
+        return scans;
+    }).then(this, [this, generation](const QVector<DirectoryScan> &scans) {
+        m_scanRunning = false;
+        if (generation == m_generation) {
+            applyRescan(scans);
+        }
+        if (!m_dirty.isEmpty()) {
+            m_debounce.start();
+        }
+    });
+}
+
+void FolderWatcher::addScannedTree(const QVector<DirectoryScan> &scans, TreeKind kind, bool baseline)
+{
+    QStringList paths;
+    for (const DirectoryScan &scan : scans) {
+        if (!scan.exists || m_directories.contains(scan.path)) {
+            continue;
+        }
+
+        WatchedDirectory directory;
+        directory.kind = kind;
+        if (baseline || kind == TreeKind::Originals) {
+            directory.files = scan.files;
+        } else {
+            // A directory created inside a hot folder: everything in it is new.
+            directory.arriving = scan.files;
+            if (!scan.files.isEmpty()) {
+                m_dirty.insert(scan.path);
+            }
+        }
+        m_directories.insert(scan.path, directory);
+        paths.append(scan.path);
+    }
+
+    if (!paths.isEmpty()) {
+        const QStringList failed = m_watcher.addPaths(paths);
+        if (!failed.isEmpty()) {
+            qWarning() << "Cannot watch" << failed.size() << "directories, e.g." << failed.first();
+        }
+    }
+    if (!m_dirty.isEmpty()) {
+        m_debounce.start();
+    }
+}
+
+void FolderWatcher::applyRescan(const QVector<DirectoryScan> &scans)
+{
+    QStringList modified;
+    QStringList removed;
+    QStringList arrived;
+    QVector<QPair<QString, TreeKind>> newDirectories;
+
+    for (const DirectoryScan &scan : scans) {
+        const auto it = m_directories.find(scan.path);
+        if (it == m_directories.end()) {
+            continue;
+        }
+        const TreeKind kind = it->kind;
+
+        if (!scan.exists) {
+            // The directory went away with everything below it.
+            const QString prefix = scan.path + QLatin1Char('/');
+            for (auto entry = m_directories.begin(); entry != m_directories.end();) {
+                if (entry.key() == scan.path || entry.key().startsWith(prefix)) {
+                    if (kind == TreeKind::Originals) {
+                        removed += entry->files.keys();
+                    }
+                    m_watcher.removePath(entry.key());
+                    m_dirty.remove(entry.key());
+                    entry = m_directories.erase(entry);
+                } else {
+                    ++entry;
+                }
+            }
+            continue;
+        }
+
+        WatchedDirectory &directory = it.value();
+        if (kind == TreeKind::Originals) {
+            for (auto file = directory.files.cbegin(); file != directory.files.cend(); ++file) {
+                const auto current = scan.files.constFind(file.key());
+                if (current == scan.files.cend()) {
+                    removed.append(file.key());
+                } else if (current.value() != file.value()) {
+                    modified.append(file.key());
+                }
+            }
+            // Files added here were put there by the library itself.
+            directory.files = scan.files;
+        } else {
+            Listing known;
+            Listing arriving;
+            for (auto file = scan.files.cbegin(); file != scan.files.cend(); ++file) {
+                if (directory.files.contains(file.key())) {
+                    known.insert(file.key(), file.value());
+                    continue;
+                }
+                const auto previous = directory.arriving.constFind(file.key());
+                if (previous != directory.arriving.cend() && previous.value() == file.value()) {
+                    arrived.append(file.key());
+                    known.insert(file.key(), file.value());
+                } else {
+                    arriving.insert(file.key(), file.value());
+                }
+            }
+            directory.files = known;
+            directory.arriving = arriving;
+            // Still being written: look again without waiting for an event.
+            if (!arriving.isEmpty()) {
+                m_dirty.insert(scan.path);
+            }
+        }
+
+        for (const QString &subdirectory : scan.subdirectories) {
+            if (!m_directories.contains(subdirectory)) {
+                newDirectories.append(qMakePair(subdirectory, kind));
+            }
+        }
+    }
+
+    for (const auto &entry : std::as_const(newDirectories)) {
+        const QString path = entry.first;
+        const TreeKind kind = entry.second;
+        const QStringList filters = nameFilters(kind);
+        const quint64 generation = m_generation;
+        QtConcurrent::run([path, filters]() {
+            return scanTree(path, filters);
+        }).then(this, [this, generation, kind](const QVector<DirectoryScan> &scans) {
+            if (generation == m_generation) {
+                addScannedTree(scans, kind, false);
+            }
+        });
+    }
+
+    if (!modified.isEmpty()) {
+        emit originalsModified(modified);
+    }
+    if (!removed.isEmpty()) {
+        emit originalsRemoved(removed);
+    }
+    if (!arrived.isEmpty()) {
+        emit hotFolderFilesArrived(arrived);
+    }
+}
+
+QStringList FolderWatcher::nameFilters(TreeKind kind)
+{
+    // Every original is of interest; hot folders only offer what can be
+    // imported.
+    return kind == TreeKind::HotFolder ? ImageLoader::supportedNameFilters() : QStringList();
+}
+
+FolderWatcher::DirectoryScan FolderWatcher::scanDirectory(const QString &path, const QStringList &nameFilters)
+{
+    DirectoryScan scan;
+    scan.path = path;
+
+    const QDir dir(path);
+    if (!dir.exists()) {
+        return scan;
+    }
+    scan.exists = true;
+
+    const QFileInfoList files = dir.entryInfoList(nameFilters, QDir::Files);
+    scan.files.reserve(files.size());
+    for (const QFileInfo &info : files) {
+        scan.files.insert(info.absoluteFilePath(), FileStamp{info.size(), info.lastModified().toMSecsSinceEpoch()});
+    }
+
+    const QFileInfoList directories = dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+    for (const QFileInfo &info : directories) {
+        scan.subdirectories.append(info.absoluteFilePath());
+    }
+    return scan;
+}
+
+QVector<FolderWatcher::DirectoryScan> FolderWatcher::scanTree(const QString &root, const QStringList &nameFilters)
+{
+    QVector<DirectoryScan> scans;
+    QQueue<QString> pending;
+    pending.enqueue(root);
+    while (!pending.isEmpty()) {
+        DirectoryScan scan = scanDirectory(pending.dequeue(), nameFilters);
+        for (const QString &subdirectory : std::as_const(scan.subdirectories)) {
+            pending.enqueue(subdirectory);
+        }
+        scans.append(std::move(scan));
+    }
+    return scans;
+}
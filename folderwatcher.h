@@ -0,0 +1,100 @@
+#ifndef FOLDERWATCHER_H
+#define FOLDERWATCHER_H
+
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+
+// Watches directory trees for files that appear, change or disappear outside
+// the application. Notifications come from QFileSystemWatcher (inotify on
+// Linux) and only mark a directory dirty; dirty directories are re-listed on
+// a worker thread once events have been quiet for a moment, and the listing
+// is compared by size and modification time against the previous one.
+//
+// Two kinds of tree are watched. In the library's originals tree, changed
+// and removed files are reported. In hot folders, files that arrive are
+// reported once their size and time have stopped changing between two
+// listings, so a copy still in progress is not picked up half written.
+// Files already present when a tree starts being watched are its baseline
+// and are never reported.
+//
+// Only directories are watched, so a change shows up only when it touches
+// the directory entry. Saves that write a new file and rename it over the
+// old one are reported as modified; a file rewritten in place is not, since
+// inotify's IN_MODIFY and IN_CLOSE_WRITE are not reported for directories.
+// Watching every original would exhaust the inotify watch limit on large
+// libraries, so in-place edits of originals go undetected.
+class FolderWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    enum class TreeKind {
+        Originals,
+        HotFolder
+    };
+
+    struct FileStamp
+    {
+        qint64 size = -1;
+        qint64 modifiedMsecs = 0;
+
+        bool operator==(const FileStamp &other) const
+        {
+            return size == other.size && modifiedMsecs == other.modifiedMsecs;
+        }
+        bool operator!=(const FileStamp &other) const { return !(*this == other); }
+    };
+    using Listing = QHash<QString, FileStamp>; // by absolute file path
+
+    explicit FolderWatcher(QObject *parent = nullptr);
+
+    // Starts watching root and every directory below it. The baseline
+    // listing is taken on a worker thread.
+    void watchTree(const QString &root, TreeKind kind);
+    void unwatchAll();
+
+signals:
+    void originalsModified(const QStringList &filePaths);
+    void originalsRemoved(const QStringList &filePaths);
+    void hotFolderFilesArrived(const QStringList &filePaths);
+
+private:
+    struct WatchedDirectory
+    {
+        TreeKind kind = TreeKind::Originals;
+        Listing files;
+        Listing arriving; // hot folder files seen once, waiting to settle
+    };
+
+    struct DirectoryScan
+    {
+        QString path;
+        bool exists = false;
+        Listing files;
+        QStringList subdirectories;
+    };
+
+    void handleDirectoryChanged(const QString &path);
+    void rescanDirtyDirectories();
+    void addScannedTree(const QVector<DirectoryScan> &scans, TreeKind kind, bool baseline);
+    void applyRescan(const QVector<DirectoryScan> &scans);
+
+    static QStringList nameFilters(TreeKind kind);
+    static DirectoryScan scanDirectory(const QString &path, const QStringList &nameFilters);
+    static QVector<DirectoryScan> scanTree(const QString &root, const QStringList &nameFilters);
+
+    QFileSystemWatcher m_watcher;
+    QTimer m_debounce;
+    QHash<QString, WatchedDirectory> m_directories;
+    QSet<QString> m_dirty;
+    bool m_scanRunning = false;
+    // Bumped by unwatchAll() so listings still in flight are dropped.
+    quint64 m_generation = 0;
+};
+
+#endif // FOLDERWATCHER_H
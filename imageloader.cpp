@@ -1,5 +1,6 @@
 #include "imageloader.h"
 
+#include <QBuffer>
 #include <QCache>
 #include <QColor>
 #include <QDir>
@@ -211,15 +212,8 @@ bool isRawFile(const QString &filePath) {
     return rawFileExtensions().contains(QFileInfo(filePath).suffix().toLower());
 }
 
-QByteArray loadEmbeddedRawPreview(const QString &filePath, QString *errorMessage) {
-    const QString key = normalizedPathKey(filePath);
-    if (!key.isEmpty()) {
-        QMutexLocker locker(&cacheMutex());
-        if (QByteArray *cached = embeddedPreviewCache().object(key)) {
-            return *cached;
-        }
-    }
-
+// Reads the embedded preview straight from the file, bypassing the cache.
+static QByteArray readEmbeddedRawPreview(const QString &filePath, QString *errorMessage) {
     if (!isRawFile(filePath)) {
         if (errorMessage) *errorMessage = QStringLiteral("File is not a RAW file.");
         return {};
@@ -247,6 +241,19 @@ QByteArray loadEmbeddedRawPreview(const QString &filePath, QString *errorMessage
     rawProcessor.recycle();
     if (result.isEmpty() && errorMessage && errorMessage->isEmpty())
         *errorMessage = QStringLiteral("Embedded preview extraction returned empty data.");
+    return result;
+}
+
+QByteArray loadEmbeddedRawPreview(const QString &filePath, QString *errorMessage) {
+    const QString key = normalizedPathKey(filePath);
+    if (!key.isEmpty()) {
+        QMutexLocker locker(&cacheMutex());
+        if (QByteArray *cached = embeddedPreviewCache().object(key)) {
+            return *cached;
+        }
+    }
+
+    const QByteArray result = readEmbeddedRawPreview(filePath, errorMessage);
     if (!key.isEmpty() && !result.isEmpty()) {
         QMutexLocker locker(&cacheMutex());
         embeddedPreviewCache().insert(key, new QByteArray(result), dataCostKb(result));
@@ -254,6 +261,48 @@ QByteArray loadEmbeddedRawPreview(const QString &filePath, QString *errorMessage
     return result;
 }
 
+QImage loadThumbnail(const QString &filePath, const QSize &boundingSize, QString *errorMessage)
+{
+    QByteArray embedded;
+    QBuffer buffer;
+    QImageReader reader;
+    if (isRawFile(filePath)) {
+        embedded = readEmbeddedRawPreview(filePath, errorMessage);
+        if (embedded.isEmpty()) {
+            return {};
+        }
+        buffer.setData(embedded);
+        buffer.open(QIODevice::ReadOnly);
+        reader.setDevice(&buffer);
+    } else {
+        reader.setFileName(filePath);
+    }
+    reader.setAutoTransform(true);
+
+    // Let the decoder downscale (JPEG decodes at 1/2, 1/4 or 1/8 directly)
+    // instead of materialising the full image first. The bounding box is
+    // applied before the orientation transform, so use its larger side.
+    const QSize sourceSize = reader.size();
+    if (sourceSize.isValid() && boundingSize.isValid()) {
+        const int side = qMax(boundingSize.width(), boundingSize.height());
+        const QSize box(side, side);
+        if (sourceSize.width() > side || sourceSize.height() > side) {
+            reader.setScaledSize(sourceSize.scaled(box, Qt::KeepAspectRatio));
+        }
+    }
+
+    QImage image = reader.read();
+    if (image.isNull()) {
+        if (errorMessage) *errorMessage = reader.errorString();
+        return {};
+    }
+    if (boundingSize.isValid()
+        && (image.width() > boundingSize.width() || image.height() > boundingSize.height())) {
+        image = image.scaled(boundingSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    return image;
+}
+
 static QImage loadEmbeddedRawPreviewImage(const QString &filePath, QString *errorMessage) {
     QString previewError;
     QByteArray data = loadEmbeddedRawPreview(filePath, &previewError);
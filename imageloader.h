@@ -3,6 +3,7 @@
 
 #include <QImage>
 #include <QSet>
+#include <QSize>
 #include <QString>
 #include <QStringList>
 
@@ -16,6 +17,10 @@ bool isRawFile(const QString &filePath);
 QImage loadRawImage(const QString &filePath, QString *errorMessage = nullptr);
 QImage loadImageWithRawSupport(const QString &filePath, QString *errorMessage = nullptr);
 QByteArray loadEmbeddedRawPreview(const QString &filePath, QString *errorMessage = nullptr);
+// Small preview that fits boundingSize, for browsing files not yet in the
+// library. Decodes at reduced size (the embedded preview for RAW files) and
+// leaves the image caches untouched.
+QImage loadThumbnail(const QString &filePath, const QSize &boundingSize, QString *errorMessage = nullptr);
 bool extractMetadata(const QString &filePath, DevelopMetadata *metadata, QString *errorMessage = nullptr);
 
 void preloadAsync(const QStringList &filePaths);
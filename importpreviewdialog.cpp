@@ -6,27 +6,206 @@
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QFileInfo>
-#include <QDir>
-#include <QMessageBox>
-#include <QApplication>
+#include <QFutureWatcher>
 #include <QPainter>
 #include <QScrollBar>
-#include <QFrame>
 #include <QResizeEvent>
+#include <QThread>
 #include <QtConcurrent>
 
 namespace {
 constexpr int kThumbnailSize = 120;
 constexpr int kThumbnailSpacing = 8;
-constexpr int kMinThumbnailColumns = 5;
+constexpr int kThumbnailCacheBudgetKb = 32 * 1024; // ~32 MB, a few hundred cells
+}
+
+ImportPreviewGrid::ImportPreviewGrid(QWidget *parent)
+    : QAbstractScrollArea(parent)
+    , m_thumbnails(kThumbnailCacheBudgetKb)
+{
+    setFrameShape(QFrame::NoFrame);
+    setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    viewport()->setBackgroundRole(QPalette::Dark);
+    viewport()->setAutoFillBackground(true);
+
+    // Decoding is mostly I/O and JPEG work; a few threads keep the visible
+    // cells filling without starving the rest of the application.
+    m_loadPool.setMaxThreadCount(qBound(2, QThread::idealThreadCount() / 2, 4));
+}
+
+ImportPreviewGrid::~ImportPreviewGrid()
+{
+    m_loadQueue.clear();
+    m_loadPool.waitForDone();
+}
+
+void ImportPreviewGrid::appendFiles(const QStringList &filePaths)
+{
+    m_filePaths += filePaths;
+    m_fileNames.reserve(m_filePaths.size());
+    for (const QString &path : filePaths) {
+        m_fileNames.append(QFileInfo(path).fileName());
+    }
+    updateLayoutMetrics();
+    viewport()->update();
+}
+
+int ImportPreviewGrid::fileCount() const
+{
+    return m_filePaths.size();
+}
+
+void ImportPreviewGrid::resizeEvent(QResizeEvent *event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    updateLayoutMetrics();
+}
+
+void ImportPreviewGrid::updateLayoutMetrics()
+{
+    const int viewportWidth = viewport()->width();
+    const int viewportHeight = viewport()->height();
+    const int cellStride = kThumbnailSize + kThumbnailSpacing;
+
+    m_columns = qMax(1, (viewportWidth - kThumbnailSpacing) / cellStride);
+    const int usedWidth = m_columns * cellStride - kThumbnailSpacing;
+    m_horizontalOffset = qMax(kThumbnailSpacing, (viewportWidth - usedWidth) / 2);
+
+    const int rows = (m_filePaths.size() + m_columns - 1) / m_columns;
+    const int contentHeight = rows * cellStride + kThumbnailSpacing;
+    verticalScrollBar()->setRange(0, qMax(0, contentHeight - viewportHeight));
+    verticalScrollBar()->setPageStep(viewportHeight);
+    verticalScrollBar()->setSingleStep(cellStride);
+}
+
+QRect ImportPreviewGrid::cellRect(int index) const
+{
+    const int cellStride = kThumbnailSize + kThumbnailSpacing;
+    const int row = index / m_columns;
+    const int column = index % m_columns;
+    return QRect(m_horizontalOffset + column * cellStride,
+                 kThumbnailSpacing + row * cellStride - verticalScrollBar()->value(),
+                 kThumbnailSize,
+                 kThumbnailSize);
+}
+
+void ImportPreviewGrid::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+
+    if (m_filePaths.isEmpty()) {
+        return;
+    }
+
+    QPainter painter(viewport());
+    painter.setRenderHint(QPainter::Antialiasing, true);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, true);
+
+    const int cellStride = kThumbnailSize + kThumbnailSpacing;
+    const int yOffset = verticalScrollBar()->value();
+    const int viewportHeight = viewport()->height();
+    const int firstRow = qMax(0, (yOffset - kThumbnailSpacing) / cellStride);
+    const int lastRow = (yOffset + viewportHeight) / cellStride;
+    const int firstIndex = firstRow * m_columns;
+    const int lastIndex = qMin(m_filePaths.size() - 1, (lastRow + 1) * m_columns - 1);
+
+    QFont nameFont = painter.font();
+    nameFont.setPointSize(7);
+
+    for (int index = firstIndex; index <= lastIndex; ++index) {
+        const QRect rect = cellRect(index);
+        const bool failed = m_failed.contains(index);
+
+        painter.setPen(failed ? QColor(0xcc, 0x00, 0x00) : QColor(0x3a, 0x3a, 0x3a));
+        painter.setBrush(QColor(0x2a, 0x2a, 0x2a));
+        painter.drawRoundedRect(QRectF(rect).adjusted(0.5, 0.5, -0.5, -0.5), 6, 6);
+
+        if (const QPixmap *thumbnail = m_thumbnails.object(index)) {
+            const QSize scaledSize = thumbnail->size().scaled(kThumbnailSize - 16, kThumbnailSize - 32, Qt::KeepAspectRatio);
+            const QRect targetRect(rect.x() + (kThumbnailSize - scaledSize.width()) / 2,
+                                   rect.y() + (kThumbnailSize - scaledSize.height() - 18) / 2,
+                                   scaledSize.width(),
+                                   scaledSize.height());
+            painter.drawPixmap(targetRect, *thumbnail);
+        } else if (failed) {
+            painter.setPen(QColor(0xcc, 0x00, 0x00));
+            painter.drawText(rect, Qt::AlignCenter, tr("Failed"));
+        } else {
+            painter.setPen(palette().color(QPalette::Mid));
+            painter.drawText(rect, Qt::AlignCenter, tr("Loading..."));
+        }
+
+        painter.setPen(Qt::white);
+        painter.setFont(nameFont);
+        const QRect textRect(rect.x() + 4, rect.bottom() - 16, kThumbnailSize - 8, 12);
+        const QString elidedText = painter.fontMetrics().elidedText(m_fileNames.at(index), Qt::ElideMiddle, textRect.width());
+        painter.drawText(textRect, Qt::AlignCenter | Qt::TextSingleLine, elidedText);
+        painter.setFont(font());
+    }
+
+    // What is on screen first, then one screen further down so scrolling
+    // at reading pace finds the next rows ready.
+    const int visibleCount = lastIndex - firstIndex + 1;
+    requestThumbnails(firstIndex, qMin(m_filePaths.size() - 1, lastIndex + visibleCount));
+}
+
+void ImportPreviewGrid::requestThumbnails(int firstIndex, int lastIndex)
+{
+    // Anything queued for cells no longer in view is simply forgotten.
+    m_loadQueue.clear();
+    for (int index = firstIndex; index <= lastIndex; ++index) {
+        if (!m_thumbnails.contains(index) && !m_failed.contains(index) && !m_loadsInFlight.contains(index)) {
+            m_loadQueue.append(index);
+        }
+    }
+    startQueuedLoads();
+}
+
+void ImportPreviewGrid::startQueuedLoads()
+{
+    // Only as many loads as the pool has threads are handed over, so the
+    // pool's own queue never holds work for cells that scrolled away.
+    while (!m_loadQueue.isEmpty() && m_loadsInFlight.size() < m_loadPool.maxThreadCount()) {
+        const int index = m_loadQueue.takeFirst();
+        m_loadsInFlight.insert(index);
+
+        auto *watcher = new QFutureWatcher<QImage>(this);
+        connect(watcher, &QFutureWatcher<QImage>::finished, this, [this, index, watcher]() {
+            finishLoad(index, watcher->result());
+            watcher->deleteLater();
+        });
+
+        const QString filePath = m_filePaths.at(index);
+        watcher->setFuture(QtConcurrent::run(&m_loadPool, [filePath]() {
+            return ImageLoader::loadThumbnail(filePath, QSize(kThumbnailSize, kThumbnailSize));
+        }));
+    }
+}
+
+void ImportPreviewGrid::finishLoad(int index, const QImage &image)
+{
+    m_loadsInFlight.remove(index);
+    if (image.isNull()) {
+        m_failed.insert(index);
+    } else {
+        const int costKb = qMax<qint64>(1, image.sizeInBytes() / 1024);
+        m_thumbnails.insert(index, new QPixmap(QPixmap::fromImage(image)), costKb);
+    }
+    viewport()->update(cellRect(index));
+    startQueuedLoads();
 }
 
 ImportPreviewDialog::ImportPreviewDialog(const QStringList &filePaths, QWidget *parent)
+    : ImportPreviewDialog(parent)
+{
+    appendFiles(filePaths);
+    setScanFinished();
+}
+
+ImportPreviewDialog::ImportPreviewDialog(QWidget *parent)
     : QDialog(parent)
-    , m_filePaths(filePaths)
+    , m_scanning(true)
 {
-    setWindowTitle(tr("Import Preview - %1 files").arg(filePaths.size()));
-    
     // Make dialog fill most of the parent window
     if (parent) {
         QSize parentSize = parent->size();
@@ -38,28 +217,8 @@ ImportPreviewDialog::ImportPreviewDialog(const QStringList &filePaths, QWidget *
         resize(1000, 700);
     }
 
-    m_previewItems.reserve(filePaths.size());
-    for (const QString &path : filePaths) {
-        PreviewItem item;
-        item.filePath = path;
-        item.fileName = QFileInfo(path).fileName();
-        m_previewItems.append(item);
-    }
-
     setupUI();
-    loadThumbnails();
-}
-
-ImportPreviewDialog::~ImportPreviewDialog()
-{
-    for (QFutureWatcher<QPixmap> *watcher : m_thumbnailWatchers) {
-        if (watcher) {
-            watcher->cancel();
-            watcher->waitForFinished();
-            watcher->deleteLater();
-        }
-    }
-    m_thumbnailWatchers.clear();
+    updateFileCount();
 }
 
 QStringList ImportPreviewDialog::selectedFiles() const
@@ -73,47 +232,14 @@ void ImportPreviewDialog::setupUI()
     mainLayout->setContentsMargins(8, 8, 8, 8);
     mainLayout->setSpacing(6);
 
-    QLabel *infoLabel = new QLabel(tr("%1 files").arg(m_filePaths.size()), this);
-    QFont font = infoLabel->font();
+    m_infoLabel = new QLabel(this);
+    QFont font = m_infoLabel->font();
     font.setPointSize(font.pointSize() - 1);
-    infoLabel->setFont(font);
-    mainLayout->addWidget(infoLabel);
-
-    m_scrollArea = new QScrollArea(this);
-    m_scrollArea->setWidgetResizable(true);
-    m_scrollArea->setBackgroundRole(QPalette::Dark);
-    m_scrollArea->setFrameShape(QFrame::NoFrame);
-
-    m_contentWidget = new QWidget();
-    m_gridLayout = new QGridLayout(m_contentWidget);
-    m_gridLayout->setSpacing(kThumbnailSpacing);
-    m_gridLayout->setContentsMargins(kThumbnailSpacing, kThumbnailSpacing, kThumbnailSpacing, kThumbnailSpacing);
-
-    recalculateColumns();
-
-    m_thumbnailLabels.reserve(m_previewItems.size());
-    for (int i = 0; i < m_previewItems.size(); ++i) {
-        QLabel *label = new QLabel(m_contentWidget);
-        label->setFixedSize(kThumbnailSize, kThumbnailSize);
-        label->setAlignment(Qt::AlignCenter);
-        label->setStyleSheet(QStringLiteral(
-            "QLabel {"
-            "  background-color: #2a2a2a;"
-            "  border: 1px solid #3a3a3a;"
-            "  border-radius: 6px;"
-            "}"
-        ));
-        label->setText(tr("Loading..."));
-
-        const int row = i / m_currentColumns;
-        const int col = i % m_currentColumns;
-        m_gridLayout->addWidget(label, row, col);
-        m_thumbnailLabels.append(label);
-    }
+    m_infoLabel->setFont(font);
+    mainLayout->addWidget(m_infoLabel);
 
-    m_contentWidget->setLayout(m_gridLayout);
-    m_scrollArea->setWidget(m_contentWidget);
-    mainLayout->addWidget(m_scrollArea, 1); // Give scroll area stretch factor
+    m_grid = new ImportPreviewGrid(this);
+    mainLayout->addWidget(m_grid, 1); // Give the grid stretch factor
 
     QHBoxLayout *buttonLayout = new QHBoxLayout();
     buttonLayout->setContentsMargins(0, 4, 0, 0);
@@ -125,139 +251,45 @@ void ImportPreviewDialog::setupUI()
     connect(cancelButton, &QPushButton::clicked, this, &ImportPreviewDialog::onCancelClicked);
     buttonLayout->addWidget(cancelButton);
 
-    QPushButton *importButton = new QPushButton(tr("Import %1").arg(m_filePaths.size()), this);
-    importButton->setMinimumWidth(100);
-    importButton->setDefault(true);
-    connect(importButton, &QPushButton::clicked, this, &ImportPreviewDialog::onImportClicked);
-    buttonLayout->addWidget(importButton);
+    m_importButton = new QPushButton(this);
+    m_importButton->setMinimumWidth(100);
+    m_importButton->setDefault(true);
+    connect(m_importButton, &QPushButton::clicked, this, &ImportPreviewDialog::onImportClicked);
+    buttonLayout->addWidget(m_importButton);
 
     mainLayout->addLayout(buttonLayout);
 }
 
-void ImportPreviewDialog::loadThumbnails()
-{
-    for (int i = 0; i < m_previewItems.size(); ++i) {
-        PreviewItem &item = m_previewItems[i];
-        if (item.thumbnailLoaded || item.thumbnailFailed) {
-            continue;
-        }
-
-        auto *watcher = new QFutureWatcher<QPixmap>(this);
-        m_thumbnailWatchers.append(watcher);
-
-        const QString filePath = item.filePath;
-        const int index = i;
-
-        connect(watcher, &QFutureWatcher<QPixmap>::finished, this, [this, index, watcher]() {
-            if (!watcher->isCanceled()) {
-                const QPixmap pixmap = watcher->result();
-                onThumbnailLoaded(index);
-                updateThumbnail(index, pixmap);
-            }
-            watcher->deleteLater();
-            m_thumbnailWatchers.removeOne(watcher);
-        });
-
-        QFuture<QPixmap> future = QtConcurrent::run([this, filePath]() -> QPixmap {
-            return loadThumbnailForFile(filePath);
-        });
-
-        watcher->setFuture(future);
-    }
-}
-
-QPixmap ImportPreviewDialog::loadThumbnailForFile(const QString &filePath)
+void ImportPreviewDialog::appendFiles(const QStringList &filePaths)
 {
-    QPixmap result;
-
-    // Try to load embedded preview for RAW files first
-    if (ImageLoader::isRawFile(filePath)) {
-        QString errorMessage;
-        QByteArray embeddedPreview = ImageLoader::loadEmbeddedRawPreview(filePath, &errorMessage);
-        if (!embeddedPreview.isEmpty()) {
-            QImage image;
-            if (image.loadFromData(embeddedPreview, "JPEG")) {
-                result = QPixmap::fromImage(image);
-            }
-        }
-    }
-
-    // If no embedded preview or not a RAW file, try loading the image directly
-    if (result.isNull()) {
-        QString errorMessage;
-        QImage image = ImageLoader::loadImageWithRawSupport(filePath, &errorMessage);
-        if (!image.isNull()) {
-            result = QPixmap::fromImage(image);
-        }
-    }
-
-    // Scale to thumbnail size if we have an image
-    if (!result.isNull()) {
-        result = result.scaled(kThumbnailSize, kThumbnailSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    if (filePaths.isEmpty()) {
+        return;
     }
 
-    return result;
+    m_filePaths += filePaths;
+    m_grid->appendFiles(filePaths);
+    updateFileCount();
 }
 
-void ImportPreviewDialog::onThumbnailLoaded(int index)
+void ImportPreviewDialog::setScanFinished()
 {
-    if (index < 0 || index >= m_previewItems.size()) {
-        return;
-    }
-
-    PreviewItem &item = m_previewItems[index];
-    item.thumbnailLoaded = true;
+    m_scanning = false;
+    updateFileCount();
 }
 
-void ImportPreviewDialog::updateThumbnail(int index, const QPixmap &pixmap)
+void ImportPreviewDialog::updateFileCount()
 {
-    if (index < 0 || index >= m_thumbnailLabels.size()) {
-        return;
-    }
-
-    PreviewItem &item = m_previewItems[index];
-    item.thumbnail = pixmap;
-    item.thumbnailLoaded = true;
-
-    QLabel *label = m_thumbnailLabels[index];
-    if (!pixmap.isNull()) {
-        // Create a pixmap with border and filename
-        QPixmap displayPixmap(kThumbnailSize, kThumbnailSize);
-        displayPixmap.fill(QColor(42, 42, 42));
-
-        QPainter painter(&displayPixmap);
-        painter.setRenderHint(QPainter::Antialiasing, true);
-
-        // Draw thumbnail centered
-        QSize scaledSize = pixmap.size().scaled(kThumbnailSize - 16, kThumbnailSize - 32, Qt::KeepAspectRatio);
-        QRect targetRect((kThumbnailSize - scaledSize.width()) / 2,
-                         (kThumbnailSize - scaledSize.height() - 18) / 2,
-                         scaledSize.width(),
-                         scaledSize.height());
-        painter.drawPixmap(targetRect, pixmap);
-
-        // Draw filename at bottom
-        painter.setPen(Qt::white);
-        QFont font = painter.font();
-        font.setPointSize(7);
-        painter.setFont(font);
-        QRect textRect(4, kThumbnailSize - 16, kThumbnailSize - 8, 12);
-        QString elidedText = painter.fontMetrics().elidedText(item.fileName, Qt::ElideMiddle, textRect.width());
-        painter.drawText(textRect, Qt::AlignCenter | Qt::TextSingleLine, elidedText);
-
-        label->setPixmap(displayPixmap);
+    const int count = m_filePaths.size();
+    setWindowTitle(tr("Import Preview - %1 files").arg(count));
+    if (m_scanning) {
+        m_infoLabel->setText(tr("Scanning... %1 files found so far").arg(count));
+    } else if (count == 0) {
+        m_infoLabel->setText(tr("No supported photo files were found in the selected folder."));
     } else {
-        item.thumbnailFailed = true;
-        label->setText(tr("Failed"));
-        label->setStyleSheet(QStringLiteral(
-            "QLabel {"
-            "  background-color: #2a2a2a;"
-            "  border: 1px solid #cc0000;"
-            "  border-radius: 6px;"
-            "  color: #cc0000;"
-            "}"
-        ));
+        m_infoLabel->setText(tr("%1 files").arg(count));
     }
+    m_importButton->setText(tr("Import %1").arg(count));
+    m_importButton->setEnabled(count > 0);
 }
 
 void ImportPreviewDialog::onImportClicked()
@@ -270,38 +302,3 @@ void ImportPreviewDialog::onCancelClicked()
 {
     reject();
 }
-
-void ImportPreviewDialog::recalculateColumns()
-{
-    if (!m_scrollArea || !m_gridLayout) {
-        m_currentColumns = kMinThumbnailColumns;
-        return;
-    }
-    
-    QVBoxLayout *layout = qobject_cast<QVBoxLayout*>(this->layout());
-    int margins = layout ? (layout->contentsMargins().left() + layout->contentsMargins().right()) : 16;
-    int availableWidth = width() - margins - 2 * kThumbnailSpacing - m_scrollArea->verticalScrollBar()->sizeHint().width();
-    m_currentColumns = qMax(kMinThumbnailColumns, availableWidth / (kThumbnailSize + kThumbnailSpacing));
-}
-
-void ImportPreviewDialog::resizeEvent(QResizeEvent *event)
-{
-    QDialog::resizeEvent(event);
-    
-    if (m_gridLayout && m_thumbnailLabels.size() > 0) {
-        int oldColumns = m_currentColumns;
-        recalculateColumns();
-        
-        if (oldColumns != m_currentColumns) {
-            // Reorganize grid layout
-            for (int i = 0; i < m_thumbnailLabels.size(); ++i) {
-                QLabel *label = m_thumbnailLabels[i];
-                m_gridLayout->removeWidget(label);
-                const int row = i / m_currentColumns;
-                const int col = i % m_currentColumns;
-                m_gridLayout->addWidget(label, row, col);
-            }
-        }
-    }
-}
-
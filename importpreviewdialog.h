@@ -1,22 +1,54 @@
 #ifndef IMPORTPREVIEWDIALOG_H
 #define IMPORTPREVIEWDIALOG_H
 
+#include <QAbstractScrollArea>
+#include <QCache>
 #include <QDialog>
-#include <QStringList>
-#include <QVector>
-#include <QFutureWatcher>
-#include <QGridLayout>
-#include <QScrollArea>
 #include <QLabel>
 #include <QPixmap>
+#include <QPushButton>
+#include <QSet>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
 
-struct PreviewItem
+// Grid of thumbnails for files that are about to be imported. Only the cells
+// on screen are painted, and only their thumbnails are loaded: requests go
+// through a small queue that is rebuilt from the visible range on every
+// paint, so cells scrolled past before their turn are never decoded. Decoded
+// thumbnails are kept in a bounded cache of their own.
+class ImportPreviewGrid : public QAbstractScrollArea
 {
-    QString filePath;
-    QString fileName;
-    QPixmap thumbnail;
-    bool thumbnailLoaded = false;
-    bool thumbnailFailed = false;
+    Q_OBJECT
+public:
+    explicit ImportPreviewGrid(QWidget *parent = nullptr);
+    // Drops queued loads and waits for the ones already running.
+    ~ImportPreviewGrid() override;
+
+    void appendFiles(const QStringList &filePaths);
+    int fileCount() const;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+
+private:
+    void updateLayoutMetrics();
+    void requestThumbnails(int firstIndex, int lastIndex);
+    void startQueuedLoads();
+    void finishLoad(int index, const QImage &image);
+    QRect cellRect(int index) const;
+
+    QStringList m_filePaths;
+    QStringList m_fileNames;
+    int m_columns = 1;
+    int m_horizontalOffset = 0;
+
+    QThreadPool m_loadPool;
+    QVector<int> m_loadQueue;  // visible cells still to load, in paint order
+    QSet<int> m_loadsInFlight; // never more than the pool's thread count
+    QCache<int, QPixmap> m_thumbnails;
+    QSet<int> m_failed;
 };
 
 class ImportPreviewDialog : public QDialog
@@ -25,35 +57,30 @@ class ImportPreviewDialog : public QDialog
 
 public:
     explicit ImportPreviewDialog(const QStringList &filePaths, QWidget *parent = nullptr);
-    ~ImportPreviewDialog() override;
+    // Opens empty while a scan is still looking for files; feed it with
+    // appendFiles() and call setScanFinished() when the scan ends.
+    explicit ImportPreviewDialog(QWidget *parent = nullptr);
 
     QStringList selectedFiles() const;
 
+public slots:
+    void appendFiles(const QStringList &filePaths);
+    void setScanFinished();
+
 private slots:
-    void onThumbnailLoaded(int index);
     void onImportClicked();
     void onCancelClicked();
 
 private:
     void setupUI();
-    void loadThumbnails();
-    void recalculateColumns();
-    QPixmap loadThumbnailForFile(const QString &filePath);
-    void updateThumbnail(int index, const QPixmap &pixmap);
-    
-protected:
-    void resizeEvent(QResizeEvent *event) override;
+    void updateFileCount();
 
     QStringList m_filePaths;
-    QVector<PreviewItem> m_previewItems;
-    QScrollArea *m_scrollArea = nullptr;
-    QWidget *m_contentWidget = nullptr;
-    QGridLayout *m_gridLayout = nullptr;
-    QVector<QLabel*> m_thumbnailLabels;
-    QVector<QFutureWatcher<QPixmap>*> m_thumbnailWatchers;
+    bool m_scanning = false;
+    QLabel *m_infoLabel = nullptr;
+    QPushButton *m_importButton = nullptr;
+    ImportPreviewGrid *m_grid = nullptr;
     QStringList m_selectedFiles;
-    int m_currentColumns = 5; // kMinThumbnailColumns
 };
 
 #endif // IMPORTPREVIEWDIALOG_H
-
@@ -1,11 +1,16 @@
 #include "libraryfilterpane.h"
 
+#include "assetmarks.h"
+
 #include <QFontMetrics>
 #include <QHBoxLayout>
 #include <QVBoxLayout>
 #include <QLabel>
+#include <QLocale>
+#include <QMenu>
 #include <QRegularExpression>
 #include <QSet>
+#include <QSignalBlocker>
 #include <qabstractitemview.h>
 
 LibraryFilterPane::LibraryFilterPane(QWidget *parent)
@@ -20,6 +25,58 @@ void LibraryFilterPane::setupUI()
     mainLayout->setContentsMargins(8, 8, 8, 8);
     mainLayout->setSpacing(8);
 
+    // Smart collections
+    m_collectionCombo = new QComboBox(this);
+    m_collectionCombo->setSizeAdjustPolicy(QComboBox::AdjustToContents);
+    m_collectionCombo->addItem(tr("All Photos"), qint64(-1));
+    m_collectionCombo->setToolTip(tr("Show the photos of a smart collection"));
+    connect(m_collectionCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &LibraryFilterPane::onCollectionChanged);
+    mainLayout->addWidget(m_collectionCombo);
+
+    m_saveCollectionButton = new QToolButton(this);
+    m_saveCollectionButton->setText(tr("Save..."));
+    m_saveCollectionButton->setToolTip(tr("Save the current filters as a smart collection"));
+    connect(m_saveCollectionButton, &QToolButton::clicked, this, [this]() {
+        emit saveCollectionRequested(m_currentOptions);
+    });
+    mainLayout->addWidget(m_saveCollectionButton);
+
+    m_removeCollectionButton = new QToolButton(this);
+    m_removeCollectionButton->setText(tr("Delete"));
+    m_removeCollectionButton->setToolTip(tr("Delete the selected smart collection"));
+    m_removeCollectionButton->setEnabled(false);
+    connect(m_removeCollectionButton, &QToolButton::clicked, this, [this]() {
+        if (m_currentOptions.collectionId >= 0) {
+            emit removeCollectionRequested(m_currentOptions.collectionId);
+        }
+    });
+    mainLayout->addWidget(m_removeCollectionButton);
+
+    mainLayout->addSpacing(16);
+
+    // Text search
+    m_searchEdit = new QLineEdit(this);
+    m_searchEdit->setPlaceholderText(tr("Search"));
+    m_searchEdit->setToolTip(tr("Find photos by file name, camera, lens or tag; every word must match the start of a word"));
+    m_searchEdit->setClearButtonEnabled(true);
+    m_searchEdit->setMinimumWidth(160);
+    m_searchTimer.setSingleShot(true);
+    m_searchTimer.setInterval(150);
+    connect(m_searchEdit, &QLineEdit::textChanged, &m_searchTimer, qOverload<>(&QTimer::start));
+    connect(&m_searchTimer, &QTimer::timeout, this, &LibraryFilterPane::onSearchTextChanged);
+    mainLayout->addWidget(m_searchEdit);
+
+    // Shown while a similarity filter is active; clicking it lifts it.
+    m_similarButton = new QToolButton(this);
+    m_similarButton->setToolTip(tr("Showing photos that look alike; click to show all"));
+    m_similarButton->setVisible(false);
+    connect(m_similarButton, &QToolButton::clicked, this, [this]() {
+        setSimilarTo(-1);
+    });
+    mainLayout->addWidget(m_similarButton);
+
+    mainLayout->addSpacing(16);
+
     // Sort order
     auto *sortLabel = new QLabel(tr("Sort:"), this);
     mainLayout->addWidget(sortLabel);
@@ -77,16 +134,98 @@ void LibraryFilterPane::setupUI()
 
     mainLayout->addSpacing(16);
 
+    // Lens
+    auto *lensLabel = new QLabel(tr("Lens:"), this);
+    mainLayout->addWidget(lensLabel);
+
+    m_lensCombo = new QComboBox(this);
+    m_lensCombo->setMinimumWidth(150);
+    m_lensCombo->setSizeAdjustPolicy(QComboBox::AdjustToContents);
+    m_lensCombo->addItem(tr("All"), QString());
+    connect(m_lensCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &LibraryFilterPane::onLensChanged);
+    mainLayout->addWidget(m_lensCombo);
+
+    mainLayout->addSpacing(16);
+
     // Tags
     auto *tagLabel = new QLabel(tr("Tags:"), this);
     mainLayout->addWidget(tagLabel);
 
     m_tagFilterEdit = new QLineEdit(this);
     m_tagFilterEdit->setPlaceholderText(tr("Comma-separated tags"));
-    m_tagFilterEdit->setToolTip(tr("Enter tags separated by commas"));
+    m_tagFilterEdit->setToolTip(tr("Enter tags separated by commas; prefix a tag with - to exclude it"));
     connect(m_tagFilterEdit, &QLineEdit::textChanged, this, &LibraryFilterPane::onTagFilterChanged);
     mainLayout->addWidget(m_tagFilterEdit);
 
+    m_tagMenuButton = new QToolButton(this);
+    m_tagMenuButton->setText(tr("Tags"));
+    m_tagMenuButton->setToolTip(tr("Add a tag to the filter"));
+    m_tagMenuButton->setPopupMode(QToolButton::InstantPopup);
+    m_tagMenuButton->setMenu(new QMenu(m_tagMenuButton));
+    m_tagMenuButton->setEnabled(false);
+    mainLayout->addWidget(m_tagMenuButton);
+
+    m_tagMatchCombo = new QComboBox(this);
+    m_tagMatchCombo->addItem(tr("Any"), FilterOptions::MatchAnyTag);
+    m_tagMatchCombo->addItem(tr("All"), FilterOptions::MatchAllTags);
+    m_tagMatchCombo->setToolTip(tr("Show assets with any or all of the listed tags"));
+    connect(m_tagMatchCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &LibraryFilterPane::onTagMatchChanged);
+    mainLayout->addWidget(m_tagMatchCombo);
+
+    mainLayout->addSpacing(16);
+
+    // Ratings, flags and colour labels
+    m_ratingCombo = new QComboBox(this);
+    m_ratingCombo->addItem(tr("Any Rating"), 0);
+    for (int stars = 1; stars <= AssetMarks::kMaxRating; ++stars) {
+        m_ratingCombo->addItem(tr("%n+ Star(s)", nullptr, stars), stars);
+    }
+    connect(m_ratingCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &LibraryFilterPane::onMarkFilterChanged);
+    mainLayout->addWidget(m_ratingCombo);
+
+    m_flagCombo = new QComboBox(this);
+    m_flagCombo->addItem(tr("Any Flag"), FilterOptions::AnyFlag);
+    m_flagCombo->addItem(tr("Picked"), FilterOptions::PickedOnly);
+    m_flagCombo->addItem(tr("Unflagged"), FilterOptions::UnflaggedOnly);
+    m_flagCombo->addItem(tr("Rejected"), FilterOptions::RejectedOnly);
+    m_flagCombo->addItem(tr("Hide Rejected"), FilterOptions::HideRejected);
+    connect(m_flagCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &LibraryFilterPane::onMarkFilterChanged);
+    mainLayout->addWidget(m_flagCombo);
+
+    m_labelButton = new QToolButton(this);
+    m_labelButton->setText(tr("Labels"));
+    m_labelButton->setToolTip(tr("Show only photos with the checked colour labels"));
+    m_labelButton->setPopupMode(QToolButton::InstantPopup);
+    auto *labelMenu = new QMenu(m_labelButton);
+    const QStringList labelNames = {tr("No Label"), tr("Red"), tr("Yellow"), tr("Green"), tr("Blue"), tr("Purple")};
+    for (int label = 0; label < AssetMarks::kLabelCount; ++label) {
+        QAction *action = labelMenu->addAction(labelNames.at(label));
+        action->setCheckable(true);
+        action->setData(label);
+        connect(action, &QAction::toggled, this, &LibraryFilterPane::onMarkFilterChanged);
+    }
+    m_labelButton->setMenu(labelMenu);
+    mainLayout->addWidget(m_labelButton);
+
+    mainLayout->addSpacing(16);
+
+    // Burst stacking
+    m_stackBurstsCheck = new QCheckBox(tr("Stack bursts"), this);
+    m_stackBurstsCheck->setToolTip(tr("Show frames from one camera taken in quick succession as a single photo"));
+    connect(m_stackBurstsCheck, &QCheckBox::toggled, this, &LibraryFilterPane::onBurstStackingChanged);
+    mainLayout->addWidget(m_stackBurstsCheck);
+
+    m_burstGapSpin = new QDoubleSpinBox(this);
+    m_burstGapSpin->setRange(0.1, 60.0);
+    m_burstGapSpin->setDecimals(1);
+    m_burstGapSpin->setSingleStep(0.5);
+    m_burstGapSpin->setSuffix(tr(" s"));
+    m_burstGapSpin->setValue(m_currentOptions.burstGapMsecs / 1000.0);
+    m_burstGapSpin->setToolTip(tr("Longest pause between two frames of the same burst"));
+    m_burstGapSpin->setEnabled(false);
+    connect(m_burstGapSpin, QOverload<double>::of(&QDoubleSpinBox::valueChanged), this, &LibraryFilterPane::onBurstStackingChanged);
+    mainLayout->addWidget(m_burstGapSpin);
+
     mainLayout->addSpacing(16);
 
     // Clear button
@@ -102,47 +241,184 @@ FilterOptions LibraryFilterPane::currentFilterOptions() const
     return m_currentOptions;
 }
 
-void LibraryFilterPane::setAvailableCameraMakes(const QStringList &makes)
+void LibraryFilterPane::setFacets(const FacetCounts &facets)
 {
-    if (!m_cameraMakeCombo) {
+    populateFacetCombo(m_cameraMakeCombo, facets.cameras);
+    populateFacetCombo(m_lensCombo, facets.lenses);
+    updateIsoToolTips(facets.isoValues);
+
+    if (m_tagMenuButton) {
+        QMenu *menu = m_tagMenuButton->menu();
+        menu->clear();
+        for (const FacetValue &tag : facets.tags) {
+            const QString tagName = tag.value;
+            QAction *action = menu->addAction(QStringLiteral("%1 (%2)").arg(tagName, QLocale().toString(tag.count)));
+            connect(action, &QAction::triggered, this, [this, tagName]() {
+                insertTag(tagName);
+            });
+        }
+        m_tagMenuButton->setEnabled(!facets.tags.isEmpty());
+    }
+}
+
+void LibraryFilterPane::setSimilarTo(qint64 assetId, const QString &label)
+{
+    if (m_similarButton) {
+        m_similarButton->setText(tr("Similar to %1").arg(label));
+        m_similarButton->setVisible(assetId >= 0);
+    }
+    if (assetId == m_currentOptions.similarToAssetId) {
         return;
     }
+    m_currentOptions.similarToAssetId = assetId;
+    emitFilterChanged();
+}
 
-    const QString current = m_cameraMakeCombo->currentData().toString();
-    m_cameraMakeCombo->clear();
-    m_cameraMakeCombo->addItem(tr("All"), QString());
+void LibraryFilterPane::setCollections(const QVector<SmartCollection> &collections)
+{
+    if (!m_collectionCombo) {
+        return;
+    }
+
+    {
+        const QSignalBlocker blocker(m_collectionCombo);
+        m_collectionCombo->clear();
+        m_collectionCombo->addItem(tr("All Photos"), qint64(-1));
+        m_markCollections.clear();
+        for (const SmartCollection &collection : collections) {
+            m_collectionCombo->addItem(collection.name, collection.id);
+            if (collection.rule.filtersOnMarks()) {
+                m_markCollections.insert(collection.id);
+            }
+        }
+        const int index = m_collectionCombo->findData(m_currentOptions.collectionId);
+        m_collectionCombo->setCurrentIndex(index >= 0 ? index : 0);
+    }
+
+    // The selected collection was deleted; show everything again.
+    if (m_collectionCombo->currentIndex() == 0 && m_currentOptions.collectionId >= 0) {
+        onCollectionChanged(0);
+    }
+}
+
+bool LibraryFilterPane::collectionFiltersOnMarks() const
+{
+    return m_markCollections.contains(m_currentOptions.collectionId);
+}
+
+void LibraryFilterPane::onCollectionChanged(int index)
+{
+    if (index < 0 || !m_collectionCombo) {
+        return;
+    }
+
+    const qint64 collectionId = m_collectionCombo->itemData(index).toLongLong();
+    m_removeCollectionButton->setEnabled(collectionId >= 0);
+    if (collectionId == m_currentOptions.collectionId) {
+        return;
+    }
+    m_currentOptions.collectionId = collectionId;
+    emitFilterChanged();
+}
+
+void LibraryFilterPane::populateFacetCombo(QComboBox *combo, const QVector<FacetValue> &values)
+{
+    if (!combo) {
+        return;
+    }
+
+    const QString current = combo->currentData().toString();
+    {
+        // Repopulating must not look like a user selection.
+        const QSignalBlocker blocker(combo);
+        combo->clear();
+        combo->addItem(tr("All"), QString());
+
+        // Find the maximum width needed for all items
+        int maxWidth = 150; // Minimum width
+        QFontMetrics fm(combo->font());
+
+        for (const FacetValue &value : values) {
+            const QString text = QStringLiteral("%1 (%2)").arg(value.value, QLocale().toString(value.count));
+            combo->addItem(text, value.value);
+            maxWidth = qMax(maxWidth, fm.horizontalAdvance(text));
+        }
+
+        // Set the view's minimum width to prevent text cutoff
+        if (combo->view()) {
+            combo->view()->setMinimumWidth(maxWidth + 50); // Add padding for scrollbar
+        }
+
+        // Set combo box width to accommodate content
+        combo->setMinimumWidth(qMin(maxWidth + 50, 400)); // Cap at 400px
 
-    // Find the maximum width needed for all items
-    int maxWidth = 150; // Minimum width
-    QFontMetrics fm(m_cameraMakeCombo->font());
-    
-    for (const QString &make : makes) {
-        m_cameraMakeCombo->addItem(make, make);
-        int textWidth = fm.horizontalAdvance(make);
-        if (textWidth > maxWidth) {
-            maxWidth = textWidth;
+        // Restore selection if still available
+        const int index = combo->findData(current);
+        combo->setCurrentIndex(index >= 0 ? index : 0);
+    }
+
+    // The selected value disappeared from the library; drop the filter.
+    if (!current.isEmpty() && combo->currentIndex() == 0) {
+        if (combo == m_cameraMakeCombo) {
+            m_currentOptions.cameraMake.clear();
+        } else if (combo == m_lensCombo) {
+            m_currentOptions.lens.clear();
         }
+        emitFilterChanged();
+    }
+}
+
+void LibraryFilterPane::updateIsoToolTips(const QVector<FacetValue> &isoValues)
+{
+    if (!m_isoMinCombo || !m_isoMaxCombo) {
+        return;
     }
-    
-    // Set the view's minimum width to prevent text cutoff
-    if (m_cameraMakeCombo->view()) {
-        m_cameraMakeCombo->view()->setMinimumWidth(maxWidth + 50); // Add padding for scrollbar
+
+    int total = 0;
+    for (const FacetValue &value : isoValues) {
+        total += value.count;
     }
-    
-    // Set combo box width to accommodate content
-    m_cameraMakeCombo->setMinimumWidth(qMin(maxWidth + 50, 400)); // Cap at 400px
 
-    // Restore selection if still available
-    int index = m_cameraMakeCombo->findData(current);
-    if (index >= 0) {
-        m_cameraMakeCombo->setCurrentIndex(index);
+    for (int i = 1; i < m_isoMinCombo->count(); ++i) {
+        const int stop = m_isoMinCombo->itemText(i).toInt();
+        int atOrBelow = 0;
+        int below = 0;
+        for (const FacetValue &value : isoValues) {
+            const int iso = value.value.toInt();
+            if (iso <= stop) {
+                atOrBelow += value.count;
+            }
+            if (iso < stop) {
+                below += value.count;
+            }
+        }
+        m_isoMinCombo->setItemData(i, tr("%n photo(s) at ISO %1 or above", nullptr, total - below).arg(stop), Qt::ToolTipRole);
+        m_isoMaxCombo->setItemData(i, tr("%n photo(s) at ISO %1 or below", nullptr, atOrBelow).arg(stop), Qt::ToolTipRole);
     }
 }
 
-void LibraryFilterPane::setAvailableTags(const QStringList &tags)
+void LibraryFilterPane::insertTag(const QString &tag)
 {
-    Q_UNUSED(tags);
-    // Could be used for autocomplete or tag selection widget in the future
+    if (!m_tagFilterEdit) {
+        return;
+    }
+
+    const QString text = m_tagFilterEdit->text().trimmed();
+    m_tagFilterEdit->setText(text.isEmpty() ? tag : QStringLiteral("%1, %2").arg(text, tag));
+}
+
+void LibraryFilterPane::onSearchTextChanged()
+{
+    if (!m_searchEdit) {
+        return;
+    }
+
+    const QString text = m_searchEdit->text().simplified();
+    if (text == m_currentOptions.searchText) {
+        return;
+    }
+    m_currentOptions.searchText = text;
+    emitFilterChanged();
 }
 
 void LibraryFilterPane::onSortOrderChanged(int index)
@@ -207,27 +483,96 @@ void LibraryFilterPane::onCameraMakeChanged(const QString &text)
     emitFilterChanged();
 }
 
+void LibraryFilterPane::onLensChanged(int index)
+{
+    if (index < 0 || !m_lensCombo) {
+        return;
+    }
+
+    m_currentOptions.lens = m_lensCombo->itemData(index).toString();
+    emitFilterChanged();
+}
+
 void LibraryFilterPane::onTagFilterChanged()
 {
     if (!m_tagFilterEdit) {
         return;
     }
 
+    m_currentOptions.tags.clear();
+    m_currentOptions.excludedTags.clear();
+
     const QString text = m_tagFilterEdit->text().trimmed();
-    if (text.isEmpty()) {
-        m_currentOptions.tags.clear();
-    } else {
-        // Split by comma and clean up
-        QStringList tags = text.split(QRegularExpression(QStringLiteral("[,;]")), Qt::SkipEmptyParts);
-        for (QString &tag : tags) {
-            tag = tag.trimmed();
+    if (!text.isEmpty()) {
+        // Split by comma and clean up; a leading '-' excludes the tag
+        const QStringList parts = text.split(QRegularExpression(QStringLiteral("[,;]")), Qt::SkipEmptyParts);
+        for (const QString &part : parts) {
+            QString tag = part.trimmed();
+            if (tag.startsWith(QLatin1Char('-'))) {
+                tag = tag.mid(1).trimmed();
+                if (!tag.isEmpty()) {
+                    m_currentOptions.excludedTags.append(tag);
+                }
+            } else if (!tag.isEmpty()) {
+                m_currentOptions.tags.append(tag);
+            }
         }
-        tags.removeAll(QString());
-        m_currentOptions.tags = tags;
     }
     emitFilterChanged();
 }
 
+void LibraryFilterPane::onTagMatchChanged(int index)
+{
+    if (index < 0 || !m_tagMatchCombo) {
+        return;
+    }
+
+    m_currentOptions.tagMatch = static_cast<FilterOptions::TagMatch>(m_tagMatchCombo->itemData(index).toInt());
+    if (!m_currentOptions.tags.isEmpty()) {
+        emitFilterChanged();
+    }
+}
+
+void LibraryFilterPane::onMarkFilterChanged()
+{
+    if (!m_ratingCombo || !m_flagCombo || !m_labelButton) {
+        return;
+    }
+
+    FilterOptions options = m_currentOptions;
+    options.minRating = m_ratingCombo->currentData().toInt();
+    options.flagFilter = static_cast<FilterOptions::FlagFilter>(m_flagCombo->currentData().toInt());
+    options.colorLabels = 0;
+    for (const QAction *action : m_labelButton->menu()->actions()) {
+        if (action->isChecked()) {
+            options.colorLabels |= quint8(1u << action->data().toInt());
+        }
+    }
+    if (options.minRating == m_currentOptions.minRating && options.flagFilter == m_currentOptions.flagFilter
+        && options.colorLabels == m_currentOptions.colorLabels) {
+        return;
+    }
+    m_currentOptions = options;
+    emitFilterChanged();
+}
+
+void LibraryFilterPane::onBurstStackingChanged()
+{
+    if (!m_stackBurstsCheck || !m_burstGapSpin) {
+        return;
+    }
+
+    const bool collapse = m_stackBurstsCheck->isChecked();
+    const int gapMsecs = qRound(m_burstGapSpin->value() * 1000.0);
+    m_burstGapSpin->setEnabled(collapse);
+    if (collapse == m_currentOptions.collapseBursts && gapMsecs == m_currentOptions.burstGapMsecs) {
+        return;
+    }
+    m_currentOptions.collapseBursts = collapse;
+    m_currentOptions.burstGapMsecs = gapMsecs;
+    emitFilterChanged();
+}
+
 void LibraryFilterPane::clearFilters()
 {
     onClearFilters();
@@ -235,6 +580,15 @@ void LibraryFilterPane::clearFilters()
 
 void LibraryFilterPane::onClearFilters()
 {
+    if (m_collectionCombo) {
+        const QSignalBlocker blocker(m_collectionCombo);
+        m_collectionCombo->setCurrentIndex(0); // All Photos
+        m_removeCollectionButton->setEnabled(false);
+    }
+    if (m_searchEdit) {
+        m_searchEdit->clear();
+        m_searchTimer.stop();
+    }
     if (m_sortCombo) {
         m_sortCombo->setCurrentIndex(0); // Date desc
     }
@@ -247,11 +601,37 @@ void LibraryFilterPane::onClearFilters()
     if (m_cameraMakeCombo) {
         m_cameraMakeCombo->setCurrentIndex(0); // All
     }
+    if (m_lensCombo) {
+        m_lensCombo->setCurrentIndex(0); // All
+    }
     if (m_tagFilterEdit) {
         m_tagFilterEdit->clear();
     }
+    if (m_tagMatchCombo) {
+        m_tagMatchCombo->setCurrentIndex(0); // Any
+    }
+    if (m_similarButton) {
+        m_similarButton->setVisible(false);
+    }
+    if (m_ratingCombo) {
+        m_ratingCombo->setCurrentIndex(0);
+    }
+    if (m_flagCombo) {
+        m_flagCombo->setCurrentIndex(0);
+    }
+    if (m_labelButton) {
+        for (QAction *action : m_labelButton->menu()->actions()) {
+            const QSignalBlocker blocker(action);
+            action->setChecked(false);
+        }
+    }
 
+    // Stacking is a way of viewing the result rather than a filter.
+    const bool collapseBursts = m_currentOptions.collapseBursts;
+    const int burstGapMsecs = m_currentOptions.burstGapMsecs;
     m_currentOptions = FilterOptions();
+    m_currentOptions.collapseBursts = collapseBursts;
+    m_currentOptions.burstGapMsecs = burstGapMsecs;
     emitFilterChanged();
 }
 
@@ -1,13 +1,19 @@
 #ifndef LIBRARYFILTERPANE_H
 #define LIBRARYFILTERPANE_H
 
+#include "librarymanager.h"
 #include "metadatacache.h"
 
 #include <QWidget>
+#include <QCheckBox>
 #include <QComboBox>
+#include <QDoubleSpinBox>
 #include <QSpinBox>
 #include <QLineEdit>
 #include <QPushButton>
+#include <QSet>
+#include <QTimer>
+#include <QToolButton>
 
 class LibraryFilterPane : public QWidget
 {
@@ -16,30 +22,66 @@ public:
     explicit LibraryFilterPane(QWidget *parent = nullptr);
 
     FilterOptions currentFilterOptions() const;
-    void setAvailableCameraMakes(const QStringList &makes);
-    void setAvailableTags(const QStringList &tags);
+    // Fills the option lists from the facet table, with asset counts.
+    void setFacets(const FacetCounts &facets);
     void clearFilters();
+    // Narrows the grid to photos that look like assetId; label names it in
+    // the pane. A negative id lifts the restriction.
+    void setSimilarTo(qint64 assetId, const QString &label = QString());
+    // Lists the library's smart collections; the selection is kept while
+    // the collection still exists.
+    void setCollections(const QVector<SmartCollection> &collections);
+    // True when the selected smart collection's rule culls on marks, so
+    // its members change with ratings, flags and labels.
+    bool collectionFiltersOnMarks() const;
 
 signals:
     void filterChanged(const FilterOptions &options);
+    // The user wants the current filters saved as a smart collection.
+    void saveCollectionRequested(const FilterOptions &rule);
+    void removeCollectionRequested(qint64 collectionId);
 
 private slots:
+    void onCollectionChanged(int index);
+    void onSearchTextChanged();
     void onSortOrderChanged(int index);
     void onIsoMinChanged(const QString &text);
     void onIsoMaxChanged(const QString &text);
     void onCameraMakeChanged(const QString &text);
+    void onLensChanged(int index);
     void onTagFilterChanged();
+    void onTagMatchChanged(int index);
+    void onBurstStackingChanged();
+    void onMarkFilterChanged();
     void onClearFilters();
 
 private:
     void setupUI();
     void emitFilterChanged();
+    void populateFacetCombo(QComboBox *combo, const QVector<FacetValue> &values);
+    void updateIsoToolTips(const QVector<FacetValue> &isoValues);
+    void insertTag(const QString &tag);
 
+    QComboBox *m_collectionCombo = nullptr;
+    QToolButton *m_saveCollectionButton = nullptr;
+    QToolButton *m_removeCollectionButton = nullptr;
+    QSet<qint64> m_markCollections; // ids whose rule filters on marks
+    QLineEdit *m_searchEdit = nullptr;
+    QTimer m_searchTimer; // coalesces keystrokes into one query
+    QToolButton *m_similarButton = nullptr;
     QComboBox *m_sortCombo = nullptr;
     QComboBox *m_isoMinCombo = nullptr;
     QComboBox *m_isoMaxCombo = nullptr;
     QComboBox *m_cameraMakeCombo = nullptr;
+    QComboBox *m_lensCombo = nullptr;
     QLineEdit *m_tagFilterEdit = nullptr;
+    QComboBox *m_tagMatchCombo = nullptr;
+    QToolButton *m_tagMenuButton = nullptr;
+    QComboBox *m_ratingCombo = nullptr;
+    QComboBox *m_flagCombo = nullptr;
+    QToolButton *m_labelButton = nullptr; // checkable menu of colour labels
+    QCheckBox *m_stackBurstsCheck = nullptr;
+    QDoubleSpinBox *m_burstGapSpin = nullptr; // seconds
     QPushButton *m_clearButton = nullptr;
 
     FilterOptions m_currentOptions;
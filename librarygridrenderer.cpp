@@ -0,0 +1,496 @@
+#include "librarygridrenderer.h"
+
+#include <QDebug>
+#include <QOpenGLContext>
+#include <QSurfaceFormat>
+
+#include <algorithm>
+#include <cstddef>
+
+namespace {
+constexpr int kThumbnailPageSize = 4096;
+constexpr int kTextPageSize = 2048;
+constexpr qint64 kThumbnailBudgetBytes = 128 * 1024 * 1024;
+constexpr qint64 kTextBudgetBytes = 32 * 1024 * 1024;
+constexpr int kSlotGranularity = 32;
+
+// Attribute 0 is the corner of the unit quad; 1-4 advance per instance.
+const char *kVertexShaderSource = R"(
+layout(location = 0) in vec2 corner;
+layout(location = 1) in vec4 rect;
+layout(location = 2) in vec4 texRect;
+layout(location = 3) in vec4 color;
+layout(location = 4) in vec3 shape;
+
+uniform vec2 viewportSize;
+
+out vec2 texCoord;
+out vec4 fillColor;
+out vec2 localPos;
+out vec2 halfSize;
+out vec3 shapeParams;
+
+void main()
+{
+    vec2 pos = rect.xy + corner * rect.zw;
+    texCoord = mix(texRect.xy, texRect.zw, corner);
+    fillColor = color;
+    halfSize = rect.zw * 0.5;
+    localPos = (corner - 0.5) * rect.zw;
+    shapeParams = shape;
+    gl_Position = vec4(pos.x / viewportSize.x * 2.0 - 1.0, 1.0 - pos.y / viewportSize.y * 2.0, 0.0, 1.0);
+}
+)";
+
+const char *kFragmentShaderSource = R"(
+in vec2 texCoord;
+in vec4 fillColor;
+in vec2 localPos;
+in vec2 halfSize;
+in vec3 shapeParams;
+
+uniform sampler2D atlas;
+
+out vec4 fragColor;
+
+float roundedBoxDistance(vec2 p, vec2 b, float r)
+{
+    vec2 q = abs(p) - b + r;
+    return length(max(q, 0.0)) + min(max(q.x, q.y), 0.0) - r;
+}
+
+void main()
+{
+    vec4 color = fillColor;
+    if (shapeParams.z > 0.5) {
+        color *= texture(atlas, texCoord);
+    }
+    float radius = min(shapeParams.x, min(halfSize.x, halfSize.y));
+    float d = roundedBoxDistance(localPos, halfSize, radius);
+    float coverage = clamp(0.5 - d, 0.0, 1.0);
+    if (shapeParams.y > 0.0) {
+        coverage *= clamp(0.5 + d + shapeParams.y, 0.0, 1.0);
+    }
+    fragColor = color * coverage;
+}
+)";
+
+void setPremultiplied(float *target, const QColor &color)
+{
+    const float alpha = float(color.alphaF());
+    target[0] = float(color.redF()) * alpha;
+    target[1] = float(color.greenF()) * alpha;
+    target[2] = float(color.blueF()) * alpha;
+    target[3] = alpha;
+}
+}
+
+LibraryGridRenderer::LibraryGridRenderer()
+{
+    m_atlases[ThumbnailAtlas].pageSize = kThumbnailPageSize;
+    m_atlases[ThumbnailAtlas].budgetBytes = kThumbnailBudgetBytes;
+    m_atlases[TextAtlas].pageSize = kTextPageSize;
+    m_atlases[TextAtlas].budgetBytes = kTextBudgetBytes;
+}
+
+bool LibraryGridRenderer::initialize()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!context) {
+        return false;
+    }
+
+    const QSurfaceFormat format = context->format();
+    const bool instancing = context->isOpenGLES() ? format.majorVersion() >= 3
+                                                   : format.version() >= qMakePair(3, 3);
+    if (!instancing) {
+        qWarning() << "LibraryGridRenderer: OpenGL" << format.majorVersion() << format.minorVersion()
+                   << "has no instancing; painting the grid with QPainter";
+        return false;
+    }
+    initializeOpenGLFunctions();
+
+    // mediump cannot address single texels across a kThumbnailPageSize page;
+    // every ES 3.0 fragment shader has highp, the fallback is for drivers
+    // that misreport it.
+    const QByteArray header = context->isOpenGLES()
+        ? QByteArrayLiteral("#version 300 es\n"
+                            "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+                            "precision highp float;\n"
+                            "#else\n"
+                            "precision mediump float;\n"
+                            "#endif\n")
+        : QByteArrayLiteral("#version 330 core\n");
+    const GLuint vertexShader = compileShader(GL_VERTEX_SHADER, header + kVertexShaderSource);
+    const GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, header + kFragmentShaderSource);
+    if (!vertexShader || !fragmentShader) {
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        return false;
+    }
+
+    m_program = glCreateProgram();
+    glAttachShader(m_program, vertexShader);
+    glAttachShader(m_program, fragmentShader);
+    glLinkProgram(m_program);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    GLint linkStatus = 0;
+    glGetProgramiv(m_program, GL_LINK_STATUS, &linkStatus);
+    if (!linkStatus) {
+        GLint logLength = 0;
+        glGetProgramiv(m_program, GL_INFO_LOG_LENGTH, &logLength);
+        QVector<char> log(qMax(1, logLength));
+        glGetProgramInfoLog(m_program, log.size(), nullptr, log.data());
+        qWarning() << "LibraryGridRenderer: Failed to link grid program:" << log.data();
+        glDeleteProgram(m_program);
+        m_program = 0;
+        return false;
+    }
+    m_viewportSizeLocation = glGetUniformLocation(m_program, "viewportSize");
+    m_atlasLocation = glGetUniformLocation(m_program, "atlas");
+
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    for (AtlasPages &atlas : m_atlases) {
+        atlas.pageSize = qMin(atlas.pageSize, int(maxTextureSize));
+    }
+
+    static const GLfloat corners[] = {0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f};
+    glGenVertexArrays(1, &m_vertexArray);
+    glBindVertexArray(m_vertexArray);
+    glGenBuffers(1, &m_quadBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_quadBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+    // The instance attributes are pointed at each run in endFrame().
+    glGenBuffers(1, &m_instanceBuffer);
+    for (GLuint location = 1; location <= 4; ++location) {
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return true;
+}
+
+void LibraryGridRenderer::release()
+{
+    if (!isInitialized()) {
+        return;
+    }
+
+    for (AtlasPages &atlas : m_atlases) {
+        resetAtlas(atlas);
+        atlas.slotSize = QSize();
+    }
+    glDeleteBuffers(1, &m_instanceBuffer);
+    glDeleteBuffers(1, &m_quadBuffer);
+    glDeleteVertexArrays(1, &m_vertexArray);
+    glDeleteProgram(m_program);
+    m_instanceBuffer = 0;
+    m_quadBuffer = 0;
+    m_vertexArray = 0;
+    m_program = 0;
+}
+
+void LibraryGridRenderer::reserveSlotSize(Atlas atlas, const QSize &size)
+{
+    AtlasPages &pages = m_atlases[atlas];
+    const auto roundUp = [&pages](int value) {
+        const int rounded = (qMax(1, value) + kSlotGranularity - 1) / kSlotGranularity * kSlotGranularity;
+        return qMin(rounded, pages.pageSize);
+    };
+    const QSize wanted(roundUp(size.width()), roundUp(size.height()));
+    const QSize &current = pages.slotSize;
+    const bool fits = current.width() >= wanted.width() && current.height() >= wanted.height();
+    const bool oversized = current.width() > 2 * wanted.width() || current.height() > 2 * wanted.height();
+    if (fits && !oversized) {
+        return;
+    }
+
+    resetAtlas(pages);
+    pages.slotSize = wanted;
+    pages.columns = pages.pageSize / wanted.width();
+    pages.rows = pages.pageSize / wanted.height();
+}
+
+bool LibraryGridRenderer::contains(Atlas atlas, const QString &key) const
+{
+    return m_atlases[atlas].lookup.contains(key);
+}
+
+bool LibraryGridRenderer::upload(Atlas atlas, const QString &key, const QImage &image)
+{
+    AtlasPages &pages = m_atlases[atlas];
+    if (!isInitialized() || pages.slotSize.isEmpty() || image.isNull()) {
+        return false;
+    }
+
+    int slot = pages.lookup.value(key, -1);
+    if (slot < 0) {
+        // A free slot, then a new page while the budget allows, then the
+        // slot drawn longest ago.
+        int oldest = -1;
+        for (int i = 0; i < pages.slots.size() && slot < 0; ++i) {
+            const Slot &candidate = pages.slots.at(i);
+            if (candidate.key.isEmpty()) {
+                slot = i;
+            } else if (candidate.lastFrame < m_frame
+                       && (oldest < 0 || candidate.lastFrame < pages.slots.at(oldest).lastFrame)) {
+                oldest = i;
+            }
+        }
+        if (slot < 0) {
+            const int firstNewSlot = pages.slots.size();
+            if (addPage(pages)) {
+                slot = firstNewSlot;
+            } else if (oldest >= 0) {
+                slot = oldest;
+            } else {
+                return false;
+            }
+        }
+    }
+
+    QImage source = image;
+    if (source.width() > pages.slotSize.width() || source.height() > pages.slotSize.height()) {
+        source = source.scaled(pages.slotSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    source = source.convertToFormat(QImage::Format_RGBA8888_Premultiplied);
+
+    const QRect target = slotRect(pages, slot);
+    glBindTexture(GL_TEXTURE_2D, pages.textures.at(slot / slotsPerPage(pages)));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, target.x(), target.y(), source.width(), source.height(),
+                    GL_RGBA, GL_UNSIGNED_BYTE, source.constBits());
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    Slot &entry = pages.slots[slot];
+    if (entry.key != key) {
+        pages.lookup.remove(entry.key);
+        pages.lookup.insert(key, slot);
+    }
+    entry.key = key;
+    entry.imageSize = source.size();
+    entry.lastFrame = m_frame;
+    return true;
+}
+
+void LibraryGridRenderer::remove(Atlas atlas, const QString &key)
+{
+    AtlasPages &pages = m_atlases[atlas];
+    const auto it = pages.lookup.find(key);
+    if (it == pages.lookup.end()) {
+        return;
+    }
+    pages.slots[it.value()] = Slot();
+    pages.lookup.erase(it);
+}
+
+QSize LibraryGridRenderer::imageSize(Atlas atlas, const QString &key) const
+{
+    const AtlasPages &pages = m_atlases[atlas];
+    const int slot = pages.lookup.value(key, -1);
+    return slot >= 0 ? pages.slots.at(slot).imageSize : QSize();
+}
+
+void LibraryGridRenderer::beginFrame(const QSize &viewportSize, qreal devicePixelRatio)
+{
+    ++m_frame;
+    m_devicePixelRatio = devicePixelRatio;
+    m_viewportSize = QSize(qRound(viewportSize.width() * devicePixelRatio),
+                           qRound(viewportSize.height() * devicePixelRatio));
+    for (QVector<LayerInstance> &layer : m_layers) {
+        layer.clear();
+    }
+}
+
+void LibraryGridRenderer::addRect(Layer layer, const QRectF &rect, const QColor &color, qreal radius, qreal borderWidth)
+{
+    const qreal scale = m_devicePixelRatio;
+    LayerInstance entry;
+    Instance &instance = entry.instance;
+    instance.rect[0] = float(rect.x() * scale);
+    instance.rect[1] = float(rect.y() * scale);
+    instance.rect[2] = float(rect.width() * scale);
+    instance.rect[3] = float(rect.height() * scale);
+    std::fill(std::begin(instance.texRect), std::end(instance.texRect), 0.0f);
+    setPremultiplied(instance.color, color);
+    instance.shape[0] = float(radius * scale);
+    instance.shape[1] = float(borderWidth * scale);
+    instance.shape[2] = 0.0f;
+    m_layers[layer].append(entry);
+}
+
+bool LibraryGridRenderer::addImage(Layer layer, Atlas atlas, const QString &key, const QRectF &rect)
+{
+    AtlasPages &pages = m_atlases[atlas];
+    const int slot = pages.lookup.value(key, -1);
+    if (slot < 0) {
+        return false;
+    }
+
+    Slot &entry = pages.slots[slot];
+    entry.lastFrame = m_frame;
+
+    // Half a texel in from the edges so filtering never reaches into a
+    // neighbouring slot.
+    const QRect texels = slotRect(pages, slot);
+    const float pageSize = float(pages.pageSize);
+    const qreal scale = m_devicePixelRatio;
+    LayerInstance layerEntry;
+    layerEntry.texture = pages.textures.at(slot / slotsPerPage(pages));
+    Instance &instance = layerEntry.instance;
+    instance.rect[0] = float(rect.x() * scale);
+    instance.rect[1] = float(rect.y() * scale);
+    instance.rect[2] = float(rect.width() * scale);
+    instance.rect[3] = float(rect.height() * scale);
+    instance.texRect[0] = (texels.x() + 0.5f) / pageSize;
+    instance.texRect[1] = (texels.y() + 0.5f) / pageSize;
+    instance.texRect[2] = (texels.x() + entry.imageSize.width() - 0.5f) / pageSize;
+    instance.texRect[3] = (texels.y() + entry.imageSize.height() - 0.5f) / pageSize;
+    setPremultiplied(instance.color, Qt::white);
+    instance.shape[0] = 0.0f;
+    instance.shape[1] = 0.0f;
+    instance.shape[2] = 1.0f;
+    m_layers[layer].append(layerEntry);
+    return true;
+}
+
+void LibraryGridRenderer::endFrame()
+{
+    if (!isInitialized()) {
+        return;
+    }
+
+    // Layers go into the buffer bottom to top, each grouped by texture, so
+    // a run of one texture is a single instanced draw.
+    struct Run
+    {
+        GLuint texture = 0;
+        int first = 0;
+        int count = 0;
+    };
+    QVector<Run> runs;
+    m_frameInstances.clear();
+    for (QVector<LayerInstance> &layer : m_layers) {
+        std::stable_sort(layer.begin(), layer.end(), [](const LayerInstance &a, const LayerInstance &b) {
+            return a.texture < b.texture;
+        });
+        for (const LayerInstance &entry : std::as_const(layer)) {
+            if (runs.isEmpty() || runs.constLast().texture != entry.texture) {
+                runs.append({entry.texture, int(m_frameInstances.size()), 0});
+            }
+            ++runs.last().count;
+            m_frameInstances.append(entry.instance);
+        }
+        layer.clear();
+    }
+    if (m_frameInstances.isEmpty()) {
+        return;
+    }
+
+    glViewport(0, 0, m_viewportSize.width(), m_viewportSize.height());
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram(m_program);
+    glUniform2f(m_viewportSizeLocation, float(m_viewportSize.width()), float(m_viewportSize.height()));
+    glUniform1i(m_atlasLocation, 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    glBindVertexArray(m_vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(m_frameInstances.size() * sizeof(Instance)),
+                 m_frameInstances.constData(), GL_STREAM_DRAW);
+    for (const Run &run : std::as_const(runs)) {
+        const quintptr base = quintptr(run.first) * sizeof(Instance);
+        const auto attribute = [this, base](GLuint location, GLint size, size_t offset) {
+            glVertexAttribPointer(location, size, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                                  reinterpret_cast<const void *>(base + offset));
+        };
+        attribute(1, 4, offsetof(Instance, rect));
+        attribute(2, 4, offsetof(Instance, texRect));
+        attribute(3, 4, offsetof(Instance, color));
+        attribute(4, 3, offsetof(Instance, shape));
+        glBindTexture(GL_TEXTURE_2D, run.texture);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, run.count);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glDisable(GL_BLEND);
+}
+
+bool LibraryGridRenderer::addPage(AtlasPages &atlas)
+{
+    const qint64 pageBytes = qint64(atlas.pageSize) * atlas.pageSize * 4;
+    if (!atlas.textures.isEmpty() && (atlas.textures.size() + 1) * pageBytes > atlas.budgetBytes) {
+        return false;
+    }
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, atlas.pageSize, atlas.pageSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    atlas.textures.append(texture);
+    atlas.slots.resize(atlas.slots.size() + slotsPerPage(atlas));
+    return true;
+}
+
+void LibraryGridRenderer::resetAtlas(AtlasPages &atlas)
+{
+    if (!atlas.textures.isEmpty()) {
+        glDeleteTextures(GLsizei(atlas.textures.size()), atlas.textures.constData());
+    }
+    atlas.textures.clear();
+    atlas.slots.clear();
+    atlas.lookup.clear();
+}
+
+int LibraryGridRenderer::slotsPerPage(const AtlasPages &atlas) const
+{
+    return atlas.columns * atlas.rows;
+}
+
+QRect LibraryGridRenderer::slotRect(const AtlasPages &atlas, int slot) const
+{
+    const int index = slot % slotsPerPage(atlas);
+    return QRect((index % atlas.columns) * atlas.slotSize.width(),
+                 (index / atlas.columns) * atlas.slotSize.height(),
+                 atlas.slotSize.width(),
+                 atlas.slotSize.height());
+}
+
+GLuint LibraryGridRenderer::compileShader(GLenum type, const QByteArray &source)
+{
+    const GLuint shader = glCreateShader(type);
+    const char *data = source.constData();
+    glShaderSource(shader, 1, &data, nullptr);
+    glCompileShader(shader);
+
+    GLint compileStatus = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
+    if (!compileStatus) {
+        GLint logLength = 0;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+        QVector<char> log(qMax(1, logLength));
+        glGetShaderInfoLog(shader, log.size(), nullptr, log.data());
+        qWarning() << "LibraryGridRenderer: Failed to compile grid shader:" << log.data();
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
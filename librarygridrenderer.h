@@ -0,0 +1,132 @@
+#ifndef LIBRARYGRIDRENDERER_H
+#define LIBRARYGRIDRENDERER_H
+
+#include <QColor>
+#include <QHash>
+#include <QImage>
+#include <QOpenGLExtraFunctions>
+#include <QRectF>
+#include <QSize>
+#include <QString>
+#include <QVector>
+
+#include <array>
+
+// OpenGL renderer behind LibraryGridView. Thumbnails and pre-rasterized
+// captions live in texture atlases, and every shape of a frame is an
+// instance of one unit quad: rounded rectangles and outlines are cut out by
+// a distance function in the fragment shader, images sample their atlas.
+// Instances are collected per layer and drawn with one instanced call per
+// layer and atlas page, so a frame costs about the same however many cells
+// are visible.
+//
+// Apart from contains(), remove() and imageSize(), every call expects the
+// widget's context to be current.
+class LibraryGridRenderer : protected QOpenGLExtraFunctions
+{
+public:
+    enum Atlas {
+        ThumbnailAtlas,
+        TextAtlas,
+        kAtlasCount
+    };
+
+    // Drawn bottom to top. Cells never overlap, so the order within a layer
+    // does not matter.
+    enum Layer {
+        BackgroundLayer,
+        ImageLayer,
+        ShadeLayer,
+        TextLayer,
+        OutlineLayer,
+        kLayerCount
+    };
+
+    LibraryGridRenderer();
+
+    // Needs OpenGL 3.3 or OpenGL ES 3.0 for instancing. On false the
+    // caller paints with QPainter instead.
+    bool initialize();
+    bool isInitialized() const { return m_program != 0; }
+    // Frees every GL object; must run before the context goes away.
+    void release();
+
+    // Largest image a slot of atlas holds, in device pixels. Slots are only
+    // rebuilt, emptying the atlas, when size outgrows them or they are more
+    // than twice as large as needed, so resizing the window does not
+    // re-upload every thumbnail.
+    void reserveSlotSize(Atlas atlas, const QSize &size);
+
+    bool contains(Atlas atlas, const QString &key) const;
+    // Copies image into a free or least recently drawn slot, scaled down if
+    // it is larger than the slot. False when every slot was drawn in the
+    // current frame and the atlas is at its memory budget.
+    bool upload(Atlas atlas, const QString &key, const QImage &image);
+    void remove(Atlas atlas, const QString &key);
+    // Size of an uploaded image in device pixels; empty for unknown keys.
+    QSize imageSize(Atlas atlas, const QString &key) const;
+
+    void beginFrame(const QSize &viewportSize, qreal devicePixelRatio);
+    // Shapes are given in logical pixels. radius rounds the corners; a
+    // borderWidth above zero draws only an outline of that width.
+    void addRect(Layer layer, const QRectF &rect, const QColor &color, qreal radius = 0, qreal borderWidth = 0);
+    // False when key has not been uploaded to atlas.
+    bool addImage(Layer layer, Atlas atlas, const QString &key, const QRectF &rect);
+    void endFrame();
+
+private:
+    struct Instance
+    {
+        float rect[4];    // x, y, width, height in device pixels
+        float texRect[4]; // u0, v0, u1, v1
+        float color[4];   // premultiplied
+        float shape[3];   // corner radius, border width, textured
+    };
+
+    struct Slot
+    {
+        QString key;
+        QSize imageSize;
+        quint64 lastFrame = 0;
+    };
+
+    struct AtlasPages
+    {
+        int pageSize = 0; // texels per side
+        qint64 budgetBytes = 0;
+        QSize slotSize;
+        int columns = 0;
+        int rows = 0;
+        QVector<GLuint> textures;
+        QVector<Slot> slots; // page * columns * rows + row * columns + column
+        QHash<QString, int> lookup;
+    };
+
+    struct LayerInstance
+    {
+        GLuint texture = 0; // 0 for untextured shapes
+        Instance instance;
+    };
+
+    bool addPage(AtlasPages &atlas);
+    void resetAtlas(AtlasPages &atlas);
+    int slotsPerPage(const AtlasPages &atlas) const;
+    QRect slotRect(const AtlasPages &atlas, int slot) const;
+    GLuint compileShader(GLenum type, const QByteArray &source);
+
+    GLuint m_program = 0;
+    GLuint m_vertexArray = 0;
+    GLuint m_quadBuffer = 0;
+    GLuint m_instanceBuffer = 0;
+    GLint m_viewportSizeLocation = -1;
+    GLint m_atlasLocation = -1;
+
+    std::array<AtlasPages, kAtlasCount> m_atlases;
+    std::array<QVector<LayerInstance>, kLayerCount> m_layers;
+    QVector<Instance> m_frameInstances;
+    QSize m_viewportSize; // device pixels
+    qreal m_devicePixelRatio = 1.0;
+    quint64 m_frame = 0;
+};
+
+#endif // LIBRARYGRIDRENDERER_H
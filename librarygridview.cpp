@@ -1,5 +1,8 @@
 #include "librarygridview.h"
 
+#include "assetmarks.h"
+#include "librarygridrenderer.h"
+
 #include <QCache>
 #include <QDir>
 #include <QFile>
@@ -7,11 +10,14 @@
 #include <QFuture>
 #include <QFutureWatcher>
 #include <QImageReader>
+#include <QLocale>
 #include <QMouseEvent>
 #include <QPainter>
 #include <QScrollBar>
 #include <QMutex>
 #include <QMutexLocker>
+#include <QOpenGLWidget>
+#include <QSurfaceFormat>
 #include <QtConcurrent>
 #include <QDragEnterEvent>
 #include <QDragMoveEvent>
@@ -20,11 +26,75 @@
 #include <QUrl>
 
 #include <algorithm>
+#include <cstdlib>
 
 namespace {
 constexpr int kInnerPadding = 8;
 constexpr int kPreviewCacheBudgetKb = 256 * 1024; // ~256 MB
-constexpr int kPrefetchRadius = 4;
+// Rows beyond the prefetch window, or beyond the viewport while flinging,
+// whose loads survive a scroll.
+constexpr int kLoadMarginRows = 2;
+// Scrolling faster than this many viewport heights per second is a fling.
+constexpr double kFlingScreensPerSecond = 3.0;
+// Scroll events further apart than this end a fling.
+constexpr int kScrollSettleMsecs = 120;
+constexpr int kMaxCachedPages = 24;
+// Items kept by asset id, including those on no loaded page, so assets that
+// move in a re-sort keep their pixmaps.
+constexpr int kMaxCachedItems = 2 * kMaxCachedPages * LibraryGridView::kPageSize;
+constexpr int kOverlayPadding = 6;
+// Composed cells of the QPainter path; a few screens at 2x.
+constexpr int kComposedCellBudgetKb = 96 * 1024;
+constexpr int kMaxUploadsPerFrame = 16;
+const QColor kSelectionColor(0, 122, 204);
+const QColor kPlaceholderColor(44, 44, 44);
+const QColor kFrameColor(30, 30, 30);
+
+QColor labelColor(AssetMarks::ColorLabel label)
+{
+    static const QColor colors[AssetMarks::kLabelCount] = {
+        QColor(), QColor(214, 69, 65), QColor(230, 196, 60), QColor(80, 170, 90),
+        QColor(66, 133, 214), QColor(150, 90, 190),
+    };
+    return colors[label];
+}
+
+// Photo number and marks on a dark pill.
+void drawCaption(QPainter &painter, const QRect &rect, const QString &text)
+{
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(QColor(0, 0, 0, 160));
+    painter.drawRoundedRect(rect, 6, 6);
+
+    painter.setPen(Qt::white);
+    painter.drawText(rect.adjusted(kOverlayPadding / 2, 0, -kOverlayPadding / 2, 0),
+                     Qt::AlignVCenter | Qt::AlignLeft,
+                     text);
+}
+
+void drawBadge(QPainter &painter, const QRect &rect, const QString &text)
+{
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(QColor(0, 0, 0, 160));
+    painter.drawRoundedRect(rect, rect.height() / 2, rect.height() / 2);
+    painter.setPen(Qt::white);
+    painter.drawText(rect, Qt::AlignCenter, text);
+}
+
+// A transparent image of size logical pixels, painted by paint for upload
+// to the grid renderer's text atlas.
+template <typename Paint>
+QImage rasterize(const QSize &size, qreal devicePixelRatio, const QFont &font, Paint paint)
+{
+    QImage image(size * devicePixelRatio, QImage::Format_ARGB32_Premultiplied);
+    image.setDevicePixelRatio(devicePixelRatio);
+    image.fill(Qt::transparent);
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing, true);
+    painter.setFont(font);
+    paint(painter, QRect(QPoint(0, 0), size));
+    return image;
+}
 
 QMutex &previewCacheMutex()
 {
@@ -65,7 +135,30 @@ QString cacheKeyForPath(const QString &path)
 
 LibraryGridView::LibraryGridView(QWidget *parent)
     : QAbstractScrollArea(parent)
+    , m_renderer(std::make_unique<LibraryGridRenderer>())
 {
+    // Cells are drawn through OpenGL when the context can instance quads;
+    // otherwise paintEvent() falls back to QPainter on the same viewport.
+    QSurfaceFormat format;
+    format.setVersion(3, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    format.setSamples(0);
+    m_glViewport = new QOpenGLWidget(this);
+    m_glViewport->setFormat(format);
+    setViewport(m_glViewport);
+    connect(m_glViewport, &QOpenGLWidget::aboutToBeDestroyed, this, &LibraryGridView::releaseRenderer);
+
+    m_composedCells.setMaxCost(kComposedCellBudgetKb);
+
+    m_scrollSettleTimer.setSingleShot(true);
+    m_scrollSettleTimer.setInterval(kScrollSettleMsecs);
+    connect(&m_scrollSettleTimer, &QTimer::timeout, this, [this]() {
+        // The scroll came to rest: load what is on screen now.
+        m_scrollVelocity = 0.0;
+        viewport()->update();
+    });
+    connect(verticalScrollBar(), &QScrollBar::valueChanged, this, &LibraryGridView::onScrollValueChanged);
+
     setMouseTracking(false);
     setFocusPolicy(Qt::StrongFocus);
     viewport()->setAutoFillBackground(false);
@@ -75,48 +168,136 @@ LibraryGridView::LibraryGridView(QWidget *parent)
 LibraryGridView::~LibraryGridView()
 {
     cancelPendingLoads();
+    releaseRenderer();
+    // The viewport outlives the renderer; its teardown must not call back.
+    disconnect(m_glViewport, nullptr, this, nullptr);
 }
 
-void LibraryGridView::setItems(const QVector<LibraryGridItem> &items)
+void LibraryGridView::setItemCount(int count)
 {
-    cancelPendingLoads();
-    m_items.clear();
-    m_indexLookup.clear();
-    m_selectedIndices.clear();
-    m_lastSelectedIndex = -1;
+    // A new result, often the same assets in another order or with a few
+    // added or removed. Item state is keyed by asset id, so pixmaps, loads
+    // in flight and the selection carry over; only the placement of ids on
+    // pages is refreshed. Old pages stay on screen until their
+    // replacements arrive.
+    m_itemCount = qMax(0, count);
+    m_requestedPages.clear();
+    m_stalePages.clear();
+    const QList<int> pages = m_pages.keys();
+    for (int page : pages) {
+        if (page * kPageSize >= m_itemCount) {
+            dropPage(page);
+        } else {
+            m_stalePages.insert(page);
+        }
+    }
 
-    m_items.reserve(items.size());
-    for (int i = 0; i < items.size(); ++i) {
-        Item item;
-        item.assetId = items.at(i).assetId;
-        item.photoNumber = items.at(i).photoNumber;
-        item.fileName = items.at(i).fileName;
-        item.previewPath = items.at(i).previewPath;
-        item.originalPath = items.at(i).originalPath;
-        m_items.append(item);
-        m_indexLookup.insert(item.assetId, i);
+    // Selected ids are reported again once they show up in the new result;
+    // pending ranges referred to the old positions. A complement applies to
+    // whatever the new result holds.
+    m_unconfirmedSelection.clear();
+    if (!m_selection.isInverted()) {
+        m_unconfirmedSelection = m_selection;
     }
+    m_unresolvedSelectionPages.clear();
+    m_selectionRangeStart = -1;
+    m_selectionRangeEnd = -1;
 
     updateLayoutMetrics();
     viewport()->update();
-    const int preloadCount = qMin(m_items.size(), 12);
-    for (int i = 0; i < preloadCount; ++i) {
-        ensurePixmapLoaded(i);
-    }
     emitSelectionChanged();
 }
 
+int LibraryGridView::itemCount() const
+{
+    return m_itemCount;
+}
+
+void LibraryGridView::setItemsAt(int offset, const QVector<LibraryGridItem> &items)
+{
+    if (offset < 0 || offset % kPageSize != 0 || offset >= m_itemCount) {
+        return;
+    }
+
+    const int page = offset / kPageSize;
+    m_requestedPages.remove(page);
+    m_stalePages.remove(page);
+    dropPage(page);
+    const bool resolveRange = m_unresolvedSelectionPages.remove(page);
+
+    // Reconcile against the items already known by id: an asset that moved
+    // keeps its pixmap, and only a changed preview path invalidates it.
+    QVector<qint64> pageIds;
+    pageIds.reserve(items.size());
+    bool selectionChanged = false;
+    for (int i = 0; i < items.size() && offset + i < m_itemCount; ++i) {
+        const LibraryGridItem &incoming = items.at(i);
+        Item &item = m_items[incoming.assetId];
+        if (item.assetId >= 0 && item.previewPath != incoming.previewPath) {
+            cancelPendingLoad(incoming.assetId);
+            item.pixmap = QPixmap();
+            item.pixmapLoaded = false;
+        }
+        if (item.assetId < 0 || item.previewPath != incoming.previewPath || item.photoNumber != incoming.photoNumber
+            || item.fileName != incoming.fileName || item.stackSize != incoming.stackSize || item.marks != incoming.marks) {
+            ++item.revision;
+        }
+        item.assetId = incoming.assetId;
+        item.photoNumber = incoming.photoNumber;
+        item.fileName = incoming.fileName;
+        item.previewPath = incoming.previewPath;
+        item.originalPath = incoming.originalPath;
+        item.stackSize = incoming.stackSize;
+        item.marks = incoming.marks;
+        pageIds.append(item.assetId);
+
+        const int index = offset + i;
+        m_indexLookup.insert(item.assetId, index);
+        if (m_unconfirmedSelection.contains(item.assetId)) {
+            m_unconfirmedSelection.deselect(item.assetId);
+            selectionChanged = true;
+        }
+        if (resolveRange && index >= m_selectionRangeStart && index <= m_selectionRangeEnd
+            && !m_selection.contains(item.assetId)) {
+            m_selection.select(item.assetId);
+            selectionChanged = true;
+        }
+    }
+    m_pages.insert(page, pageIds);
+
+    const int firstVisible = qMax(0, verticalScrollBar()->value() / qMax(1, m_itemSize.height() + m_spacing)) * m_columns;
+    evictDistantPages(firstVisible / kPageSize);
+    pruneItems();
+
+    // Warm the first screen of a fresh result set.
+    if (offset == 0) {
+        const int preloadCount = qMin(int(pageIds.size()), 12);
+        for (int i = 0; i < preloadCount; ++i) {
+            ensurePixmapLoaded(i);
+        }
+    }
+
+    viewport()->update();
+    if (selectionChanged) {
+        emitSelectionChanged();
+    }
+}
+
 void LibraryGridView::clear()
 {
     cancelPendingLoads();
-    if (m_items.isEmpty() && m_selectedIndices.isEmpty()) {
+    m_items.clear();
+    m_composedCells.clear();
+    if (m_itemCount == 0 && m_selection.isEmpty()) {
         return;
     }
 
-    m_items.clear();
+    m_itemCount = 0;
+    m_pages.clear();
+    m_stalePages.clear();
+    m_requestedPages.clear();
     m_indexLookup.clear();
-    m_selectedIndices.clear();
-    m_lastSelectedIndex = -1;
+    clearSelection();
 
     updateLayoutMetrics();
     viewport()->update();
@@ -125,12 +306,12 @@ void LibraryGridView::clear()
 
 void LibraryGridView::updateItemPreview(qint64 assetId, const QString &previewPath)
 {
-    const int index = m_indexLookup.value(assetId, -1);
-    if (index < 0 || index >= m_items.size()) {
+    const auto found = m_items.find(assetId);
+    if (found == m_items.end()) {
         return;
     }
 
-    Item &item = m_items[index];
+    Item &item = found.value();
     const QString previousPath = item.previewPath;
     
     // Clear cache for both old and new paths to ensure fresh load
@@ -151,25 +332,75 @@ void LibraryGridView::updateItemPreview(qint64 assetId, const QString &previewPa
         }
     }
     
+    if (m_renderer) {
+        m_renderer->remove(LibraryGridRenderer::ThumbnailAtlas, previousPath);
+        m_renderer->remove(LibraryGridRenderer::ThumbnailAtlas, previewPath);
+    }
     item.previewPath = previewPath;
     item.pixmap = QPixmap();
     item.pixmapLoaded = false;
-    cancelPendingLoad(index);
+    ++item.revision;
+    cancelPendingLoad(assetId);
 
     // Force update the entire viewport to ensure refresh
     viewport()->update();
 }
 
-QList<qint64> LibraryGridView::selectedAssetIds() const
+void LibraryGridView::updateItemMarks(const QList<qint64> &assetIds, quint8 fieldMask, quint8 bits)
 {
-    QList<qint64> ids;
-    ids.reserve(m_selectedIndices.size());
-    for (int index : m_selectedIndices) {
-        if (index >= 0 && index < m_items.size()) {
-            ids.append(m_items.at(index).assetId);
+    bool changed = false;
+    for (qint64 assetId : assetIds) {
+        const auto it = m_items.find(assetId);
+        if (it != m_items.end()) {
+            it->marks = AssetMarks::withField(it->marks, fieldMask, bits);
+            ++it->revision;
+            changed = true;
         }
     }
-    return ids;
+    if (changed) {
+        viewport()->update();
+    }
+}
+
+AssetSelection LibraryGridView::selection() const
+{
+    AssetSelection confirmed = m_selection;
+    confirmed -= m_unconfirmedSelection;
+    return confirmed;
+}
+
+qint64 LibraryGridView::selectedCount() const
+{
+    return selection().count(m_itemCount);
+}
+
+void LibraryGridView::selectAll()
+{
+    clearSelection();
+    m_selection.selectAll();
+    emitSelectionChanged();
+    viewport()->update();
+}
+
+void LibraryGridView::selectNone()
+{
+    clearSelection();
+    emitSelectionChanged();
+    viewport()->update();
+}
+
+void LibraryGridView::invertSelection()
+{
+    // Inverts what is selected now. A shift-click range still waiting for
+    // its pages is dropped, as is what has not been seen in a new result.
+    const qint64 anchor = m_anchorAssetId;
+    AssetSelection inverted = selection();
+    inverted.invert();
+    clearSelection();
+    m_selection = inverted;
+    m_anchorAssetId = anchor;
+    emitSelectionChanged();
+    viewport()->update();
 }
 
 void LibraryGridView::paintEvent(QPaintEvent *event)
@@ -179,110 +410,378 @@ void LibraryGridView::paintEvent(QPaintEvent *event)
     QPainter painter(viewport());
     painter.fillRect(viewport()->rect(), palette().window());
 
-    const int viewportHeight = viewport()->height();
-    const int viewportWidth = viewport()->width();
-    const int yOffset = verticalScrollBar()->value();
-
-    if (m_items.isEmpty()) {
+    if (m_itemCount == 0) {
         painter.setPen(palette().color(QPalette::Midlight));
         painter.drawText(viewport()->rect(), Qt::AlignCenter, tr("No items"));
         return;
     }
 
+    int firstIndex = 0;
+    int endIndex = 0;
+    visibleRange(&firstIndex, &endIndex);
+    if (!renderCells(painter, firstIndex, endIndex)) {
+        paintCells(painter, firstIndex, endIndex);
+    }
+    if (!isFlinging()) {
+        prefetchAhead(firstIndex, endIndex);
+    }
+
+    // Fetch one screen ahead and behind so scrolling rarely shows empty cells.
+    const int visibleCount = endIndex - firstIndex;
+    requestPages(firstIndex - visibleCount, endIndex + visibleCount);
+}
+
+void LibraryGridView::paintCells(QPainter &painter, int firstIndex, int endIndex)
+{
+    painter.setRenderHint(QPainter::Antialiasing, true);
+
+    // Each cell is composed once and then blitted until something it shows
+    // changes, so scrolling does not re-elide, re-scale or re-stroke.
+    const qreal dpr = viewport()->devicePixelRatioF();
+    if (m_composedCellSize != m_itemSize || m_composedDevicePixelRatio != dpr) {
+        m_composedCells.clear();
+        m_composedCellSize = m_itemSize;
+        m_composedDevicePixelRatio = dpr;
+    }
+
+    const bool flinging = isFlinging();
+    const int yOffset = verticalScrollBar()->value();
+    for (int index = firstIndex; index < endIndex; ++index) {
+        const QRect cellRect = itemRect(index, yOffset);
+
+        Item *loaded = itemAt(index);
+        if (!loaded) {
+            // Page not fetched yet; requested by paintEvent().
+            painter.setPen(Qt::NoPen);
+            painter.setBrush(kFrameColor);
+            painter.drawRoundedRect(cellRect.adjusted(0, 0, -1, -1), 8, 8);
+            continue;
+        }
+        Item &item = *loaded;
+
+        loadVisiblePixmap(index);
+
+        const bool selected = m_selection.contains(item.assetId);
+        const bool placeholder = flinging && item.pixmap.isNull();
+        const ComposedCell *cached = m_composedCells.object(item.assetId);
+        if (cached && cached->revision == item.revision && cached->selected == selected
+            && cached->placeholder == placeholder) {
+            painter.drawPixmap(cellRect.topLeft(), cached->pixmap);
+            continue;
+        }
+
+        auto *cell = new ComposedCell;
+        cell->pixmap = composeCell(item, cellRect.size(), dpr, painter.font(), selected, placeholder);
+        cell->revision = item.revision;
+        cell->selected = selected;
+        cell->placeholder = placeholder;
+        painter.drawPixmap(cellRect.topLeft(), cell->pixmap);
+        const qint64 bytes = qint64(cell->pixmap.width()) * cell->pixmap.height() * 4;
+        m_composedCells.insert(item.assetId, cell, int(qMax<qint64>(1, bytes / 1024)));
+    }
+}
+
+QPixmap LibraryGridView::composeCell(const Item &item, const QSize &cellSize, qreal devicePixelRatio,
+                                     const QFont &font, bool selected, bool placeholder) const
+{
+    QPixmap pixmap(cellSize * devicePixelRatio);
+    pixmap.setDevicePixelRatio(devicePixelRatio);
+    pixmap.fill(Qt::transparent);
+
+    QPainter painter(&pixmap);
     painter.setRenderHint(QPainter::Antialiasing, true);
     painter.setRenderHint(QPainter::SmoothPixmapTransform, true);
+    painter.setFont(font);
+
+    const QRect cellRect(QPoint(0, 0), cellSize);
+    const QRect frameRect = cellRect.adjusted(0, 0, -1, -1);
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(kFrameColor);
+    painter.drawRoundedRect(frameRect, 8, 8);
+
+    const CellLayout layout = cellLayout(item, cellRect, QFontMetrics(font));
+    const QRect &imageRect = layout.imageRect;
+
+    if (!item.pixmap.isNull()) {
+        QSize scaledSize = item.pixmap.size().scaled(imageRect.size(), Qt::KeepAspectRatio);
+        QRect targetRect(QPoint(0, 0), scaledSize);
+        targetRect.moveCenter(imageRect.center());
+        painter.drawPixmap(targetRect, item.pixmap);
+    } else if (placeholder) {
+        painter.setBrush(kPlaceholderColor);
+        painter.drawRoundedRect(imageRect, 4, 4);
+    } else {
+        painter.setPen(QColor(150, 150, 150));
+        painter.drawText(imageRect, Qt::AlignCenter | Qt::TextWordWrap, tr("Preview pending"));
+    }
 
-    const int rowHeight = m_itemSize.height() + m_spacing;
-    const int firstRow = qMax(0, yOffset / rowHeight);
+    if (AssetMarks::flag(item.marks) == AssetMarks::Rejected) {
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(QColor(0, 0, 0, 140));
+        painter.drawRect(imageRect);
+    }
 
-    int index = firstRow * m_columns;
-    int y = firstRow * rowHeight - yOffset;
+    if (!layout.captionRect.isEmpty()) {
+        drawCaption(painter, layout.captionRect, layout.caption);
+    }
+    if (!layout.badgeRect.isEmpty()) {
+        drawBadge(painter, layout.badgeRect, layout.badge);
+    }
 
-    while (index < m_items.size() && y < viewportHeight) {
-        int x = m_horizontalOffset;
-        for (int column = 0; column < m_columns && index < m_items.size(); ++column, ++index) {
-            QRect cellRect(x, y, m_itemSize.width(), m_itemSize.height());
-            if (cellRect.right() < 0) {
-                x += m_itemSize.width() + m_spacing;
-                continue;
-            }
-            if (cellRect.left() > viewportWidth) {
-                break;
-            }
+    if (!layout.labelRect.isEmpty()) {
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(labelColor(AssetMarks::colorLabel(item.marks)));
+        painter.drawRoundedRect(layout.labelRect, 2, 2);
+    }
 
-            Item &item = m_items[index];
-            painter.save();
+    if (selected) {
+        painter.setPen(QPen(kSelectionColor, 3));
+        painter.setBrush(Qt::NoBrush);
+        painter.drawRoundedRect(frameRect.adjusted(1, 1, -1, -1), 8, 8);
+    }
+    return pixmap;
+}
 
-            QRect frameRect = cellRect.adjusted(0, 0, -1, -1);
-            painter.setPen(Qt::NoPen);
-            painter.setBrush(QColor(30, 30, 30));
-            painter.drawRoundedRect(frameRect, 8, 8);
+bool LibraryGridView::renderCells(QPainter &painter, int firstIndex, int endIndex)
+{
+    if (!m_renderer) {
+        return false;
+    }
 
-            ensurePixmapLoaded(index);
-            prefetchAround(index);
+    painter.beginNativePainting();
+    if (!m_renderer->isInitialized() && !m_renderer->initialize()) {
+        painter.endNativePainting();
+        m_renderer.reset();
+        return false;
+    }
+
+    using Renderer = LibraryGridRenderer;
+    const qreal dpr = viewport()->devicePixelRatioF();
+    const QFont font = painter.font();
+    const QFontMetrics fm(font);
+    const QString ratioKey = QString::number(dpr);
+    const QSize previewSize = targetPreviewSize();
+    m_renderer->reserveSlotSize(Renderer::ThumbnailAtlas, previewSize * dpr);
+    m_renderer->reserveSlotSize(Renderer::TextAtlas, QSize(previewSize.width(), fm.height() + kOverlayPadding) * dpr);
+    m_renderer->beginFrame(viewport()->size(), dpr);
+
+    // Decoding and uploading are spread over frames so a fast scroll into
+    // fresh territory does not stall one of them.
+    int uploads = 0;
+    bool deferred = false;
+    const auto ensureUploaded = [&](Renderer::Atlas atlas, const QString &key, const auto &makeImage) {
+        if (m_renderer->contains(atlas, key)) {
+            return true;
+        }
+        if (uploads >= kMaxUploadsPerFrame) {
+            deferred = true;
+            return false;
+        }
+        ++uploads;
+        return m_renderer->upload(atlas, key, makeImage());
+    };
+
+    const bool flinging = isFlinging();
+    const int yOffset = verticalScrollBar()->value();
+    for (int index = firstIndex; index < endIndex; ++index) {
+        const QRect cellRect = itemRect(index, yOffset);
+        const QRect frameRect = cellRect.adjusted(0, 0, -1, -1);
+        m_renderer->addRect(Renderer::BackgroundLayer, frameRect, kFrameColor, 8);
+
+        Item *loaded = itemAt(index);
+        if (!loaded) {
+            continue;
+        }
+        Item &item = *loaded;
+
+        loadVisiblePixmap(index);
 
-            QRect imageRect = frameRect.adjusted(kInnerPadding,
-                                                kInnerPadding,
-                                                -kInnerPadding,
-                                                -kInnerPadding);
+        const CellLayout layout = cachedCellLayout(item, cellRect.size(), fm, dpr).translated(cellRect.topLeft());
+        const QRect &imageRect = layout.imageRect;
 
-            if (!item.pixmap.isNull()) {
-                QSize scaledSize = item.pixmap.size().scaled(imageRect.size(), Qt::KeepAspectRatio);
-                QRect targetRect(QPoint(0, 0), scaledSize);
+        if (!item.pixmap.isNull()) {
+            const QString &key = item.previewPath;
+            if (ensureUploaded(Renderer::ThumbnailAtlas, key, [&item]() { return item.pixmap.toImage(); })) {
+                QRect targetRect(QPoint(0, 0), item.pixmap.size().scaled(imageRect.size(), Qt::KeepAspectRatio));
                 targetRect.moveCenter(imageRect.center());
-                painter.drawPixmap(targetRect, item.pixmap);
-            } else {
-                painter.setPen(QColor(150, 150, 150));
-                painter.drawText(imageRect, Qt::AlignCenter | Qt::TextWordWrap, tr("Preview pending"));
+                m_renderer->addImage(Renderer::ImageLayer, Renderer::ThumbnailAtlas, key, targetRect);
             }
-
-            QString overlayText;
-            if (!item.photoNumber.trimmed().isEmpty()) {
-                overlayText = item.photoNumber.trimmed();
-            } else if (!item.fileName.isEmpty()) {
-                overlayText = item.fileName;
-            } else {
-                overlayText = tr("No ID");
+        } else if (flinging) {
+            m_renderer->addRect(Renderer::ImageLayer, imageRect, kPlaceholderColor, 4);
+        } else {
+            const QString text = tr("Preview pending");
+            QRect textRect(0, 0, imageRect.width(), fm.height() + kOverlayPadding);
+            textRect.moveCenter(imageRect.center());
+            const QString key = QStringLiteral("pending/%1/%2").arg(textRect.width()).arg(ratioKey);
+            const auto makeImage = [&]() {
+                return rasterize(textRect.size(), dpr, font, [&](QPainter &textPainter, const QRect &rect) {
+                    textPainter.setPen(QColor(150, 150, 150));
+                    textPainter.drawText(rect, Qt::AlignCenter, fm.elidedText(text, Qt::ElideRight, rect.width()));
+                });
+            };
+            if (ensureUploaded(Renderer::TextAtlas, key, makeImage)) {
+                m_renderer->addImage(Renderer::TextLayer, Renderer::TextAtlas, key, textRect);
             }
+        }
 
-            QFontMetrics fm(painter.font());
-            const int overlayPadding = 6;
-            const int overlayHeight = fm.height() + overlayPadding;
-            int overlayWidth = fm.horizontalAdvance(overlayText) + overlayPadding * 2;
-            const int maxOverlayWidth = imageRect.width() - overlayPadding * 2;
-
-            if (overlayHeight > 0 && maxOverlayWidth > overlayPadding) {
-                overlayWidth = qMin(overlayWidth, maxOverlayWidth);
-                overlayWidth = qMax(overlayWidth, overlayPadding * 2);
-
-                QRect overlayRect(imageRect.left() + overlayPadding,
-                                  imageRect.bottom() - overlayHeight - overlayPadding,
-                                  overlayWidth,
-                                  overlayHeight);
-
-                painter.setPen(Qt::NoPen);
-                painter.setBrush(QColor(0, 0, 0, 160));
-                painter.drawRoundedRect(overlayRect, 6, 6);
-
-                painter.setPen(Qt::white);
-                painter.drawText(overlayRect.adjusted(overlayPadding / 2, 0, -overlayPadding / 2, 0),
-                                 Qt::AlignVCenter | Qt::AlignLeft,
-                                 overlayText);
-            }
+        if (AssetMarks::flag(item.marks) == AssetMarks::Rejected) {
+            m_renderer->addRect(Renderer::ShadeLayer, imageRect, QColor(0, 0, 0, 140));
+        }
 
-            if (m_selectedIndices.contains(index)) {
-                painter.setPen(QPen(QColor(0, 122, 204), 3));
-                painter.setBrush(Qt::NoBrush);
-                painter.drawRoundedRect(frameRect.adjusted(1, 1, -1, -1), 8, 8);
+        // Captions and badges are rasterized once and then drawn from the
+        // atlas until their text changes.
+        if (!layout.captionRect.isEmpty()) {
+            const QString &key = layout.captionKey;
+            const auto makeImage = [&]() {
+                return rasterize(layout.captionRect.size(), dpr, font, [&](QPainter &textPainter, const QRect &rect) {
+                    drawCaption(textPainter, rect, layout.caption);
+                });
+            };
+            if (ensureUploaded(Renderer::TextAtlas, key, makeImage)) {
+                m_renderer->addImage(Renderer::TextLayer, Renderer::TextAtlas, key, layout.captionRect);
             }
+        }
+        if (!layout.badgeRect.isEmpty()) {
+            const QString &key = layout.badgeKey;
+            const auto makeImage = [&]() {
+                return rasterize(layout.badgeRect.size(), dpr, font, [&](QPainter &textPainter, const QRect &rect) {
+                    drawBadge(textPainter, rect, layout.badge);
+                });
+            };
+            if (ensureUploaded(Renderer::TextAtlas, key, makeImage)) {
+                m_renderer->addImage(Renderer::TextLayer, Renderer::TextAtlas, key, layout.badgeRect);
+            }
+        }
 
-            painter.restore();
+        if (!layout.labelRect.isEmpty()) {
+            m_renderer->addRect(Renderer::OutlineLayer, layout.labelRect,
+                                labelColor(AssetMarks::colorLabel(item.marks)), 2);
+        }
+        if (m_selection.contains(item.assetId)) {
+            // The QPainter path strokes a 3 px pen centred one pixel inside
+            // the frame.
+            m_renderer->addRect(Renderer::OutlineLayer, QRectF(frameRect).adjusted(-0.5, -0.5, 0.5, 0.5),
+                                kSelectionColor, 8, 3);
+        }
+    }
+
+    m_renderer->endFrame();
+    painter.endNativePainting();
+
+    if (deferred) {
+        viewport()->update();
+    }
+    return true;
+}
+
+LibraryGridView::CellLayout LibraryGridView::cellLayout(const Item &item, const QRect &cellRect, const QFontMetrics &fm) const
+{
+    CellLayout layout;
+    const QRect frameRect = cellRect.adjusted(0, 0, -1, -1);
+    layout.imageRect = frameRect.adjusted(kInnerPadding, kInnerPadding, -kInnerPadding, -kInnerPadding);
+    const QRect &imageRect = layout.imageRect;
+
+    if (!item.photoNumber.trimmed().isEmpty()) {
+        layout.caption = item.photoNumber.trimmed();
+    } else if (!item.fileName.isEmpty()) {
+        layout.caption = item.fileName;
+    } else {
+        layout.caption = tr("No ID");
+    }
+    // Stars, then a flag for picks or a cross for rejects.
+    const int stars = AssetMarks::rating(item.marks);
+    if (stars > 0) {
+        layout.caption += QStringLiteral(" ") + QString(stars, QChar(0x2605));
+    }
+    if (AssetMarks::flag(item.marks) == AssetMarks::Picked) {
+        layout.caption += QStringLiteral(" ") + QChar(0x2691);
+    } else if (AssetMarks::flag(item.marks) == AssetMarks::Rejected) {
+        layout.caption += QStringLiteral(" ") + QChar(0x2715);
+    }
 
-            x += m_itemSize.width() + m_spacing;
+    const int overlayHeight = fm.height() + kOverlayPadding;
+    int overlayWidth = fm.horizontalAdvance(layout.caption) + kOverlayPadding * 2;
+    const int maxOverlayWidth = imageRect.width() - kOverlayPadding * 2;
+
+    if (overlayHeight > 0 && maxOverlayWidth > kOverlayPadding) {
+        overlayWidth = qMin(overlayWidth, maxOverlayWidth);
+        overlayWidth = qMax(overlayWidth, kOverlayPadding * 2);
+
+        layout.captionRect = QRect(imageRect.left() + kOverlayPadding,
+                                   imageRect.bottom() - overlayHeight - kOverlayPadding,
+                                   overlayWidth,
+                                   overlayHeight);
+
+        // Frame count of a collapsed burst, in the opposite corner.
+        if (item.stackSize > 1) {
+            layout.badge = QLocale().toString(item.stackSize);
+            const int badgeWidth = qMax(overlayHeight, fm.horizontalAdvance(layout.badge) + kOverlayPadding * 2);
+            layout.badgeRect = QRect(imageRect.right() - kOverlayPadding - badgeWidth,
+                                     imageRect.top() + kOverlayPadding,
+                                     badgeWidth,
+                                     overlayHeight);
         }
+    }
+
+    if (AssetMarks::colorLabel(item.marks) != AssetMarks::NoLabel) {
+        layout.labelRect = QRect(frameRect.left() + kInnerPadding, frameRect.bottom() - kInnerPadding / 2 - 2,
+                                 frameRect.width() - kInnerPadding * 2, 4);
+    }
+    return layout;
+}
+
+const LibraryGridView::CellLayout &LibraryGridView::cachedCellLayout(Item &item, const QSize &cellSize,
+                                                                     const QFontMetrics &fm, qreal devicePixelRatio)
+{
+    if (item.layoutRevision == item.revision && item.layoutCellSize == cellSize
+        && item.layoutDevicePixelRatio == devicePixelRatio) {
+        return item.layout;
+    }
 
-        y += rowHeight;
+    item.layout = cellLayout(item, QRect(QPoint(0, 0), cellSize), fm);
+    const QString ratioKey = QString::number(devicePixelRatio);
+    if (!item.layout.captionRect.isEmpty()) {
+        item.layout.captionKey = QStringLiteral("caption/%1/%2/%3")
+                                     .arg(item.layout.captionRect.width()).arg(ratioKey, item.layout.caption);
+    }
+    if (!item.layout.badgeRect.isEmpty()) {
+        item.layout.badgeKey = QStringLiteral("badge/%1/%2/%3")
+                                   .arg(item.layout.badgeRect.width()).arg(ratioKey, item.layout.badge);
     }
+    item.layoutRevision = item.revision;
+    item.layoutCellSize = cellSize;
+    item.layoutDevicePixelRatio = devicePixelRatio;
+    return item.layout;
+}
+
+LibraryGridView::CellLayout LibraryGridView::CellLayout::translated(const QPoint &offset) const
+{
+    CellLayout layout = *this;
+    layout.imageRect.translate(offset);
+    layout.captionRect.translate(offset);
+    layout.badgeRect.translate(offset);
+    layout.labelRect.translate(offset);
+    return layout;
+}
+
+void LibraryGridView::visibleRange(int *firstIndex, int *endIndex) const
+{
+    const int rowHeight = qMax(1, m_itemSize.height() + m_spacing);
+    const int yOffset = verticalScrollBar()->value();
+    const int firstRow = qMax(0, yOffset / rowHeight);
+    const int lastRow = qMax(firstRow, (yOffset + viewport()->height() - 1) / rowHeight);
+    *firstIndex = qMin(m_itemCount, firstRow * m_columns);
+    *endIndex = qMin(m_itemCount, (lastRow + 1) * m_columns);
+}
+
+void LibraryGridView::releaseRenderer()
+{
+    if (!m_glViewport || !m_renderer || !m_renderer->isInitialized()) {
+        return;
+    }
+    m_glViewport->makeCurrent();
+    m_renderer->release();
+    m_glViewport->doneCurrent();
 }
 
 void LibraryGridView::resizeEvent(QResizeEvent *event)
@@ -299,9 +798,8 @@ void LibraryGridView::mousePressEvent(QMouseEvent *event)
 
     if (index < 0) {
         if (!(modifiers & Qt::ControlModifier) && !(modifiers & Qt::ShiftModifier)) {
-            if (!m_selectedIndices.isEmpty()) {
-                m_selectedIndices.clear();
-                m_lastSelectedIndex = -1;
+            if (!m_selection.isEmpty() || m_selectionRangeStart >= 0) {
+                clearSelection();
                 emitSelectionChanged();
                 viewport()->update();
             }
@@ -310,19 +808,28 @@ void LibraryGridView::mousePressEvent(QMouseEvent *event)
         return;
     }
 
-    if ((modifiers & Qt::ShiftModifier) && m_lastSelectedIndex >= 0) {
-        setSelectionRange(m_lastSelectedIndex, index);
+    const Item *clicked = itemAt(index);
+    // The anchor follows its asset through re-sorts while its page is
+    // loaded.
+    const int anchorIndex = m_anchorAssetId >= 0 ? m_indexLookup.value(m_anchorAssetId, -1) : -1;
+    if ((modifiers & Qt::ShiftModifier) && anchorIndex >= 0) {
+        setSelectionRange(anchorIndex, index);
+    } else if (!clicked) {
+        // Page not loaded yet; there is no asset to select.
+        QAbstractScrollArea::mousePressEvent(event);
+        return;
     } else if (modifiers & Qt::ControlModifier) {
-        if (m_selectedIndices.contains(index)) {
-            m_selectedIndices.remove(index);
+        if (m_selection.contains(clicked->assetId)) {
+            m_selection.deselect(clicked->assetId);
+            m_unconfirmedSelection.deselect(clicked->assetId);
         } else {
-            m_selectedIndices.insert(index);
-            m_lastSelectedIndex = index;
+            m_selection.select(clicked->assetId);
+            m_anchorAssetId = clicked->assetId;
         }
     } else {
-        m_selectedIndices.clear();
-        m_selectedIndices.insert(index);
-        m_lastSelectedIndex = index;
+        clearSelection();
+        m_selection.select(clicked->assetId);
+        m_anchorAssetId = clicked->assetId;
     }
 
     emitSelectionChanged();
@@ -333,9 +840,8 @@ void LibraryGridView::mousePressEvent(QMouseEvent *event)
 void LibraryGridView::mouseDoubleClickEvent(QMouseEvent *event)
 {
     const int index = indexAt(event->pos());
-    if (index >= 0 && index < m_items.size()) {
-        const Item &item = m_items.at(index);
-        emit assetActivated(item.assetId, item.originalPath);
+    if (const Item *item = itemAt(index)) {
+        emit assetActivated(item->assetId, item->originalPath);
     }
     QAbstractScrollArea::mouseDoubleClickEvent(event);
 }
@@ -375,7 +881,7 @@ void LibraryGridView::updateLayoutMetrics()
     const int usedWidth = m_columns * m_itemSize.width() + totalSpacing;
     m_horizontalOffset = qMax(0, (viewportWidth - usedWidth) / 2);
 
-    const int totalRows = m_columns > 0 ? (m_items.size() + m_columns - 1) / m_columns : 0;
+    const int totalRows = m_columns > 0 ? (m_itemCount + m_columns - 1) / m_columns : 0;
     const int contentHeight = totalRows > 0
         ? totalRows * m_itemSize.height() + qMax(0, (totalRows - 1) * m_spacing)
         : viewportHeight;
@@ -388,7 +894,7 @@ void LibraryGridView::updateLayoutMetrics()
 
 QRect LibraryGridView::itemRect(int index, int verticalOffset) const
 {
-    if (index < 0 || index >= m_items.size() || m_columns <= 0) {
+    if (index < 0 || index >= m_itemCount || m_columns <= 0) {
         return {};
     }
 
@@ -403,7 +909,7 @@ QRect LibraryGridView::itemRect(int index, int verticalOffset) const
 
 int LibraryGridView::indexAt(const QPoint &pos) const
 {
-    if (m_items.isEmpty() || m_columns <= 0) {
+    if (m_itemCount == 0 || m_columns <= 0) {
         return -1;
     }
 
@@ -439,7 +945,7 @@ int LibraryGridView::indexAt(const QPoint &pos) const
     }
 
     const int index = row * m_columns + column;
-    if (index < 0 || index >= m_items.size()) {
+    if (index < 0 || index >= m_itemCount) {
         return -1;
     }
 
@@ -452,18 +958,27 @@ int LibraryGridView::indexAt(const QPoint &pos) const
 
 void LibraryGridView::ensurePixmapLoaded(int index)
 {
-    if (index < 0 || index >= m_items.size()) {
+    Item *loaded = itemAt(index);
+    if (!loaded) {
         return;
     }
 
-    Item &item = m_items[index];
-    if (item.pixmapLoaded) {
+    Item &item = *loaded;
+    if (adoptCachedPixmap(item) || m_pendingLoads.contains(item.assetId)) {
         return;
     }
 
+    schedulePixmapLoad(item);
+}
+
+bool LibraryGridView::adoptCachedPixmap(Item &item)
+{
+    if (item.pixmapLoaded) {
+        return true;
+    }
     if (item.previewPath.isEmpty()) {
         item.pixmapLoaded = true;
-        return;
+        return true;
     }
 
     const QString key = cacheKeyForPath(item.previewPath);
@@ -472,52 +987,53 @@ void LibraryGridView::ensurePixmapLoaded(int index)
         if (QPixmap *cached = previewCache().object(key)) {
             item.pixmap = *cached;
             item.pixmapLoaded = true;
-            return;
+            ++item.revision;
+            return true;
         }
     }
-
-    if (m_pendingLoads.contains(index)) {
-        return;
-    }
-
-    schedulePixmapLoad(index);
+    return false;
 }
 
-void LibraryGridView::schedulePixmapLoad(int index)
+void LibraryGridView::loadVisiblePixmap(int index)
 {
-    if (index < 0 || index >= m_items.size()) {
-        return;
+    if (!isFlinging()) {
+        ensurePixmapLoaded(index);
+    } else if (Item *item = itemAt(index)) {
+        adoptCachedPixmap(*item);
     }
+}
 
-    Item &item = m_items[index];
+void LibraryGridView::schedulePixmapLoad(Item &item)
+{
     if (item.previewPath.isEmpty()) {
         item.pixmapLoaded = true;
         return;
     }
 
     auto *watcher = new QFutureWatcher<QPixmap>(this);
-    m_pendingLoads.insert(index, watcher);
+    m_pendingLoads.insert(item.assetId, watcher);
 
+    const qint64 assetId = item.assetId;
     const QString path = item.previewPath;
     const QString cacheKey = cacheKeyForPath(path);
     const QSize desiredSize = targetPreviewSize();
 
-    connect(watcher, &QFutureWatcher<QPixmap>::finished, this, [this, index, path, cacheKey, watcher]() {
-        m_pendingLoads.remove(index);
+    connect(watcher, &QFutureWatcher<QPixmap>::finished, this, [this, assetId, path, cacheKey, watcher]() {
+        // Discarded watchers are disconnected, so this one is still current.
+        m_pendingLoads.remove(assetId);
         const QPixmap pixmap = watcher->result();
         watcher->deleteLater();
 
-        if (index < 0 || index >= m_items.size()) {
+        auto found = m_items.find(assetId);
+        if (found == m_items.end() || found->previewPath != path) {
             return;
         }
 
-        Item &current = m_items[index];
-        if (current.previewPath != path) {
-            return;
-        }
+        Item &current = found.value();
 
         current.pixmapLoaded = true;
         current.pixmap = pixmap;
+        ++current.revision;
 
         if (!pixmap.isNull() && !cacheKey.isEmpty()) {
             QMutexLocker locker(&previewCacheMutex());
@@ -525,8 +1041,11 @@ void LibraryGridView::schedulePixmapLoad(int index)
             previewCache().insert(cacheKey, new QPixmap(pixmap), cost);
         }
 
-        viewport()->update(itemRect(index, verticalScrollBar()->value()));
-        prefetchAround(index);
+        // The asset may have moved while loading; repaint where it is now.
+        const int index = m_indexLookup.value(assetId, -1);
+        if (index >= 0) {
+            viewport()->update(itemRect(index, verticalScrollBar()->value()));
+        }
     });
 
     QFuture<QPixmap> future = QtConcurrent::run([path, desiredSize]() -> QPixmap {
@@ -554,50 +1073,120 @@ void LibraryGridView::schedulePixmapLoad(int index)
     watcher->setFuture(future);
 }
 
-void LibraryGridView::cancelPendingLoad(int index)
+void LibraryGridView::cancelPendingLoad(qint64 assetId)
 {
-    auto it = m_pendingLoads.find(index);
+    auto it = m_pendingLoads.find(assetId);
     if (it == m_pendingLoads.end()) {
         return;
     }
 
     QFutureWatcher<QPixmap> *watcher = it.value();
     m_pendingLoads.erase(it);
-    if (!watcher) {
-        return;
-    }
-    watcher->cancel();
-    watcher->deleteLater();
+    discardLoad(watcher);
 }
 
 void LibraryGridView::cancelPendingLoads()
 {
     const auto watchers = m_pendingLoads;
     for (QFutureWatcher<QPixmap> *watcher : watchers) {
-        if (!watcher) {
-            continue;
-        }
-        watcher->cancel();
-        watcher->deleteLater();
+        discardLoad(watcher);
     }
     m_pendingLoads.clear();
 }
 
-void LibraryGridView::prefetchAround(int index)
+void LibraryGridView::cancelLoadsOutside(int firstIndex, int endIndex)
 {
-    if (index < 0 || index >= m_items.size()) {
+    for (auto it = m_pendingLoads.begin(); it != m_pendingLoads.end();) {
+        const int index = m_indexLookup.value(it.key(), -1);
+        if (index < firstIndex || index >= endIndex) {
+            discardLoad(it.value());
+            it = m_pendingLoads.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void LibraryGridView::discardLoad(QFutureWatcher<QPixmap> *watcher)
+{
+    if (!watcher) {
         return;
     }
+    // Loads still queued in the pool are skipped; one already decoding
+    // finishes into a watcher nobody listens to.
+    watcher->disconnect(this);
+    watcher->cancel();
+    watcher->deleteLater();
+}
 
-    for (int offset = -kPrefetchRadius; offset <= kPrefetchRadius; ++offset) {
-        if (offset == 0) {
-            continue;
+void LibraryGridView::prefetchAhead(int firstIndex, int endIndex)
+{
+    // Nearest first: a screen ahead in the scroll direction, then a row
+    // behind in case the scroll turns around.
+    const int visibleCount = endIndex - firstIndex;
+    if (m_scrollDirection >= 0) {
+        for (int index = endIndex; index < endIndex + visibleCount; ++index) {
+            ensurePixmapLoaded(index);
         }
-        const int neighbor = index + offset;
-        if (neighbor < 0 || neighbor >= m_items.size()) {
-            continue;
+        for (int index = firstIndex - 1; index >= firstIndex - m_columns; --index) {
+            ensurePixmapLoaded(index);
+        }
+    } else {
+        for (int index = firstIndex - 1; index >= firstIndex - visibleCount; --index) {
+            ensurePixmapLoaded(index);
+        }
+        for (int index = endIndex; index < endIndex + m_columns; ++index) {
+            ensurePixmapLoaded(index);
         }
-        ensurePixmapLoaded(neighbor);
+    }
+}
+
+bool LibraryGridView::isFlinging() const
+{
+    return m_scrollVelocity > kFlingScreensPerSecond * qMax(1, viewport()->height());
+}
+
+void LibraryGridView::onScrollValueChanged(int value)
+{
+    const int delta = value - m_lastScrollValue;
+    m_lastScrollValue = value;
+    if (delta != 0) {
+        m_scrollDirection = delta > 0 ? 1 : -1;
+    }
+
+    // Pixels per second, smoothed over the last few events so a single
+    // jump such as a page step or a click in the scroll bar track does
+    // not count as a fling.
+    const qint64 elapsed = m_scrollClock.isValid() ? m_scrollClock.restart() : -1;
+    if (!m_scrollClock.isValid()) {
+        m_scrollClock.start();
+    }
+    if (elapsed < 0 || elapsed > kScrollSettleMsecs) {
+        m_scrollVelocity = 0.0;
+    } else {
+        const double instant = std::abs(delta) * 1000.0 / qMax<qint64>(1, elapsed);
+        m_scrollVelocity = 0.5 * m_scrollVelocity + 0.5 * instant;
+    }
+    m_scrollSettleTimer.start();
+
+    int firstIndex = 0;
+    int endIndex = 0;
+    visibleRange(&firstIndex, &endIndex);
+    const int margin = kLoadMarginRows * m_columns;
+    if (isFlinging()) {
+        // Nothing off screen is still wanted by the time it decodes.
+        cancelLoadsOutside(firstIndex - margin, endIndex + margin);
+        return;
+    }
+
+    // Keeps what prefetchAhead() queued: a screen ahead in the scroll
+    // direction and a row behind.
+    const int ahead = (endIndex - firstIndex) + margin;
+    const int behind = m_columns + margin;
+    if (m_scrollDirection >= 0) {
+        cancelLoadsOutside(firstIndex - behind, endIndex + ahead);
+    } else {
+        cancelLoadsOutside(firstIndex - ahead, endIndex + behind);
     }
 }
 
@@ -614,19 +1203,148 @@ void LibraryGridView::setSelectionRange(int start, int end)
     if (start > end) {
         std::swap(start, end);
     }
+    start = qMax(0, start);
+    end = qMin(end, m_itemCount - 1);
+
+    const qint64 anchor = m_anchorAssetId;
+    clearSelection();
+    m_anchorAssetId = anchor;
+    for (int page = start / kPageSize; page <= end / kPageSize; ++page) {
+        if (!m_pages.contains(page) || m_stalePages.contains(page)) {
+            m_unresolvedSelectionPages.insert(page);
+            continue;
+        }
+        const int last = qMin(end, (page + 1) * kPageSize - 1);
+        for (int i = qMax(start, page * kPageSize); i <= last; ++i) {
+            if (const Item *item = itemAt(i)) {
+                m_selection.select(item->assetId);
+            }
+        }
+    }
+
+    // Pages the range covers but that are not loaded resolve their ids
+    // when they arrive.
+    if (!m_unresolvedSelectionPages.isEmpty()) {
+        m_selectionRangeStart = start;
+        m_selectionRangeEnd = end;
+        requestPages(start, end);
+    }
+}
+
+void LibraryGridView::clearSelection()
+{
+    m_selection.clear();
+    m_unconfirmedSelection.clear();
+    m_unresolvedSelectionPages.clear();
+    m_selectionRangeStart = -1;
+    m_selectionRangeEnd = -1;
+    m_anchorAssetId = -1;
+}
+
+LibraryGridView::Item *LibraryGridView::itemAt(int index)
+{
+    if (index < 0 || index >= m_itemCount) {
+        return nullptr;
+    }
+    auto page = m_pages.constFind(index / kPageSize);
+    if (page == m_pages.constEnd() || index % kPageSize >= page->size()) {
+        return nullptr;
+    }
+    auto it = m_items.find(page->at(index % kPageSize));
+    return it != m_items.end() ? &it.value() : nullptr;
+}
+
+const LibraryGridView::Item *LibraryGridView::itemAt(int index) const
+{
+    if (index < 0 || index >= m_itemCount) {
+        return nullptr;
+    }
+    auto page = m_pages.constFind(index / kPageSize);
+    if (page == m_pages.constEnd() || index % kPageSize >= page->size()) {
+        return nullptr;
+    }
+    auto it = m_items.constFind(page->at(index % kPageSize));
+    return it != m_items.constEnd() ? &it.value() : nullptr;
+}
+
+void LibraryGridView::requestPages(int firstIndex, int lastIndex)
+{
+    if (m_itemCount == 0) {
+        return;
+    }
 
-    m_selectedIndices.clear();
-    for (int i = start; i <= end; ++i) {
-        if (i >= 0 && i < m_items.size()) {
-            m_selectedIndices.insert(i);
+    firstIndex = qBound(0, firstIndex, m_itemCount - 1);
+    lastIndex = qBound(0, lastIndex, m_itemCount - 1);
+    for (int page = firstIndex / kPageSize; page <= lastIndex / kPageSize; ++page) {
+        const bool current = m_pages.contains(page) && !m_stalePages.contains(page);
+        if (current || m_requestedPages.contains(page)) {
+            continue;
+        }
+        m_requestedPages.insert(page);
+        emit itemsRequested(page * kPageSize, kPageSize);
+    }
+}
+
+void LibraryGridView::evictDistantPages(int centerPage)
+{
+    while (m_pages.size() > kMaxCachedPages) {
+        int farthest = -1;
+        int farthestDistance = -1;
+        for (auto it = m_pages.cbegin(); it != m_pages.cend(); ++it) {
+            const int distance = std::abs(it.key() - centerPage);
+            if (distance > farthestDistance) {
+                farthest = it.key();
+                farthestDistance = distance;
+            }
+        }
+        if (farthest < 0) {
+            break;
+        }
+        dropPage(farthest);
+    }
+}
+
+void LibraryGridView::dropPage(int page)
+{
+    auto it = m_pages.find(page);
+    if (it == m_pages.end()) {
+        return;
+    }
+
+    // The items themselves stay in m_items until pruneItems() needs room,
+    // so an asset that reappears elsewhere keeps its pixmap.
+    const int offset = page * kPageSize;
+    for (int i = 0; i < it->size(); ++i) {
+        const qint64 assetId = it->at(i);
+        if (m_indexLookup.value(assetId, -1) == offset + i) {
+            m_indexLookup.remove(assetId);
+        }
+    }
+    m_pages.erase(it);
+    m_stalePages.remove(page);
+}
+
+void LibraryGridView::pruneItems()
+{
+    if (m_items.size() <= kMaxCachedItems) {
+        return;
+    }
+
+    for (auto it = m_items.begin(); it != m_items.end() && m_items.size() > kMaxCachedItems;) {
+        if (m_indexLookup.contains(it.key())) {
+            ++it;
+            continue;
         }
+        cancelPendingLoad(it.key());
+        // A returning item restarts its revisions.
+        m_composedCells.remove(it.key());
+        it = m_items.erase(it);
     }
-    m_lastSelectedIndex = end;
 }
 
 void LibraryGridView::emitSelectionChanged()
 {
-    emit selectionChanged(selectedAssetIds());
+    emit selectionChanged();
 }
 
 void LibraryGridView::dragEnterEvent(QDragEnterEvent *event)
@@ -2,15 +2,29 @@
 #define LIBRARYGRIDVIEW_H
 
 #include <QAbstractScrollArea>
+#include <QCache>
+#include <QElapsedTimer>
 #include <QFutureWatcher>
 #include <QHash>
 #include <QList>
 #include <QPixmap>
+#include <QRect>
 #include <QSize>
 #include <QSet>
 #include <QString>
+#include <QTimer>
 #include <QVector>
 
+#include <memory>
+
+#include "assetselection.h"
+
+class LibraryGridRenderer;
+class QFont;
+class QFontMetrics;
+class QOpenGLWidget;
+class QPainter;
+
 struct LibraryGridItem
 {
     qint64 assetId = -1;
@@ -18,6 +32,8 @@ struct LibraryGridItem
     QString fileName;
     QString previewPath;
     QString originalPath;
+    int stackSize = 1; // > 1 for a collapsed burst
+    quint8 marks = 0;  // see assetmarks.h
 };
 
 class LibraryGridView : public QAbstractScrollArea
@@ -27,15 +43,35 @@ public:
     explicit LibraryGridView(QWidget *parent = nullptr);
     ~LibraryGridView() override;
 
-    void setItems(const QVector<LibraryGridItem> &items);
+    // Items are paged in on demand: setItemCount() sizes the grid and
+    // itemsRequested() asks for the pages around the visible range, which
+    // arrive through setItemsAt().
+    static constexpr int kPageSize = 128;
+
+    void setItemCount(int count);
+    int itemCount() const;
+    void setItemsAt(int offset, const QVector<LibraryGridItem> &items);
     void clear();
     void updateItemPreview(qint64 assetId, const QString &previewPath);
-    QList<qint64> selectedAssetIds() const;
+    // Sets the AssetMarks field selected by fieldMask on loaded items.
+    void updateItemMarks(const QList<qint64> &assetIds, quint8 fieldMask, quint8 bits);
+
+    // Selected items on pages that have not loaded yet, and selected items
+    // not yet seen in a new result, join the selection once their page
+    // arrives. Walk it with AssetSelection::forEach().
+    AssetSelection selection() const;
+    qint64 selectedCount() const;
+    // The asset clicked last, -1 when none.
+    qint64 anchorAssetId() const { return m_anchorAssetId; }
+    void selectAll();
+    void selectNone();
+    void invertSelection();
 
 signals:
-    void selectionChanged(const QList<qint64> &selectedAssetIds);
+    void selectionChanged();
     void assetActivated(qint64 assetId, const QString &originalPath);
     void folderDropped(const QString &folderPath);
+    void itemsRequested(int offset, int count);
 
 protected:
     void paintEvent(QPaintEvent *event) override;
@@ -47,6 +83,21 @@ protected:
     void dropEvent(QDropEvent *event) override;
 
 private:
+    // Where the parts of a cell go, shared by both paint paths.
+    struct CellLayout
+    {
+        QRect imageRect;
+        QString caption;
+        QRect captionRect; // empty when the cell is too narrow
+        QString badge;     // frame count of a collapsed burst
+        QRect badgeRect;
+        QRect labelRect;   // empty without a colour label
+        QString captionKey; // text atlas keys, set by cachedCellLayout()
+        QString badgeKey;
+
+        CellLayout translated(const QPoint &offset) const;
+    };
+
     struct Item
     {
         qint64 assetId = -1;
@@ -54,14 +105,50 @@ private:
         QString fileName;
         QString previewPath;
         QString originalPath;
+        int stackSize = 1;
+        quint8 marks = 0;
         QPixmap pixmap;
         bool pixmapLoaded = false;
+        // Bumped whenever anything drawn from the item changes, which is
+        // what invalidates its cached layout and composed cell.
+        quint32 revision = 0;
+        // cellLayout() for a cell at the origin.
+        CellLayout layout;
+        QSize layoutCellSize;
+        qreal layoutDevicePixelRatio = 0;
+        quint32 layoutRevision = 0;
     };
 
-    QVector<Item> m_items;
+    // A cell as the QPainter path last composed it, drawn with one blit
+    // until the item, its selection or its placeholder state changes.
+    struct ComposedCell
+    {
+        QPixmap pixmap;
+        quint32 revision = 0;
+        bool selected = false;
+        bool placeholder = false;
+    };
+
+    // Item state is keyed by asset id and pages only hold the order, so a
+    // re-sort or a changed filter moves assets between cells without
+    // reloading their thumbnails.
+    int m_itemCount = 0;
+    QHash<qint64, Item> m_items;
+    QHash<int, QVector<qint64>> m_pages; // page number -> asset ids
+    QSet<int> m_stalePages; // from the previous result, shown until replaced
+    QSet<int> m_requestedPages;
     QHash<qint64, int> m_indexLookup;
-    QSet<int> m_selectedIndices;
-    int m_lastSelectedIndex = -1;
+
+    AssetSelection m_selection;
+    // Selected before the last setItemCount() and not seen in the new
+    // result yet.
+    AssetSelection m_unconfirmedSelection;
+    // A shift-click range over pages that had not loaded; their ids are
+    // added as the pages arrive.
+    QSet<int> m_unresolvedSelectionPages;
+    int m_selectionRangeStart = -1;
+    int m_selectionRangeEnd = -1;
+    qint64 m_anchorAssetId = -1;
 
     QSize m_itemSize = QSize(200, 150);
     int m_spacing = 12;
@@ -70,19 +157,65 @@ private:
     int m_minItemWidth = 200;
     double m_itemAspectRatio = 4.0 / 3.0; // width / height
 
+    Item *itemAt(int index);
+    const Item *itemAt(int index) const;
+    void requestPages(int firstIndex, int lastIndex);
+    void evictDistantPages(int centerPage);
+    void dropPage(int page);
+    // Forgets items on no page once there are more than a few pages' worth.
+    void pruneItems();
+
+    void visibleRange(int *firstIndex, int *endIndex) const;
+    void paintCells(QPainter &painter, int firstIndex, int endIndex);
+    // False when OpenGL is unavailable and paintCells() has to run.
+    bool renderCells(QPainter &painter, int firstIndex, int endIndex);
+    CellLayout cellLayout(const Item &item, const QRect &cellRect, const QFontMetrics &fm) const;
+    const CellLayout &cachedCellLayout(Item &item, const QSize &cellSize, const QFontMetrics &fm, qreal devicePixelRatio);
+    QPixmap composeCell(const Item &item, const QSize &cellSize, qreal devicePixelRatio, const QFont &font,
+                        bool selected, bool placeholder) const;
+    void releaseRenderer();
+
     void updateLayoutMetrics();
     QRect itemRect(int index, int verticalOffset) const;
     int indexAt(const QPoint &pos) const;
     void ensurePixmapLoaded(int index);
-    void schedulePixmapLoad(int index);
-    void cancelPendingLoad(int index);
+    // Takes the pixmap from the shared cache without loading; true when
+    // the item needs no load.
+    bool adoptCachedPixmap(Item &item);
+    // ensurePixmapLoaded(), except that flinging only uses cached pixmaps.
+    void loadVisiblePixmap(int index);
+    void schedulePixmapLoad(Item &item);
+    void cancelPendingLoad(qint64 assetId);
     void cancelPendingLoads();
-    void prefetchAround(int index);
+    void cancelLoadsOutside(int firstIndex, int endIndex);
+    void discardLoad(QFutureWatcher<QPixmap> *watcher);
+    void prefetchAhead(int firstIndex, int endIndex);
+    bool isFlinging() const;
+    void onScrollValueChanged(int value);
     QSize targetPreviewSize() const;
     void setSelectionRange(int start, int end);
+    void clearSelection();
     void emitSelectionChanged();
 
-    QHash<int, QFutureWatcher<QPixmap>*> m_pendingLoads;
+    QHash<qint64, QFutureWatcher<QPixmap>*> m_pendingLoads; // by asset id
+
+    // Keyed by asset id; all entries share one cell size and device pixel
+    // ratio and are dropped when either changes.
+    QCache<qint64, ComposedCell> m_composedCells;
+    QSize m_composedCellSize;
+    qreal m_composedDevicePixelRatio = 0;
+
+    // Scroll tracking. While flinging, cells show flat placeholders and
+    // only loads near the viewport are kept; loading resumes once the
+    // scroll settles.
+    QElapsedTimer m_scrollClock;
+    QTimer m_scrollSettleTimer;
+    int m_lastScrollValue = 0;
+    int m_scrollDirection = 1; // 1 down, -1 up
+    double m_scrollVelocity = 0.0; // pixels per second
+
+    QOpenGLWidget *m_glViewport = nullptr;
+    std::unique_ptr<LibraryGridRenderer> m_renderer; // null once OpenGL proved unusable
 };
 
 #endif // LIBRARYGRIDVIEW_H
@@ -1,16 +1,29 @@
 #include "librarymanager.h"
 
+#include "assetindex.h"
 #include "imageloader.h"
 #include "previewgenerator.h"
 #include "jobmanager.h"
 #include "metadatacache.h"
+#include "databaseconnectionpool.h"
+#include "databasewriter.h"
+#include "folderwatcher.h"
+#include "perceptualhash.h"
+#include "schemamigrations.h"
 
 #include <QDateTime>
 #include <QDebug>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QLocale>
+#include <QMutexLocker>
+#include <QPair>
+#include <QSet>
 #include <QSqlError>
 #include <QSqlQuery>
 #include <QUuid>
@@ -19,10 +32,20 @@
 
 namespace {
 constexpr auto kDatabaseFileName = "library.db";
+constexpr auto kSnapshotFileName = "library.snapshot";
 constexpr auto kOriginalsDirName = "originals";
 constexpr auto kPreviewsDirName = "previews";
 constexpr int kPreviewHeight = 512;
 constexpr int kAssetsPerBucket = 128;
+// Bump when the on-disk location of originals or previews changes; libraries
+// checked against an older layout get one background storage pass.
+constexpr int kStorageLayoutVersion = 1;
+constexpr int kStorageCheckBatchSize = 500;
+// Imports at least this large rewrite the asset snapshot straight away
+// rather than waiting for the library to close.
+constexpr int kSnapshotImportThreshold = 1000;
+// library_meta key holding the hot folders, one absolute path per line.
+constexpr auto kHotFoldersKey = "hot_folders";
 
 QString bucketName(int bucketIndex)
 {
@@ -38,16 +61,937 @@ int bucketIndexForPhotoNumber(const QString &photoNumber)
     }
     return ((numeric - 1) / kAssetsPerBucket) + 1;
 }
+
+const QString &upsertAdjustmentsSql()
+{
+    static const QString sql = QStringLiteral(
+        "INSERT INTO develop_adjustments(asset_id, payload, payload_id, history_seq, updated_at) "
+        "VALUES(?, ?, NULL, ?, ?) "
+        "ON CONFLICT(asset_id) DO UPDATE SET "
+        "payload = excluded.payload, "
+        "payload_id = NULL, "
+        "history_seq = excluded.history_seq, "
+        "updated_at = excluded.updated_at;");
+    return sql;
+}
+
+// The highest photo number handed out. Rows from before photo_no existed
+// are counted until the background pass has filled it in; the partial index
+// keeps that part empty once it has.
+const QString &maxPhotoNumberSql()
+{
+    static const QString sql = QStringLiteral(
+        "SELECT MAX(n) FROM ("
+        "SELECT MAX(photo_no) AS n FROM assets "
+        "UNION ALL SELECT MAX(CAST(photo_number AS INTEGER)) FROM assets "
+        "WHERE photo_no IS NULL AND photo_number IS NOT NULL)");
+    return sql;
+}
+
+// develop_history holds one row per saved edit of an asset. Every
+// kHistorySnapshotInterval-th step stores the full state and the others only
+// the fields that changed, so restoring any step decodes one snapshot and a
+// bounded number of small deltas.
+constexpr int kHistorySnapshotInterval = 32;
+
+// An original copied into the library whose row is not written yet.
+struct StagedImport
+{
+    QString sourceFile;
+    QString fileName;
+    QString format;
+    QString originalRelativePath;
+    int photoNumber = 0;
+    qint64 assetId = -1;
+};
+
+struct DevelopState
+{
+    DevelopAdjustments adjustments;
+    qint64 historySeq = 0; // 0 until the asset's first recorded edit
+};
+
+bool readDevelopState(const QSqlDatabase &db, qint64 assetId, DevelopState *state, QString *errorMessage)
+{
+    QSqlQuery *query = DatabaseConnectionPool::instance().cachedQuery(db, QStringLiteral(
+        "SELECT COALESCE(p.payload, a.payload), a.history_seq FROM develop_adjustments a "
+        "LEFT JOIN develop_payloads p ON p.id = a.payload_id "
+        "WHERE a.asset_id = ?"), errorMessage);
+    if (!query) {
+        return false;
+    }
+
+    query->bindValue(0, assetId);
+    if (!query->exec()) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Failed to read develop adjustments: %1").arg(query->lastError().text());
+        }
+        query->finish();
+        return false;
+    }
+
+    *state = DevelopState();
+    if (query->next()) {
+        state->adjustments = deserializeAdjustments(query->value(0).toByteArray());
+        state->historySeq = query->value(1).toLongLong();
+    }
+    query->finish();
+    return true;
+}
+
+bool insertHistoryStep(const QSqlDatabase &db,
+                       qint64 assetId,
+                       qint64 seq,
+                       bool snapshot,
+                       const QByteArray &payload,
+                       const QString &timestamp,
+                       QString *errorMessage)
+{
+    QSqlQuery *insert = DatabaseConnectionPool::instance().cachedQuery(db, QStringLiteral(
+        "INSERT INTO develop_history(asset_id, seq, is_snapshot, payload, created_at) "
+        "VALUES(?, ?, ?, ?, ?)"), errorMessage);
+    if (!insert) {
+        return false;
+    }
+
+    insert->bindValue(0, assetId);
+    insert->bindValue(1, seq);
+    insert->bindValue(2, snapshot ? 1 : 0);
+    insert->bindValue(3, payload);
+    insert->bindValue(4, timestamp);
+    const bool ok = insert->exec();
+    if (!ok && errorMessage) {
+        *errorMessage = QStringLiteral("Failed to record develop history: %1").arg(insert->lastError().text());
+    }
+    insert->finish();
+    return ok;
+}
+
+// Records next as the step after the asset's current position and returns
+// the position to store with it: unchanged when next equals the current
+// state, -1 on failure. Steps undone before this edit are discarded.
+qint64 recordDevelopEdit(const QSqlDatabase &db,
+                         qint64 assetId,
+                         const DevelopAdjustments &next,
+                         const QByteArray &payload,
+                         const QString &timestamp,
+                         QString *errorMessage)
+{
+    DevelopState state;
+    if (!readDevelopState(db, assetId, &state, errorMessage)) {
+        return -1;
+    }
+    if (serializeAdjustments(state.adjustments) == payload) {
+        return state.historySeq;
+    }
+
+    QSqlQuery *discard = DatabaseConnectionPool::instance().cachedQuery(db, QStringLiteral(
+        "DELETE FROM develop_history WHERE asset_id = ? AND seq > ?"), errorMessage);
+    if (!discard) {
+        return -1;
+    }
+    discard->bindValue(0, assetId);
+    discard->bindValue(1, state.historySeq);
+    const bool discarded = discard->exec();
+    if (!discarded && errorMessage) {
+        *errorMessage = QStringLiteral("Failed to discard undone edits: %1").arg(discard->lastError().text());
+    }
+    discard->finish();
+    if (!discarded) {
+        return -1;
+    }
+
+    qint64 seq = state.historySeq;
+    if (seq == 0) {
+        // The state before the first recorded edit, so that edit can be undone.
+        if (!insertHistoryStep(db, assetId, ++seq, true, serializeAdjustments(state.adjustments), timestamp, errorMessage)) {
+            return -1;
+        }
+    }
+
+    ++seq;
+    const bool snapshot = (seq - 1) % kHistorySnapshotInterval == 0;
+    const QByteArray step = snapshot ? payload : serializeAdjustmentsDelta(state.adjustments, next);
+    if (!insertHistoryStep(db, assetId, seq, snapshot, step, timestamp, errorMessage)) {
+        return -1;
+    }
+    return seq;
+}
+
+// Rebuilds the state at history step seq from the nearest snapshot at or
+// before it.
+bool developStateAt(const QSqlDatabase &db, qint64 assetId, qint64 seq, DevelopAdjustments *adjustments, QString *errorMessage)
+{
+    QSqlQuery *query = DatabaseConnectionPool::instance().cachedQuery(db, QStringLiteral(
+        "SELECT is_snapshot, payload FROM develop_history "
+        "WHERE asset_id = ? AND seq <= ? AND seq >= ("
+        "SELECT MAX(seq) FROM develop_history WHERE asset_id = ? AND seq <= ? AND is_snapshot = 1"
+        ") ORDER BY seq"), errorMessage);
+    if (!query) {
+        return false;
+    }
+
+    query->bindValue(0, assetId);
+    query->bindValue(1, seq);
+    query->bindValue(2, assetId);
+    query->bindValue(3, seq);
+    if (!query->exec()) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Failed to read develop history: %1").arg(query->lastError().text());
+        }
+        query->finish();
+        return false;
+    }
+
+    bool first = true;
+    bool ok = true;
+    while (query->next()) {
+        const QByteArray payload = query->value(1).toByteArray();
+        if (first) {
+            ok = query->value(0).toBool();
+            *adjustments = deserializeAdjustments(payload);
+            first = false;
+        } else {
+            ok = applyAdjustmentsDelta(*adjustments, payload) && ok;
+        }
+    }
+    query->finish();
+
+    if (first || !ok) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Develop history of asset %1 is incomplete").arg(assetId);
+        }
+        return false;
+    }
+    return true;
+}
+
+QVariant historySeqValue(qint64 seq)
+{
+    return seq > 0 ? QVariant(seq) : QVariant();
+}
+
+// Ordered sort key of the asset listing. The last expression is always
+// a.id so every row has a unique key, which keyset pagination relies on.
+struct AssetSortKey
+{
+    QStringList expressions;
+    QVector<bool> descending;
+
+    void add(const QString &expression, bool isDescending)
+    {
+        expressions.append(expression);
+        descending.append(isDescending);
+    }
+
+    // Row-value comparisons only work when all columns sort the same way.
+    bool supportsKeyset() const
+    {
+        return !descending.isEmpty() && descending.count(descending.first()) == descending.size();
+    }
+};
+
+// Keys for the assets (a) LEFT JOIN meta.asset_metadata (m) listing. Assets
+// without a metadata row have NULL m.* columns, so those are coalesced to
+// keep row-value comparisons well defined.
+AssetSortKey assetSortKey(FilterOptions::SortOrder sortOrder, bool metadataAttached)
+{
+    AssetSortKey key;
+    if (!metadataAttached) {
+        switch (sortOrder) {
+        case FilterOptions::SortByDateAsc:
+            key.add(QStringLiteral("a.imported_at"), false);
+            key.add(QStringLiteral("a.id"), false);
+            break;
+        case FilterOptions::SortByFileName:
+            key.add(QStringLiteral("a.file_name"), false);
+            key.add(QStringLiteral("a.id"), false);
+            break;
+        default:
+            key.add(QStringLiteral("a.imported_at"), true);
+            key.add(QStringLiteral("a.id"), true);
+            break;
+        }
+        return key;
+    }
+
+    const QString captureEpoch = QStringLiteral("COALESCE(m.capture_epoch, 0)");
+    switch (sortOrder) {
+    case FilterOptions::SortByDateDesc:
+        // Assets with a capture time first
+        key.add(QStringLiteral("(m.capture_epoch IS NOT NULL)"), true);
+        key.add(captureEpoch, true);
+        key.add(QStringLiteral("a.id"), true);
+        break;
+    case FilterOptions::SortByDateAsc:
+        key.add(QStringLiteral("(m.capture_epoch IS NULL)"), false);
+        key.add(captureEpoch, false);
+        key.add(QStringLiteral("a.id"), false);
+        break;
+    case FilterOptions::SortByIsoDesc:
+        key.add(QStringLiteral("COALESCE(m.iso, 0)"), true);
+        key.add(QStringLiteral("a.id"), true);
+        break;
+    case FilterOptions::SortByIsoAsc:
+        key.add(QStringLiteral("COALESCE(m.iso, 0)"), false);
+        key.add(QStringLiteral("a.id"), false);
+        break;
+    case FilterOptions::SortByCameraMake:
+        key.add(QStringLiteral("COALESCE(m.camera_make, '')"), false);
+        key.add(QStringLiteral("COALESCE(m.camera_model, '')"), false);
+        key.add(captureEpoch, true);
+        key.add(QStringLiteral("a.id"), true);
+        break;
+    case FilterOptions::SortByFileName:
+        key.add(QStringLiteral("a.file_name"), false);
+        key.add(QStringLiteral("a.id"), false);
+        break;
+    }
+    return key;
+}
+
+QString orderByClause(const AssetSortKey &key)
+{
+    QStringList terms;
+    for (int i = 0; i < key.expressions.size(); ++i) {
+        terms.append(key.expressions.at(i) + (key.descending.at(i) ? QStringLiteral(" DESC") : QStringLiteral(" ASC")));
+    }
+    return QStringLiteral("ORDER BY %1").arg(terms.join(QStringLiteral(", ")));
+}
+
+// "(k1, k2, ...) > (?, ?, ...)": rows strictly after the given key.
+QString keysetCondition(const AssetSortKey &key)
+{
+    QStringList placeholders;
+    for (int i = 0; i < key.expressions.size(); ++i) {
+        placeholders.append(QStringLiteral("?"));
+    }
+    return QStringLiteral("(%1) %2 (%3)")
+        .arg(key.expressions.join(QStringLiteral(", ")),
+             key.descending.first() ? QStringLiteral("<") : QStringLiteral(">"),
+             placeholders.join(QStringLiteral(", ")));
+}
+
+QString appendCondition(const QString &whereClause, const QString &condition)
+{
+    if (whereClause.isEmpty()) {
+        return QStringLiteral("WHERE %1").arg(condition);
+    }
+    return QStringLiteral("%1 AND %2").arg(whereClause, condition);
+}
+
+// SQL stand-in for FilterOptions::similarToAssetId while the asset index is
+// still loading. SQLite cannot count bits, so the hashes are compared in
+// findSimilarAssets(); the matches are bound through a temp table on the
+// calling thread's connection so the statement text never changes. The
+// table is only refilled when it holds a different match set. Empty when
+// there is no similarity filter.
+QString similarityCondition(const QString &dbPath, const SimilarAssetMatches *matches)
+{
+    if (!matches) {
+        return {};
+    }
+    if (matches->assetIds.isEmpty()) {
+        return QStringLiteral("0");
+    }
+
+    DatabaseConnectionPool &pool = DatabaseConnectionPool::instance();
+    QString connectionError;
+    QSqlDatabase db = pool.connection(dbPath, &connectionError);
+    if (!db.isOpen()) {
+        qWarning() << "Failed to open pooled library connection for similarity filter:" << connectionError;
+        return QStringLiteral("0");
+    }
+    QSqlQuery setup(db);
+    if (!setup.exec(QStringLiteral("CREATE TEMP TABLE IF NOT EXISTS similar_assets(asset_id INTEGER PRIMARY KEY)"))
+        || !setup.exec(QStringLiteral("CREATE TEMP TABLE IF NOT EXISTS similar_assets_serial(serial INTEGER NOT NULL)"))) {
+        qWarning() << "Failed to create similarity match table:" << setup.lastError();
+        return QStringLiteral("0");
+    }
+
+    QSqlQuery *current = pool.cachedQuery(dbPath, QStringLiteral("SELECT serial FROM temp.similar_assets_serial"), &connectionError);
+    if (!current) {
+        qWarning() << "Failed to prepare similarity match lookup:" << connectionError;
+        return QStringLiteral("0");
+    }
+    const bool bound = current->exec() && current->next() && current->value(0).toULongLong() == matches->serial;
+    current->finish();
+    if (bound) {
+        return QStringLiteral("a.id IN (SELECT asset_id FROM temp.similar_assets)");
+    }
+
+    QSqlQuery *insert = pool.cachedQuery(dbPath, QStringLiteral("INSERT INTO temp.similar_assets(asset_id) VALUES(?)"), &connectionError);
+    QSqlQuery *mark = pool.cachedQuery(dbPath, QStringLiteral("INSERT INTO temp.similar_assets_serial(serial) VALUES(?)"), &connectionError);
+    if (!insert || !mark) {
+        qWarning() << "Failed to prepare similarity match insert:" << connectionError;
+        return QStringLiteral("0");
+    }
+    bool ok = setup.exec(QStringLiteral("SAVEPOINT similar_assets"))
+        && setup.exec(QStringLiteral("DELETE FROM temp.similar_assets"))
+        && setup.exec(QStringLiteral("DELETE FROM temp.similar_assets_serial"));
+    for (int i = 0; ok && i < matches->assetIds.size(); ++i) {
+        insert->bindValue(0, matches->assetIds.at(i));
+        ok = insert->exec();
+    }
+    insert->finish();
+    if (ok) {
+        mark->bindValue(0, qint64(matches->serial));
+        ok = mark->exec();
+        mark->finish();
+    }
+    if (!ok) {
+        qWarning() << "Failed to store similarity matches:" << insert->lastError() << setup.lastError();
+        setup.exec(QStringLiteral("ROLLBACK TO similar_assets"));
+    }
+    setup.exec(QStringLiteral("RELEASE similar_assets"));
+    return ok ? QStringLiteral("a.id IN (SELECT asset_id FROM temp.similar_assets)") : QStringLiteral("0");
+}
+
+// SQL stand-in for the FilterOptions mark filters while the asset index is
+// still loading. Expects asset_marks joined as k; assets without a row
+// there are unmarked. Empty when no mark filter is set.
+QString marksCondition(const FilterOptions &options)
+{
+    const QString marks = QStringLiteral("COALESCE(k.marks, 0)");
+    QStringList conditions;
+    if (options.minRating > 0) {
+        conditions.append(QStringLiteral("(%1 & %2) >= %3").arg(marks).arg(AssetMarks::kRatingMask).arg(options.minRating));
+    }
+
+    const QString flag = QStringLiteral("((%1 & %2) >> 3)").arg(marks).arg(AssetMarks::kFlagMask);
+    switch (options.flagFilter) {
+    case FilterOptions::AnyFlag:
+        break;
+    case FilterOptions::PickedOnly:
+        conditions.append(QStringLiteral("%1 = %2").arg(flag).arg(AssetMarks::Picked));
+        break;
+    case FilterOptions::UnflaggedOnly:
+        conditions.append(QStringLiteral("%1 = %2").arg(flag).arg(AssetMarks::Unflagged));
+        break;
+    case FilterOptions::RejectedOnly:
+        conditions.append(QStringLiteral("%1 = %2").arg(flag).arg(AssetMarks::Rejected));
+        break;
+    case FilterOptions::HideRejected:
+        conditions.append(QStringLiteral("%1 <> %2").arg(flag).arg(AssetMarks::Rejected));
+        break;
+    }
+
+    if (options.colorLabels != 0) {
+        conditions.append(QStringLiteral("((%1 >> ((%2 & %3) >> 5)) & 1) = 1")
+                              .arg(options.colorLabels).arg(marks).arg(AssetMarks::kLabelMask));
+    }
+    return conditions.join(QStringLiteral(" AND "));
+}
+
+// Smart collection rules are stored as JSON holding the predicate fields.
+QByteArray encodeCollectionRule(const FilterOptions &rule)
+{
+    QJsonObject object;
+    object.insert(QStringLiteral("isoMin"), rule.isoMin);
+    object.insert(QStringLiteral("isoMax"), rule.isoMax);
+    object.insert(QStringLiteral("camera"), rule.cameraMake);
+    object.insert(QStringLiteral("lens"), rule.lens);
+    object.insert(QStringLiteral("tags"), QJsonArray::fromStringList(rule.tags));
+    object.insert(QStringLiteral("matchAllTags"), rule.tagMatch == FilterOptions::MatchAllTags);
+    object.insert(QStringLiteral("excludedTags"), QJsonArray::fromStringList(rule.excludedTags));
+    object.insert(QStringLiteral("minRating"), rule.minRating);
+    object.insert(QStringLiteral("flag"), int(rule.flagFilter));
+    object.insert(QStringLiteral("labels"), int(rule.colorLabels));
+    return QJsonDocument(object).toJson(QJsonDocument::Compact);
+}
+
+FilterOptions decodeCollectionRule(const QByteArray &data)
+{
+    const auto toStringList = [](const QJsonValue &value) {
+        QStringList result;
+        for (const QJsonValue &item : value.toArray()) {
+            result.append(item.toString());
+        }
+        return result;
+    };
+
+    const QJsonObject object = QJsonDocument::fromJson(data).object();
+    FilterOptions rule;
+    rule.isoMin = object.value(QStringLiteral("isoMin")).toInt();
+    rule.isoMax = object.value(QStringLiteral("isoMax")).toInt();
+    rule.cameraMake = object.value(QStringLiteral("camera")).toString();
+    rule.lens = object.value(QStringLiteral("lens")).toString();
+    rule.tags = toStringList(object.value(QStringLiteral("tags")));
+    rule.tagMatch = object.value(QStringLiteral("matchAllTags")).toBool() ? FilterOptions::MatchAllTags
+                                                                         : FilterOptions::MatchAnyTag;
+    rule.excludedTags = toStringList(object.value(QStringLiteral("excludedTags")));
+    rule.minRating = qBound(0, object.value(QStringLiteral("minRating")).toInt(), int(AssetMarks::kMaxRating));
+    const int flag = object.value(QStringLiteral("flag")).toInt();
+    rule.flagFilter = flag >= FilterOptions::AnyFlag && flag <= FilterOptions::HideRejected
+        ? static_cast<FilterOptions::FlagFilter>(flag)
+        : FilterOptions::AnyFlag;
+    rule.colorLabels = quint8(object.value(QStringLiteral("labels")).toInt());
+    return rule;
+}
+
+// SQL stand-in for FilterOptions::collectionId while the asset index is
+// still loading: the collection's rule is applied as further conditions.
+// Expects the aliases queryAssets() uses. A rule on metadata matches
+// nothing while the metadata cache is not attached, rather than briefly
+// showing the whole library. Empty when no collection is selected.
+QString collectionCondition(const QString &dbPath,
+                            const FilterOptions &options,
+                            bool metadataAttached,
+                            QVariantList *bindValues)
+{
+    if (options.collectionId < 0) {
+        return {};
+    }
+
+    QString connectionError;
+    QSqlQuery *query = DatabaseConnectionPool::instance().cachedQuery(dbPath, QStringLiteral(
+        "SELECT rule FROM smart_collections WHERE id = ?"), &connectionError);
+    if (!query) {
+        qWarning() << "Failed to prepare smart collection lookup:" << connectionError;
+        return QStringLiteral("0");
+    }
+    query->bindValue(0, options.collectionId);
+    const bool found = query->exec() && query->next();
+    const FilterOptions rule = found ? decodeCollectionRule(query->value(0).toByteArray()) : FilterOptions();
+    query->finish();
+    if (!found) {
+        return QStringLiteral("0");
+    }
+
+    QStringList conditions;
+    QVariantList metadataBindValues;
+    const QString where = MetadataCache::filterWhereClause(rule, QStringLiteral("m."), &metadataBindValues, QStringLiteral("a.id"));
+    if (where.startsWith(QLatin1String("WHERE "))) {
+        if (!metadataAttached) {
+            return QStringLiteral("0");
+        }
+        conditions.append(where.mid(6));
+        bindValues->append(metadataBindValues);
+    }
+    const QString marks = marksCondition(rule);
+    if (!marks.isEmpty()) {
+        conditions.append(marks);
+    }
+    return conditions.isEmpty() ? QStringLiteral("1") : conditions.join(QStringLiteral(" AND "));
+}
+
+// Version 1: the layout libraries had before versioning was introduced.
+// Every statement tolerates a database that already has it.
+bool createBaseSchema(QSqlDatabase &db, QString *errorMessage)
+{
+    const QStringList statements = {
+        QStringLiteral("CREATE TABLE IF NOT EXISTS assets ("
+                       "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                       "file_name TEXT NOT NULL,"
+                       "photo_number TEXT,"
+                       "original_path TEXT NOT NULL,"
+                       "preview_path TEXT,"
+                       "format TEXT,"
+                       "width INTEGER DEFAULT 0,"
+                       "height INTEGER DEFAULT 0,"
+                       "imported_at TEXT NOT NULL"
+                       ")"),
+        QStringLiteral("CREATE TABLE IF NOT EXISTS develop_adjustments ("
+                       "asset_id INTEGER PRIMARY KEY,"
+                       "payload TEXT NOT NULL,"
+                       "updated_at TEXT NOT NULL,"
+                       "FOREIGN KEY(asset_id) REFERENCES assets(id) ON DELETE CASCADE"
+                       ")"),
+        QStringLiteral("CREATE INDEX IF NOT EXISTS idx_develop_adjustments_updated_at ON develop_adjustments(updated_at DESC)"),
+    };
+
+    return SchemaMigrator::exec(db, statements, errorMessage)
+        && SchemaMigrator::addColumn(db, QStringLiteral("assets"), QStringLiteral("photo_number"), QStringLiteral("TEXT"), errorMessage);
+}
+
+// Version 2: number assets imported before photo numbers existed, in import
+// order after the highest number already assigned.
+bool assignMissingPhotoNumbers(QSqlDatabase &db, QString *errorMessage)
+{
+    QSqlQuery query(db);
+    int nextNumber = 0;
+    if (query.exec(QStringLiteral("SELECT MAX(CAST(photo_number AS INTEGER)) FROM assets")) && query.next()) {
+        nextNumber = query.value(0).toInt();
+    }
+    query.finish();
+
+    if (!query.exec(QStringLiteral("SELECT id FROM assets WHERE photo_number IS NULL OR TRIM(photo_number) = '' ORDER BY imported_at ASC, id ASC"))) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Failed to find assets missing photo numbers: %1").arg(query.lastError().text());
+        }
+        return false;
+    }
+
+    QSqlQuery update(db);
+    update.prepare(QStringLiteral("UPDATE assets SET photo_number = ? WHERE id = ?"));
+    while (query.next()) {
+        update.bindValue(0, QString::number(++nextNumber));
+        update.bindValue(1, query.value(0).toLongLong());
+        if (!update.exec()) {
+            if (errorMessage) {
+                *errorMessage = QStringLiteral("Failed to assign photo number: %1").arg(update.lastError().text());
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+// Version 3: an integer copy of photo_number so the next number is an index
+// lookup, plus covering indexes for the orders the listing uses when no
+// metadata is attached and for file name order. Existing rows get photo_no
+// from backfillPhotoNumbers() after the library has opened.
+bool addTypedSortColumns(QSqlDatabase &db, QString *errorMessage)
+{
+    return SchemaMigrator::addColumn(db, QStringLiteral("assets"), QStringLiteral("photo_no"), QStringLiteral("INTEGER"), errorMessage)
+        && SchemaMigrator::exec(db, {
+               QStringLiteral("CREATE INDEX IF NOT EXISTS idx_assets_photo_no ON assets(photo_no)"),
+               QStringLiteral("CREATE INDEX IF NOT EXISTS idx_assets_missing_photo_no ON assets(id) "
+                              "WHERE photo_no IS NULL AND photo_number IS NOT NULL"),
+               QStringLiteral("CREATE INDEX IF NOT EXISTS idx_assets_imported_at ON assets(imported_at, id)"),
+               QStringLiteral("CREATE INDEX IF NOT EXISTS idx_assets_file_name ON assets(file_name, id)"),
+           }, errorMessage);
+}
+
+// Version 4: key/value state of the library itself. The storage layout
+// starts at 0 so libraries from before the check was versioned are verified
+// once.
+bool createLibraryMeta(QSqlDatabase &db, QString *errorMessage)
+{
+    return SchemaMigrator::exec(db, {
+        QStringLiteral("CREATE TABLE IF NOT EXISTS library_meta ("
+                       "key TEXT PRIMARY KEY,"
+                       "value TEXT NOT NULL"
+                       ") WITHOUT ROWID"),
+        QStringLiteral("INSERT OR IGNORE INTO library_meta(key, value) VALUES('storage_layout_version', '0')"),
+    }, errorMessage);
+}
+
+// Version 5: adjustments pasted onto many assets store their payload once in
+// develop_payloads and reference it by payload_id, leaving payload empty. A
+// shared payload is dropped when its last reference goes.
+bool addSharedDevelopPayloads(QSqlDatabase &db, QString *errorMessage)
+{
+    return SchemaMigrator::exec(db, {
+               QStringLiteral("CREATE TABLE IF NOT EXISTS develop_payloads ("
+                              "id INTEGER PRIMARY KEY,"
+                              "payload TEXT NOT NULL"
+                              ")"),
+           }, errorMessage)
+        && SchemaMigrator::addColumn(db, QStringLiteral("develop_adjustments"), QStringLiteral("payload_id"),
+                                     QStringLiteral("INTEGER REFERENCES develop_payloads(id)"), errorMessage)
+        && SchemaMigrator::exec(db, {
+               QStringLiteral("CREATE INDEX IF NOT EXISTS idx_develop_adjustments_payload_id "
+                              "ON develop_adjustments(payload_id) WHERE payload_id IS NOT NULL"),
+               QStringLiteral("CREATE TRIGGER IF NOT EXISTS develop_payloads_release_update "
+                              "AFTER UPDATE OF payload_id ON develop_adjustments "
+                              "WHEN old.payload_id IS NOT NULL AND old.payload_id IS NOT new.payload_id BEGIN "
+                              "DELETE FROM develop_payloads WHERE id = old.payload_id "
+                              "AND NOT EXISTS (SELECT 1 FROM develop_adjustments WHERE payload_id = old.payload_id); "
+                              "END"),
+               QStringLiteral("CREATE TRIGGER IF NOT EXISTS develop_payloads_release_delete "
+                              "AFTER DELETE ON develop_adjustments "
+                              "WHEN old.payload_id IS NOT NULL BEGIN "
+                              "DELETE FROM develop_payloads WHERE id = old.payload_id "
+                              "AND NOT EXISTS (SELECT 1 FROM develop_adjustments WHERE payload_id = old.payload_id); "
+                              "END"),
+           }, errorMessage);
+}
+
+// Version 6: append-only develop history. Adjustments stored as JSON text
+// stay readable and are re-encoded to the compact binary form by
+// reencodeDevelopPayloads() after the library has opened.
+bool addDevelopHistory(QSqlDatabase &db, QString *errorMessage)
+{
+    return SchemaMigrator::exec(db, {
+               QStringLiteral("CREATE TABLE IF NOT EXISTS develop_history ("
+                              "asset_id INTEGER NOT NULL,"
+                              "seq INTEGER NOT NULL,"
+                              "is_snapshot INTEGER NOT NULL,"
+                              "payload BLOB NOT NULL,"
+                              "created_at TEXT NOT NULL,"
+                              "PRIMARY KEY(asset_id, seq)"
+                              ") WITHOUT ROWID"),
+           }, errorMessage)
+        && SchemaMigrator::addColumn(db, QStringLiteral("develop_adjustments"), QStringLiteral("history_seq"),
+                                     QStringLiteral("INTEGER"), errorMessage);
+}
+
+// Version 7: finds the asset behind a changed original without a scan.
+bool indexOriginalPaths(QSqlDatabase &db, QString *errorMessage)
+{
+    return SchemaMigrator::exec(db, {
+        QStringLiteral("CREATE INDEX IF NOT EXISTS idx_assets_original_path ON assets(original_path)"),
+    }, errorMessage);
+}
+
+// Version 8: perceptual hashes of the previews, for similarity queries.
+// Rows still to be hashed are found through a partial index.
+bool addPerceptualHashes(QSqlDatabase &db, QString *errorMessage)
+{
+    return SchemaMigrator::addColumn(db, QStringLiteral("assets"), QStringLiteral("phash"), QStringLiteral("INTEGER"), errorMessage)
+        && SchemaMigrator::exec(db, {
+               QStringLiteral("CREATE INDEX IF NOT EXISTS idx_assets_missing_phash ON assets(id) WHERE phash IS NULL"),
+           }, errorMessage);
+}
+
+// Version 9: rating, flag and colour label packed into one byte per asset
+// (see assetmarks.h). Assets that were never marked have no row.
+bool addAssetMarks(QSqlDatabase &db, QString *errorMessage)
+{
+    return SchemaMigrator::exec(db, {
+        QStringLiteral("CREATE TABLE IF NOT EXISTS asset_marks ("
+                       "asset_id INTEGER PRIMARY KEY,"
+                       "marks INTEGER NOT NULL,"
+                       "FOREIGN KEY(asset_id) REFERENCES assets(id) ON DELETE CASCADE"
+                       ")"),
+    }, errorMessage);
+}
+
+QString resolveLibraryPath(const QDir &root, const QString &path)
+{
+    return QDir::isAbsolutePath(path) ? path : root.filePath(path);
+}
+
+// Moves a stored file to expectedRel. Returns true when the file is at
+// expectedRel afterwards, including when an earlier pass moved it but was
+// interrupted before recording the new path.
+bool relocateStoredFile(const QDir &root, const QString &currentRel, const QString &expectedRel)
+{
+    const QString currentPath = resolveLibraryPath(root, currentRel);
+    const QString targetPath = root.filePath(expectedRel);
+    if (!QFile::exists(currentPath)) {
+        return QFile::exists(targetPath);
+    }
+
+    QFile::remove(targetPath);
+    if (!QFile::rename(currentPath, targetPath)) {
+        qWarning() << "Failed to move" << currentPath << "to" << targetPath;
+        return false;
+    }
+    return true;
+}
+
+// 0 means "not hashed" and is stored as NULL.
+QVariant perceptualHashValue(quint64 hash)
+{
+    return hash != 0 ? QVariant(qint64(hash)) : QVariant();
+}
+
+// Version 10: saved smart collections; their members are kept by the
+// asset index.
+bool addSmartCollections(QSqlDatabase &db, QString *errorMessage)
+{
+    return SchemaMigrator::exec(db, {
+        QStringLiteral("CREATE TABLE IF NOT EXISTS smart_collections ("
+                       "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                       "name TEXT NOT NULL,"
+                       "rule BLOB NOT NULL"
+                       ")"),
+    }, errorMessage);
+}
+
+// Column order: id, photo_number, file_name, original_path, preview_path, format, width, height, phash, marks
+LibraryAsset readAssetRow(const QSqlQuery &query)
+{
+    LibraryAsset asset;
+    asset.id = query.value(0).toLongLong();
+    asset.photoNumber = query.value(1).toString();
+    asset.fileName = query.value(2).toString();
+    asset.originalRelativePath = query.value(3).toString();
+    asset.previewRelativePath = query.value(4).toString();
+    asset.format = query.value(5).toString();
+    asset.width = query.value(6).toInt();
+    asset.height = query.value(7).toInt();
+    // Stored as SQLite's signed 64-bit integer.
+    asset.perceptualHash = quint64(query.value(8).toLongLong());
+    asset.marks = quint8(query.value(9).toUInt());
+    return asset;
+}
+
+// Copies photo_number into photo_no for up to batchSize assets from before
+// the column existed. Returns the number of rows filled, or -1 on failure.
+int backfillPhotoNumbers(const QSharedPointer<DatabaseWriter> &writer, int batchSize)
+{
+    const auto filled = QSharedPointer<int>::create(0);
+    QFuture<bool> written = writer->submit([filled, batchSize](QSqlDatabase &db, QString *errorMessage) {
+        QSqlQuery *update = DatabaseConnectionPool::instance().cachedQuery(db, QStringLiteral(
+            "UPDATE assets SET photo_no = CAST(photo_number AS INTEGER) WHERE id IN ("
+            "SELECT id FROM assets WHERE photo_no IS NULL AND photo_number IS NOT NULL LIMIT ?)"), errorMessage);
+        if (!update) {
+            return false;
+        }
+        update->bindValue(0, batchSize);
+        const bool ok = update->exec();
+        if (ok) {
+            *filled = update->numRowsAffected();
+        } else if (errorMessage) {
+            *errorMessage = update->lastError().text();
+        }
+        update->finish();
+        return ok;
+    });
+    written.waitForFinished();
+    return written.result() ? *filled : -1;
+}
+
+// Re-encodes up to batchSize develop payloads of table after afterKey that
+// are still JSON text in the binary form. Returns the last key examined, or
+// -1 once no rows remain.
+qint64 reencodeDevelopPayloads(const QSharedPointer<DatabaseWriter> &writer,
+                               const QString &table,
+                               const QString &keyColumn,
+                               qint64 afterKey,
+                               int batchSize)
+{
+    QString connectionError;
+    QSqlQuery *select = DatabaseConnectionPool::instance().cachedQuery(writer->databasePath(), QStringLiteral(
+        "SELECT %1, payload FROM %2 WHERE %1 > ? AND typeof(payload) = 'text' AND payload <> '' "
+        "ORDER BY %1 LIMIT ?").arg(keyColumn, table), &connectionError);
+    if (!select) {
+        qWarning() << "Failed to prepare develop payload re-encoding:" << connectionError;
+        return -1;
+    }
+
+    select->bindValue(0, afterKey);
+    select->bindValue(1, batchSize);
+    if (!select->exec()) {
+        qWarning() << "Failed to read JSON develop payloads:" << select->lastError();
+        select->finish();
+        return -1;
+    }
+    QVector<QPair<qint64, QByteArray>> rows;
+    while (select->next()) {
+        rows.append({select->value(0).toLongLong(),
+                     serializeAdjustments(deserializeAdjustments(select->value(1).toByteArray()))});
+    }
+    select->finish();
+    if (rows.isEmpty()) {
+        return -1;
+    }
+
+    // Rows saved again since the read are already binary and left alone.
+    const QString sql = QStringLiteral("UPDATE %1 SET payload = ? WHERE %2 = ? AND typeof(payload) = 'text'")
+                            .arg(table, keyColumn);
+    QFuture<bool> written = writer->submit([rows, sql](QSqlDatabase &db, QString *errorMessage) {
+        QSqlQuery *update = DatabaseConnectionPool::instance().cachedQuery(db, sql, errorMessage);
+        if (!update) {
+            return false;
+        }
+        for (const auto &row : rows) {
+            update->bindValue(0, row.second);
+            update->bindValue(1, row.first);
+            if (!update->exec()) {
+                if (errorMessage) {
+                    *errorMessage = update->lastError().text();
+                }
+                update->finish();
+                return false;
+            }
+        }
+        update->finish();
+        return true;
+    });
+    written.waitForFinished();
+    return written.result() ? rows.constLast().first : -1;
+}
+
+// Hashes the previews of up to batchSize assets after afterAssetId that were
+// generated before hashes existed. Returns the last asset id examined, or -1
+// once no rows remain.
+qint64 backfillPerceptualHashes(const QString &libraryPath,
+                                const QSharedPointer<DatabaseWriter> &writer,
+                                const QSharedPointer<AssetIndex> &index,
+                                qint64 afterAssetId,
+                                int batchSize)
+{
+    const QString dbPath = writer->databasePath();
+    DatabaseConnectionPool &pool = DatabaseConnectionPool::instance();
+    QString connectionError;
+    QSqlQuery *select = pool.cachedQuery(dbPath, QStringLiteral(
+        "SELECT id, preview_path FROM assets WHERE phash IS NULL AND id > ? ORDER BY id LIMIT ?"), &connectionError);
+    if (!select) {
+        qWarning() << "Failed to prepare perceptual hash backfill:" << connectionError;
+        return -1;
+    }
+
+    select->bindValue(0, afterAssetId);
+    select->bindValue(1, batchSize);
+    if (!select->exec()) {
+        qWarning() << "Failed to read assets without perceptual hashes:" << select->lastError();
+        select->finish();
+        return -1;
+    }
+    QVector<QPair<qint64, QString>> pending;
+    while (select->next()) {
+        pending.append(qMakePair(select->value(0).toLongLong(), select->value(1).toString()));
+    }
+    select->finish();
+    if (pending.isEmpty()) {
+        return -1;
+    }
+
+    // Assets without a readable preview are skipped and hashed when their
+    // preview is next generated.
+    const QDir root(libraryPath);
+    QVector<QPair<qint64, quint64>> hashes;
+    for (const auto &asset : std::as_const(pending)) {
+        if (asset.second.isEmpty()) {
+            continue;
+        }
+        const quint64 hash = PerceptualHash::compute(QImage(resolveLibraryPath(root, asset.second)));
+        if (hash != 0) {
+            hashes.append(qMakePair(asset.first, hash));
+        }
+    }
+
+    if (!hashes.isEmpty()) {
+        QFuture<bool> written = writer->submit([hashes](QSqlDatabase &db, QString *errorMessage) {
+            QSqlQuery *update = DatabaseConnectionPool::instance().cachedQuery(db, QStringLiteral(
+                "UPDATE assets SET phash = ? WHERE id = ? AND phash IS NULL"), errorMessage);
+            if (!update) {
+                return false;
+            }
+            for (const auto &entry : hashes) {
+                update->bindValue(0, qint64(entry.second));
+                update->bindValue(1, entry.first);
+                if (!update->exec()) {
+                    if (errorMessage) {
+                        *errorMessage = update->lastError().text();
+                    }
+                    update->finish();
+                    return false;
+                }
+            }
+            update->finish();
+            return true;
+        });
+        written.waitForFinished();
+        if (!written.result()) {
+            return -1;
+        }
+        index->updatePerceptualHashes(hashes);
+    }
+    return pending.constLast().first;
+}
 }
 
 LibraryManager::LibraryManager(QObject *parent)
     : QObject(parent)
     , m_previewGenerator(new PreviewGenerator(this))
     , m_metadataCache(new MetadataCache(this))
+    , m_assetIndex(QSharedPointer<AssetIndex>::create())
+    , m_folderWatcher(new FolderWatcher(this))
 {
     // Register LibraryAsset for use with queued connections
     qRegisterMetaType<LibraryAsset>("LibraryAsset");
     qRegisterMetaType<QVector<LibraryAsset>>("QVector<LibraryAsset>");
+    connect(m_folderWatcher, &FolderWatcher::originalsModified, this, &LibraryManager::handleOriginalsModified);
+    connect(m_folderWatcher, &FolderWatcher::originalsRemoved, this, &LibraryManager::handleOriginalsRemoved);
+    connect(m_folderWatcher, &FolderWatcher::hotFolderFilesArrived, this, &LibraryManager::importHotFolderFiles);
+    connect(m_metadataCache, &MetadataCache::metadataUpdated, this, [this](qint64 assetId) {
+        m_assetIndex->updateMetadata(m_metadataCache->loadMetadata(assetId));
+    });
     connect(m_previewGenerator, &PreviewGenerator::previewReady, this, [this](const PreviewResult &result) {
         if (!hasOpenLibrary()) {
             return;
@@ -75,18 +1019,37 @@ LibraryManager::LibraryManager(QObject *parent)
             m_jobManager->completeJob(jobId, tr("Preview generated"));
         }
 
-        QSqlQuery update(m_database);
-        update.prepare(QStringLiteral("UPDATE assets SET preview_path = ?, width = ?, height = ? WHERE id = ?"));
+        // The preview file already exists, so views are updated right away
+        // and the row is written behind them.
         const QString relativePreview = QDir(m_libraryPath).relativeFilePath(result.previewPath);
-        update.addBindValue(relativePreview);
-        update.addBindValue(result.imageSize.width());
-        update.addBindValue(result.imageSize.height());
-        update.addBindValue(result.assetId);
+        const qint64 assetId = result.assetId;
+        const int width = result.imageSize.width();
+        const int height = result.imageSize.height();
+        const quint64 perceptualHash = result.perceptualHash;
+        m_writer->submit([assetId, relativePreview, width, height, perceptualHash](QSqlDatabase &db, QString *errorMessage) {
+            QSqlQuery *update = DatabaseConnectionPool::instance().cachedQuery(db, QStringLiteral(
+                "UPDATE assets SET preview_path = ?, width = ?, height = ?, phash = ? WHERE id = ?"), errorMessage);
+            if (!update) {
+                return false;
+            }
+            update->bindValue(0, relativePreview);
+            update->bindValue(1, width);
+            update->bindValue(2, height);
+            update->bindValue(3, perceptualHashValue(perceptualHash));
+            update->bindValue(4, assetId);
+            const bool ok = update->exec();
+            if (!ok && errorMessage) {
+                *errorMessage = update->lastError().text();
+            }
+            update->finish();
+            return ok;
+        }).then(this, [this](bool committed) {
+            if (!committed) {
+                emit errorOccurred(QStringLiteral("Failed to update preview metadata."));
+            }
+        });
 
-        if (!update.exec()) {
-            emit errorOccurred(QStringLiteral("Failed to update preview metadata: %1").arg(update.lastError().text()));
-            return;
-        }
+        m_assetIndex->updatePreview(assetId, relativePreview, width, height, perceptualHash);
 
         emit assetPreviewUpdated(result.assetId, result.previewPath);
         emit assetsChanged();
@@ -138,20 +1101,17 @@ bool LibraryManager::createLibrary(const QString &directoryPath, QString *errorM
         return false;
     }
 
+    DatabaseConnectionPool::configureConnection(db);
+
     m_libraryPath = directoryPath;
     m_database = db;
 
-    if (!initializeDatabaseSchema(errorMessage)) {
-        closeLibrary();
-        return false;
-    }
-
-    if (!ensureDevelopAdjustmentsTable(errorMessage)) {
+    if (!migrateDatabaseSchema(errorMessage)) {
         closeLibrary();
         return false;
     }
 
-    ensurePhotoNumberSupport();
+    m_writer = QSharedPointer<DatabaseWriter>::create(databasePath());
 
     // Open metadata cache
     if (m_metadataCache) {
@@ -162,6 +1122,11 @@ bool LibraryManager::createLibrary(const QString &directoryPath, QString *errorM
         }
     }
 
+    startAssetIndexLoad();
+    startCaptureEpochBackfill();
+    startStorageConsistencyCheck();
+    startFolderWatch();
+
     emit libraryOpened(m_libraryPath);
     emit assetsChanged();
     return true;
@@ -209,19 +1174,17 @@ bool LibraryManager::openLibrary(const QString &directoryPath, QString *errorMes
         return false;
     }
 
+    DatabaseConnectionPool::configureConnection(db);
+
     m_libraryPath = directoryPath;
     m_database = db;
 
-    QString adjustmentsError;
-    if (!ensureDevelopAdjustmentsTable(&adjustmentsError)) {
-        if (errorMessage) {
-            *errorMessage = adjustmentsError;
-        }
+    if (!migrateDatabaseSchema(errorMessage)) {
         closeLibrary();
         return false;
     }
 
-    ensurePhotoNumberSupport();
+    m_writer = QSharedPointer<DatabaseWriter>::create(databasePath());
 
     // Open metadata cache
     if (m_metadataCache) {
@@ -232,6 +1195,23 @@ bool LibraryManager::openLibrary(const QString &directoryPath, QString *errorMes
         }
     }
 
+    // The grid is served from the snapshot written at the last close while
+    // the databases are read and reconciled in the background.
+    const QString snapshot = snapshotPath();
+    QString snapshotError;
+    if (QFile::exists(snapshot)
+        && !m_assetIndex->loadSnapshot(m_assetIndex->reset(), snapshot, &snapshotError)) {
+        qWarning() << "Ignoring asset snapshot:" << snapshotError;
+    }
+    for (const SmartCollection &collection : smartCollections()) {
+        m_assetIndex->setCollection(collection.id, collection.rule);
+    }
+
+    startAssetIndexLoad();
+    startCaptureEpochBackfill();
+    startStorageConsistencyCheck();
+    startFolderWatch();
+
     emit libraryOpened(m_libraryPath);
     emit assetsChanged();
     return true;
@@ -239,6 +1219,9 @@ bool LibraryManager::openLibrary(const QString &directoryPath, QString *errorMes
 
 void LibraryManager::closeLibrary()
 {
+    m_folderWatcher->unwatchAll();
+    m_hotFolderImports.waitForFinished();
+
     if (m_jobManager) {
         for (const QUuid &jobId : std::as_const(m_previewJobIds)) {
             if (!jobId.isNull()) {
@@ -280,14 +1263,50 @@ void LibraryManager::closeLibrary()
     }
     m_metadataExtractionWatchers.clear();
 
-    if (m_metadataCache) {
-        m_metadataCache->closeCache();
+    if (m_backfillCancelled) {
+        m_backfillCancelled->storeRelaxed(1);
+        m_backfillCancelled.reset();
     }
 
-    if (!m_connectionName.isEmpty()) {
-        if (m_database.isOpen()) {
-            m_database.close();
-        }
+    // An interrupted storage pass resumes from its saved cursor next time.
+    if (m_storageCheckCancelled) {
+        m_storageCheckCancelled->storeRelaxed(1);
+        m_storageCheckCancelled.reset();
+    }
+    m_relocatedOriginals.reset();
+    if (m_jobManager && !m_storageCheckJobId.isNull()) {
+        m_jobManager->cancelJob(m_storageCheckJobId, tr("Library closed"));
+    }
+    m_storageCheckJobId = QUuid();
+
+    if (m_writer) {
+        // Queued writes still land before the connections are released.
+        m_writer->stop();
+        m_writer.reset();
+    }
+
+    if (m_metadataCache) {
+        m_metadataCache->closeCache();
+    }
+
+    if (!m_libraryPath.isEmpty() && m_assetIndex->isLoaded()) {
+        QString snapshotError;
+        if (!m_assetIndex->writeSnapshot(snapshotPath(), &snapshotError)) {
+            qWarning() << snapshotError;
+        }
+    }
+    m_assetIndex->reset();
+
+    if (!m_libraryPath.isEmpty()) {
+        DatabaseConnectionPool &pool = DatabaseConnectionPool::instance();
+        pool.releaseDatabase(databasePath());
+        pool.releaseDatabase(MetadataCache::databasePath(m_libraryPath));
+    }
+
+    if (!m_connectionName.isEmpty()) {
+        if (m_database.isOpen()) {
+            m_database.close();
+        }
         QSqlDatabase::removeDatabase(m_connectionName);
         m_connectionName.clear();
     }
@@ -310,349 +1329,612 @@ QVector<LibraryAsset> LibraryManager::assets() const
 
 QVector<LibraryAsset> LibraryManager::assets(const FilterOptions &filterOptions) const
 {
-    QVector<LibraryAsset> result;
     if (!hasOpenLibrary()) {
-        return result;
+        return {};
     }
 
-    // If metadata cache is available and filters are specified, use it
-    if (m_metadataCache && m_metadataCache->hasOpenCache()) {
-        // Check if any filters are actually applied (not just default sort)
-        bool hasActiveFilters = (filterOptions.isoMin > 0 || filterOptions.isoMax > 0 || 
-                                 !filterOptions.cameraMake.isEmpty() || !filterOptions.tags.isEmpty());
-        
-        QVector<qint64> filteredIds = m_metadataCache->filterAssets(filterOptions);
-        
-        // Only return empty if filters were actively applied and no results found
-        // If no filters are active, fall through to query all assets
-        if (hasActiveFilters && filteredIds.isEmpty()) {
-            // Filters applied but no results
+    const QString metadataPath = (m_metadataCache && m_metadataCache->hasOpenCache())
+        ? MetadataCache::databasePath(m_libraryPath)
+        : QString();
+
+    if (m_assetIndex->isLoaded()) {
+        QVector<qint64> searchMatches;
+        const bool searching = !metadataPath.isEmpty()
+            && MetadataCache::searchAssetIds(metadataPath, filterOptions.searchText, &searchMatches);
+        return m_assetIndex->query(filterOptions, searching ? &searchMatches : nullptr);
+    }
+
+    return queryAssets(databasePath(), metadataPath, filterOptions);
+}
+
+struct LibraryManager::AssetQueryState
+{
+    quint64 generation = 0;
+    FilterOptions filterOptions;
+    QString dbPath;
+    QString metadataPath;
+    QSharedPointer<AssetIndex> index;
+
+    // Guards the two below; held across whole SQL reads.
+    QMutex mutex;
+    // Similarity matches of an SQL answer, found once for all its reads.
+    QSharedPointer<const SimilarAssetMatches> similar;
+    AssetPageCursor cursor;
+
+    // Guards everything below. Never held across a query, so the GUI thread
+    // may take it.
+    QMutex idsMutex;
+    bool fromIndex = false;
+    bool idsListing = false; // orderedIds of an SQL answer being listed
+    bool idsListed = false;
+    QVector<qint64> orderedIds; // from the index, or listed on request
+    QHash<qint64, int> stackSizes; // collapsed bursts among orderedIds
+};
+
+LibraryAsset LibraryManager::assetById(qint64 assetId) const
+{
+    if (!hasOpenLibrary()) {
+        return {};
+    }
+
+    if (m_assetIndex->isLoaded()) {
+        return m_assetIndex->asset(assetId);
+    }
+
+    QSqlQuery query(m_database);
+    query.prepare(QStringLiteral(
+        "SELECT a.id, a.photo_number, a.file_name, a.original_path, a.preview_path, a.format, a.width, a.height, a.phash, k.marks "
+        "FROM assets a LEFT JOIN asset_marks k ON k.asset_id = a.id WHERE a.id = ?"));
+    query.addBindValue(assetId);
+    if (!query.exec() || !query.next()) {
+        return {};
+    }
+    return readAssetRow(query);
+}
+
+QFuture<QVector<LibraryAsset>> LibraryManager::lookupAssets(const QVector<qint64> &assetIds) const
+{
+    if (!hasOpenLibrary() || assetIds.isEmpty()) {
+        return QtFuture::makeReadyFuture(QVector<LibraryAsset>());
+    }
+
+    const QSharedPointer<AssetIndex> index = m_assetIndex;
+    const QString dbPath = databasePath();
+    return QtConcurrent::run([index, dbPath, assetIds]() {
+        if (index->isLoaded()) {
+            return index->assets(assetIds);
+        }
+
+        QVector<LibraryAsset> result;
+        QString connectionError;
+        QSqlQuery *query = DatabaseConnectionPool::instance().cachedQuery(dbPath, QStringLiteral(
+            "SELECT a.id, a.photo_number, a.file_name, a.original_path, a.preview_path, a.format, a.width, a.height, a.phash, k.marks "
+            "FROM assets a LEFT JOIN asset_marks k ON k.asset_id = a.id WHERE a.id = ?"), &connectionError);
+        if (!query) {
+            qWarning() << "Failed to prepare asset lookup:" << connectionError;
             return result;
         }
-        
-        // Build query with filtered IDs or all assets
-        QString querySql;
-        if (!hasActiveFilters && filteredIds.isEmpty()) {
-            // No filters and no metadata yet - query all assets from main database
-            querySql = QStringLiteral("SELECT id, photo_number, file_name, original_path, preview_path, format, width, height FROM assets");
-        } else if (!filteredIds.isEmpty()) {
-            // Use filtered/sorted results from metadata cache
-            QStringList idPlaceholders;
-            for (int i = 0; i < filteredIds.size(); ++i) {
-                idPlaceholders.append(QStringLiteral("?"));
+        result.reserve(assetIds.size());
+        for (qint64 assetId : assetIds) {
+            query->bindValue(0, assetId);
+            if (query->exec() && query->next()) {
+                result.append(readAssetRow(*query));
             }
-            querySql = QStringLiteral("SELECT id, photo_number, file_name, original_path, preview_path, format, width, height FROM assets WHERE id IN (%1)").arg(idPlaceholders.join(QStringLiteral(", ")));
-        } else {
-            // Has filters but no results - return empty
-            return result;
+            query->finish();
         }
+        return result;
+    });
+}
 
-        // Apply sorting if not handled by metadata cache
-        // When metadata cache handles sorting, we preserve the order from filteredIds
-        QString orderBy;
-        if (filteredIds.isEmpty()) {
-            // No metadata cache results, use simple sorting from main database
-            switch (filterOptions.sortOrder) {
-            case FilterOptions::SortByDateDesc:
-                orderBy = QStringLiteral("ORDER BY imported_at DESC");
-                break;
-            case FilterOptions::SortByDateAsc:
-                orderBy = QStringLiteral("ORDER BY imported_at ASC");
-                break;
-            case FilterOptions::SortByFileName:
-                orderBy = QStringLiteral("ORDER BY file_name ASC");
-                break;
-            default:
-                orderBy = QStringLiteral("ORDER BY imported_at DESC");
-                break;
-            }
-            if (!orderBy.isEmpty()) {
-                querySql += QStringLiteral(" %1").arg(orderBy);
-            }
-        } else {
-            // Metadata cache already sorted, preserve order by using filteredIds order
-            // Don't add ORDER BY - we'll preserve the order manually
+void LibraryManager::requestAssets(const FilterOptions &filterOptions)
+{
+    const quint64 generation = ++m_assetQueryGeneration;
+
+    // Capture necessary data before entering the lambda
+    if (!hasOpenLibrary()) {
+        m_assetQuery.reset();
+        emit assetsQueried(generation, 0);
+        return;
+    }
+
+    auto state = QSharedPointer<AssetQueryState>::create();
+    state->generation = generation;
+    state->filterOptions = filterOptions;
+    state->dbPath = databasePath();
+    // The worker uses its own pooled connection to the metadata cache, the
+    // MetadataCache QObject itself stays on this thread.
+    state->metadataPath = (m_metadataCache && m_metadataCache->hasOpenCache())
+        ? MetadataCache::databasePath(m_libraryPath)
+        : QString();
+    state->index = m_assetIndex;
+    m_assetQuery = state;
+
+    // Use QPointer for thread-safe access in the lambda
+    QPointer<LibraryManager> self(this);
+
+    QtConcurrent::run([self, state]() {
+        if (!self) {
+            return;
         }
 
-        QSqlQuery query(m_database);
-        if (!filteredIds.isEmpty()) {
-            query.prepare(querySql);
-            for (qint64 id : filteredIds) {
-                query.addBindValue(id);
-            }
+        int totalCount = 0;
+        // The in-memory index answers without touching SQLite once loaded.
+        if (state->index->isLoaded()) {
+            // Text search is the one filter the index cannot answer; the
+            // FTS index narrows it to a set of ids first.
+            QVector<qint64> searchMatches;
+            const bool searching = !state->metadataPath.isEmpty()
+                && MetadataCache::searchAssetIds(state->metadataPath, state->filterOptions.searchText, &searchMatches);
+            QHash<qint64, int> stackSizes;
+            QVector<qint64> orderedIds = state->index->queryIds(state->filterOptions,
+                                                                searching ? &searchMatches : nullptr,
+                                                                &stackSizes);
+            totalCount = orderedIds.size();
+
+            QMutexLocker locker(&state->idsMutex);
+            state->orderedIds = std::move(orderedIds);
+            state->stackSizes = std::move(stackSizes);
+            state->fromIndex = true;
         } else {
-            query.prepare(querySql);
+            QMutexLocker locker(&state->mutex);
+            state->similar = findSimilarAssets(state->dbPath, state->filterOptions);
+            // Bursts come from the index; until it is loaded every
+            // frame is listed.
+            totalCount = countAssets(state->dbPath, state->metadataPath, state->filterOptions,
+                                     state->similar.data());
         }
 
-        if (!query.exec()) {
-            qWarning() << "Failed to query filtered assets:" << query.lastError();
-            return result;
+        if (self) {
+            emit self->assetsQueried(state->generation, totalCount);
         }
+    });
+}
 
-        // Create a map for quick lookup
-        QHash<qint64, LibraryAsset> assetMap;
-        while (query.next()) {
-            LibraryAsset asset = hydrateAsset(query.record());
-            assetMap.insert(asset.id, asset);
+bool LibraryManager::queriedAssetIds(quint64 generation, QVector<qint64> *ids)
+{
+    const QSharedPointer<AssetQueryState> state = m_assetQuery;
+    if (!state || state->generation != generation) {
+        return false;
+    }
+
+    {
+        QMutexLocker locker(&state->idsMutex);
+        if (state->fromIndex || state->idsListed) {
+            *ids = state->orderedIds;
+            return true;
+        }
+        if (state->idsListing) {
+            return false;
         }
+        state->idsListing = true;
+    }
 
-        // Preserve order from filteredIds if available
-        if (!filteredIds.isEmpty()) {
-            for (qint64 id : filteredIds) {
-                if (assetMap.contains(id)) {
-                    result.append(assetMap.value(id));
-                }
+    // Until the index has loaded the result only exists as SQL pages; it is
+    // listed once, away from the GUI thread.
+    QPointer<LibraryManager> self(this);
+    QtConcurrent::run([self, state]() {
+        QSharedPointer<const SimilarAssetMatches> similar;
+        {
+            QMutexLocker locker(&state->mutex);
+            similar = state->similar;
+        }
+        const QVector<LibraryAsset> assets = queryAssets(state->dbPath, state->metadataPath, state->filterOptions,
+                                                         0, -1, nullptr, similar.data());
+        QVector<qint64> listed;
+        listed.reserve(assets.size());
+        for (const LibraryAsset &asset : assets) {
+            listed.append(asset.id);
+        }
+        {
+            QMutexLocker locker(&state->idsMutex);
+            if (!state->fromIndex) {
+                state->orderedIds = std::move(listed);
+            }
+            state->idsListed = true;
+        }
+        if (!self) {
+            return;
+        }
+        const quint64 generation = state->generation;
+        QMetaObject::invokeMethod(self, [self, generation]() {
+            if (self) {
+                emit self->queriedAssetIdsReady(generation);
+            }
+        }, Qt::QueuedConnection);
+    });
+    return false;
+}
+
+void LibraryManager::requestAssetPage(quint64 generation, int offset, int limit)
+{
+    const QSharedPointer<AssetQueryState> state = m_assetQuery;
+    if (!state || state->generation != generation || offset < 0 || limit <= 0) {
+        return;
+    }
+
+    QPointer<LibraryManager> self(this);
+
+    QtConcurrent::run([self, state, offset, limit]() {
+        if (!self) {
+            return;
+        }
+
+        QVector<LibraryAsset> page;
+        bool fromIndex = false;
+        QVector<qint64> pageIds;
+        {
+            QMutexLocker locker(&state->idsMutex);
+            fromIndex = state->fromIndex;
+            if (fromIndex) {
+                pageIds = state->orderedIds.mid(offset, limit);
+            }
+        }
+        if (fromIndex) {
+            page = state->index->assets(pageIds);
+            QMutexLocker locker(&state->idsMutex);
+            for (LibraryAsset &asset : page) {
+                asset.stackSize = state->stackSizes.value(asset.id, 1);
             }
         } else {
-            // No filters, use query order
-            result = assetMap.values().toVector();
+            // Pages of one query are read one at a time so the keyset
+            // cursor always describes the last page returned.
+            QMutexLocker locker(&state->mutex);
+            page = queryAssets(state->dbPath, state->metadataPath, state->filterOptions,
+                               offset, limit, &state->cursor, state->similar.data());
         }
-    } else {
-        // Fallback to simple query without metadata cache
-        QString orderBy;
-        switch (filterOptions.sortOrder) {
-        case FilterOptions::SortByDateDesc:
-            orderBy = QStringLiteral("ORDER BY imported_at DESC");
-            break;
-        case FilterOptions::SortByDateAsc:
-            orderBy = QStringLiteral("ORDER BY imported_at ASC");
-            break;
-        case FilterOptions::SortByFileName:
-            orderBy = QStringLiteral("ORDER BY file_name ASC");
-            break;
-        default:
-            orderBy = QStringLiteral("ORDER BY imported_at DESC");
-            break;
+
+        if (self) {
+            emit self->assetPageReady(state->generation, offset, page);
         }
+    });
+}
 
-        QSqlQuery query(m_database);
-        const QString sql = QStringLiteral("SELECT id, photo_number, file_name, original_path, preview_path, format, width, height FROM assets %1").arg(orderBy);
-        if (!query.exec(sql)) {
-            qWarning() << "Failed to query assets:" << query.lastError();
-            return result;
+QVector<LibraryAsset> LibraryManager::queryAssets(const QString &dbPath,
+                                                  const QString &metadataPath,
+                                                  const FilterOptions &filterOptions,
+                                                  int offset,
+                                                  int limit,
+                                                  AssetPageCursor *cursor,
+                                                  const SimilarAssetMatches *similar)
+{
+    QVector<LibraryAsset> result;
+    DatabaseConnectionPool &pool = DatabaseConnectionPool::instance();
+
+    QString connectionError;
+    QSqlDatabase db = pool.connection(dbPath, &connectionError);
+    if (!db.isOpen()) {
+        qWarning() << "Failed to open pooled library connection for query:" << connectionError;
+        return result;
+    }
+
+    bool metadataAttached = false;
+    if (!metadataPath.isEmpty()) {
+        metadataAttached = pool.attachDatabase(dbPath, QStringLiteral("meta"), metadataPath, &connectionError);
+        if (!metadataAttached) {
+            qWarning() << "Failed to attach metadata cache for query:" << connectionError;
         }
+    }
 
-        while (query.next()) {
-            result.append(hydrateAsset(query.record()));
+    // Filter, sort and fetch in one statement; SQLite joins on the
+    // asset_metadata primary key so no intermediate id list is built.
+    QVariantList bindValues;
+    QString whereClause;
+    QString fromClause = QStringLiteral("FROM assets a LEFT JOIN asset_marks k ON k.asset_id = a.id");
+    if (metadataAttached) {
+        fromClause += QStringLiteral(" LEFT JOIN meta.asset_metadata m ON m.asset_id = a.id");
+        whereClause = MetadataCache::filterWhereClause(filterOptions, QStringLiteral("m."), &bindValues, QStringLiteral("a.id"));
+    }
+    QSharedPointer<const SimilarAssetMatches> ownMatches;
+    if (!similar && filterOptions.similarToAssetId >= 0) {
+        ownMatches = findSimilarAssets(dbPath, filterOptions);
+        similar = ownMatches.data();
+    }
+    const QString similarity = similarityCondition(dbPath, similar);
+    if (!similarity.isEmpty()) {
+        whereClause = appendCondition(whereClause, similarity);
+    }
+    const QString marks = marksCondition(filterOptions);
+    if (!marks.isEmpty()) {
+        whereClause = appendCondition(whereClause, marks);
+    }
+    const QString collection = collectionCondition(dbPath, filterOptions, metadataAttached, &bindValues);
+    if (!collection.isEmpty()) {
+        whereClause = appendCondition(whereClause, collection);
+    }
+
+    const AssetSortKey sortKey = assetSortKey(filterOptions.sortOrder, metadataAttached);
+
+    // Continuing right after the previous page: seek past its last key
+    // instead of making SQLite step over `offset` rows again.
+    int skip = offset;
+    if (cursor && offset > 0 && cursor->offset == offset
+        && cursor->sortKey.size() == sortKey.expressions.size() && sortKey.supportsKeyset()) {
+        whereClause = appendCondition(whereClause, keysetCondition(sortKey));
+        bindValues += cursor->sortKey;
+        skip = 0;
+    }
+    bindValues.append(limit > 0 ? limit : -1);
+    bindValues.append(skip);
+
+    const QString sql = QStringLiteral(
+        "SELECT a.id, a.photo_number, a.file_name, a.original_path, a.preview_path, a.format, a.width, a.height, a.phash, k.marks, %1 "
+        "%2 %3 %4 LIMIT ? OFFSET ?")
+                            .arg(sortKey.expressions.join(QStringLiteral(", ")), fromClause, whereClause, orderByClause(sortKey));
+
+    // The text varies with the filters, so it is prepared here rather than
+    // taking a slot in the pool's statement cache.
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.prepare(sql)) {
+        qWarning() << "Failed to prepare asset query:" << query.lastError();
+        return result;
+    }
+
+    for (int i = 0; i < bindValues.size(); ++i) {
+        query.bindValue(i, bindValues.at(i));
+    }
+
+    if (!query.exec()) {
+        qWarning() << "Failed to query assets:" << query.lastError();
+        return result;
+    }
+
+    constexpr int kSortKeyColumn = 10;
+    QVariantList lastKey;
+    while (query.next()) {
+        result.append(readAssetRow(query));
+        if (cursor) {
+            lastKey.clear();
+            for (int i = 0; i < sortKey.expressions.size(); ++i) {
+                lastKey.append(query.value(kSortKeyColumn + i));
+            }
         }
     }
+    query.finish();
+
+    if (cursor) {
+        cursor->offset = result.isEmpty() ? -1 : offset + result.size();
+        cursor->sortKey = lastKey;
+    }
 
     return result;
 }
 
-void LibraryManager::requestAssets(const FilterOptions &filterOptions)
+QSharedPointer<const SimilarAssetMatches> LibraryManager::findSimilarAssets(const QString &dbPath,
+                                                                           const FilterOptions &filterOptions)
 {
-    // Capture necessary data before entering the lambda
-    if (!hasOpenLibrary()) {
-        emit assetsQueried(QVector<LibraryAsset>());
-        return;
+    if (filterOptions.similarToAssetId < 0) {
+        return {};
     }
 
-    const QString libraryPath = m_libraryPath;
-    const QString connectionName = m_connectionName;
-    const QString dbPath = QDir(libraryPath).filePath(QString::fromLatin1(kDatabaseFileName));
-    
-    // Capture metadata cache state - we'll check if it's available and use it
-    // Note: We can't safely access QObject from background thread, so we'll
-    // capture the cache path and open it in the background thread if needed
-    bool hasMetadataCache = (m_metadataCache && m_metadataCache->hasOpenCache());
-    QString metadataCachePath;
-    if (hasMetadataCache) {
-        // We'll need to open the cache in the background thread
-        metadataCachePath = libraryPath;
-    }
+    static QAtomicInteger<quint64> lastSerial;
+    auto matches = QSharedPointer<SimilarAssetMatches>::create();
+    matches->serial = lastSerial.fetchAndAddRelaxed(1) + 1;
 
-    // Use QPointer for thread-safe access in the lambda
-    QPointer<LibraryManager> self(this);
+    DatabaseConnectionPool &pool = DatabaseConnectionPool::instance();
+    QString connectionError;
+    QSqlQuery *reference = pool.cachedQuery(dbPath, QStringLiteral("SELECT phash FROM assets WHERE id = ?"), &connectionError);
+    if (!reference) {
+        qWarning() << "Failed to prepare similarity lookup:" << connectionError;
+        return matches;
+    }
+    reference->bindValue(0, filterOptions.similarToAssetId);
+    quint64 hash = 0;
+    if (reference->exec() && reference->next()) {
+        hash = quint64(reference->value(0).toLongLong());
+    }
+    reference->finish();
+    if (hash == 0) {
+        return matches;
+    }
 
-    QtConcurrent::run([self, filterOptions, libraryPath, dbPath, connectionName, hasMetadataCache, metadataCachePath]() {
-        if (!self) {
-            return;
+    QSqlQuery *scan = pool.cachedQuery(dbPath, QStringLiteral("SELECT id, phash FROM assets WHERE phash IS NOT NULL"), &connectionError);
+    if (!scan || !scan->exec()) {
+        qWarning() << "Failed to scan perceptual hashes:" << (scan ? scan->lastError().text() : connectionError);
+        if (scan) {
+            scan->finish();
+        }
+        return matches;
+    }
+    while (scan->next()) {
+        if (PerceptualHash::distance(quint64(scan->value(1).toLongLong()), hash) <= filterOptions.similarityThreshold) {
+            matches->assetIds.append(scan->value(0).toLongLong());
         }
+    }
+    scan->finish();
+    return matches;
+}
 
-        // Create a thread-local database connection
-        const QString threadConnectionName = QStringLiteral("%1_query_%2").arg(connectionName).arg(QUuid::createUuid().toString(QUuid::Id128));
-        QSqlDatabase threadDb = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), threadConnectionName);
-        threadDb.setDatabaseName(dbPath);
-        
-        if (!threadDb.open()) {
-            qWarning() << "Failed to open thread-local database connection for query:" << threadDb.lastError();
-            QSqlDatabase::removeDatabase(threadConnectionName);
-            emit self->assetsQueried(QVector<LibraryAsset>());
-            return;
+int LibraryManager::countAssets(const QString &dbPath,
+                                const QString &metadataPath,
+                                const FilterOptions &filterOptions,
+                                const SimilarAssetMatches *similar)
+{
+    DatabaseConnectionPool &pool = DatabaseConnectionPool::instance();
+
+    QString connectionError;
+    bool metadataAttached = false;
+    if (!metadataPath.isEmpty()) {
+        metadataAttached = pool.attachDatabase(dbPath, QStringLiteral("meta"), metadataPath, &connectionError);
+        if (!metadataAttached) {
+            qWarning() << "Failed to attach metadata cache for count:" << connectionError;
         }
+    }
 
-        QVector<LibraryAsset> result;
+    QVariantList bindValues;
+    QString sql = QStringLiteral("SELECT COUNT(*) FROM assets a");
+    QString whereClause;
+    if (metadataAttached) {
+        sql += QStringLiteral(" LEFT JOIN meta.asset_metadata m ON m.asset_id = a.id");
+        whereClause = MetadataCache::filterWhereClause(filterOptions, QStringLiteral("m."), &bindValues, QStringLiteral("a.id"));
+    }
+    QSharedPointer<const SimilarAssetMatches> ownMatches;
+    if (!similar && filterOptions.similarToAssetId >= 0) {
+        ownMatches = findSimilarAssets(dbPath, filterOptions);
+        similar = ownMatches.data();
+    }
+    const QString similarity = similarityCondition(dbPath, similar);
+    if (!similarity.isEmpty()) {
+        whereClause = appendCondition(whereClause, similarity);
+    }
+    const QString marks = marksCondition(filterOptions);
+    if (!marks.isEmpty()) {
+        whereClause = appendCondition(whereClause, marks);
+    }
+    const QString collection = collectionCondition(dbPath, filterOptions, metadataAttached, &bindValues);
+    if (!collection.isEmpty()) {
+        whereClause = appendCondition(whereClause, collection);
+    }
+    if (!marks.isEmpty() || !collection.isEmpty()) {
+        sql += QStringLiteral(" LEFT JOIN asset_marks k ON k.asset_id = a.id");
+    }
+    if (!whereClause.isEmpty()) {
+        sql += QLatin1Char(' ') + whereClause;
+    }
 
-        // Open metadata cache in background thread if needed
-        MetadataCache *threadCache = nullptr;
-        if (hasMetadataCache) {
-            threadCache = new MetadataCache();
-            QString cacheError;
-            if (!threadCache->openCache(metadataCachePath, &cacheError)) {
-                qWarning() << "Failed to open metadata cache in background thread:" << cacheError;
-                delete threadCache;
-                threadCache = nullptr;
-            }
-        }
+    // Built from the filters, so not for the pool's statement cache.
+    QSqlDatabase db = pool.connection(dbPath, &connectionError);
+    if (!db.isOpen()) {
+        qWarning() << "Failed to open pooled library connection for count:" << connectionError;
+        return 0;
+    }
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.prepare(sql)) {
+        qWarning() << "Failed to prepare asset count:" << query.lastError();
+        return 0;
+    }
 
-        // Perform the query (similar logic to assets() method)
-        if (threadCache && threadCache->hasOpenCache()) {
-            // Check if any filters are actually applied (not just default sort)
-            bool hasActiveFilters = (filterOptions.isoMin > 0 || filterOptions.isoMax > 0 || 
-                                     !filterOptions.cameraMake.isEmpty() || !filterOptions.tags.isEmpty());
-            
-            QVector<qint64> filteredIds = threadCache->filterAssets(filterOptions);
-            
-            // Only return empty if filters were actively applied and no results found
-            if (hasActiveFilters && filteredIds.isEmpty()) {
-                // Filters applied but no results
-                delete threadCache;
-                threadDb.close();
-                QSqlDatabase::removeDatabase(threadConnectionName);
-                emit self->assetsQueried(result);
-                return;
-            }
-            
-            // Build query with filtered IDs or all assets
-            QString querySql;
-            if (!hasActiveFilters && filteredIds.isEmpty()) {
-                // No filters and no metadata yet - query all assets from main database
-                querySql = QStringLiteral("SELECT id, photo_number, file_name, original_path, preview_path, format, width, height FROM assets");
-            } else if (!filteredIds.isEmpty()) {
-                // Use filtered/sorted results from metadata cache
-                QStringList idPlaceholders;
-                for (int i = 0; i < filteredIds.size(); ++i) {
-                    idPlaceholders.append(QStringLiteral("?"));
-                }
-                querySql = QStringLiteral("SELECT id, photo_number, file_name, original_path, preview_path, format, width, height FROM assets WHERE id IN (%1)").arg(idPlaceholders.join(QStringLiteral(", ")));
-            } else {
-                // Has filters but no results - return empty
-                delete threadCache;
-                threadDb.close();
-                QSqlDatabase::removeDatabase(threadConnectionName);
-                emit self->assetsQueried(result);
-                return;
-            }
+    for (int i = 0; i < bindValues.size(); ++i) {
+        query.bindValue(i, bindValues.at(i));
+    }
 
-            // Apply sorting if not handled by metadata cache
-            QString orderBy;
-            if (filteredIds.isEmpty()) {
-                // No metadata cache results, use simple sorting from main database
-                switch (filterOptions.sortOrder) {
-                case FilterOptions::SortByDateDesc:
-                    orderBy = QStringLiteral("ORDER BY imported_at DESC");
-                    break;
-                case FilterOptions::SortByDateAsc:
-                    orderBy = QStringLiteral("ORDER BY imported_at ASC");
-                    break;
-                case FilterOptions::SortByFileName:
-                    orderBy = QStringLiteral("ORDER BY file_name ASC");
-                    break;
-                default:
-                    orderBy = QStringLiteral("ORDER BY imported_at DESC");
-                    break;
-                }
-                if (!orderBy.isEmpty()) {
-                    querySql += QStringLiteral(" %1").arg(orderBy);
-                }
-            }
+    int count = 0;
+    if (query.exec() && query.next()) {
+        count = query.value(0).toInt();
+    } else {
+        qWarning() << "Failed to count assets:" << query.lastError();
+    }
+    query.finish();
+    return count;
+}
 
-            QSqlQuery query(threadDb);
-            if (!filteredIds.isEmpty()) {
-                query.prepare(querySql);
-                for (qint64 id : filteredIds) {
-                    query.addBindValue(id);
-                }
-            } else {
-                query.prepare(querySql);
-            }
+void LibraryManager::startAssetIndexLoad()
+{
+    const quint64 generation = m_assetIndex->beginReload();
+    const QSharedPointer<AssetIndex> index = m_assetIndex;
+    const QString dbPath = databasePath();
+    const QString metadataPath = (m_metadataCache && m_metadataCache->hasOpenCache())
+        ? MetadataCache::databasePath(m_libraryPath)
+        : QString();
+    QPointer<LibraryManager> self(this);
 
-            if (!query.exec()) {
-                qWarning() << "Failed to query filtered assets:" << query.lastError();
-                delete threadCache;
-                threadDb.close();
-                QSqlDatabase::removeDatabase(threadConnectionName);
-                emit self->assetsQueried(result);
-                return;
-            }
+    // Until the load finishes, queries are answered from the snapshot when
+    // one was loaded and fall back to SQLite otherwise.
+    QtConcurrent::run([self, index, generation, dbPath, metadataPath]() {
+        const QVector<LibraryAsset> assets = queryAssets(dbPath, QString(), FilterOptions());
+        const QVector<AssetMetadata> metadata = metadataPath.isEmpty()
+            ? QVector<AssetMetadata>()
+            : MetadataCache::loadAllMetadata(metadataPath);
+        bool changed = false;
+        if (index->load(generation, assets, metadata, &changed) && changed && self) {
+            // What was on screen came from a stale snapshot.
+            emit self->assetsChanged();
+        }
+    });
+}
 
-            // Create a map for quick lookup
-            QHash<qint64, LibraryAsset> assetMap;
-            while (query.next()) {
-                LibraryAsset asset;
-                asset.id = query.value(QStringLiteral("id")).toLongLong();
-                asset.photoNumber = query.value(QStringLiteral("photo_number")).toString();
-                asset.fileName = query.value(QStringLiteral("file_name")).toString();
-                asset.originalRelativePath = query.value(QStringLiteral("original_path")).toString();
-                asset.previewRelativePath = query.value(QStringLiteral("preview_path")).toString();
-                asset.format = query.value(QStringLiteral("format")).toString();
-                asset.width = query.value(QStringLiteral("width")).toInt();
-                asset.height = query.value(QStringLiteral("height")).toInt();
-                assetMap.insert(asset.id, asset);
+void LibraryManager::startCaptureEpochBackfill()
+{
+    m_backfillCancelled = QSharedPointer<QAtomicInt>::create(0);
+    const QSharedPointer<QAtomicInt> cancelled = m_backfillCancelled;
+    const QString dbPath = databasePath();
+    const QString libraryPath = m_libraryPath;
+    const QSharedPointer<DatabaseWriter> writer = m_writer;
+    // Null while no metadata cache is open.
+    const QSharedPointer<DatabaseWriter> metadataWriter = m_metadataCache
+        ? m_metadataCache->writer()
+        : QSharedPointer<DatabaseWriter>();
+    const QSharedPointer<AssetIndex> index = m_assetIndex;
+
+    // Rows written before photo_no, binary develop payloads, capture_epoch,
+    // file_name and phash existed are converted in short transactions so
+    // neither opening the library nor foreground writers wait on them.
+    QtConcurrent::run([cancelled, metadataWriter, dbPath, libraryPath, writer, index]() {
+        constexpr int kBatchSize = 2000;
+        constexpr int kHashBatchSize = 200; // each one decodes a preview
+        while (!cancelled->loadRelaxed()) {
+            if (backfillPhotoNumbers(writer, kBatchSize) <= 0) {
+                break;
             }
+        }
 
-            // Preserve order from filteredIds if available
-            if (!filteredIds.isEmpty()) {
-                for (qint64 id : filteredIds) {
-                    if (assetMap.contains(id)) {
-                        result.append(assetMap.value(id));
-                    }
+        const QList<QPair<QString, QString>> payloadTables = {
+            {QStringLiteral("develop_adjustments"), QStringLiteral("asset_id")},
+            {QStringLiteral("develop_payloads"), QStringLiteral("id")},
+        };
+        for (const auto &table : payloadTables) {
+            qint64 lastKey = 0;
+            while (!cancelled->loadRelaxed()) {
+                lastKey = reencodeDevelopPayloads(writer, table.first, table.second, lastKey, kBatchSize);
+                if (lastKey < 0) {
+                    break;
                 }
-            } else {
-                // No filters, use query order
-                result = assetMap.values().toVector();
             }
+        }
 
-            delete threadCache;
-        } else {
-            // Fallback to simple query without metadata cache
-            QString orderBy;
-            switch (filterOptions.sortOrder) {
-            case FilterOptions::SortByDateDesc:
-                orderBy = QStringLiteral("ORDER BY imported_at DESC");
-                break;
-            case FilterOptions::SortByDateAsc:
-                orderBy = QStringLiteral("ORDER BY imported_at ASC");
-                break;
-            case FilterOptions::SortByFileName:
-                orderBy = QStringLiteral("ORDER BY file_name ASC");
-                break;
-            default:
-                orderBy = QStringLiteral("ORDER BY imported_at DESC");
+        qint64 lastAssetId = 0;
+        while (metadataWriter && !cancelled->loadRelaxed()) {
+            lastAssetId = MetadataCache::backfillCaptureEpochs(metadataWriter, lastAssetId, kBatchSize);
+            if (lastAssetId < 0) {
                 break;
             }
+        }
 
-            QSqlQuery query(threadDb);
-            const QString sql = QStringLiteral("SELECT id, photo_number, file_name, original_path, preview_path, format, width, height FROM assets %1").arg(orderBy);
-            if (!query.exec(sql)) {
-                qWarning() << "Failed to query assets:" << query.lastError();
-                threadDb.close();
-                QSqlDatabase::removeDatabase(threadConnectionName);
-                emit self->assetsQueried(result);
-                return;
+        lastAssetId = 0;
+        while (metadataWriter && !cancelled->loadRelaxed()) {
+            lastAssetId = MetadataCache::backfillFileNames(metadataWriter, dbPath, lastAssetId, kBatchSize);
+            if (lastAssetId < 0) {
+                break;
             }
+        }
 
-            while (query.next()) {
-                LibraryAsset asset;
-                asset.id = query.value(QStringLiteral("id")).toLongLong();
-                asset.photoNumber = query.value(QStringLiteral("photo_number")).toString();
-                asset.fileName = query.value(QStringLiteral("file_name")).toString();
-                asset.originalRelativePath = query.value(QStringLiteral("original_path")).toString();
-                asset.previewRelativePath = query.value(QStringLiteral("preview_path")).toString();
-                asset.format = query.value(QStringLiteral("format")).toString();
-                asset.width = query.value(QStringLiteral("width")).toInt();
-                asset.height = query.value(QStringLiteral("height")).toInt();
-                result.append(asset);
+        lastAssetId = 0;
+        while (!cancelled->loadRelaxed()) {
+            lastAssetId = backfillPerceptualHashes(libraryPath, writer, index, lastAssetId, kHashBatchSize);
+            if (lastAssetId < 0) {
+                break;
             }
         }
+    });
+}
 
-        // Clean up thread-local database connection
-        threadDb.close();
-        QSqlDatabase::removeDatabase(threadConnectionName);
+bool LibraryManager::migrateDatabaseSchema(QString *errorMessage)
+{
+    if (!hasOpenLibrary()) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("No open library to initialize schema.");
+        }
+        return false;
+    }
 
-        emit self->assetsQueried(result);
-    });
+    return SchemaMigrator::migrate(m_database, schemaMigrations(), errorMessage);
+}
+
+QVector<SchemaMigration> LibraryManager::schemaMigrations()
+{
+    return {
+        {1, QStringLiteral("assets and develop adjustments"), createBaseSchema},
+        {2, QStringLiteral("assign missing photo numbers"), assignMissingPhotoNumbers},
+        {3, QStringLiteral("typed photo numbers and sort indexes"), addTypedSortColumns},
+        {4, QStringLiteral("library state"), createLibraryMeta},
+        {5, QStringLiteral("shared develop payloads"), addSharedDevelopPayloads},
+        {6, QStringLiteral("develop history and binary adjustments"), addDevelopHistory},
+        {7, QStringLiteral("original path lookup"), indexOriginalPaths},
+        {8, QStringLiteral("perceptual hashes"), addPerceptualHashes},
+        {9, QStringLiteral("ratings, flags and colour labels"), addAssetMarks},
+        {10, QStringLiteral("smart collections"), addSmartCollections},
+    };
 }
 
 MetadataCache *LibraryManager::metadataCache() const
@@ -696,35 +1978,28 @@ void LibraryManager::importFiles(const QStringList &filePaths)
         QMetaObject::invokeMethod(this, "doStartBatchMetadataJob", Qt::QueuedConnection, Q_ARG(int, metadataExtractionCount));
     }
 
-    // Create a thread-local database connection for this import operation
-    // SQLite connections are not thread-safe, so each thread needs its own connection
-    const QString threadConnectionName = QStringLiteral("%1_import_%2").arg(m_connectionName).arg(QUuid::createUuid().toString(QUuid::Id128));
-    QSqlDatabase threadDb = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), threadConnectionName);
-    threadDb.setDatabaseName(QDir(m_libraryPath).filePath(QString::fromLatin1(kDatabaseFileName)));
-    
-    if (!threadDb.open()) {
-        emit errorOccurred(QStringLiteral("Failed to open thread-local database connection: %1").arg(threadDb.lastError().text()));
-        QSqlDatabase::removeDatabase(threadConnectionName);
+    // Photo numbers continue from MAX(photo_no). Imports take turns so the
+    // numbers read here are still free when the rows are written; no
+    // database lock is held while the files are copied.
+    QMutexLocker importLock(&m_importMutex);
+
+    const QSharedPointer<DatabaseWriter> writer = m_writer;
+    const QString dbPath = writer->databasePath();
+    QString connectionError;
+    int lastPhotoNumber = 0;
+    QSqlQuery *maxQuery = DatabaseConnectionPool::instance().cachedQuery(
+        dbPath, maxPhotoNumberSql(), &connectionError);
+    if (!maxQuery || !maxQuery->exec()) {
+        emit errorOccurred(QStringLiteral("Failed to query max photo number: %1")
+                               .arg(maxQuery ? maxQuery->lastError().text() : connectionError));
         return;
     }
-
-    // Get next photo number using thread-local database connection
-    int nextPhotoNumber = 0;
-    QSqlQuery maxQuery(threadDb);
-    if (maxQuery.exec(QStringLiteral("SELECT MAX(CAST(photo_number AS INTEGER)) FROM assets"))) {
-        if (maxQuery.next()) {
-            nextPhotoNumber = maxQuery.value(0).toInt();
-        }
-    } else {
-        qWarning() << "Failed to query max photo number:" << maxQuery.lastError();
-    }
-
-    if (!threadDb.transaction()) {
-        emit errorOccurred(QStringLiteral("Failed to begin import transaction: %1").arg(threadDb.lastError().text()));
-        QSqlDatabase::removeDatabase(threadConnectionName);
-        return;
+    if (maxQuery->next()) {
+        lastPhotoNumber = maxQuery->value(0).toInt();
     }
+    maxQuery->finish();
 
+    QVector<StagedImport> staged;
     for (const QString &sourceFile : filePaths) {
         QString errorMessage;
         QFileInfo info(sourceFile);
@@ -733,69 +2008,134 @@ void LibraryManager::importFiles(const QStringList &filePaths)
             continue;
         }
 
-        const int tentativeNumber = nextPhotoNumber + 1;
-        const QString assignedPhotoNumber = QString::number(tentativeNumber);
-        const int bucketIndex = bucketIndexForPhotoNumber(assignedPhotoNumber);
-
-        QString storedRelative = storeOriginal(sourceFile, bucketIndex, &errorMessage);
-        if (storedRelative.isEmpty()) {
+        StagedImport entry;
+        entry.photoNumber = lastPhotoNumber + staged.size() + 1;
+        entry.originalRelativePath = storeOriginal(sourceFile,
+                                                   bucketIndexForPhotoNumber(QString::number(entry.photoNumber)),
+                                                   &errorMessage);
+        if (entry.originalRelativePath.isEmpty()) {
             emit errorOccurred(errorMessage);
             continue;
         }
+        entry.sourceFile = sourceFile;
+        entry.fileName = info.fileName();
+        entry.format = info.suffix().toLower();
+        staged.append(entry);
+    }
 
-        QSqlQuery insert(threadDb);
-        insert.prepare(QStringLiteral(
-            "INSERT INTO assets (file_name, original_path, format, imported_at, photo_number) "
-            "VALUES (?, ?, ?, ?, ?)"));
-        insert.addBindValue(info.fileName());
-        insert.addBindValue(storedRelative);
-        insert.addBindValue(info.suffix().toLower());
-        insert.addBindValue(QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
-        insert.addBindValue(assignedPhotoNumber);
+    // One short writer command numbers and inserts every copied file.
+    const QString libraryPath = m_libraryPath;
+    const QString importedAt = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    const auto rows = QSharedPointer<QVector<StagedImport>>::create(staged);
+    QFuture<bool> written = writer->submit([rows, libraryPath, importedAt](QSqlDatabase &db, QString *errorMessage) {
+        DatabaseConnectionPool &pool = DatabaseConnectionPool::instance();
+        QSqlQuery *maxQuery = pool.cachedQuery(db, maxPhotoNumberSql(), errorMessage);
+        if (!maxQuery || !maxQuery->exec()) {
+            if (maxQuery && errorMessage) {
+                *errorMessage = QStringLiteral("Failed to query max photo number: %1").arg(maxQuery->lastError().text());
+            }
+            return false;
+        }
+        int photoNumber = maxQuery->next() ? maxQuery->value(0).toInt() : 0;
+        maxQuery->finish();
+
+        QSqlQuery *insert = pool.cachedQuery(db, QStringLiteral(
+            "INSERT INTO assets (file_name, original_path, format, imported_at, photo_number, photo_no) "
+            "VALUES (?, ?, ?, ?, ?, ?)"), errorMessage);
+        if (!insert) {
+            return false;
+        }
 
-        if (!insert.exec()) {
-            emit errorOccurred(QStringLiteral("Failed to insert asset metadata: %1").arg(insert.lastError().text()));
-            continue;
+        const QDir root(libraryPath);
+        for (StagedImport &entry : *rows) {
+            // Another writer numbered assets since the copy; the file follows
+            // its number into the right bucket.
+            const int copiedBucket = bucketIndexForPhotoNumber(QString::number(entry.photoNumber));
+            entry.photoNumber = ++photoNumber;
+            const int bucketIndex = bucketIndexForPhotoNumber(QString::number(entry.photoNumber));
+            if (bucketIndex != copiedBucket) {
+                const QString expectedRel = makeOriginalRelativePath(bucketIndex, QFileInfo(entry.originalRelativePath).fileName());
+                ensureBucketExists(root.filePath(QString::fromLatin1(kOriginalsDirName)), bucketIndex);
+                if (relocateStoredFile(root, entry.originalRelativePath, expectedRel)) {
+                    entry.originalRelativePath = expectedRel;
+                }
+            }
+
+            insert->bindValue(0, entry.fileName);
+            insert->bindValue(1, entry.originalRelativePath);
+            insert->bindValue(2, entry.format);
+            insert->bindValue(3, importedAt);
+            insert->bindValue(4, QString::number(entry.photoNumber));
+            insert->bindValue(5, entry.photoNumber);
+            if (!insert->exec()) {
+                if (errorMessage) {
+                    *errorMessage = QStringLiteral("Failed to insert asset metadata: %1").arg(insert->lastError().text());
+                }
+                insert->finish();
+                return false;
+            }
+            entry.assetId = insert->lastInsertId().toLongLong();
         }
+        insert->finish();
+        return true;
+    });
+    written.waitForFinished();
+    importLock.unlock();
 
-        ++nextPhotoNumber;
+    if (!written.result()) {
+        // Nothing refers to the copies.
+        for (const StagedImport &entry : std::as_const(*rows)) {
+            QFile::remove(absoluteAssetPath(entry.originalRelativePath));
+        }
+        emit errorOccurred(tr("Failed to import %n file(s).", nullptr, rows->size()));
+        rows->clear();
+    }
 
-        const qint64 assetId = insert.lastInsertId().toLongLong();
+    // Only committed rows reach the index and the follow-up work.
+    QVector<QPair<qint64, QString>> importedNames;
+    for (const StagedImport &entry : std::as_const(*rows)) {
+        const int bucketIndex = bucketIndexForPhotoNumber(QString::number(entry.photoNumber));
         LibraryAsset asset;
-        asset.id = assetId;
-        asset.photoNumber = assignedPhotoNumber;
-        asset.fileName = info.fileName();
-        asset.originalRelativePath = storedRelative;
-        asset.format = info.suffix().toLower();
+        asset.id = entry.assetId;
+        asset.photoNumber = QString::number(entry.photoNumber);
+        asset.fileName = entry.fileName;
+        asset.originalRelativePath = entry.originalRelativePath;
+        asset.format = entry.format;
 
-        QString reservedPreview = reservePreviewPath(assetId, bucketIndex);
+        QString reservedPreview = reservePreviewPath(asset.id, bucketIndex);
         if (reservedPreview.isEmpty()) {
-            emit errorOccurred(QStringLiteral("Failed to reserve preview path for %1").arg(info.fileName()));
+            emit errorOccurred(QStringLiteral("Failed to reserve preview path for %1").arg(entry.fileName));
             continue;
         }
         asset.previewRelativePath = reservedPreview;
+        m_assetIndex->upsertAsset(asset);
+        importedNames.append(qMakePair(asset.id, asset.fileName));
 
         // Queue metadata extraction to main thread (creates QObjects)
         if (m_metadataCache && m_metadataCache->hasOpenCache()) {
             QMetaObject::invokeMethod(this, "doEnqueueMetadataExtraction", Qt::QueuedConnection,
-                                      Q_ARG(qint64, assetId), Q_ARG(QString, sourceFile));
+                                      Q_ARG(qint64, asset.id), Q_ARG(QString, entry.sourceFile), Q_ARG(QString, entry.fileName));
         }
 
         // Queue preview generation to main thread (accesses JobManager QObject)
         QMetaObject::invokeMethod(this, "doEnqueuePreviewGeneration", Qt::QueuedConnection,
                                   Q_ARG(LibraryAsset, asset));
-        
+
         imported++;
         emit importProgress(imported, total);
     }
 
-    if (!threadDb.commit()) {
-        emit errorOccurred(QStringLiteral("Failed to commit import transaction: %1").arg(threadDb.lastError().text()));
+    // Searchable by name straight away, independent of metadata
+    // extraction.
+    if (m_metadataCache && m_metadataCache->hasOpenCache()) {
+        MetadataCache::storeFileNames(m_metadataCache->writer(), importedNames);
+    }
+    if (imported >= kSnapshotImportThreshold) {
+        QString snapshotError;
+        if (!m_assetIndex->writeSnapshot(snapshotPath(), &snapshotError)) {
+            qWarning() << snapshotError;
+        }
     }
-
-    // Clean up thread-local database connection
-    threadDb.close();
-    QSqlDatabase::removeDatabase(threadConnectionName);
 
     emit assetsChanged();
     emit importCompleted();
@@ -811,6 +2151,159 @@ void LibraryManager::importFiles(const QStringList &filePaths)
     }
 }
 
+QStringList LibraryManager::hotFolders() const
+{
+    if (!hasOpenLibrary()) {
+        return {};
+    }
+
+    QSqlQuery query(m_database);
+    query.prepare(QStringLiteral("SELECT value FROM library_meta WHERE key = ?"));
+    query.addBindValue(QString::fromLatin1(kHotFoldersKey));
+    if (!query.exec()) {
+        qWarning() << "Failed to read hot folders:" << query.lastError();
+        return {};
+    }
+    return query.next() ? query.value(0).toString().split(QLatin1Char('\n'), Qt::SkipEmptyParts) : QStringList();
+}
+
+QFuture<bool> LibraryManager::setHotFolders(const QStringList &folders)
+{
+    if (!hasOpenLibrary()) {
+        return QtFuture::makeReadyFuture(false);
+    }
+
+    QStringList cleaned;
+    for (const QString &folder : folders) {
+        const QString path = QDir::cleanPath(QFileInfo(folder).absoluteFilePath());
+        if (!folder.isEmpty() && !cleaned.contains(path)) {
+            cleaned.append(path);
+        }
+    }
+
+    const QString value = cleaned.join(QLatin1Char('\n'));
+    const QSharedPointer<DatabaseWriter> writer = m_writer;
+    return m_writer->submit([value](QSqlDatabase &db, QString *error) {
+        QSqlQuery *query = DatabaseConnectionPool::instance().cachedQuery(db, QStringLiteral(
+            "INSERT INTO library_meta(key, value) VALUES(?, ?) "
+            "ON CONFLICT(key) DO UPDATE SET value = excluded.value"), error);
+        if (!query) {
+            return false;
+        }
+        query->bindValue(0, QString::fromLatin1(kHotFoldersKey));
+        query->bindValue(1, value);
+        const bool ok = query->exec();
+        if (!ok && error) {
+            *error = query->lastError().text();
+        }
+        query->finish();
+        return ok;
+    }).then(this, [this, writer](bool committed) {
+        // Not rewatched for a library that was closed in the meantime.
+        if (committed && writer == m_writer) {
+            m_folderWatcher->unwatchAll();
+            startFolderWatch();
+        }
+        return committed;
+    });
+}
+
+void LibraryManager::startFolderWatch()
+{
+    m_folderWatcher->watchTree(originalsDirectory(), FolderWatcher::TreeKind::Originals);
+    const QStringList folders = hotFolders();
+    for (const QString &folder : folders) {
+        m_folderWatcher->watchTree(folder, FolderWatcher::TreeKind::HotFolder);
+    }
+}
+
+QVector<LibraryAsset> LibraryManager::assetsForOriginals(const QStringList &filePaths) const
+{
+    QVector<LibraryAsset> result;
+    if (!hasOpenLibrary()) {
+        return result;
+    }
+
+    const QDir root(m_libraryPath);
+    QSqlQuery query(m_database);
+    query.prepare(QStringLiteral(
+        "SELECT a.id, a.photo_number, a.file_name, a.original_path, a.preview_path, a.format, a.width, a.height, a.phash, k.marks "
+        "FROM assets a LEFT JOIN asset_marks k ON k.asset_id = a.id WHERE a.original_path = ?"));
+    for (const QString &filePath : filePaths) {
+        query.bindValue(0, root.relativeFilePath(filePath));
+        if (!query.exec()) {
+            qWarning() << "Failed to look up original" << filePath << query.lastError();
+            continue;
+        }
+        while (query.next()) {
+            result.append(readAssetRow(query));
+        }
+    }
+    return result;
+}
+
+void LibraryManager::handleOriginalsModified(const QStringList &filePaths)
+{
+    // Only files whose size or time changed get here; everything derived
+    // from them is rebuilt.
+    const QVector<LibraryAsset> changed = assetsForOriginals(filePaths);
+    for (const LibraryAsset &asset : changed) {
+        if (m_metadataCache && m_metadataCache->hasOpenCache()) {
+            enqueueMetadataExtraction(asset.id, absoluteAssetPath(asset.originalRelativePath), asset.fileName);
+        }
+        if (!asset.previewRelativePath.isEmpty()) {
+            enqueuePreviewGeneration(asset);
+        }
+    }
+}
+
+void LibraryManager::handleOriginalsRemoved(const QStringList &filePaths)
+{
+    // The storage check's own moves look like removals here; each is
+    // reported once and then forgotten.
+    QStringList removed;
+    if (m_relocatedOriginals) {
+        QMutexLocker locker(&m_relocatedOriginals->mutex);
+        for (const QString &filePath : filePaths) {
+            if (!m_relocatedOriginals->paths.remove(QDir::cleanPath(filePath))) {
+                removed.append(filePath);
+            }
+        }
+    } else {
+        removed = filePaths;
+    }
+
+    const QVector<LibraryAsset> missing = assetsForOriginals(removed);
+    if (missing.isEmpty()) {
+        return;
+    }
+    for (const LibraryAsset &asset : missing) {
+        qWarning() << "Original of asset" << asset.id << "was removed:" << asset.originalRelativePath;
+    }
+    emit errorOccurred(QStringLiteral("%1 original file(s) were removed from the library folder outside the app, including %2.")
+                           .arg(missing.size())
+                           .arg(missing.first().fileName));
+}
+
+void LibraryManager::importHotFolderFiles(const QStringList &filePaths)
+{
+    if (!hasOpenLibrary()) {
+        return;
+    }
+
+    // importFiles() serialises on m_importMutex anyway; chaining the batches
+    // keeps queued ones from holding pool threads while they wait.
+    QPointer<LibraryManager> self(this);
+    auto import = [self, filePaths]() {
+        if (self) {
+            self->importFiles(filePaths);
+        }
+    };
+    m_hotFolderImports = m_hotFolderImports.isFinished()
+        ? QtConcurrent::run(import)
+        : m_hotFolderImports.then(QtFuture::Launch::Async, import);
+}
+
 QString LibraryManager::ensureLibraryDirectories(const QString &directoryPath, QString *errorMessage)
 {
     QDir root(directoryPath);
@@ -851,58 +2344,23 @@ QString LibraryManager::ensureLibraryDirectories(const QString &directoryPath, Q
         previewsDir.mkpath(bucketName(1));
     }
 
-    return root.filePath(QString::fromLatin1(kDatabaseFileName));
-}
-
-bool LibraryManager::initializeDatabaseSchema(QString *errorMessage)
-{
-    if (!hasOpenLibrary()) {
-        if (errorMessage) {
-            *errorMessage = QStringLiteral("No open library to initialize schema.");
-        }
-        return false;
-    }
-
-    QSqlQuery query(m_database);
-    const QString createSql = QStringLiteral(
-        "CREATE TABLE IF NOT EXISTS assets ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-        "file_name TEXT NOT NULL,"
-        "photo_number TEXT,"
-        "original_path TEXT NOT NULL,"
-        "preview_path TEXT,"
-        "format TEXT,"
-        "width INTEGER DEFAULT 0,"
-        "height INTEGER DEFAULT 0,"
-        "imported_at TEXT NOT NULL"
-        ");");
-
-    if (!query.exec(createSql)) {
-        if (errorMessage) {
-            *errorMessage = QStringLiteral("Failed to initialize library schema: %1").arg(query.lastError().text());
-        }
-        return false;
-    }
-
-    if (!ensureDevelopAdjustmentsTable(errorMessage)) {
-        return false;
-    }
-
-    return true;
+    return root.filePath(QString::fromLatin1(kDatabaseFileName));
 }
 
-LibraryAsset LibraryManager::hydrateAsset(const QSqlRecord &record) const
+QString LibraryManager::databasePath() const
 {
-    LibraryAsset asset;
-    asset.id = record.value(QStringLiteral("id")).toLongLong();
-    asset.photoNumber = record.value(QStringLiteral("photo_number")).toString();
-    asset.fileName = record.value(QStringLiteral("file_name")).toString();
-    asset.originalRelativePath = record.value(QStringLiteral("original_path")).toString();
-    asset.previewRelativePath = record.value(QStringLiteral("preview_path")).toString();
-    asset.format = record.value(QStringLiteral("format")).toString();
-    asset.width = record.value(QStringLiteral("width")).toInt();
-    asset.height = record.value(QStringLiteral("height")).toInt();
-    return asset;
+    if (m_libraryPath.isEmpty()) {
+        return {};
+    }
+    return QDir(m_libraryPath).filePath(QString::fromLatin1(kDatabaseFileName));
+}
+
+QString LibraryManager::snapshotPath() const
+{
+    if (m_libraryPath.isEmpty()) {
+        return {};
+    }
+    return QDir(m_libraryPath).filePath(QString::fromLatin1(kSnapshotFileName));
 }
 
 QString LibraryManager::originalsDirectory() const
@@ -990,7 +2448,7 @@ QString LibraryManager::reservePreviewPath(qint64 assetId, int bucketIndex) cons
     return makePreviewRelativePath(bucketIndex, filename);
 }
 
-void LibraryManager::enqueueMetadataExtraction(qint64 assetId, const QString &sourceFile)
+void LibraryManager::enqueueMetadataExtraction(qint64 assetId, const QString &sourceFile, const QString &fileName)
 {
     if (m_metadataExtractionWatchers.contains(assetId)) {
         // Already extracting metadata for this asset
@@ -1010,9 +2468,10 @@ void LibraryManager::enqueueMetadataExtraction(qint64 assetId, const QString &so
     });
 
     // Extract metadata in background thread
-    QFuture<AssetMetadata> future = QtConcurrent::run([assetId, sourceFile]() -> AssetMetadata {
+    QFuture<AssetMetadata> future = QtConcurrent::run([assetId, sourceFile, fileName]() -> AssetMetadata {
         AssetMetadata meta;
         meta.assetId = assetId;
+        meta.fileName = fileName;
 
         DevelopMetadata developMeta;
         if (!ImageLoader::extractMetadata(sourceFile, &developMeta, nullptr)) {
@@ -1032,6 +2491,7 @@ void LibraryManager::enqueueMetadataExtraction(qint64 assetId, const QString &so
 
         meta.cameraMake = developMeta.cameraMake.trimmed();
         meta.cameraModel = developMeta.cameraModel.trimmed();
+        meta.lens = developMeta.lens.trimmed();
         meta.captureDate = developMeta.captureDateTime;
 
         return meta;
@@ -1062,17 +2522,17 @@ void LibraryManager::handleMetadataExtractionComplete(qint64 assetId, const QUui
         return; // Invalid result
     }
 
-    QString metaError;
-    if (!m_metadataCache->updateMetadata(assetId, meta, &metaError)) {
-        qWarning() << "Failed to store metadata for asset" << assetId << ":" << metaError;
-        m_metadataExtractionCompleted++;
-        updateBatchMetadataProgress();
-    } else {
-        m_metadataExtractionCompleted++;
-        updateBatchMetadataProgress();
+    m_metadataExtractionCompleted++;
+    updateBatchMetadataProgress();
+
+    m_metadataCache->updateMetadata(assetId, meta).then(this, [this, assetId](bool committed) {
+        if (!committed) {
+            qWarning() << "Failed to store metadata for asset" << assetId;
+            return;
+        }
         // Emit signal to update filter pane options if needed
         emit assetsChanged();
-    }
+    });
 }
 
 void LibraryManager::startBatchMetadataJob(int total)
@@ -1183,352 +2643,693 @@ void LibraryManager::enqueuePreviewGeneration(const LibraryAsset &asset)
     m_previewGenerator->enqueueJob(job);
 }
 
-bool LibraryManager::ensurePhotoNumberColumn(QString *errorMessage)
+DevelopAdjustments LibraryManager::loadDevelopAdjustments(qint64 assetId) const
 {
-    if (!hasOpenLibrary()) {
-        return false;
+    if (!hasOpenLibrary() || assetId <= 0) {
+        return defaultDevelopAdjustments();
     }
 
-    QSqlQuery pragma(m_database);
-    if (!pragma.exec(QStringLiteral("PRAGMA table_info(assets)"))) {
-        const QString message = QStringLiteral("Failed to inspect assets table: %1").arg(pragma.lastError().text());
-        if (errorMessage) {
-            *errorMessage = message;
-        }
-        return false;
-    }
+    QSqlQuery query(m_database);
+    query.prepare(QStringLiteral(
+        "SELECT COALESCE(p.payload, a.payload) FROM develop_adjustments a "
+        "LEFT JOIN develop_payloads p ON p.id = a.payload_id "
+        "WHERE a.asset_id = ?"));
+    query.addBindValue(assetId);
 
-    bool hasColumn = false;
-    while (pragma.next()) {
-        if (pragma.value(1).toString() == QStringLiteral("photo_number")) {
-            hasColumn = true;
-            break;
-        }
+    if (!query.exec()) {
+        qWarning() << "Failed to load develop adjustments for asset" << assetId << query.lastError();
+        return defaultDevelopAdjustments();
     }
 
-    if (hasColumn) {
-        return true;
+    if (!query.next()) {
+        return defaultDevelopAdjustments();
     }
 
-    QSqlQuery alter(m_database);
-    if (!alter.exec(QStringLiteral("ALTER TABLE assets ADD COLUMN photo_number TEXT"))) {
-        const QString message = QStringLiteral("Failed to add photo_number column: %1").arg(alter.lastError().text());
-        if (errorMessage) {
-            *errorMessage = message;
+    const QByteArray payload = query.value(0).toByteArray();
+    return deserializeAdjustments(payload);
+}
+
+QFuture<QHash<qint64, DevelopAdjustments>> LibraryManager::loadDevelopAdjustmentsBatch(const QVector<qint64> &assetIds) const
+{
+    if (!hasOpenLibrary() || assetIds.isEmpty()) {
+        return QtFuture::makeReadyFuture(QHash<qint64, DevelopAdjustments>());
+    }
+
+    const QSharedPointer<DatabaseWriter> writer = m_writer;
+    const QString dbPath = databasePath();
+    return QtConcurrent::run([writer, dbPath, assetIds]() {
+        // Edits saved just before the call are read back, not their
+        // predecessors.
+        writer->flush();
+
+        QHash<qint64, DevelopAdjustments> result;
+        QString connectionError;
+        QSqlQuery *query = DatabaseConnectionPool::instance().cachedQuery(dbPath, QStringLiteral(
+            "SELECT COALESCE(p.payload, a.payload) FROM develop_adjustments a "
+            "LEFT JOIN develop_payloads p ON p.id = a.payload_id "
+            "WHERE a.asset_id = ?"), &connectionError);
+        if (!query) {
+            qWarning() << "Failed to prepare develop adjustments lookup:" << connectionError;
+            return result;
         }
-        return false;
+        result.reserve(assetIds.size());
+        for (qint64 assetId : assetIds) {
+            query->bindValue(0, assetId);
+            if (!query->exec()) {
+                qWarning() << "Failed to load develop adjustments for asset" << assetId << query->lastError();
+            } else if (query->next()) {
+                result.insert(assetId, deserializeAdjustments(query->value(0).toByteArray()));
+            }
+            query->finish();
+        }
+        return result;
+    });
+}
+
+void LibraryManager::saveDevelopAdjustmentsAsync(qint64 assetId, const DevelopAdjustments &adjustments)
+{
+    if (!hasOpenLibrary() || assetId <= 0) {
+        return;
     }
 
-    return true;
+    submitDevelopAdjustments(assetId, adjustments);
 }
 
-int LibraryManager::currentMaxPhotoNumber() const
+QFuture<QHash<qint64, bool>> LibraryManager::saveDevelopAdjustmentsBatch(const QVector<qint64> &assetIds,
+                                                                         const DevelopAdjustments &adjustments)
 {
-    if (!hasOpenLibrary()) {
-        return 0;
+    if (!hasOpenLibrary() || assetIds.isEmpty()) {
+        return QtFuture::makeReadyFuture(QHash<qint64, bool>());
     }
 
-    QSqlQuery query(m_database);
-    if (!query.exec(QStringLiteral("SELECT MAX(CAST(photo_number AS INTEGER)) FROM assets"))) {
-        qWarning() << "Failed to query max photo number:" << query.lastError();
-        return 0;
-    }
+    const QByteArray payload = serializeAdjustments(adjustments);
+    const QString timestamp = QDateTime::currentDateTimeUtc().toString(Qt::ISODateWithMs);
+    const auto results = QSharedPointer<QHash<qint64, bool>>::create();
+
+    return m_writer->submit([assetIds, adjustments, payload, timestamp, results](QSqlDatabase &db, QString *errorMessage) {
+        DatabaseConnectionPool &pool = DatabaseConnectionPool::instance();
+        QSqlQuery *insertPayload = pool.cachedQuery(db, QStringLiteral(
+            "INSERT INTO develop_payloads(payload) VALUES(?)"), errorMessage);
+        if (!insertPayload) {
+            return false;
+        }
+        insertPayload->bindValue(0, payload);
+        if (!insertPayload->exec()) {
+            if (errorMessage) {
+                *errorMessage = QStringLiteral("Failed to store develop payload: %1").arg(insertPayload->lastError().text());
+            }
+            insertPayload->finish();
+            return false;
+        }
+        const qint64 payloadId = insertPayload->lastInsertId().toLongLong();
+        insertPayload->finish();
 
-    if (query.next()) {
-        return query.value(0).toInt();
-    }
+        QSqlQuery *link = pool.cachedQuery(db, QStringLiteral(
+            "INSERT INTO develop_adjustments(asset_id, payload, payload_id, history_seq, updated_at) "
+            "VALUES(?, '', ?, ?, ?) "
+            "ON CONFLICT(asset_id) DO UPDATE SET "
+            "payload = excluded.payload, "
+            "payload_id = excluded.payload_id, "
+            "history_seq = excluded.history_seq, "
+            "updated_at = excluded.updated_at"), errorMessage);
+        if (!link) {
+            return false;
+        }
+
+        // Each asset gets its own savepoint so a failure only fails that asset.
+        QSqlQuery savepoint(db);
+        for (qint64 assetId : assetIds) {
+            savepoint.exec(QStringLiteral("SAVEPOINT asset"));
+            QString assetError;
+            const qint64 seq = recordDevelopEdit(db, assetId, adjustments, payload, timestamp, &assetError);
+            bool ok = seq >= 0;
+            if (ok) {
+                link->bindValue(0, assetId);
+                link->bindValue(1, payloadId);
+                link->bindValue(2, historySeqValue(seq));
+                link->bindValue(3, timestamp);
+                ok = link->exec();
+                if (!ok) {
+                    assetError = link->lastError().text();
+                }
+                link->finish();
+            }
+            if (!ok) {
+                qWarning() << "Failed to save develop adjustments for asset" << assetId << ":" << assetError;
+                savepoint.exec(QStringLiteral("ROLLBACK TO asset"));
+            }
+            savepoint.exec(QStringLiteral("RELEASE asset"));
+            results->insert(assetId, ok);
+        }
+        return true;
+    }).then([assetIds, results](bool committed) {
+        QHash<qint64, bool> outcome;
+        outcome.reserve(assetIds.size());
+        for (qint64 assetId : assetIds) {
+            outcome.insert(assetId, committed && results->value(assetId, false));
+        }
+        return outcome;
+    });
+}
+
+QFuture<DevelopHistoryStep> LibraryManager::undoDevelopAdjustments(qint64 assetId)
+{
+    return stepDevelopHistory(assetId, -1);
+}
 
-    return 0;
+QFuture<DevelopHistoryStep> LibraryManager::redoDevelopAdjustments(qint64 assetId)
+{
+    return stepDevelopHistory(assetId, 1);
 }
 
-void LibraryManager::ensurePhotoNumbersAssigned()
+QVector<SmartCollection> LibraryManager::smartCollections() const
 {
+    QVector<SmartCollection> result;
     if (!hasOpenLibrary()) {
-        return;
+        return result;
     }
 
     QSqlQuery query(m_database);
-    if (!query.exec(QStringLiteral("SELECT id FROM assets WHERE photo_number IS NULL OR TRIM(photo_number) = '' ORDER BY imported_at ASC, id ASC"))) {
-        qWarning() << "Failed to find assets missing photo numbers:" << query.lastError();
-        return;
+    if (!query.exec(QStringLiteral("SELECT id, name, rule FROM smart_collections ORDER BY name COLLATE NOCASE, id"))) {
+        qWarning() << "Failed to read smart collections:" << query.lastError();
+        return result;
     }
-
-    int nextNumber = currentMaxPhotoNumber();
-
     while (query.next()) {
-        const qint64 assetId = query.value(0).toLongLong();
-        ++nextNumber;
-
-        QSqlQuery update(m_database);
-        update.prepare(QStringLiteral("UPDATE assets SET photo_number = ? WHERE id = ?"));
-        update.addBindValue(QString::number(nextNumber));
-        update.addBindValue(assetId);
-
-        if (!update.exec()) {
-            qWarning() << "Failed to assign photo number:" << update.lastError();
-            break;
-        }
+        SmartCollection collection;
+        collection.id = query.value(0).toLongLong();
+        collection.name = query.value(1).toString();
+        collection.rule = decodeCollectionRule(query.value(2).toByteArray());
+        result.append(collection);
     }
+    return result;
 }
 
-void LibraryManager::ensurePhotoNumberSupport()
+QFuture<qint64> LibraryManager::createSmartCollection(const QString &name, const FilterOptions &rule)
 {
     if (!hasOpenLibrary()) {
-        return;
+        return QtFuture::makeReadyFuture(qint64(-1));
     }
 
-    QString errorMessage;
-    if (!ensurePhotoNumberColumn(&errorMessage)) {
-        if (!errorMessage.isEmpty()) {
-            emit errorOccurred(errorMessage);
+    const QByteArray encoded = encodeCollectionRule(rule);
+    const auto collectionId = QSharedPointer<qint64>::create(-1);
+    const QSharedPointer<DatabaseWriter> writer = m_writer;
+    return m_writer->submit([name, encoded, collectionId](QSqlDatabase &db, QString *error) {
+        QSqlQuery *insert = DatabaseConnectionPool::instance().cachedQuery(db, QStringLiteral(
+            "INSERT INTO smart_collections(name, rule) VALUES(?, ?)"), error);
+        if (!insert) {
+            return false;
         }
-        return;
-    }
-
-    ensurePhotoNumbersAssigned();
-    ensureAssetStorageConsistency();
+        insert->bindValue(0, name);
+        insert->bindValue(1, encoded);
+        const bool ok = insert->exec();
+        if (ok) {
+            *collectionId = insert->lastInsertId().toLongLong();
+        } else if (error) {
+            *error = insert->lastError().text();
+        }
+        insert->finish();
+        return ok;
+    }).then(this, [this, writer, encoded, collectionId](bool committed) {
+        if (!committed || writer != m_writer) {
+            return qint64(-1);
+        }
+        // Membership is computed once here and kept current from then on.
+        m_assetIndex->setCollection(*collectionId, decodeCollectionRule(encoded));
+        emit smartCollectionsChanged();
+        return *collectionId;
+    });
 }
 
-bool LibraryManager::ensureDevelopAdjustmentsTable(QString *errorMessage) const
+QFuture<bool> LibraryManager::removeSmartCollection(qint64 collectionId)
 {
     if (!hasOpenLibrary()) {
-        if (errorMessage) {
-            *errorMessage = QStringLiteral("No open library for adjustments schema.");
-        }
-        return false;
+        return QtFuture::makeReadyFuture(false);
     }
 
-    QSqlQuery query(m_database);
-    const QString createSql = QStringLiteral(
-        "CREATE TABLE IF NOT EXISTS develop_adjustments ("
-        "asset_id INTEGER PRIMARY KEY,"
-        "payload TEXT NOT NULL,"
-        "updated_at TEXT NOT NULL,"
-        "FOREIGN KEY(asset_id) REFERENCES assets(id) ON DELETE CASCADE"
-        ");");
-
-    if (!query.exec(createSql)) {
-        if (errorMessage) {
-            *errorMessage = QStringLiteral("Failed to ensure develop adjustments table: %1").arg(query.lastError().text());
+    const QSharedPointer<DatabaseWriter> writer = m_writer;
+    return m_writer->submit([collectionId](QSqlDatabase &db, QString *error) {
+        QSqlQuery *remove = DatabaseConnectionPool::instance().cachedQuery(db, QStringLiteral(
+            "DELETE FROM smart_collections WHERE id = ?"), error);
+        if (!remove) {
+            return false;
         }
-        return false;
-    }
-
-    QSqlQuery indexQuery(m_database);
-    if (!indexQuery.exec(QStringLiteral("CREATE INDEX IF NOT EXISTS idx_develop_adjustments_updated_at ON develop_adjustments(updated_at DESC)"))) {
-        // Index creation failure should not be fatal but log it.
-        qWarning() << "Failed to create develop adjustments index:" << indexQuery.lastError();
-    }
+        remove->bindValue(0, collectionId);
+        const bool ok = remove->exec();
+        if (!ok && error) {
+            *error = remove->lastError().text();
+        }
+        remove->finish();
+        return ok;
+    }).then(this, [this, writer, collectionId](bool committed) {
+        if (!committed || writer != m_writer) {
+            return false;
+        }
+        m_assetIndex->removeCollection(collectionId);
+        emit smartCollectionsChanged();
+        return true;
+    });
+}
 
-    return true;
+void LibraryManager::setRating(const QList<qint64> &assetIds, int stars)
+{
+    updateMarks(assetIds, AssetMarks::kRatingMask, AssetMarks::ratingBits(stars));
 }
 
-DevelopAdjustments LibraryManager::loadDevelopAdjustments(qint64 assetId) const
+void LibraryManager::setFlag(const QList<qint64> &assetIds, AssetMarks::Flag flag)
 {
-    if (!hasOpenLibrary() || assetId <= 0) {
-        return defaultDevelopAdjustments();
-    }
+    updateMarks(assetIds, AssetMarks::kFlagMask, AssetMarks::flagBits(flag));
+}
 
-    QSqlQuery query(m_database);
-    query.prepare(QStringLiteral("SELECT payload FROM develop_adjustments WHERE asset_id = ?"));
-    query.addBindValue(assetId);
+void LibraryManager::setColorLabel(const QList<qint64> &assetIds, AssetMarks::ColorLabel label)
+{
+    updateMarks(assetIds, AssetMarks::kLabelMask, AssetMarks::labelBits(label));
+}
 
-    if (!query.exec()) {
-        qWarning() << "Failed to load develop adjustments for asset" << assetId << query.lastError();
-        return defaultDevelopAdjustments();
+void LibraryManager::updateMarks(const QList<qint64> &assetIds, quint8 fieldMask, quint8 bits)
+{
+    if (!hasOpenLibrary() || assetIds.isEmpty()) {
+        return;
     }
 
-    if (!query.next()) {
-        return defaultDevelopAdjustments();
-    }
+    // One queued command per keystroke; the writer folds a run of them into
+    // a single transaction.
+    m_writer->submit([assetIds, fieldMask, bits](QSqlDatabase &db, QString *errorMessage) {
+        QSqlQuery *upsert = DatabaseConnectionPool::instance().cachedQuery(db, QStringLiteral(
+            "INSERT INTO asset_marks(asset_id, marks) VALUES(?, ?) "
+            "ON CONFLICT(asset_id) DO UPDATE SET marks = (marks & ?) | ?"), errorMessage);
+        if (!upsert) {
+            return false;
+        }
+        for (qint64 assetId : assetIds) {
+            upsert->bindValue(0, assetId);
+            upsert->bindValue(1, int(bits));
+            upsert->bindValue(2, int(quint8(~fieldMask)));
+            upsert->bindValue(3, int(bits));
+            if (!upsert->exec()) {
+                if (errorMessage) {
+                    *errorMessage = upsert->lastError().text();
+                }
+                upsert->finish();
+                return false;
+            }
+        }
+        upsert->finish();
+        return true;
+    }).then(this, [this](bool committed) {
+        if (!committed) {
+            emit errorOccurred(QStringLiteral("Failed to save ratings and flags."));
+        }
+    });
 
-    const QByteArray payload = query.value(0).toByteArray();
-    return deserializeAdjustments(payload);
+    m_assetIndex->updateMarks(QVector<qint64>(assetIds.cbegin(), assetIds.cend()), fieldMask, bits);
+    emit assetMarksChanged(assetIds, fieldMask, bits);
 }
 
-bool LibraryManager::saveDevelopAdjustments(qint64 assetId,
-                                            const DevelopAdjustments &adjustments,
-                                            QString *errorMessage)
+QFuture<DevelopHistoryStep> LibraryManager::stepDevelopHistory(qint64 assetId, int offset)
 {
     if (!hasOpenLibrary() || assetId <= 0) {
-        if (errorMessage) {
-            *errorMessage = QStringLiteral("Cannot save adjustments without an open library.");
-        }
-        return false;
+        return QtFuture::makeReadyFuture(DevelopHistoryStep());
     }
 
-    const QByteArray payload = serializeAdjustments(adjustments);
-    const QString payloadText = QString::fromUtf8(payload);
     const QString timestamp = QDateTime::currentDateTimeUtc().toString(Qt::ISODateWithMs);
+    const auto result = QSharedPointer<DevelopHistoryStep>::create();
 
-    QSqlQuery query(m_database);
-    query.prepare(QStringLiteral(
-        "INSERT INTO develop_adjustments(asset_id, payload, updated_at) "
-        "VALUES(?, ?, ?) "
-        "ON CONFLICT(asset_id) DO UPDATE SET "
-        "payload = excluded.payload, "
-        "updated_at = excluded.updated_at;"));
-    query.addBindValue(assetId);
-    query.addBindValue(payloadText);
-    query.addBindValue(timestamp);
+    return m_writer->submit([assetId, offset, timestamp, result](QSqlDatabase &db, QString *errorMessage) {
+        DevelopState state;
+        if (!readDevelopState(db, assetId, &state, errorMessage)) {
+            return false;
+        }
+        const qint64 target = state.historySeq + offset;
+        if (state.historySeq == 0 || target < 1) {
+            return true;
+        }
 
-    if (!query.exec()) {
-        const QString message = QStringLiteral("Failed to persist develop adjustments: %1").arg(query.lastError().text());
-        if (errorMessage) {
-            *errorMessage = message;
-        } else {
-            qWarning() << message;
+        DatabaseConnectionPool &pool = DatabaseConnectionPool::instance();
+        QSqlQuery *exists = pool.cachedQuery(db, QStringLiteral(
+            "SELECT 1 FROM develop_history WHERE asset_id = ? AND seq = ?"), errorMessage);
+        if (!exists) {
+            return false;
+        }
+        exists->bindValue(0, assetId);
+        exists->bindValue(1, target);
+        const bool hasTarget = exists->exec() && exists->next();
+        exists->finish();
+        if (!hasTarget) {
+            return true;
         }
-        return false;
-    }
 
-    return true;
+        DevelopAdjustments adjustments;
+        if (!developStateAt(db, assetId, target, &adjustments, errorMessage)) {
+            return false;
+        }
+
+        QSqlQuery *update = pool.cachedQuery(db, QStringLiteral(
+            "UPDATE develop_adjustments SET payload = ?, payload_id = NULL, history_seq = ?, updated_at = ? "
+            "WHERE asset_id = ?"), errorMessage);
+        if (!update) {
+            return false;
+        }
+        update->bindValue(0, serializeAdjustments(adjustments));
+        update->bindValue(1, target);
+        update->bindValue(2, timestamp);
+        update->bindValue(3, assetId);
+        const bool ok = update->exec();
+        if (!ok && errorMessage) {
+            *errorMessage = QStringLiteral("Failed to restore develop history: %1").arg(update->lastError().text());
+        }
+        update->finish();
+
+        result->moved = ok;
+        result->adjustments = adjustments;
+        return ok;
+    }).then([result](bool committed) {
+        return committed ? *result : DevelopHistoryStep();
+    });
 }
 
-void LibraryManager::saveDevelopAdjustmentsAsync(qint64 assetId, const DevelopAdjustments &adjustments)
+QFuture<bool> LibraryManager::submitDevelopAdjustments(qint64 assetId, const DevelopAdjustments &adjustments)
 {
-    // Capture necessary data before entering the lambda
-    if (!hasOpenLibrary() || assetId <= 0) {
-        return;
-    }
-
-    const QString libraryPath = m_libraryPath;
-    const QString connectionName = m_connectionName;
-    const QString dbPath = QDir(libraryPath).filePath(QString::fromLatin1(kDatabaseFileName));
     const QByteArray payload = serializeAdjustments(adjustments);
-    const QString payloadText = QString::fromUtf8(payload);
     const QString timestamp = QDateTime::currentDateTimeUtc().toString(Qt::ISODateWithMs);
 
-    QtConcurrent::run([libraryPath, connectionName, dbPath, assetId, payloadText, timestamp]() {
-        // Create a thread-local database connection
-        const QString threadConnectionName = QStringLiteral("%1_save_%2").arg(connectionName).arg(QUuid::createUuid().toString(QUuid::Id128));
-        QSqlDatabase threadDb = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), threadConnectionName);
-        threadDb.setDatabaseName(dbPath);
-        
-        if (!threadDb.open()) {
-            qWarning() << "Failed to open thread-local database connection for saving adjustments:" << threadDb.lastError();
-            QSqlDatabase::removeDatabase(threadConnectionName);
-            return;
+    return m_writer->submit([assetId, adjustments, payload, timestamp](QSqlDatabase &db, QString *errorMessage) {
+        const qint64 seq = recordDevelopEdit(db, assetId, adjustments, payload, timestamp, errorMessage);
+        if (seq < 0) {
+            return false;
         }
 
-        QSqlQuery query(threadDb);
-        query.prepare(QStringLiteral(
-            "INSERT INTO develop_adjustments(asset_id, payload, updated_at) "
-            "VALUES(?, ?, ?) "
-            "ON CONFLICT(asset_id) DO UPDATE SET "
-            "payload = excluded.payload, "
-            "updated_at = excluded.updated_at;"));
-        query.addBindValue(assetId);
-        query.addBindValue(payloadText);
-        query.addBindValue(timestamp);
-
-        if (!query.exec()) {
-            qWarning() << "Failed to persist adjustments in background:" << query.lastError().text();
+        QSqlQuery *query = DatabaseConnectionPool::instance().cachedQuery(db, upsertAdjustmentsSql(), errorMessage);
+        if (!query) {
+            return false;
         }
 
-        // Clean up thread-local database connection
-        threadDb.close();
-        QSqlDatabase::removeDatabase(threadConnectionName);
+        query->bindValue(0, assetId);
+        query->bindValue(1, payload);
+        query->bindValue(2, historySeqValue(seq));
+        query->bindValue(3, timestamp);
+
+        const bool ok = query->exec();
+        if (!ok && errorMessage) {
+            *errorMessage = QStringLiteral("Failed to persist develop adjustments: %1").arg(query->lastError().text());
+        }
+        query->finish();
+        return ok;
     });
 }
 
-void LibraryManager::ensureAssetStorageConsistency()
+void LibraryManager::startStorageConsistencyCheck()
 {
     if (!hasOpenLibrary()) {
         return;
     }
 
-    const QString originalsRoot = originalsDirectory();
-    const QString previewsRoot = previewsDirectory();
-
+    int layoutVersion = 0;
+    qint64 resumeAfter = -1;
     QSqlQuery query(m_database);
-    if (!query.exec(QStringLiteral("SELECT id, photo_number, original_path, preview_path FROM assets"))) {
-        qWarning() << "Failed to query assets for storage consistency:" << query.lastError();
+    if (!query.exec(QStringLiteral("SELECT key, value FROM library_meta"))) {
+        qWarning() << "Failed to read library state:" << query.lastError();
         return;
     }
-
     while (query.next()) {
-        const qint64 assetId = query.value(0).toLongLong();
-        const QString photoNumber = query.value(1).toString();
+        const QString key = query.value(0).toString();
+        if (key == QLatin1String("storage_layout_version")) {
+            layoutVersion = query.value(1).toInt();
+        } else if (key == QLatin1String("storage_check_cursor")) {
+            resumeAfter = query.value(1).toLongLong();
+        }
+    }
+
+    // A saved cursor marks a pass that was interrupted; otherwise only a
+    // layout change makes the library need one.
+    if (resumeAfter < 0) {
+        if (layoutVersion >= kStorageLayoutVersion) {
+            return;
+        }
+        resumeAfter = 0;
+    }
+
+    m_storageCheckCancelled = QSharedPointer<QAtomicInt>::create(0);
+    const QSharedPointer<QAtomicInt> cancelled = m_storageCheckCancelled;
+    // Outlives the check: the watcher reports moves after a delay.
+    if (!m_relocatedOriginals) {
+        m_relocatedOriginals = QSharedPointer<RelocatedOriginals>::create();
+    }
+    const QSharedPointer<RelocatedOriginals> relocatedOriginals = m_relocatedOriginals;
+    const QString libraryPath = m_libraryPath;
+    if (m_jobManager) {
+        m_storageCheckJobId = m_jobManager->startJob(JobCategory::Misc,
+                                                     tr("Checking library storage"),
+                                                     tr("Verifying asset locations"));
+    }
+
+    // The manager can be closed or destroyed while a batch runs; the
+    // cancel flag is only read between batches, so progress goes through
+    // a guarded pointer.
+    QPointer<LibraryManager> self(this);
+    const QSharedPointer<DatabaseWriter> writer = m_writer;
+
+    QtConcurrent::run([self, cancelled, libraryPath, writer, relocatedOriginals, resumeAfter]() {
+        DatabaseConnectionPool &pool = DatabaseConnectionPool::instance();
+        const QString dbPath = writer->databasePath();
+        int total = 0;
+        QSqlQuery *count = pool.cachedQuery(dbPath, QStringLiteral("SELECT COUNT(*) FROM assets WHERE id > ?"));
+        if (count) {
+            count->bindValue(0, resumeAfter);
+            if (count->exec() && count->next()) {
+                total = count->value(0).toInt();
+            }
+            count->finish();
+        }
+
+        QSet<int> preparedBuckets;
+        qint64 lastAssetId = resumeAfter;
+        int checked = 0;
+        int relocated = 0;
+        bool completed = false;
+        while (!cancelled->loadRelaxed() && self) {
+            const StorageCheckBatch batch = checkStorageBatch(libraryPath, writer, lastAssetId,
+                                                              kStorageCheckBatchSize, &preparedBuckets,
+                                                              relocatedOriginals.data());
+            if (!batch.ok) {
+                break;
+            }
+            lastAssetId = batch.lastAssetId;
+            checked += batch.checked;
+            relocated += batch.relocated;
+            if (batch.finished) {
+                completed = true;
+                break;
+            }
+
+            if (!self) {
+                return;
+            }
+            QMetaObject::invokeMethod(self, [self, cancelled, checked, total]() {
+                if (self && !cancelled->loadRelaxed() && self->m_jobManager && !self->m_storageCheckJobId.isNull()) {
+                    self->m_jobManager->updateProgress(self->m_storageCheckJobId, checked, qMax(checked, total));
+                }
+            }, Qt::QueuedConnection);
+        }
+
+        if (!self) {
+            return;
+        }
+        QMetaObject::invokeMethod(self, [self, cancelled, completed, relocated]() {
+            if (self && !cancelled->loadRelaxed()) {
+                self->finishStorageConsistencyCheck(completed, relocated);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void LibraryManager::finishStorageConsistencyCheck(bool completed, int relocated)
+{
+    if (m_jobManager && !m_storageCheckJobId.isNull()) {
+        if (completed) {
+            m_jobManager->completeJob(m_storageCheckJobId, tr("%n file(s) relocated", nullptr, relocated));
+        } else {
+            m_jobManager->failJob(m_storageCheckJobId, tr("Storage check stopped; it resumes next time the library opens"));
+        }
+    }
+    m_storageCheckJobId = QUuid();
+    m_storageCheckCancelled.reset();
+
+    // The index holds the paths that were just rewritten; the reload
+    // announces the change once it lands.
+    if (relocated > 0) {
+        startAssetIndexLoad();
+    }
+}
+
+LibraryManager::StorageCheckBatch LibraryManager::checkStorageBatch(const QString &libraryPath,
+                                                                    const QSharedPointer<DatabaseWriter> &writer,
+                                                                    qint64 afterAssetId,
+                                                                    int batchSize,
+                                                                    QSet<int> *preparedBuckets,
+                                                                    RelocatedOriginals *relocatedOriginals)
+{
+    StorageCheckBatch batch;
+    batch.lastAssetId = afterAssetId;
+
+    const QDir root(libraryPath);
+    DatabaseConnectionPool &pool = DatabaseConnectionPool::instance();
+    QString connectionError;
+    QSqlQuery *select = pool.cachedQuery(writer->databasePath(), QStringLiteral(
+        "SELECT id, photo_number, original_path, preview_path FROM assets "
+        "WHERE id > ? ORDER BY id LIMIT ?"), &connectionError);
+    if (!select) {
+        qWarning() << "Failed to prepare storage check query:" << connectionError;
+        return batch;
+    }
+    select->bindValue(0, afterAssetId);
+    select->bindValue(1, batchSize);
+    if (!select->exec()) {
+        qWarning() << "Failed to query assets for storage consistency:" << select->lastError();
+        select->finish();
+        return batch;
+    }
+
+    const QString originalsRoot = root.filePath(QString::fromLatin1(kOriginalsDirName));
+    const QString previewsRoot = root.filePath(QString::fromLatin1(kPreviewsDirName));
+    QVector<QPair<qint64, QString>> originalMoves;
+    QVector<QPair<qint64, QString>> previewMoves;
+    while (select->next()) {
+        const qint64 assetId = select->value(0).toLongLong();
+        batch.lastAssetId = assetId;
+        ++batch.checked;
+
+        const QString photoNumber = select->value(1).toString();
         if (photoNumber.trimmed().isEmpty()) {
             continue;
         }
 
         const int bucketIndex = bucketIndexForPhotoNumber(photoNumber);
-        ensureBucketExists(originalsRoot, bucketIndex);
-        ensureBucketExists(previewsRoot, bucketIndex);
-
-        const QString originalRel = query.value(2).toString();
-        if (!originalRel.isEmpty()) {
-            const QString fileName = QFileInfo(originalRel).fileName();
-            if (!fileName.isEmpty()) {
-                const QString expectedRel = makeOriginalRelativePath(bucketIndex, fileName);
-                if (expectedRel != originalRel) {
-                    const QString currentPath = absoluteAssetPath(originalRel);
-                    const QString targetPath = absoluteAssetPath(expectedRel);
-                    const QString targetDir = QFileInfo(targetPath).dir().absolutePath();
-                    QDir().mkpath(targetDir);
-                    if (QFile::exists(currentPath)) {
-                        QFile::remove(targetPath);
-                        if (QFile::rename(currentPath, targetPath)) {
-                            QSqlQuery update(m_database);
-                            update.prepare(QStringLiteral("UPDATE assets SET original_path = ? WHERE id = ?"));
-                            update.addBindValue(expectedRel);
-                            update.addBindValue(assetId);
-                            if (!update.exec()) {
-                                qWarning() << "Failed to update original_path for asset" << assetId << update.lastError();
-                            }
-                        } else {
-                            qWarning() << "Failed to move original" << currentPath << "to" << targetPath;
-                        }
-                    }
+        if (!preparedBuckets->contains(bucketIndex)) {
+            ensureBucketExists(originalsRoot, bucketIndex);
+            ensureBucketExists(previewsRoot, bucketIndex);
+            preparedBuckets->insert(bucketIndex);
+        }
+
+        const QString originalRel = select->value(2).toString();
+        const QString originalName = QFileInfo(originalRel).fileName();
+        if (!originalName.isEmpty()) {
+            const QString expectedRel = makeOriginalRelativePath(bucketIndex, originalName);
+            if (expectedRel != originalRel) {
+                // Recorded before the move so the watcher can never see it first.
+                const QString movedPath = QDir::cleanPath(resolveLibraryPath(root, originalRel));
+                {
+                    QMutexLocker locker(&relocatedOriginals->mutex);
+                    relocatedOriginals->paths.insert(movedPath);
+                }
+                if (relocateStoredFile(root, originalRel, expectedRel)) {
+                    originalMoves.append({assetId, expectedRel});
+                } else {
+                    QMutexLocker locker(&relocatedOriginals->mutex);
+                    relocatedOriginals->paths.remove(movedPath);
                 }
             }
         }
 
-        const QString previewRel = query.value(3).toString();
-        if (!previewRel.isEmpty()) {
-            const QString fileName = QFileInfo(previewRel).fileName();
-            if (!fileName.isEmpty()) {
-                const QString expectedRel = makePreviewRelativePath(bucketIndex, fileName);
-                if (expectedRel != previewRel) {
-                    const QString currentPath = absoluteAssetPath(previewRel);
-                    const QString targetPath = absoluteAssetPath(expectedRel);
-                    const QString targetDir = QFileInfo(targetPath).dir().absolutePath();
-                    QDir().mkpath(targetDir);
-                    if (QFile::exists(currentPath)) {
-                        QFile::remove(targetPath);
-                        if (QFile::rename(currentPath, targetPath)) {
-                            QSqlQuery update(m_database);
-                            update.prepare(QStringLiteral("UPDATE assets SET preview_path = ? WHERE id = ?"));
-                            update.addBindValue(expectedRel);
-                            update.addBindValue(assetId);
-                            if (!update.exec()) {
-                                qWarning() << "Failed to update preview_path for asset" << assetId << update.lastError();
-                            }
-                        } else {
-                            qWarning() << "Failed to move preview" << currentPath << "to" << targetPath;
-                        }
+        const QString previewRel = select->value(3).toString();
+        const QString previewName = QFileInfo(previewRel).fileName();
+        if (!previewName.isEmpty()) {
+            const QString expectedRel = makePreviewRelativePath(bucketIndex, previewName);
+            if (expectedRel != previewRel && relocateStoredFile(root, previewRel, expectedRel)) {
+                previewMoves.append({assetId, expectedRel});
+            }
+        }
+    }
+    select->finish();
+
+    // The new paths and the cursor are committed together, so a pass stopped
+    // at any point resumes after the last batch it recorded.
+    const bool finished = batch.checked < batchSize;
+    const qint64 lastAssetId = batch.lastAssetId;
+    QFuture<bool> recorded = writer->submit([originalMoves, previewMoves, finished, lastAssetId](QSqlDatabase &db, QString *errorMessage) {
+        DatabaseConnectionPool &pool = DatabaseConnectionPool::instance();
+        const auto applyMoves = [&](const QString &sql, const QVector<QPair<qint64, QString>> &moves) {
+            if (moves.isEmpty()) {
+                return true;
+            }
+            QSqlQuery *update = pool.cachedQuery(db, sql, errorMessage);
+            if (!update) {
+                return false;
+            }
+            for (const auto &move : moves) {
+                update->bindValue(0, move.second);
+                update->bindValue(1, move.first);
+                if (!update->exec()) {
+                    if (errorMessage) {
+                        *errorMessage = QStringLiteral("Failed to record relocated file for asset %1: %2")
+                                            .arg(move.first).arg(update->lastError().text());
                     }
+                    update->finish();
+                    return false;
                 }
             }
+            update->finish();
+            return true;
+        };
+        if (!applyMoves(QStringLiteral("UPDATE assets SET original_path = ? WHERE id = ?"), originalMoves)
+            || !applyMoves(QStringLiteral("UPDATE assets SET preview_path = ? WHERE id = ?"), previewMoves)) {
+            return false;
+        }
+
+        QSqlQuery *state = pool.cachedQuery(db, QStringLiteral(
+            "INSERT INTO library_meta(key, value) VALUES(?, ?) "
+            "ON CONFLICT(key) DO UPDATE SET value = excluded.value"), errorMessage);
+        if (!state) {
+            return false;
+        }
+        if (finished) {
+            state->bindValue(0, QStringLiteral("storage_layout_version"));
+            state->bindValue(1, QString::number(kStorageLayoutVersion));
+        } else {
+            state->bindValue(0, QStringLiteral("storage_check_cursor"));
+            state->bindValue(1, QString::number(lastAssetId));
+        }
+        bool ok = state->exec();
+        if (!ok && errorMessage) {
+            *errorMessage = QStringLiteral("Failed to record storage check progress: %1").arg(state->lastError().text());
+        }
+        state->finish();
+
+        if (ok && finished) {
+            QSqlQuery *clearCursor = pool.cachedQuery(db, QStringLiteral(
+                "DELETE FROM library_meta WHERE key = 'storage_check_cursor'"), errorMessage);
+            ok = clearCursor && clearCursor->exec();
+            if (clearCursor) {
+                clearCursor->finish();
+            }
         }
+        return ok;
+    });
+    // Runs on the check's worker thread, so waiting here only paces the
+    // next batch behind the commit.
+    recorded.waitForFinished();
+    if (!recorded.result()) {
+        return batch;
     }
+
+    batch.ok = true;
+    batch.finished = finished;
+    batch.relocated = originalMoves.size() + previewMoves.size();
+    return batch;
 }
 
-QString LibraryManager::makeOriginalRelativePath(int bucketIndex, const QString &fileName) const
+QString LibraryManager::makeOriginalRelativePath(int bucketIndex, const QString &fileName)
 {
     return QStringLiteral("%1/%2/%3")
         .arg(QString::fromLatin1(kOriginalsDirName), bucketName(bucketIndex), fileName);
 }
 
-QString LibraryManager::makePreviewRelativePath(int bucketIndex, const QString &fileName) const
+QString LibraryManager::makePreviewRelativePath(int bucketIndex, const QString &fileName)
 {
     return QStringLiteral("%1/%2/%3")
         .arg(QString::fromLatin1(kPreviewsDirName), bucketName(bucketIndex), fileName);
 }
 
-bool LibraryManager::ensureBucketExists(const QString &baseDir, int bucketIndex) const
+bool LibraryManager::ensureBucketExists(const QString &baseDir, int bucketIndex)
 {
     if (baseDir.isEmpty()) {
         return false;
@@ -1542,11 +3343,11 @@ bool LibraryManager::ensureBucketExists(const QString &baseDir, int bucketIndex)
     return dir.mkpath(bucket);
 }
 
-void LibraryManager::doEnqueueMetadataExtraction(qint64 assetId, const QString &sourceFile)
+void LibraryManager::doEnqueueMetadataExtraction(qint64 assetId, const QString &sourceFile, const QString &fileName)
 {
     // This method is called from the main thread via queued connection
     // It's safe to create QObjects here
-    enqueueMetadataExtraction(assetId, sourceFile);
+    enqueueMetadataExtraction(assetId, sourceFile, fileName);
 }
 
 void LibraryManager::doEnqueuePreviewGeneration(const LibraryAsset &asset)
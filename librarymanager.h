@@ -6,13 +6,19 @@
 #include <QSqlQuery>
 #include <QSqlRecord>
 #include <QString>
+#include <QVariantList>
 #include <QVector>
 #include <QHash>
+#include <QSet>
 #include <QUuid>
 #include <QFutureWatcher>
 #include <QFuture>
 #include <QPointer>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QSharedPointer>
 
+#include "assetmarks.h"
 #include "developtypes.h"
 #include "metadatacache.h"
 
@@ -26,11 +32,44 @@ struct LibraryAsset
     QString format;
     int width = 0;
     int height = 0;
+    quint64 perceptualHash = 0; // 0 until the preview has been hashed
+    int stackSize = 1; // frames this asset stands for in a collapsed burst
+    quint8 marks = 0;  // rating, flag and colour label, see assetmarks.h
+};
+
+// A saved filter whose members the asset index keeps current; selected
+// through FilterOptions::collectionId.
+struct SmartCollection
+{
+    qint64 id = -1;
+    QString name;
+    // Only the predicate fields are stored: ISO, camera, lens, tags and
+    // marks. Sort order, search text, similarity and bursts are not.
+    FilterOptions rule;
+};
+
+// Result of moving through an asset's develop history.
+struct DevelopHistoryStep
+{
+    bool moved = false; // false when there was nothing to undo or redo
+    DevelopAdjustments adjustments;
+};
+
+// Assets within FilterOptions::similarityThreshold of similarToAssetId, found
+// by one scan of the hashes and shared by every SQL read of a query.
+struct SimilarAssetMatches
+{
+    quint64 serial = 0; // tells match sets apart once bound to a connection
+    QVector<qint64> assetIds;
 };
 
 Q_DECLARE_METATYPE(LibraryAsset)
 Q_DECLARE_METATYPE(QVector<LibraryAsset>)
 
+class AssetIndex;
+class DatabaseWriter;
+class FolderWatcher;
+struct SchemaMigration;
 class PreviewGenerator;
 class JobManager;
 
@@ -52,16 +91,53 @@ public:
 
     QVector<LibraryAsset> assets() const;
     QVector<LibraryAsset> assets(const FilterOptions &filterOptions) const;
+    // Ids of every asset in the result of requestAssets() generation, in
+    // result order. False while they are not known: before the index has
+    // loaded they are listed on a worker thread first, and
+    // queriedAssetIdsReady() follows. False too once a newer query started.
+    bool queriedAssetIds(quint64 generation, QVector<qint64> *ids);
+    LibraryAsset assetById(qint64 assetId) const;
+    // Looks up many assets on a worker thread: from the index once it has
+    // loaded, otherwise through a pooled connection. Unknown ids are left
+    // out.
+    QFuture<QVector<LibraryAsset>> lookupAssets(const QVector<qint64> &assetIds) const;
     QString resolvePath(const QString &relativePath) const;
     
     MetadataCache *metadataCache() const;
 
     void importFiles(const QStringList &filePaths);
 
+    // Folders whose new image files are imported automatically while the
+    // library is open. Stored with the library; the new set is watched, and
+    // the future finishes, once the write has committed.
+    QStringList hotFolders() const;
+    QFuture<bool> setHotFolders(const QStringList &folders);
+
     DevelopAdjustments loadDevelopAdjustments(qint64 assetId) const;
-    bool saveDevelopAdjustments(qint64 assetId,
-                                const DevelopAdjustments &adjustments,
-                                QString *errorMessage = nullptr);
+    // Stored adjustments of assetIds, read on a worker thread after the
+    // writes queued so far have committed. Assets without any are left out.
+    QFuture<QHash<qint64, DevelopAdjustments>> loadDevelopAdjustmentsBatch(const QVector<qint64> &assetIds) const;
+    // Applies one set of adjustments to many assets in a single background
+    // transaction. The payload is stored once and shared by every row; the
+    // future reports, per asset, whether its row was committed.
+    QFuture<QHash<qint64, bool>> saveDevelopAdjustmentsBatch(const QVector<qint64> &assetIds,
+                                                             const DevelopAdjustments &adjustments);
+    // Every saved change is recorded in the asset's develop history. These
+    // move one step back or forward, store the restored state and return it.
+    QFuture<DevelopHistoryStep> undoDevelopAdjustments(qint64 assetId);
+    QFuture<DevelopHistoryStep> redoDevelopAdjustments(qint64 assetId);
+
+    // Culling marks. The asset index is updated at once and the rows are
+    // written behind it, so these never wait on the database.
+    void setRating(const QList<qint64> &assetIds, int stars);
+    void setFlag(const QList<qint64> &assetIds, AssetMarks::Flag flag);
+    void setColorLabel(const QList<qint64> &assetIds, AssetMarks::ColorLabel label);
+
+    QVector<SmartCollection> smartCollections() const;
+    // Finish once the write has committed and smartCollectionsChanged() has
+    // been emitted. The new collection's id is -1 on failure.
+    QFuture<qint64> createSmartCollection(const QString &name, const FilterOptions &rule);
+    QFuture<bool> removeSmartCollection(qint64 collectionId);
 
 signals:
     void libraryOpened(const QString &path);
@@ -71,38 +147,97 @@ signals:
     void importProgress(int imported, int total);
     void importCompleted();
     void errorOccurred(const QString &message);
-    void assetsQueried(const QVector<LibraryAsset> &assets);
+    // A query started by requestAssets() has totalCount rows; fetch them
+    // with requestAssetPage() using the same generation.
+    void assetsQueried(quint64 generation, int totalCount);
+    void assetPageReady(quint64 generation, int offset, const QVector<LibraryAsset> &assets);
+    void queriedAssetIdsReady(quint64 generation);
+    // The AssetMarks field selected by fieldMask was set to bits on assetIds.
+    void assetMarksChanged(const QList<qint64> &assetIds, quint8 fieldMask, quint8 bits);
+    void smartCollectionsChanged();
 
 public slots:
     void requestAssets(const FilterOptions &filterOptions);
+    void requestAssetPage(quint64 generation, int offset, int limit);
     void saveDevelopAdjustmentsAsync(qint64 assetId, const DevelopAdjustments &adjustments);
 
 private slots:
-    void doEnqueueMetadataExtraction(qint64 assetId, const QString &sourceFile);
+    void doEnqueueMetadataExtraction(qint64 assetId, const QString &sourceFile, const QString &fileName);
     void doEnqueuePreviewGeneration(const LibraryAsset &asset);
     void doStartBatchPreviewJob(int total);
     void doStartBatchMetadataJob(int total);
 
 private:
-    bool ensurePhotoNumberColumn(QString *errorMessage = nullptr);
-    void ensurePhotoNumbersAssigned();
-    int currentMaxPhotoNumber() const;
-    void ensurePhotoNumberSupport();
-    bool ensureDevelopAdjustmentsTable(QString *errorMessage = nullptr) const;
-
     QString ensureLibraryDirectories(const QString &directoryPath, QString *errorMessage);
-    bool initializeDatabaseSchema(QString *errorMessage);
-    LibraryAsset hydrateAsset(const QSqlRecord &record) const;
+    bool migrateDatabaseSchema(QString *errorMessage);
+    static QVector<SchemaMigration> schemaMigrations();
+    QString databasePath() const;
+    QString snapshotPath() const;
+    void startAssetIndexLoad();
+    void startCaptureEpochBackfill();
+    void startStorageConsistencyCheck();
+    void finishStorageConsistencyCheck(bool completed, int relocated);
+    void startFolderWatch();
+    QVector<LibraryAsset> assetsForOriginals(const QStringList &filePaths) const;
+    void handleOriginalsModified(const QStringList &filePaths);
+    void handleOriginalsRemoved(const QStringList &filePaths);
+    void updateMarks(const QList<qint64> &assetIds, quint8 fieldMask, quint8 bits);
+    void importHotFolderFiles(const QStringList &filePaths);
+    struct AssetPageCursor
+    {
+        int offset = -1;        // row the next sequential page starts at
+        QVariantList sortKey;   // sort key of the row before it
+    };
+    struct AssetQueryState;
+
+    // similar is the match set of filterOptions.similarToAssetId when the
+    // caller already has one; otherwise it is found for this call.
+    static QVector<LibraryAsset> queryAssets(const QString &dbPath,
+                                             const QString &metadataPath,
+                                             const FilterOptions &filterOptions,
+                                             int offset = 0,
+                                             int limit = -1,
+                                             AssetPageCursor *cursor = nullptr,
+                                             const SimilarAssetMatches *similar = nullptr);
+    static int countAssets(const QString &dbPath,
+                           const QString &metadataPath,
+                           const FilterOptions &filterOptions,
+                           const SimilarAssetMatches *similar = nullptr);
+    static QSharedPointer<const SimilarAssetMatches> findSimilarAssets(const QString &dbPath,
+                                                                      const FilterOptions &filterOptions);
     QString originalsDirectory() const;
     QString previewsDirectory() const;
     QString absoluteAssetPath(const QString &relativePath) const;
     QString storeOriginal(const QString &sourceFile, int bucketIndex, QString *errorMessage) const;
     QString reservePreviewPath(qint64 assetId, int bucketIndex) const;
-    QString makeOriginalRelativePath(int bucketIndex, const QString &fileName) const;
-    QString makePreviewRelativePath(int bucketIndex, const QString &fileName) const;
-    bool ensureBucketExists(const QString &baseDir, int bucketIndex) const;
+    static QString makeOriginalRelativePath(int bucketIndex, const QString &fileName);
+    static QString makePreviewRelativePath(int bucketIndex, const QString &fileName);
+    static bool ensureBucketExists(const QString &baseDir, int bucketIndex);
     void enqueuePreviewGeneration(const LibraryAsset &asset);
-    void ensureAssetStorageConsistency();
+    QFuture<bool> submitDevelopAdjustments(qint64 assetId, const DevelopAdjustments &adjustments);
+    QFuture<DevelopHistoryStep> stepDevelopHistory(qint64 assetId, int offset);
+
+    struct StorageCheckBatch
+    {
+        bool ok = false;
+        bool finished = false;  // no assets after this batch
+        qint64 lastAssetId = 0; // resume point for the next batch
+        int checked = 0;
+        int relocated = 0;
+    };
+    // Absolute paths of originals the storage check moved away, so the
+    // watcher's late reports of them are not taken for external removals.
+    struct RelocatedOriginals
+    {
+        QMutex mutex;
+        QSet<QString> paths;
+    };
+    static StorageCheckBatch checkStorageBatch(const QString &libraryPath,
+                                               const QSharedPointer<DatabaseWriter> &writer,
+                                               qint64 afterAssetId,
+                                               int batchSize,
+                                               QSet<int> *preparedBuckets,
+                                               RelocatedOriginals *relocatedOriginals);
 
     QString m_libraryPath;
     QString m_connectionName;
@@ -118,8 +253,23 @@ private:
     int m_metadataExtractionTotal = 0;
     int m_metadataExtractionCompleted = 0;
     MetadataCache *m_metadataCache = nullptr;
+    // Single writer for library.db; GUI-thread writes go through it.
+    QSharedPointer<DatabaseWriter> m_writer;
+    QSharedPointer<AssetIndex> m_assetIndex;
+    QSharedPointer<AssetQueryState> m_assetQuery;
+    quint64 m_assetQueryGeneration = 0;
+    QSharedPointer<QAtomicInt> m_backfillCancelled;
+    QSharedPointer<QAtomicInt> m_storageCheckCancelled;
+    QSharedPointer<RelocatedOriginals> m_relocatedOriginals;
+    QUuid m_storageCheckJobId;
+    FolderWatcher *m_folderWatcher = nullptr;
+    QFuture<void> m_hotFolderImports;
+    // Held by importFiles() from reading MAX(photo_no) until its commit.
+    QMutex m_importMutex;
     QHash<qint64, QFutureWatcher<AssetMetadata>*> m_metadataExtractionWatchers;
-    void enqueueMetadataExtraction(qint64 assetId, const QString &sourceFile);
+    // fileName is the asset's name in library.db, stored with the metadata
+    // so it can be searched for.
+    void enqueueMetadataExtraction(qint64 assetId, const QString &sourceFile, const QString &fileName);
     void handleMetadataExtractionComplete(qint64 assetId, const QUuid &jobId);
     void startBatchMetadataJob(int total);
     void updateBatchMetadataProgress();
@@ -9,6 +9,8 @@
 #include "exportdialog.h"
 #include "importpreviewdialog.h"
 #include "imageloader.h"
+#include "directoryscanner.h"
+#include "assetmarks.h"
 
 #include <QAction>
 #include <QAbstractItemView>
@@ -18,17 +20,19 @@
 #include <QDateTime>
 #include <QDebug>
 #include <QDir>
-#include <QDirIterator>
 #include <QFileDialog>
 #include <QFileInfo>
 #include <QGraphicsView>
 #include <QImage>
 #include <QImageReader>
 #include <QImageWriter>
+#include <QInputDialog>
+#include <QKeySequence>
 #include <QLabel>
 #include <QIcon>
 #include <QLocale>
 #include <QListWidget>
+#include <QMenu>
 #include <QMessageBox>
 #include <QPainter>
 #include <QPushButton>
@@ -48,6 +52,7 @@
 #include <cmath>
 #include <utility>
 #include <memory>
+#include <tuple>
 #include <QFile>
 #include <QPixmap>
 #include <QPointer>
@@ -71,6 +76,8 @@ namespace {
 constexpr int kHistogramBins = 256;
 constexpr int kHistogramTargetSampleCount = 750000;
 constexpr int kPreviewMaxDimension = 960;
+constexpr int kFilmstripRadius = 40;
+constexpr int kMaxLoadedAssets = 4096;
 
 struct ExportTaskReport
 {
@@ -365,6 +372,7 @@ MainWindow::MainWindow(QWidget *parent)
     m_libraryManager = new LibraryManager(this);
     setupAdjustmentEngine();
     setupJobSystem();
+    setupMarkActions();
     bindLibrarySignals();
 
     // Create filter pane
@@ -373,6 +381,16 @@ MainWindow::MainWindow(QWidget *parent)
             this, [this](const FilterOptions &options) {
                 refreshLibraryView(options);
             });
+    connect(m_libraryFilterPane, &LibraryFilterPane::saveCollectionRequested,
+            this, &MainWindow::saveSmartCollection);
+    connect(m_libraryFilterPane, &LibraryFilterPane::removeCollectionRequested,
+            this, [this](qint64 collectionId) {
+                m_libraryManager->removeSmartCollection(collectionId).then(this, [this](bool removed) {
+                    if (!removed) {
+                        QMessageBox::warning(this, tr("Smart Collection"), tr("Failed to remove smart collection."));
+                    }
+                });
+            });
 
     // Create library grid view
     m_libraryGridView = new LibraryGridView(this);
@@ -382,6 +400,8 @@ MainWindow::MainWindow(QWidget *parent)
             this, &MainWindow::handleSelectionChanged);
     connect(m_libraryGridView, &LibraryGridView::folderDropped,
             this, &MainWindow::handleFolderDropped);
+    connect(m_libraryGridView, &LibraryGridView::itemsRequested,
+            this, &MainWindow::handleGridItemsRequested);
 
     // Add filter pane and grid view to layout
     if (ui->libraryPageLayout) {
@@ -478,6 +498,9 @@ MainWindow::MainWindow(QWidget *parent)
     if (ui->actionImport) {
         ui->actionImport->setEnabled(false);
     }
+    if (ui->actionHot_Folder) {
+        ui->actionHot_Folder->setEnabled(false);
+    }
 
     openOrCreateDefaultLibrary();
 }
@@ -877,8 +900,12 @@ void MainWindow::bindLibrarySignals()
         if (ui->actionImport) {
             ui->actionImport->setEnabled(true);
         }
+        if (ui->actionHot_Folder) {
+            ui->actionHot_Folder->setEnabled(true);
+        }
         // Clear filters when library is loaded
         if (m_libraryFilterPane) {
+            m_libraryFilterPane->setCollections(m_libraryManager->smartCollections());
             m_libraryFilterPane->clearFilters();
         }
         showStatusMessage(tr("Opened library: %1").arg(QDir(path).dirName()), 4000);
@@ -890,6 +917,12 @@ void MainWindow::bindLibrarySignals()
         if (ui->actionImport) {
             ui->actionImport->setEnabled(false);
         }
+        if (ui->actionHot_Folder) {
+            ui->actionHot_Folder->setEnabled(false);
+        }
+        if (m_libraryFilterPane) {
+            m_libraryFilterPane->setCollections({});
+        }
         clearLibrary();
     });
 
@@ -902,11 +935,19 @@ void MainWindow::bindLibrarySignals()
         }
     });
     connect(m_libraryManager, &LibraryManager::assetPreviewUpdated, this, &MainWindow::updateThumbnailPreview);
+    connect(m_libraryManager, &LibraryManager::assetMarksChanged, this, &MainWindow::handleAssetMarksChanged);
+    connect(m_libraryManager, &LibraryManager::smartCollectionsChanged, this, [this]() {
+        if (m_libraryFilterPane) {
+            m_libraryFilterPane->setCollections(m_libraryManager->smartCollections());
+        }
+    });
 
     connect(m_libraryManager, &LibraryManager::importProgress, this, &MainWindow::handleImportProgress);
     connect(m_libraryManager, &LibraryManager::importCompleted, this, &MainWindow::handleImportCompleted);
     connect(m_libraryManager, &LibraryManager::errorOccurred, this, &MainWindow::handleLibraryError);
     connect(m_libraryManager, &LibraryManager::assetsQueried, this, &MainWindow::handleAssetsQueried);
+    connect(m_libraryManager, &LibraryManager::assetPageReady, this, &MainWindow::handleAssetPageReady);
+    connect(m_libraryManager, &LibraryManager::queriedAssetIdsReady, this, &MainWindow::handleQueriedAssetIdsReady);
 }
 
 void MainWindow::setupJobSystem()
@@ -1043,17 +1084,8 @@ void MainWindow::updateFilterPaneOptions()
         return;
     }
 
-    // Update available camera makes
-    QStringList cameraMakes = cache->getAllCameraMakes();
-    m_libraryFilterPane->setAvailableCameraMakes(cameraMakes);
-
-    // Update ISO range
-    int minIso = cache->getMinIso();
-    int maxIso = cache->getMaxIso();
-
-    // Update available tags
-    QStringList tags = cache->getAllTags();
-    m_libraryFilterPane->setAvailableTags(tags);
+    // One read of the trigger-maintained facet table; no metadata scans.
+    m_libraryFilterPane->setFacets(cache->facets());
 }
 
 void MainWindow::refreshLibraryView(const FilterOptions &filterOptions)
@@ -1063,7 +1095,7 @@ void MainWindow::refreshLibraryView(const FilterOptions &filterOptions)
     }
 
     if (!m_libraryManager || !m_libraryManager->hasOpenLibrary()) {
-        m_assets.clear();
+        resetLoadedAssets();
         m_libraryGridView->clear();
         updateDevelopFilmstrip();
         return;
@@ -1076,43 +1108,175 @@ void MainWindow::refreshLibraryView(const FilterOptions &filterOptions)
     m_libraryManager->requestAssets(filterOptions);
 }
 
-void MainWindow::handleAssetsQueried(const QVector<LibraryAsset> &queriedAssets)
+void MainWindow::handleAssetsQueried(quint64 generation, int totalCount)
 {
-    if (!m_libraryGridView) {
+    if (!m_libraryGridView || generation < m_assetQueryGeneration) {
         return;
     }
 
-    m_assets = queriedAssets;
+    resetLoadedAssets();
+    m_assetQueryGeneration = generation;
+    m_assetCount = totalCount;
+    // It was waiting for the previous result's ids.
+    m_pendingSelectionAction = nullptr;
+
+    // The grid asks for the pages it shows through itemsRequested().
+    m_libraryGridView->setItemCount(totalCount);
+    updateDevelopFilmstrip();
+}
+
+void MainWindow::handleAssetPageReady(quint64 generation, int offset, const QVector<LibraryAsset> &assets)
+{
+    if (!m_libraryGridView || generation != m_assetQueryGeneration) {
+        return;
+    }
+
+    m_requestedAssetPages.remove(offset / LibraryGridView::kPageSize);
 
     QVector<LibraryGridItem> items;
-    items.reserve(m_assets.size());
-    for (const LibraryAsset &asset : m_assets) {
-        LibraryGridItem item;
-        item.assetId = asset.id;
-        item.photoNumber = asset.photoNumber;
-        item.fileName = asset.fileName;
-        item.previewPath = assetPreviewPath(asset);
-        item.originalPath = assetOriginalPath(asset);
-        items.append(item);
+    items.reserve(assets.size());
+    for (int i = 0; i < assets.size(); ++i) {
+        const LibraryAsset &asset = assets.at(i);
+        m_loadedAssets.insert(offset + i, asset);
+        m_loadedAssetPositions.insert(asset.id, offset + i);
+        items.append(gridItemForAsset(asset));
     }
 
-    m_libraryGridView->setItems(items);
-    updateDevelopFilmstrip();
+    m_libraryGridView->setItemsAt(offset, items);
+    trimLoadedAssets(offset);
 
-    QStringList preloadPaths;
-    const int preloadCount = qMin(items.size(), 8);
-    for (int i = 0; i < preloadCount; ++i) {
-        const QString &path = items.at(i).originalPath;
-        if (!path.isEmpty()) {
-            preloadPaths.append(path);
+    if (offset == 0) {
+        QStringList preloadPaths;
+        const int preloadCount = qMin(items.size(), 8);
+        for (int i = 0; i < preloadCount; ++i) {
+            const QString &path = items.at(i).originalPath;
+            if (!path.isEmpty()) {
+                preloadPaths.append(path);
+            }
+        }
+        if (!preloadPaths.isEmpty()) {
+            ImageLoader::preloadAsync(preloadPaths);
         }
     }
-    if (!preloadPaths.isEmpty()) {
-        ImageLoader::preloadAsync(preloadPaths);
+
+    // Rebuild the filmstrip only when this page fills part of its window.
+    const int center = m_loadedAssetPositions.value(m_currentDevelopAssetId, 0);
+    const int windowFirst = qMax(0, center - kFilmstripRadius);
+    const int windowLast = windowFirst + 2 * kFilmstripRadius;
+    if (offset <= windowLast && offset + assets.size() > windowFirst) {
+        updateDevelopFilmstrip();
+    }
+}
+
+void MainWindow::handleGridItemsRequested(int offset, int count)
+{
+    if (!m_libraryManager || m_assetCount == 0) {
+        return;
     }
+
+    // Pages the grid evicted may still be held here; hand them back without
+    // another query.
+    const int end = qMin(offset + count, m_assetCount);
+    QVector<LibraryGridItem> cached;
+    cached.reserve(end - offset);
+    for (int position = offset; position < end; ++position) {
+        auto it = m_loadedAssets.constFind(position);
+        if (it == m_loadedAssets.constEnd()) {
+            cached.clear();
+            break;
+        }
+        cached.append(gridItemForAsset(it.value()));
+    }
+
+    if (!cached.isEmpty()) {
+        const quint64 generation = m_assetQueryGeneration;
+        QMetaObject::invokeMethod(this, [this, generation, offset, cached]() {
+            if (m_libraryGridView && generation == m_assetQueryGeneration) {
+                m_libraryGridView->setItemsAt(offset, cached);
+            }
+        }, Qt::QueuedConnection);
+        return;
+    }
+
+    const int page = offset / LibraryGridView::kPageSize;
+    if (m_requestedAssetPages.contains(page)) {
+        return;
+    }
+    m_requestedAssetPages.insert(page);
+    m_libraryManager->requestAssetPage(m_assetQueryGeneration, page * LibraryGridView::kPageSize, LibraryGridView::kPageSize);
+}
+
+void MainWindow::requestMissingAssets(int firstPosition, int lastPosition)
+{
+    if (!m_libraryManager || m_assetCount == 0) {
+        return;
+    }
+
+    const int pageSize = LibraryGridView::kPageSize;
+    firstPosition = qBound(0, firstPosition, m_assetCount - 1);
+    lastPosition = qBound(0, lastPosition, m_assetCount - 1);
+    for (int page = firstPosition / pageSize; page <= lastPosition / pageSize; ++page) {
+        if (m_requestedAssetPages.contains(page)) {
+            continue;
+        }
+        const int pageFirst = qMax(firstPosition, page * pageSize);
+        const int pageLast = qMin(lastPosition, page * pageSize + pageSize - 1);
+        bool missing = false;
+        for (int position = pageFirst; position <= pageLast && !missing; ++position) {
+            missing = !m_loadedAssets.contains(position);
+        }
+        if (missing) {
+            m_requestedAssetPages.insert(page);
+            m_libraryManager->requestAssetPage(m_assetQueryGeneration, page * pageSize, pageSize);
+        }
+    }
+}
+
+void MainWindow::trimLoadedAssets(int anchorPosition)
+{
+    if (m_loadedAssets.size() <= kMaxLoadedAssets) {
+        return;
+    }
+
+    // Keep what is around the newest page and around the filmstrip.
+    const int keepRadius = kMaxLoadedAssets / 2 - kFilmstripRadius;
+    const int filmstripCenter = m_loadedAssetPositions.value(m_currentDevelopAssetId, -1);
+    for (auto it = m_loadedAssets.begin(); it != m_loadedAssets.end();) {
+        const int position = it.key();
+        const bool nearAnchor = std::abs(position - anchorPosition) <= keepRadius;
+        const bool nearFilmstrip = filmstripCenter >= 0 && std::abs(position - filmstripCenter) <= kFilmstripRadius;
+        if (nearAnchor || nearFilmstrip) {
+            ++it;
+            continue;
+        }
+        m_loadedAssetPositions.remove(it.value().id);
+        it = m_loadedAssets.erase(it);
+    }
+}
+
+void MainWindow::resetLoadedAssets()
+{
+    m_assetCount = 0;
+    m_loadedAssets.clear();
+    m_loadedAssetPositions.clear();
+    m_requestedAssetPages.clear();
+    m_assetLookupCache.clear();
 }
 
-void MainWindow::updateDevelopFilmstrip()
+LibraryGridItem MainWindow::gridItemForAsset(const LibraryAsset &asset) const
+{
+    LibraryGridItem item;
+    item.assetId = asset.id;
+    item.photoNumber = asset.photoNumber;
+    item.fileName = asset.fileName;
+    item.previewPath = assetPreviewPath(asset);
+    item.originalPath = assetOriginalPath(asset);
+    item.stackSize = asset.stackSize;
+    item.marks = asset.marks;
+    return item;
+}
+
+void MainWindow::updateDevelopFilmstrip(qint64 centerAssetId)
 {
     if (!ui->developFilmstripList) {
         return;
@@ -1121,21 +1285,31 @@ void MainWindow::updateDevelopFilmstrip()
     QSignalBlocker blocker(ui->developFilmstripList);
     ui->developFilmstripList->clear();
 
+    if (m_assetCount == 0) {
+        return;
+    }
+
     const QSize iconSize = ui->developFilmstripList->iconSize();
 
-    int currentIndex = -1;
-    for (int i = 0; i < m_assets.size(); ++i) {
-        if (m_assets.at(i).id == m_currentDevelopAssetId) {
-            currentIndex = i;
-            break;
-        }
+    // The filmstrip shows a window of the current result around the asset
+    // being developed rather than the whole library.
+    if (centerAssetId < 0) {
+        centerAssetId = m_currentDevelopAssetId;
     }
+    const int currentIndex = m_loadedAssetPositions.value(centerAssetId, -1);
+    const int firstIndex = qMax(0, (currentIndex >= 0 ? currentIndex : 0) - kFilmstripRadius);
+    const int lastIndex = qMin(m_assetCount - 1, firstIndex + 2 * kFilmstripRadius);
+    requestMissingAssets(firstIndex, lastIndex);
 
     QStringList developPreload;
     const int neighborRadius = 4;
 
-    for (int index = 0; index < m_assets.size(); ++index) {
-        const LibraryAsset &asset = m_assets.at(index);
+    for (int index = firstIndex; index <= lastIndex; ++index) {
+        auto it = m_loadedAssets.constFind(index);
+        if (it == m_loadedAssets.constEnd()) {
+            continue;
+        }
+        const LibraryAsset &asset = it.value();
         auto *item = new QListWidgetItem(asset.fileName);
         item->setData(Qt::UserRole, asset.id);
         item->setToolTip(asset.fileName);
@@ -1157,7 +1331,7 @@ void MainWindow::updateDevelopFilmstrip()
         }
 
         ui->developFilmstripList->addItem(item);
-        if (asset.id == m_currentDevelopAssetId) {
+        if (asset.id == centerAssetId) {
             item->setSelected(true);
             ui->developFilmstripList->scrollToItem(item, QAbstractItemView::PositionAtCenter);
         }
@@ -1171,9 +1345,13 @@ void MainWindow::updateDevelopFilmstrip()
     }
 
     if (developPreload.isEmpty()) {
-        const int preloadCount = qMin(m_assets.size(), 6);
+        const int preloadCount = qMin(m_assetCount, 6);
         for (int i = 0; i < preloadCount; ++i) {
-            const QString originalPath = assetOriginalPath(m_assets.at(i));
+            auto it = m_loadedAssets.constFind(i);
+            if (it == m_loadedAssets.constEnd()) {
+                continue;
+            }
+            const QString originalPath = assetOriginalPath(it.value());
             if (!originalPath.isEmpty()) {
                 developPreload.append(originalPath);
             }
@@ -1192,6 +1370,7 @@ void MainWindow::selectFilmstripItem(qint64 assetId)
     }
 
     QSignalBlocker blocker(ui->developFilmstripList);
+    bool found = false;
     for (int row = 0; row < ui->developFilmstripList->count(); ++row) {
         QListWidgetItem *item = ui->developFilmstripList->item(row);
         if (!item) {
@@ -1201,9 +1380,16 @@ void MainWindow::selectFilmstripItem(qint64 assetId)
         const bool isCurrent = item->data(Qt::UserRole).toLongLong() == assetId;
         item->setSelected(isCurrent);
         if (isCurrent) {
+            found = true;
             ui->developFilmstripList->scrollToItem(item, QAbstractItemView::PositionAtCenter);
         }
     }
+
+    // Outside the current window: recenter the filmstrip on it.
+    if (!found && m_loadedAssetPositions.contains(assetId)) {
+        blocker.unblock();
+        updateDevelopFilmstrip(assetId);
+    }
 }
 
 void MainWindow::setupAdjustmentEngine()
@@ -1976,18 +2162,20 @@ void MainWindow::updateThumbnailPreview(qint64 assetId, const QString &previewPa
         return;
     }
 
-    if (!m_assets.isEmpty() && m_libraryManager) {
+    if (m_libraryManager) {
+        QString relativePreview;
         const QString libraryPath = m_libraryManager->libraryPath();
-        for (LibraryAsset &asset : m_assets) {
-            if (asset.id == assetId) {
-                if (!libraryPath.isEmpty() && QFileInfo(previewPath).isAbsolute()) {
-                    QDir root(libraryPath);
-                    asset.previewRelativePath = root.relativeFilePath(previewPath);
-                } else {
-                    asset.previewRelativePath.clear();
-                }
-                break;
-            }
+        if (!libraryPath.isEmpty() && QFileInfo(previewPath).isAbsolute()) {
+            relativePreview = QDir(libraryPath).relativeFilePath(previewPath);
+        }
+
+        const int position = m_loadedAssetPositions.value(assetId, -1);
+        auto it = m_loadedAssets.find(position);
+        if (it != m_loadedAssets.end()) {
+            it->previewRelativePath = relativePreview;
+        }
+        if (LibraryAsset *cached = m_assetLookupCache.object(assetId)) {
+            cached->previewRelativePath = relativePreview;
         }
     }
 
@@ -2155,13 +2343,26 @@ void MainWindow::populateDevelopMetadata(const QImage &image, const QString &fil
 
 const LibraryAsset *MainWindow::assetById(qint64 assetId) const
 {
-    auto it = std::find_if(m_assets.cbegin(), m_assets.cend(), [assetId](const LibraryAsset &asset) {
-        return asset.id == assetId;
-    });
-    if (it == m_assets.cend()) {
+    auto loaded = m_loadedAssets.constFind(m_loadedAssetPositions.value(assetId, -1));
+    if (loaded != m_loadedAssets.constEnd()) {
+        return &loaded.value();
+    }
+
+    // Selections and develop targets can outlive the page they came from.
+    // Batches of lookups go through LibraryManager::lookupAssets() instead.
+    if (LibraryAsset *cached = m_assetLookupCache.object(assetId)) {
+        return cached;
+    }
+    if (!m_libraryManager) {
+        return nullptr;
+    }
+    const LibraryAsset asset = m_libraryManager->assetById(assetId);
+    if (asset.id != assetId) {
         return nullptr;
     }
-    return &(*it);
+    auto *cached = new LibraryAsset(asset);
+    m_assetLookupCache.insert(assetId, cached);
+    return cached;
 }
 
 void MainWindow::fitDevelopViewToImage()
@@ -2307,7 +2508,7 @@ void MainWindow::openOrCreateDefaultLibrary()
 
 void MainWindow::clearLibrary()
 {
-    m_assets.clear();
+    resetLoadedAssets();
     if (m_libraryGridView) {
         m_libraryGridView->clear();
     }
@@ -2390,23 +2591,17 @@ void MainWindow::openAssetInDevelop(qint64 assetId, const QString &filePath)
 
     QStringList preloadTargets;
     preloadTargets.append(filePath);
-    int currentIndex = -1;
-    for (int i = 0; i < m_assets.size(); ++i) {
-        if (m_assets.at(i).id == assetId) {
-            currentIndex = i;
-            break;
-        }
-    }
+    const int currentIndex = m_loadedAssetPositions.value(assetId, -1);
     if (currentIndex >= 0) {
         for (int offset = -3; offset <= 3; ++offset) {
             if (offset == 0) {
                 continue;
             }
-            const int neighborIndex = currentIndex + offset;
-            if (neighborIndex < 0 || neighborIndex >= m_assets.size()) {
+            auto neighbor = m_loadedAssets.constFind(currentIndex + offset);
+            if (neighbor == m_loadedAssets.constEnd()) {
                 continue;
             }
-            const QString neighborPath = assetOriginalPath(m_assets.at(neighborIndex));
+            const QString neighborPath = assetOriginalPath(neighbor.value());
             if (!neighborPath.isEmpty()) {
                 preloadTargets.append(neighborPath);
             }
@@ -2488,18 +2683,49 @@ void MainWindow::handleDevelopImageLoaded()
     m_pendingDevelopFilePath.clear();
 }
 
-void MainWindow::handleSelectionChanged(const QList<qint64> &selection)
+void MainWindow::handleSelectionChanged()
 {
-    if (selection.isEmpty()) {
+    const qint64 count = m_libraryGridView ? m_libraryGridView->selectedCount() : 0;
+    if (count == 0) {
         showStatusMessage(tr("No items selected"), 1500);
         return;
     }
 
-    if (selection.size() == 1) {
+    if (count == 1) {
         showStatusMessage(tr("1 item selected"), 1500);
     } else {
-        showStatusMessage(tr("%1 items selected").arg(selection.size()), 1500);
+        showStatusMessage(tr("%1 items selected").arg(count), 1500);
+    }
+}
+
+bool MainWindow::forEachSelectedAssetId(const std::function<void(qint64)> &visit, const std::function<void()> &retry)
+{
+    if (!m_libraryGridView) {
+        return true;
     }
+
+    // Only a complemented selection, e.g. after Select All, needs the ids of
+    // the whole result.
+    const AssetSelection selection = m_libraryGridView->selection();
+    QVector<qint64> resultIds;
+    if (selection.isInverted() && m_libraryManager
+        && !m_libraryManager->queriedAssetIds(m_assetQueryGeneration, &resultIds)) {
+        m_pendingSelectionAction = retry;
+        showStatusMessage(tr("Listing the selected photos..."), 3000);
+        return false;
+    }
+    selection.forEach(resultIds, visit);
+    return true;
+}
+
+void MainWindow::handleQueriedAssetIdsReady(quint64 generation)
+{
+    if (generation != m_assetQueryGeneration || !m_pendingSelectionAction) {
+        return;
+    }
+    const std::function<void()> action = std::move(m_pendingSelectionAction);
+    m_pendingSelectionAction = nullptr;
+    action();
 }
 
 
@@ -2621,10 +2847,39 @@ void MainWindow::on_actionClear_recents_triggered(){
 }
 
 void MainWindow::on_actionUndo_triggered(){
-    qDebug() << "Undo clicked!";
+    stepDevelopHistory(false);
 }
 void MainWindow::on_actionRedo_triggered(){
-    qDebug() << "Redo clicked!";
+    stepDevelopHistory(true);
+}
+
+void MainWindow::stepDevelopHistory(bool redo)
+{
+    if (!m_libraryManager || m_currentDevelopAssetId < 0) {
+        return;
+    }
+
+    // Pending slider edits are queued first so the step starts from them.
+    persistCurrentAdjustments();
+
+    const qint64 assetId = m_currentDevelopAssetId;
+    QFuture<DevelopHistoryStep> step = redo ? m_libraryManager->redoDevelopAdjustments(assetId)
+                                            : m_libraryManager->undoDevelopAdjustments(assetId);
+    step.then(this, [this, assetId, redo](const DevelopHistoryStep &result) {
+        if (assetId != m_currentDevelopAssetId) {
+            return;
+        }
+        if (!result.moved) {
+            showStatusMessage(redo ? tr("Nothing to redo") : tr("Nothing to undo"), 2000);
+            return;
+        }
+
+        m_currentAdjustments = result.adjustments;
+        m_savingAdjustmentsPending = false;
+        m_adjustmentPersistTimer.stop();
+        syncAdjustmentControls(m_currentAdjustments);
+        requestAdjustmentRender(true, false);
+    });
 }
 
 void MainWindow::on_actionCut_triggered(){
@@ -2649,7 +2904,7 @@ void MainWindow::on_actionPaste_triggered(){
         return;
     }
 
-    QList<qint64> selectedIds;
+    QVector<qint64> selectedIds;
     
     // Check which page is currently active
     bool isDevelopPage = false;
@@ -2663,10 +2918,12 @@ void MainWindow::on_actionPaste_triggered(){
         qDebug() << "Pasting to current Develop image:" << m_currentDevelopAssetId;
     } else {
         // Otherwise, paste to all selected images in library
-        if (m_libraryGridView) {
-            selectedIds = m_libraryGridView->selectedAssetIds();
+        selectedIds.reserve(int(m_libraryGridView ? m_libraryGridView->selectedCount() : 0));
+        if (!forEachSelectedAssetId([&selectedIds](qint64 assetId) { selectedIds.append(assetId); },
+                                    [this]() { on_actionPaste_triggered(); })) {
+            return;
         }
-        
+
         if (selectedIds.isEmpty()) {
             showStatusMessage(tr("No images selected. Select images in the library or open an image in Develop."), 3000);
             return;
@@ -2674,25 +2931,39 @@ void MainWindow::on_actionPaste_triggered(){
         qDebug() << "Pasting to" << selectedIds.size() << "selected library image(s)";
     }
 
+    if (!m_libraryManager) {
+        return;
+    }
+
+    qDebug() << "Pasting adjustments to" << selectedIds.size() << "image(s)";
+
+    // All rows are written in one transaction off the GUI thread.
+    const DevelopAdjustments adjustments = m_copiedAdjustments;
+    m_libraryManager->saveDevelopAdjustmentsBatch(selectedIds, adjustments)
+        .then(this, [this, selectedIds, adjustments](const QHash<qint64, bool> &results) {
+            handlePastedAdjustments(selectedIds, adjustments, results);
+        });
+}
+
+void MainWindow::handlePastedAdjustments(const QList<qint64> &assetIds,
+                                         const DevelopAdjustments &adjustments,
+                                         const QHash<qint64, bool> &results)
+{
     int successCount = 0;
     int failCount = 0;
     QList<qint64> successfulIds;
     bool pastedToCurrentImage = false;
 
-    qDebug() << "Pasting adjustments to" << selectedIds.size() << "image(s)";
-
-    for (qint64 assetId : selectedIds) {
-        QString error;
-        if (m_libraryManager && m_libraryManager->saveDevelopAdjustments(assetId, m_copiedAdjustments, &error)) {
+    for (qint64 assetId : assetIds) {
+        if (results.value(assetId, false)) {
             successCount++;
             successfulIds.append(assetId);
-            qDebug() << "Successfully pasted adjustments to asset" << assetId;
             if (assetId == m_currentDevelopAssetId) {
                 pastedToCurrentImage = true;
             }
         } else {
             failCount++;
-            qWarning() << "Failed to paste adjustments to asset" << assetId << ":" << error;
+            qWarning() << "Failed to paste adjustments to asset" << assetId;
         }
     }
 
@@ -2701,7 +2972,7 @@ void MainWindow::on_actionPaste_triggered(){
     // If pasting to current image, directly set adjustments and re-render
     if (pastedToCurrentImage && m_currentDevelopAssetId >= 0) {
         // Directly set the adjustments instead of reloading from database
-        m_currentAdjustments = m_copiedAdjustments;
+        m_currentAdjustments = adjustments;
         syncAdjustmentControls(m_currentAdjustments);
         m_savingAdjustmentsPending = false;
         // Clear any pending adjustment persist timer since we just saved
@@ -2771,13 +3042,162 @@ void MainWindow::on_actionPaste_triggered(){
 }
 
 void MainWindow::on_actionSelect_All_triggered(){
-    qDebug() << "Select All clicked!";
+    if (m_libraryGridView) {
+        m_libraryGridView->selectAll();
+    }
 }
 void MainWindow::on_actionSelect_None_triggered(){
-    qDebug() << "Select None clicked!";
+    if (m_libraryGridView) {
+        m_libraryGridView->selectNone();
+    }
 }
 void MainWindow::on_actionInverse_Selection_triggered(){
-    qDebug() << "Inverse Selection clicked!";
+    if (m_libraryGridView) {
+        m_libraryGridView->invertSelection();
+    }
+}
+
+void MainWindow::on_actionFind_Similar_triggered()
+{
+    if (!m_libraryManager || !m_libraryManager->hasOpenLibrary() || !m_libraryGridView || !m_libraryFilterPane) {
+        return;
+    }
+
+    // The photo clicked last stands for the selection.
+    const qint64 assetId = m_libraryGridView->anchorAssetId();
+    if (assetId < 0 || !m_libraryGridView->selection().contains(assetId)) {
+        showStatusMessage(tr("Select a photo to find similar ones"), 3000);
+        return;
+    }
+
+    const LibraryAsset asset = m_libraryManager->assetById(assetId);
+    if (asset.perceptualHash == 0) {
+        showStatusMessage(tr("%1 has no preview to compare yet").arg(asset.fileName), 3000);
+        return;
+    }
+    m_libraryFilterPane->setSimilarTo(asset.id, asset.fileName);
+}
+
+// Single-key culling shortcuts, in a Photo menu: 0-5 rate, P/X/U flag and
+// 6-9 apply colour labels.
+void MainWindow::setupMarkActions()
+{
+    if (!ui->menubar) {
+        return;
+    }
+
+    QMenu *photoMenu = ui->menubar->addMenu(tr("Photo"));
+    const auto addMarkAction = [this](QMenu *menu, const QString &text, const QKeySequence &shortcut,
+                                      const std::function<void(const QList<qint64> &)> &apply) {
+        QAction *action = menu->addAction(text);
+        action->setShortcut(shortcut);
+        connect(action, &QAction::triggered, this, [this, action, apply]() {
+            if (!m_libraryManager || !m_libraryManager->hasOpenLibrary()) {
+                return;
+            }
+            const QList<qint64> assetIds = markTargetAssetIds([action]() { action->trigger(); });
+            if (!assetIds.isEmpty()) {
+                apply(assetIds);
+            }
+        });
+    };
+
+    QMenu *ratingMenu = photoMenu->addMenu(tr("Rating"));
+    for (int stars = 0; stars <= AssetMarks::kMaxRating; ++stars) {
+        addMarkAction(ratingMenu, stars == 0 ? tr("No Rating") : tr("%n Star(s)", nullptr, stars),
+                      QKeySequence(Qt::Key_0 + stars), [this, stars](const QList<qint64> &assetIds) {
+                          m_libraryManager->setRating(assetIds, stars);
+                      });
+    }
+
+    QMenu *flagMenu = photoMenu->addMenu(tr("Flag"));
+    const QList<std::tuple<QString, Qt::Key, AssetMarks::Flag>> flags = {
+        {tr("Pick"), Qt::Key_P, AssetMarks::Picked},
+        {tr("Reject"), Qt::Key_X, AssetMarks::Rejected},
+        {tr("Unflag"), Qt::Key_U, AssetMarks::Unflagged},
+    };
+    for (const auto &[text, key, flag] : flags) {
+        const AssetMarks::Flag value = flag;
+        addMarkAction(flagMenu, text, QKeySequence(key), [this, value](const QList<qint64> &assetIds) {
+            m_libraryManager->setFlag(assetIds, value);
+        });
+    }
+
+    QMenu *labelMenu = photoMenu->addMenu(tr("Color Label"));
+    const QList<std::tuple<QString, QKeySequence, AssetMarks::ColorLabel>> labels = {
+        {tr("Red"), QKeySequence(Qt::Key_6), AssetMarks::Red},
+        {tr("Yellow"), QKeySequence(Qt::Key_7), AssetMarks::Yellow},
+        {tr("Green"), QKeySequence(Qt::Key_8), AssetMarks::Green},
+        {tr("Blue"), QKeySequence(Qt::Key_9), AssetMarks::Blue},
+        {tr("Purple"), QKeySequence(), AssetMarks::Purple},
+        {tr("None"), QKeySequence(), AssetMarks::NoLabel},
+    };
+    for (const auto &[text, shortcut, label] : labels) {
+        const AssetMarks::ColorLabel value = label;
+        addMarkAction(labelMenu, text, shortcut, [this, value](const QList<qint64> &assetIds) {
+            m_libraryManager->setColorLabel(assetIds, value);
+        });
+    }
+}
+
+// The photo being developed, or the grid selection in the library.
+QList<qint64> MainWindow::markTargetAssetIds(const std::function<void()> &retry)
+{
+    if (ui->stackedWidget && ui->stackedWidget->currentWidget() == ui->developPage && m_currentDevelopAssetId >= 0) {
+        return {m_currentDevelopAssetId};
+    }
+    QList<qint64> assetIds;
+    forEachSelectedAssetId([&assetIds](qint64 assetId) { assetIds.append(assetId); }, retry);
+    return assetIds;
+}
+
+void MainWindow::handleAssetMarksChanged(const QList<qint64> &assetIds, quint8 fieldMask, quint8 bits)
+{
+    for (qint64 assetId : assetIds) {
+        auto it = m_loadedAssets.find(m_loadedAssetPositions.value(assetId, -1));
+        if (it != m_loadedAssets.end()) {
+            it->marks = AssetMarks::withField(it->marks, fieldMask, bits);
+        }
+        if (LibraryAsset *cached = m_assetLookupCache.object(assetId)) {
+            cached->marks = AssetMarks::withField(cached->marks, fieldMask, bits);
+        }
+    }
+
+    if (m_libraryGridView) {
+        m_libraryGridView->updateItemMarks(assetIds, fieldMask, bits);
+    }
+
+    // Marked photos may have left or joined the result.
+    // Membership of the shown collection may follow the marks as well.
+    if (m_libraryFilterPane) {
+        const FilterOptions options = m_libraryFilterPane->currentFilterOptions();
+        if (options.filtersOnMarks() || m_libraryFilterPane->collectionFiltersOnMarks()) {
+            refreshLibraryView(options);
+        }
+    }
+}
+
+void MainWindow::saveSmartCollection(const FilterOptions &rule)
+{
+    if (!m_libraryManager || !m_libraryManager->hasOpenLibrary()) {
+        return;
+    }
+
+    bool ok = false;
+    const QString name = QInputDialog::getText(this, tr("Save Smart Collection"),
+                                               tr("Collection name:"), QLineEdit::Normal,
+                                               QString(), &ok).trimmed();
+    if (!ok || name.isEmpty()) {
+        return;
+    }
+
+    m_libraryManager->createSmartCollection(name, rule).then(this, [this, name](qint64 collectionId) {
+        if (collectionId < 0) {
+            QMessageBox::warning(this, tr("Smart Collection"), tr("Failed to save smart collection %1.").arg(name));
+            return;
+        }
+        showStatusMessage(tr("Saved smart collection %1").arg(name), 3000);
+    });
 }
 
 void MainWindow::on_actionPreferences_triggered()
@@ -2799,48 +3219,58 @@ void MainWindow::on_actionExport_triggered()
 
     persistCurrentAdjustments();
 
+    QVector<qint64> assetIds;
+    if (!forEachSelectedAssetId([&assetIds](qint64 assetId) { assetIds.append(assetId); },
+                                [this]() { on_actionExport_triggered(); })) {
+        return;
+    }
+    if (assetIds.isEmpty() && m_currentDevelopAssetId >= 0) {
+        assetIds.append(m_currentDevelopAssetId);
+    }
+    if (assetIds.isEmpty()) {
+        QMessageBox::information(this,
+                                 tr("No images selected"),
+                                 tr("Select one or more images in the library to export."));
+        return;
+    }
+
+    // A Select All can cover the whole library, so the assets and their
+    // adjustments are read in batches off the GUI thread.
+    QPointer<LibraryManager> manager = m_libraryManager;
+    m_libraryManager->lookupAssets(assetIds).then(this, [this, manager](const QVector<LibraryAsset> &assets) {
+        if (!manager) {
+            return;
+        }
+        QVector<qint64> foundIds;
+        foundIds.reserve(assets.size());
+        for (const LibraryAsset &asset : assets) {
+            foundIds.append(asset.id);
+        }
+        manager->loadDevelopAdjustmentsBatch(foundIds).then(this, [this, assets](const QHash<qint64, DevelopAdjustments> &adjustments) {
+            exportAssets(assets, adjustments);
+        });
+    });
+}
+
+void MainWindow::exportAssets(const QVector<LibraryAsset> &assets, const QHash<qint64, DevelopAdjustments> &adjustments)
+{
     QVector<ExportItem> candidateItems;
-    candidateItems.reserve(32);
+    candidateItems.reserve(assets.size());
     QSet<QString> seenPaths;
 
-    if (m_libraryGridView) {
-        const QList<qint64> selection = m_libraryGridView->selectedAssetIds();
-        for (qint64 assetId : selection) {
-            const LibraryAsset *asset = assetById(assetId);
-            if (!asset) {
-                continue;
-            }
-            const QString originalPath = assetOriginalPath(*asset);
-            if (originalPath.isEmpty() || seenPaths.contains(originalPath)) {
-                continue;
-            }
-
-            ExportItem item;
-            item.assetId = assetId;
-            item.sourcePath = originalPath;
-            item.adjustments = m_libraryManager ? m_libraryManager->loadDevelopAdjustments(assetId)
-                                                : defaultDevelopAdjustments();
-            item.identity = adjustmentsAreIdentity(item.adjustments);
-            candidateItems.append(item);
-            seenPaths.insert(originalPath);
+    for (const LibraryAsset &asset : assets) {
+        const QString originalPath = assetOriginalPath(asset);
+        if (originalPath.isEmpty() || seenPaths.contains(originalPath)) {
+            continue;
         }
-    }
 
-    if (candidateItems.isEmpty() && m_currentDevelopAssetId >= 0) {
-        const LibraryAsset *asset = assetById(m_currentDevelopAssetId);
-        if (asset) {
-            const QString originalPath = assetOriginalPath(*asset);
-            if (!originalPath.isEmpty() && !seenPaths.contains(originalPath)) {
-                ExportItem item;
-                item.assetId = m_currentDevelopAssetId;
-                item.sourcePath = originalPath;
-                item.adjustments = m_libraryManager ? m_libraryManager->loadDevelopAdjustments(m_currentDevelopAssetId)
-                                                    : defaultDevelopAdjustments();
-                item.identity = adjustmentsAreIdentity(item.adjustments);
-                candidateItems.append(item);
-                seenPaths.insert(originalPath);
-            }
-        }
+        ExportItem item;
+        item.assetId = asset.id;
+        item.sourcePath = originalPath;
+        item.adjustments = adjustments.value(asset.id, defaultDevelopAdjustments());
+        item.identity = adjustmentsAreIdentity(item.adjustments);
+        candidateItems.append(item);
+        seenPaths.insert(originalPath);
     }
 
     if (candidateItems.isEmpty()) {
@@ -3181,26 +3611,48 @@ void MainWindow::on_actionImport_triggered()
     });
 }
 
-namespace {
-QStringList findPhotoFilesRecursively(const QString &folderPath)
+void MainWindow::on_actionHot_Folder_triggered()
 {
-    QStringList result;
-    QDir dir(folderPath);
-    if (!dir.exists()) {
-        return result;
+    if (!m_libraryManager || !m_libraryManager->hasOpenLibrary()) {
+        QMessageBox::information(this,
+                                 tr("No open library"),
+                                 tr("Open a library before adding a hot folder."));
+        return;
     }
 
-    // Get supported extensions from ImageLoader
-    QStringList nameFilters = ImageLoader::supportedNameFilters();
-    
-    // Recursively find all files matching the filters
-    QDirIterator it(folderPath, nameFilters, QDir::Files, QDirIterator::Subdirectories);
-    while (it.hasNext()) {
-        result.append(it.next());
+    const QString folder = QFileDialog::getExistingDirectory(this, tr("Choose Hot Folder"));
+    if (folder.isEmpty()) {
+        return;
     }
 
-    return result;
-}
+    // Choosing a folder that is already hot offers to stop watching it.
+    QStringList folders = m_libraryManager->hotFolders();
+    const QString path = QDir::cleanPath(folder);
+    bool adding = true;
+    if (folders.contains(path)) {
+        const auto answer = QMessageBox::question(this,
+                                                  tr("Hot folder"),
+                                                  tr("%1 is already a hot folder. Stop watching it?")
+                                                      .arg(QDir::toNativeSeparators(path)));
+        if (answer != QMessageBox::Yes) {
+            return;
+        }
+        folders.removeAll(path);
+        adding = false;
+    } else {
+        folders.append(path);
+    }
+
+    m_libraryManager->setHotFolders(folders).then(this, [this, path, adding](bool saved) {
+        if (!saved) {
+            QMessageBox::warning(this, tr("Hot folder"), tr("Failed to save hot folders."));
+            return;
+        }
+        showStatusMessage(adding
+                              ? tr("New photos in %1 will be imported automatically").arg(QDir::toNativeSeparators(path))
+                              : tr("Stopped watching %1").arg(QDir::toNativeSeparators(path)),
+                          4000);
+    });
 }
 
 void MainWindow::handleFolderDropped(const QString &folderPath)
@@ -3212,19 +3664,17 @@ void MainWindow::handleFolderDropped(const QString &folderPath)
         return;
     }
 
-    // Recursively find all photo files in the folder
-    QStringList files = findPhotoFilesRecursively(folderPath);
-    
-    if (files.isEmpty()) {
-        QMessageBox::information(this,
-                                tr("No photos found"),
-                                tr("No supported photo files were found in the selected folder."));
-        return;
-    }
-
-    // Show preview dialog
-    ImportPreviewDialog dialog(files, this);
-    if (dialog.exec() != QDialog::Accepted) {
+    // The dialog opens right away and fills in while the folder is walked.
+    ImportPreviewDialog dialog(this);
+    DirectoryScanner scanner;
+    connect(&scanner, &DirectoryScanner::filesFound, &dialog, &ImportPreviewDialog::appendFiles);
+    connect(&scanner, &DirectoryScanner::finished, &dialog, &ImportPreviewDialog::setScanFinished);
+    scanner.start(folderPath, ImageLoader::supportedNameFilters());
+    const int result = dialog.exec();
+    // Importing before the walk is over takes what has been found so far.
+    scanner.disconnect(&dialog);
+    scanner.cancel();
+    if (result != QDialog::Accepted) {
         return;
     }
 
@@ -3,12 +3,15 @@
 
 #include "librarymanager.h"
 
+#include <QCache>
 #include <QGraphicsPixmapItem>
 #include <QFutureWatcher>
 #include <QGraphicsScene>
+#include <QHash>
 #include <QImage>
 #include <QList>
 #include <QMainWindow>
+#include <QSet>
 #include <QUuid>
 #include <QString>
 #include <QVector>
@@ -25,6 +28,7 @@ class MainWindow;
 QT_END_NAMESPACE
 
 class LibraryGridView;
+struct LibraryGridItem;
 class LibraryFilterPane;
 class HistogramWidget;
 class JobManager;
@@ -74,11 +78,13 @@ private slots:
     void on_actionSelect_All_triggered();
     void on_actionSelect_None_triggered();
     void on_actionInverse_Selection_triggered();
+    void on_actionFind_Similar_triggered();
     void on_actionPreferences_triggered();
     void on_actionImport_triggered();
+    void on_actionHot_Folder_triggered();
     void on_actionExport_triggered();
     void openAssetInDevelop(qint64 assetId, const QString &filePath);
-    void handleSelectionChanged(const QList<qint64> &selection);
+    void handleSelectionChanged();
 
     void toggleJobsWindow();
     void handleImportProgress(int imported, int total);
@@ -86,7 +92,9 @@ private slots:
     void handleLibraryError(const QString &message);
     void handleJobListChanged();
     void handleFolderDropped(const QString &folderPath);
-    void handleAssetsQueried(const QVector<LibraryAsset> &assets);
+    void handleAssetsQueried(quint64 generation, int totalCount);
+    void handleAssetPageReady(quint64 generation, int offset, const QVector<LibraryAsset> &assets);
+    void handleGridItemsRequested(int offset, int count);
 
 private:
     Ui::MainWindow *ui;
@@ -97,7 +105,19 @@ private:
     HistogramWidget *m_histogramWidget = nullptr;
 
     QString currentLibraryPath;
-    QVector<LibraryAsset> m_assets;
+    // Current library query. Rows are paged in as the grid and filmstrip
+    // need them, so only a bounded window is held here.
+    quint64 m_assetQueryGeneration = 0;
+    int m_assetCount = 0;
+    QHash<int, LibraryAsset> m_loadedAssets;   // result position -> asset
+    QHash<qint64, int> m_loadedAssetPositions; // asset id -> result position
+    QSet<int> m_requestedAssetPages;           // pages in flight
+    // The action that asked for the ids of a Select All before they were
+    // listed; it runs again when they are.
+    std::function<void()> m_pendingSelectionAction;
+    // Assets looked up outside the loaded pages, least recently used first
+    // to go.
+    mutable QCache<qint64, LibraryAsset> m_assetLookupCache{256};
     qint64 m_currentDevelopAssetId = -1;
     double m_developZoom = 1.0;
     bool m_developFitMode = true;
@@ -119,9 +139,16 @@ private:
     QString assetPreviewPath(const LibraryAsset &asset) const;
     QString assetOriginalPath(const LibraryAsset &asset) const;
     void showStatusMessage(const QString &message, int timeoutMs = 3000);
-    void updateDevelopFilmstrip();
+    void updateDevelopFilmstrip(qint64 centerAssetId = -1);
+    void requestMissingAssets(int firstPosition, int lastPosition);
+    void trimLoadedAssets(int anchorPosition);
+    void resetLoadedAssets();
+    LibraryGridItem gridItemForAsset(const LibraryAsset &asset) const;
     void populateDevelopMetadata(const QImage &image, const QString &filePath, const DevelopMetadata &metadata);
+    // The pointer is valid until the next call.
     const LibraryAsset *assetById(qint64 assetId) const;
+    // Second half of Export, once the assets and their adjustments are read.
+    void exportAssets(const QVector<LibraryAsset> &assets, const QHash<qint64, DevelopAdjustments> &adjustments);
     void applyDevelopZoomPreset(const QString &preset);
     void fitDevelopViewToImage();
     void showDevelopPreview(const QPixmap &pixmap);
@@ -131,6 +158,15 @@ private:
     void handleHistogramReady();
     void requestHistogramComputation(const QImage &image, int requestId);
     void setupJobSystem();
+    void setupMarkActions();
+    QList<qint64> markTargetAssetIds(const std::function<void()> &retry);
+    // Calls visit(assetId) for every asset selected in the grid, without
+    // copying the selection into a list first. While a Select All cannot be
+    // resolved to ids yet, returns false and runs retry once they are listed.
+    bool forEachSelectedAssetId(const std::function<void(qint64)> &visit, const std::function<void()> &retry);
+    void handleQueriedAssetIdsReady(quint64 generation);
+    void handleAssetMarksChanged(const QList<qint64> &assetIds, quint8 fieldMask, quint8 bits);
+    void saveSmartCollection(const FilterOptions &rule);
     void updateJobsActionBadge();
     void schedulePreviewRegeneration(qint64 assetId, const QImage &sourceImage, const QUuid &parentJobId = {}, std::function<void()> onComplete = nullptr);
     void resetHistogram();
@@ -161,6 +197,10 @@ private:
     void loadAdjustmentsForAsset(qint64 assetId);
     void resetAdjustmentsToDefault();
     void processNextPreviewRegeneration();
+    void handlePastedAdjustments(const QList<qint64> &assetIds,
+                                 const DevelopAdjustments &adjustments,
+                                 const QHash<qint64, bool> &results);
+    void stepDevelopHistory(bool redo);
 
     LibraryManager *m_libraryManager = nullptr;
     JobManager *m_jobManager = nullptr;
@@ -1,10 +1,16 @@
 #include "metadatacache.h"
 
+#include "databaseconnectionpool.h"
+#include "databasewriter.h"
+#include "schemamigrations.h"
+
 #include <QDebug>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QHash>
 #include <QMutexLocker>
+#include <QPair>
 #include <QSet>
 #include <QSqlError>
 #include <QSqlQuery>
@@ -14,10 +20,481 @@
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QRegularExpression>
 #include <QVariant>
 
+#include <algorithm>
+
 namespace {
 constexpr auto kCacheFileName = "metadata_cache.db";
+
+struct FacetDefinition
+{
+    const char *name;
+    const char *expression; // %1 is the row alias; NULL means "not counted"
+};
+
+// Facets derived from asset_metadata columns. The camera label matches the
+// "Make Model" strings FilterOptions::cameraMake is compared against.
+const FacetDefinition kMetadataFacets[] = {
+    {"camera", "NULLIF(TRIM(TRIM(COALESCE(%1.camera_make, '')) || ' ' || TRIM(COALESCE(%1.camera_model, ''))), '')"},
+    {"lens", "NULLIF(TRIM(COALESCE(%1.lens, '')), '')"},
+    {"iso", "CASE WHEN CAST(%1.iso AS INTEGER) > 0 THEN CAST(CAST(%1.iso AS INTEGER) AS TEXT) END"},
+    {"month", "NULLIF(substr(COALESCE(%1.capture_date, ''), 1, 7), '')"},
+};
+const FacetDefinition kTagFacet = {"tag", "(SELECT name FROM tags WHERE id = %1.tag_id)"};
+
+QString facetIncrement(const FacetDefinition &facet, const QString &row)
+{
+    const QString value = QString::fromLatin1(facet.expression).arg(row);
+    return QStringLiteral(
+               "INSERT INTO facet_values (facet, value, count) SELECT '%1', %2, 1 WHERE %2 IS NOT NULL "
+               "ON CONFLICT(facet, value) DO UPDATE SET count = count + 1;")
+        .arg(QString::fromLatin1(facet.name), value);
+}
+
+QString facetDecrement(const FacetDefinition &facet, const QString &row)
+{
+    const QString value = QString::fromLatin1(facet.expression).arg(row);
+    return QStringLiteral("UPDATE facet_values SET count = count - 1 WHERE facet = '%1' AND value = %2;")
+        .arg(QString::fromLatin1(facet.name), value);
+}
+
+QStringList parseTagsJson(const QString &tagsJson)
+{
+    QStringList tags;
+    if (tagsJson.isEmpty()) {
+        return tags;
+    }
+
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(tagsJson.toUtf8(), &error);
+    if (error.error == QJsonParseError::NoError && doc.isArray()) {
+        const QJsonArray array = doc.array();
+        for (const QJsonValue &value : array) {
+            if (value.isString()) {
+                tags.append(value.toString());
+            }
+        }
+    }
+    return tags;
+}
+
+// Links each tag to the asset, creating tag rows as needed. Both statements
+// are plain inserts, so tagging never reads the asset's current tag set.
+bool linkTags(QSqlDatabase &db, qint64 assetId, const QStringList &tags, QString *errorMessage)
+{
+    QSqlQuery insertName(db);
+    QSqlQuery insertLink(db);
+    if (!insertName.prepare(QStringLiteral("INSERT OR IGNORE INTO tags (name) VALUES (?)"))
+        || !insertLink.prepare(QStringLiteral("INSERT OR IGNORE INTO asset_tags (asset_id, tag_id) SELECT ?, id FROM tags WHERE name = ?"))) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Failed to prepare tag insert: %1").arg(db.lastError().text());
+        }
+        return false;
+    }
+
+    for (const QString &tag : tags) {
+        if (tag.isEmpty()) {
+            continue;
+        }
+
+        insertName.bindValue(0, tag);
+        insertLink.bindValue(0, assetId);
+        insertLink.bindValue(1, tag);
+        if (!insertName.exec() || !insertLink.exec()) {
+            if (errorMessage) {
+                const QSqlError error = insertName.lastError().isValid() ? insertName.lastError() : insertLink.lastError();
+                *errorMessage = QStringLiteral("Failed to store tag: %1").arg(error.text());
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+bool replaceAssetTags(QSqlDatabase &db, qint64 assetId, const QStringList &tags, QString *errorMessage)
+{
+    QSqlQuery query(db);
+    query.prepare(QStringLiteral("DELETE FROM asset_tags WHERE asset_id = ?"));
+    query.addBindValue(assetId);
+    if (!query.exec()) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Failed to clear tags: %1").arg(query.lastError().text());
+        }
+        return false;
+    }
+    return linkTags(db, assetId, tags, errorMessage);
+}
+
+// "<assetIdColumn> [NOT] IN (ids carrying any/all of tags)"; appends the
+// tag names to bindValues in placeholder order.
+QString tagCondition(const QString &assetIdColumn, QStringList tags, bool requireAll, bool negate, QVariantList *bindValues)
+{
+    tags.removeDuplicates();
+
+    QStringList placeholders;
+    for (const QString &tag : std::as_const(tags)) {
+        placeholders.append(QStringLiteral("?"));
+        bindValues->append(tag);
+    }
+
+    QString subquery = QStringLiteral(
+        "SELECT at.asset_id FROM asset_tags at JOIN tags t ON t.id = at.tag_id WHERE t.name IN (%1)")
+                           .arg(placeholders.join(QStringLiteral(", ")));
+    if (requireAll && tags.size() > 1) {
+        subquery += QStringLiteral(" GROUP BY at.asset_id HAVING COUNT(*) = %1").arg(tags.size());
+    }
+
+    return QStringLiteral("%1 %2IN (%3)").arg(assetIdColumn, negate ? QStringLiteral("NOT ") : QString(), subquery);
+}
+
+// Version 1: the layout caches had before versioning was introduced, plus
+// moving tags out of the legacy JSON column. Every statement tolerates a
+// database that already has it.
+bool createBaseSchema(QSqlDatabase &db, QString *errorMessage)
+{
+    const QStringList statements = {
+        QStringLiteral("CREATE TABLE IF NOT EXISTS asset_metadata ("
+                       "asset_id INTEGER PRIMARY KEY,"
+                       "iso INTEGER DEFAULT 0,"
+                       "camera_make TEXT,"
+                       "camera_model TEXT,"
+                       "capture_date TEXT,"
+                       "tags TEXT DEFAULT '[]'"
+                       ")"),
+        QStringLiteral("CREATE INDEX IF NOT EXISTS idx_metadata_iso ON asset_metadata(iso)"),
+        QStringLiteral("CREATE INDEX IF NOT EXISTS idx_metadata_camera_make ON asset_metadata(camera_make)"),
+        QStringLiteral("CREATE INDEX IF NOT EXISTS idx_metadata_capture_date ON asset_metadata(capture_date)"),
+        // Tags are normalized into a dictionary plus a link table; the
+        // (tag_id, asset_id) index serves tag filters and counts.
+        QStringLiteral("CREATE TABLE IF NOT EXISTS tags ("
+                       "id INTEGER PRIMARY KEY,"
+                       "name TEXT NOT NULL UNIQUE"
+                       ")"),
+        QStringLiteral("CREATE TABLE IF NOT EXISTS asset_tags ("
+                       "asset_id INTEGER NOT NULL,"
+                       "tag_id INTEGER NOT NULL,"
+                       "PRIMARY KEY (asset_id, tag_id)"
+                       ") WITHOUT ROWID"),
+        QStringLiteral("CREATE INDEX IF NOT EXISTS idx_asset_tags_tag ON asset_tags(tag_id, asset_id)"),
+    };
+
+    if (!SchemaMigrator::exec(db, statements, errorMessage)
+        || !SchemaMigrator::addColumn(db, QStringLiteral("asset_metadata"), QStringLiteral("lens"), QStringLiteral("TEXT"), errorMessage)) {
+        return false;
+    }
+
+    // Older caches kept tags as a JSON array in asset_metadata.tags. Move them
+    // into asset_tags and blank the column.
+    const QString pendingCondition = QStringLiteral("tags IS NOT NULL AND tags NOT IN ('', '[]')");
+
+    QSqlQuery select(db);
+    select.setForwardOnly(true);
+    if (!select.exec(QStringLiteral("SELECT asset_id, tags FROM asset_metadata WHERE %1").arg(pendingCondition))) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Failed to read legacy tags: %1").arg(select.lastError().text());
+        }
+        return false;
+    }
+
+    QVector<QPair<qint64, QStringList>> pending;
+    while (select.next()) {
+        pending.append(qMakePair(select.value(0).toLongLong(), parseTagsJson(select.value(1).toString())));
+    }
+    select.finish();
+
+    for (const auto &entry : std::as_const(pending)) {
+        if (!linkTags(db, entry.first, entry.second, errorMessage)) {
+            return false;
+        }
+    }
+
+    return pending.isEmpty()
+        || SchemaMigrator::exec(db, {QStringLiteral("UPDATE asset_metadata SET tags = '[]' WHERE %1").arg(pendingCondition)}, errorMessage);
+}
+
+// Version 2: facet_values, kept current by triggers so every write path
+// (including ones outside MetadataCache) updates the counts in the same
+// transaction and reading the filter options never scans asset_metadata.
+bool createFacets(QSqlDatabase &db, QString *errorMessage)
+{
+    QString metadataInsert;
+    QString metadataDelete;
+    for (const FacetDefinition &facet : kMetadataFacets) {
+        metadataInsert += facetIncrement(facet, QStringLiteral("NEW"));
+        metadataDelete += facetDecrement(facet, QStringLiteral("OLD"));
+    }
+    const QString prune = QStringLiteral("DELETE FROM facet_values WHERE count <= 0;");
+
+    QStringList statements = {
+        QStringLiteral("CREATE TABLE IF NOT EXISTS facet_values ("
+                       "facet TEXT NOT NULL,"
+                       "value TEXT NOT NULL,"
+                       "count INTEGER NOT NULL,"
+                       "PRIMARY KEY (facet, value)"
+                       ") WITHOUT ROWID"),
+        QStringLiteral("CREATE TRIGGER IF NOT EXISTS facets_metadata_insert AFTER INSERT ON asset_metadata "
+                       "BEGIN %1 END")
+            .arg(metadataInsert),
+        QStringLiteral("CREATE TRIGGER IF NOT EXISTS facets_metadata_delete AFTER DELETE ON asset_metadata "
+                       "BEGIN %1 %2 END")
+            .arg(metadataDelete, prune),
+        QStringLiteral("CREATE TRIGGER IF NOT EXISTS facets_metadata_update "
+                       "AFTER UPDATE OF iso, camera_make, camera_model, lens, capture_date ON asset_metadata "
+                       "BEGIN %1 %2 %3 END")
+            .arg(metadataDelete, metadataInsert, prune),
+        QStringLiteral("CREATE TRIGGER IF NOT EXISTS facets_tag_insert AFTER INSERT ON asset_tags "
+                       "BEGIN %1 END")
+            .arg(facetIncrement(kTagFacet, QStringLiteral("NEW"))),
+        QStringLiteral("CREATE TRIGGER IF NOT EXISTS facets_tag_delete AFTER DELETE ON asset_tags "
+                       "BEGIN %1 %2 END")
+            .arg(facetDecrement(kTagFacet, QStringLiteral("OLD")), prune),
+    };
+
+    // Count what is already there; from here on the triggers take over.
+    statements.append(QStringLiteral("DELETE FROM facet_values"));
+    for (const FacetDefinition &facet : kMetadataFacets) {
+        statements.append(QStringLiteral(
+                              "INSERT INTO facet_values (facet, value, count) "
+                              "SELECT '%1', v, COUNT(*) FROM (SELECT %2 AS v FROM asset_metadata m) "
+                              "WHERE v IS NOT NULL GROUP BY v")
+                              .arg(QString::fromLatin1(facet.name), QString::fromLatin1(facet.expression).arg(QStringLiteral("m"))));
+    }
+    statements.append(QStringLiteral(
+        "INSERT INTO facet_values (facet, value, count) "
+        "SELECT 'tag', t.name, COUNT(*) FROM asset_tags at JOIN tags t ON t.id = at.tag_id GROUP BY t.name"));
+
+    return SchemaMigrator::exec(db, statements, errorMessage);
+}
+
+// Version 3: sort and range filters compare plain integer columns, so the
+// indexes below can serve them. capture_epoch is filled for new writes
+// immediately and for existing rows by backfillCaptureEpochs().
+bool addTypedSortColumns(QSqlDatabase &db, QString *errorMessage)
+{
+    if (!SchemaMigrator::addColumn(db, QStringLiteral("asset_metadata"), QStringLiteral("capture_epoch"), QStringLiteral("INTEGER"), errorMessage)) {
+        return false;
+    }
+
+    return SchemaMigrator::exec(db, {
+        // Older writers could leave text in the INTEGER column.
+        QStringLiteral("UPDATE asset_metadata SET iso = COALESCE(CAST(iso AS INTEGER), 0) WHERE typeof(iso) <> 'integer'"),
+        QStringLiteral("DROP INDEX IF EXISTS idx_metadata_iso"),
+        QStringLiteral("DROP INDEX IF EXISTS idx_metadata_camera_make"),
+        QStringLiteral("DROP INDEX IF EXISTS idx_metadata_capture_date"),
+        // One covering index per FilterOptions::SortOrder; file name order
+        // is served by library.db.
+        QStringLiteral("CREATE INDEX IF NOT EXISTS idx_metadata_capture_epoch ON asset_metadata(capture_epoch, asset_id)"),
+        QStringLiteral("CREATE INDEX IF NOT EXISTS idx_metadata_iso_sort ON asset_metadata(iso, asset_id)"),
+        QStringLiteral("CREATE INDEX IF NOT EXISTS idx_metadata_camera_sort ON asset_metadata(camera_make, camera_model, capture_epoch, asset_id)"),
+    }, errorMessage);
+}
+
+// The asset_search row for the asset whose id is idExpression: file name,
+// "Make Model", lens and the space-separated tag names. Nothing is selected
+// once the asset has neither metadata nor tags.
+QString searchDocumentInsert(const QString &idExpression)
+{
+    return QStringLiteral(
+               "INSERT INTO asset_search (rowid, file_name, camera, lens, tags) "
+               "SELECT %1, m.file_name, "
+               "TRIM(COALESCE(m.camera_make, '') || ' ' || COALESCE(m.camera_model, '')), "
+               "m.lens, "
+               "(SELECT group_concat(t.name, ' ') FROM asset_tags at JOIN tags t ON t.id = at.tag_id WHERE at.asset_id = %1) "
+               "FROM (SELECT 1) LEFT JOIN asset_metadata m ON m.asset_id = %1 "
+               "WHERE m.asset_id IS NOT NULL OR EXISTS (SELECT 1 FROM asset_tags WHERE asset_id = %1);")
+        .arg(idExpression);
+}
+
+QString searchDocumentRefresh(const QString &idExpression)
+{
+    return QStringLiteral("DELETE FROM asset_search WHERE rowid = %1;").arg(idExpression)
+        + searchDocumentInsert(idExpression);
+}
+
+// Version 4: asset_search, an FTS5 index over the text an asset can be found
+// by. Like facet_values it is maintained by triggers, so it changes in the
+// same transaction as the rows it indexes. file_name is a copy of
+// library.db's, filled by new writes and backfillFileNames().
+bool createSearchIndex(QSqlDatabase &db, QString *errorMessage)
+{
+    if (!SchemaMigrator::addColumn(db, QStringLiteral("asset_metadata"), QStringLiteral("file_name"), QStringLiteral("TEXT"), errorMessage)) {
+        return false;
+    }
+
+    const QString newRow = searchDocumentRefresh(QStringLiteral("NEW.asset_id"));
+    const QString oldRow = searchDocumentRefresh(QStringLiteral("OLD.asset_id"));
+    return SchemaMigrator::exec(db, {
+        // prefix= keeps two and three character prefix queries on the index
+        // instead of scanning every term.
+        QStringLiteral("CREATE VIRTUAL TABLE IF NOT EXISTS asset_search USING fts5("
+                       "file_name, camera, lens, tags, "
+                       "tokenize = 'unicode61 remove_diacritics 2', prefix = '2 3')"),
+        QStringLiteral("CREATE INDEX IF NOT EXISTS idx_metadata_missing_file_name "
+                       "ON asset_metadata(asset_id) WHERE file_name IS NULL"),
+        QStringLiteral("CREATE TRIGGER IF NOT EXISTS search_metadata_insert AFTER INSERT ON asset_metadata "
+                       "BEGIN %1 END").arg(newRow),
+        QStringLiteral("CREATE TRIGGER IF NOT EXISTS search_metadata_update "
+                       "AFTER UPDATE OF file_name, camera_make, camera_model, lens ON asset_metadata "
+                       "BEGIN %1 END").arg(newRow),
+        QStringLiteral("CREATE TRIGGER IF NOT EXISTS search_metadata_delete AFTER DELETE ON asset_metadata "
+                       "BEGIN %1 END").arg(oldRow),
+        QStringLiteral("CREATE TRIGGER IF NOT EXISTS search_tag_insert AFTER INSERT ON asset_tags "
+                       "BEGIN %1 END").arg(newRow),
+        QStringLiteral("CREATE TRIGGER IF NOT EXISTS search_tag_delete AFTER DELETE ON asset_tags "
+                       "BEGIN %1 END").arg(oldRow),
+        QStringLiteral("DELETE FROM asset_search"),
+        QStringLiteral("INSERT INTO asset_search (rowid, file_name, camera, lens, tags) "
+                       "SELECT ids.asset_id, m.file_name, "
+                       "TRIM(COALESCE(m.camera_make, '') || ' ' || COALESCE(m.camera_model, '')), "
+                       "m.lens, "
+                       "(SELECT group_concat(t.name, ' ') FROM asset_tags at JOIN tags t ON t.id = at.tag_id WHERE at.asset_id = ids.asset_id) "
+                       "FROM (SELECT asset_id FROM asset_metadata UNION SELECT asset_id FROM asset_tags) ids "
+                       "LEFT JOIN asset_metadata m ON m.asset_id = ids.asset_id"),
+    }, errorMessage);
+}
+
+// The asset_search row as of version 5: like searchDocumentInsert(), but the
+// file name comes from asset_names, so assets are found by name before, and
+// without, any metadata.
+QString namedSearchDocumentInsert(const QString &idExpression)
+{
+    return QStringLiteral(
+               "INSERT INTO asset_search (rowid, file_name, camera, lens, tags) "
+               "SELECT %1, COALESCE(n.file_name, m.file_name), "
+               "TRIM(COALESCE(m.camera_make, '') || ' ' || COALESCE(m.camera_model, '')), "
+               "m.lens, "
+               "(SELECT group_concat(t.name, ' ') FROM asset_tags at JOIN tags t ON t.id = at.tag_id WHERE at.asset_id = %1) "
+               "FROM (SELECT 1) LEFT JOIN asset_metadata m ON m.asset_id = %1 "
+               "LEFT JOIN asset_names n ON n.asset_id = %1 "
+               "WHERE m.asset_id IS NOT NULL OR n.asset_id IS NOT NULL "
+               "OR EXISTS (SELECT 1 FROM asset_tags WHERE asset_id = %1);")
+        .arg(idExpression);
+}
+
+QString namedSearchDocumentRefresh(const QString &idExpression)
+{
+    return QStringLiteral("DELETE FROM asset_search WHERE rowid = %1;").arg(idExpression)
+        + namedSearchDocumentInsert(idExpression);
+}
+
+// Version 5: asset_names, every asset's file name written at import. Names
+// copied into asset_metadata only arrived with extracted metadata, so assets
+// whose extraction was pending or had failed could not be found by name.
+// The search triggers are recreated to read it.
+bool addSearchNames(QSqlDatabase &db, QString *errorMessage)
+{
+    const QString newRow = namedSearchDocumentRefresh(QStringLiteral("NEW.asset_id"));
+    const QString oldRow = namedSearchDocumentRefresh(QStringLiteral("OLD.asset_id"));
+    return SchemaMigrator::exec(db, {
+        QStringLiteral("CREATE TABLE IF NOT EXISTS asset_names ("
+                       "asset_id INTEGER PRIMARY KEY,"
+                       "file_name TEXT NOT NULL)"),
+        QStringLiteral("INSERT OR IGNORE INTO asset_names (asset_id, file_name) "
+                       "SELECT asset_id, file_name FROM asset_metadata WHERE file_name IS NOT NULL AND file_name <> ''"),
+        QStringLiteral("DROP TRIGGER IF EXISTS search_metadata_insert"),
+        QStringLiteral("DROP TRIGGER IF EXISTS search_metadata_update"),
+        QStringLiteral("DROP TRIGGER IF EXISTS search_metadata_delete"),
+        QStringLiteral("DROP TRIGGER IF EXISTS search_tag_insert"),
+        QStringLiteral("DROP TRIGGER IF EXISTS search_tag_delete"),
+        QStringLiteral("CREATE TRIGGER search_metadata_insert AFTER INSERT ON asset_metadata "
+                       "BEGIN %1 END").arg(newRow),
+        QStringLiteral("CREATE TRIGGER search_metadata_update "
+                       "AFTER UPDATE OF file_name, camera_make, camera_model, lens ON asset_metadata "
+                       "BEGIN %1 END").arg(newRow),
+        QStringLiteral("CREATE TRIGGER search_metadata_delete AFTER DELETE ON asset_metadata "
+                       "BEGIN %1 END").arg(oldRow),
+        QStringLiteral("CREATE TRIGGER search_tag_insert AFTER INSERT ON asset_tags "
+                       "BEGIN %1 END").arg(newRow),
+        QStringLiteral("CREATE TRIGGER search_tag_delete AFTER DELETE ON asset_tags "
+                       "BEGIN %1 END").arg(oldRow),
+        QStringLiteral("CREATE TRIGGER IF NOT EXISTS search_name_insert AFTER INSERT ON asset_names "
+                       "BEGIN %1 END").arg(newRow),
+        QStringLiteral("CREATE TRIGGER IF NOT EXISTS search_name_update AFTER UPDATE OF file_name ON asset_names "
+                       "BEGIN %1 END").arg(newRow),
+        QStringLiteral("CREATE TRIGGER IF NOT EXISTS search_name_delete AFTER DELETE ON asset_names "
+                       "BEGIN %1 END").arg(oldRow),
+        QStringLiteral("DELETE FROM asset_search"),
+        QStringLiteral("INSERT INTO asset_search (rowid, file_name, camera, lens, tags) "
+                       "SELECT ids.asset_id, COALESCE(n.file_name, m.file_name), "
+                       "TRIM(COALESCE(m.camera_make, '') || ' ' || COALESCE(m.camera_model, '')), "
+                       "m.lens, "
+                       "(SELECT group_concat(t.name, ' ') FROM asset_tags at JOIN tags t ON t.id = at.tag_id WHERE at.asset_id = ids.asset_id) "
+                       "FROM (SELECT asset_id FROM asset_metadata UNION SELECT asset_id FROM asset_tags "
+                       "UNION SELECT asset_id FROM asset_names) ids "
+                       "LEFT JOIN asset_metadata m ON m.asset_id = ids.asset_id "
+                       "LEFT JOIN asset_names n ON n.asset_id = ids.asset_id"),
+    }, errorMessage);
+}
+
+// Turns free text into an FTS5 query: every whitespace-separated word must
+// match, each as a quoted prefix phrase so punctuation in the input is never
+// parsed as query syntax. "DSC_4412" becomes "DSC_4412"*, which the
+// tokenizer reads as the phrase dsc 4412*. Empty when nothing is searchable.
+QString searchMatchExpression(const QString &text)
+{
+    QStringList terms;
+    const QStringList words = text.split(QRegularExpression(QStringLiteral("\\s+")), Qt::SkipEmptyParts);
+    for (QString word : words) {
+        word.remove(QLatin1Char('"'));
+        const bool searchable = std::any_of(word.cbegin(), word.cend(), [](QChar c) {
+            return c.isLetterOrNumber();
+        });
+        if (searchable) {
+            terms.append(QStringLiteral("\"%1\"*").arg(word));
+        }
+    }
+    return terms.join(QLatin1Char(' '));
+}
+
+QVariant captureEpochValue(const QDateTime &captureDate)
+{
+    return captureDate.isValid() ? QVariant(captureDate.toMSecsSinceEpoch()) : QVariant();
+}
+
+// NULL keeps the name a row already has; search reads asset_names first.
+QVariant fileNameValue(const QString &fileName)
+{
+    return fileName.isEmpty() ? QVariant() : QVariant(fileName);
+}
+
+// Inserts or replaces an asset's row and adds metadata.tags to its tags. Tags
+// are merged rather than replaced, as extraction rarely returns any and must
+// not drop those the user added. The caller owns the transaction.
+bool upsertMetadata(QSqlDatabase &db, qint64 assetId, const AssetMetadata &metadata, QString *errorMessage)
+{
+    QSqlQuery query(db);
+    query.prepare(QStringLiteral(
+        "INSERT INTO asset_metadata (asset_id, iso, camera_make, camera_model, lens, capture_date, capture_epoch, file_name) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?) "
+        "ON CONFLICT(asset_id) DO UPDATE SET "
+        "iso = excluded.iso, "
+        "camera_make = excluded.camera_make, "
+        "camera_model = excluded.camera_model, "
+        "lens = excluded.lens, "
+        "capture_date = excluded.capture_date, "
+        "capture_epoch = excluded.capture_epoch, "
+        "file_name = COALESCE(excluded.file_name, file_name)"));
+    query.addBindValue(assetId);
+    query.addBindValue(metadata.iso);
+    query.addBindValue(metadata.cameraMake);
+    query.addBindValue(metadata.cameraModel);
+    query.addBindValue(metadata.lens);
+    query.addBindValue(metadata.captureDate.isValid() ? metadata.captureDate.toString(Qt::ISODate) : QString());
+    query.addBindValue(captureEpochValue(metadata.captureDate));
+    query.addBindValue(fileNameValue(metadata.fileName));
+
+    if (!query.exec()) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Failed to update metadata: %1").arg(query.lastError().text());
+        }
+        return false;
+    }
+    query.finish();
+
+    return linkTags(db, assetId, metadata.tags, errorMessage);
+}
 }
 
 MetadataCache::MetadataCache(QObject *parent)
@@ -66,6 +543,8 @@ bool MetadataCache::openCache(const QString &libraryPath, QString *errorMessage)
         return false;
     }
 
+    DatabaseConnectionPool::configureConnection(db);
+
     m_cachePath = libraryPath;
     m_database = db;
 
@@ -74,12 +553,18 @@ bool MetadataCache::openCache(const QString &libraryPath, QString *errorMessage)
         return false;
     }
 
+    m_writer = QSharedPointer<DatabaseWriter>::create(databasePath(libraryPath));
     return true;
 }
 
 void MetadataCache::closeCache()
 {
     QMutexLocker locker(&m_mutex);
+    if (m_writer) {
+        // Queued writes still land before the connections are released.
+        m_writer->stop();
+        m_writer.reset();
+    }
     if (!m_connectionName.isEmpty()) {
         if (m_database.isOpen()) {
             m_database.close();
@@ -104,6 +589,11 @@ QString MetadataCache::cachePath() const
 }
 
 QString MetadataCache::makeCachePath(const QString &libraryPath) const
+{
+    return databasePath(libraryPath);
+}
+
+QString MetadataCache::databasePath(const QString &libraryPath)
 {
     return QDir(libraryPath).filePath(QString::fromLatin1(kCacheFileName));
 }
@@ -117,190 +607,385 @@ bool MetadataCache::initializeSchema(QString *errorMessage)
         return false;
     }
 
-    QSqlQuery query(m_database);
-
-    // Main metadata table
-    const QString createMetadataTable = QStringLiteral(
-        "CREATE TABLE IF NOT EXISTS asset_metadata ("
-        "asset_id INTEGER PRIMARY KEY,"
-        "iso INTEGER DEFAULT 0,"
-        "camera_make TEXT,"
-        "camera_model TEXT,"
-        "capture_date TEXT,"
-        "tags TEXT DEFAULT '[]'"
-        ");");
-
-    if (!query.exec(createMetadataTable)) {
-        if (errorMessage) {
-            *errorMessage = QStringLiteral("Failed to create asset_metadata table: %1").arg(query.lastError().text());
-        }
-        return false;
-    }
+    return SchemaMigrator::migrate(m_database, schemaMigrations(), errorMessage);
+}
 
-    // Create indexes for faster queries
-    const QStringList indexes = {
-        QStringLiteral("CREATE INDEX IF NOT EXISTS idx_metadata_iso ON asset_metadata(iso)"),
-        QStringLiteral("CREATE INDEX IF NOT EXISTS idx_metadata_camera_make ON asset_metadata(camera_make)"),
-        QStringLiteral("CREATE INDEX IF NOT EXISTS idx_metadata_capture_date ON asset_metadata(capture_date)"),
+QVector<SchemaMigration> MetadataCache::schemaMigrations()
+{
+    return {
+        {1, QStringLiteral("asset metadata and normalized tags"), createBaseSchema},
+        {2, QStringLiteral("facet counts"), createFacets},
+        {3, QStringLiteral("typed sort columns and covering indexes"), addTypedSortColumns},
+        {4, QStringLiteral("full-text search index"), createSearchIndex},
+        {5, QStringLiteral("file names for search independent of metadata"), addSearchNames},
     };
+}
 
-    for (const QString &indexSql : indexes) {
-        if (!query.exec(indexSql)) {
-            qWarning() << "Failed to create index:" << query.lastError();
+QFuture<bool> MetadataCache::storeMetadata(qint64 assetId, const AssetMetadata &metadata)
+{
+    return submitAssetWrite(assetId, [assetId, metadata](QSqlDatabase &db, QString *errorMessage) {
+        QSqlQuery query(db);
+        query.prepare(QStringLiteral(
+            "INSERT INTO asset_metadata (asset_id, iso, camera_make, camera_model, lens, capture_date, capture_epoch, file_name) "
+            "VALUES (?, ?, ?, ?, ?, ?, ?, ?)"));
+        query.addBindValue(assetId);
+        query.addBindValue(metadata.iso);
+        query.addBindValue(metadata.cameraMake);
+        query.addBindValue(metadata.cameraModel);
+        query.addBindValue(metadata.lens);
+        query.addBindValue(metadata.captureDate.isValid() ? metadata.captureDate.toString(Qt::ISODate) : QString());
+        query.addBindValue(captureEpochValue(metadata.captureDate));
+        query.addBindValue(fileNameValue(metadata.fileName));
+
+        if (!query.exec()) {
+            if (errorMessage) {
+                *errorMessage = QStringLiteral("Failed to store metadata: %1").arg(query.lastError().text());
+            }
+            return false;
         }
+        return replaceAssetTags(db, assetId, metadata.tags, errorMessage);
+    });
+}
+
+QFuture<bool> MetadataCache::updateMetadata(qint64 assetId, const AssetMetadata &metadata)
+{
+    return submitAssetWrite(assetId, [assetId, metadata](QSqlDatabase &db, QString *errorMessage) {
+        return upsertMetadata(db, assetId, metadata, errorMessage);
+    });
+}
+
+QFuture<bool> MetadataCache::submitAssetWrite(qint64 assetId, std::function<bool(QSqlDatabase &, QString *)> command)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_writer || assetId <= 0) {
+        return QtFuture::makeReadyFuture(false);
     }
 
-    return true;
+    const QSharedPointer<DatabaseWriter> writer = m_writer;
+    return m_writer->submit(std::move(command)).then(this, [this, writer, assetId](bool committed) {
+        // Not announced for a cache that was closed in the meantime.
+        if (committed && writer == m_writer) {
+            emit metadataUpdated(assetId);
+        }
+        return committed;
+    });
+}
+
+QSharedPointer<DatabaseWriter> MetadataCache::writer() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_writer;
 }
 
-bool MetadataCache::storeMetadata(qint64 assetId, const AssetMetadata &metadata, QString *errorMessage)
+AssetMetadata MetadataCache::loadMetadata(qint64 assetId) const
 {
+    AssetMetadata metadata;
+    metadata.assetId = assetId;
+
     QMutexLocker locker(&m_mutex);
     if (!hasOpenCache() || assetId <= 0) {
-        if (errorMessage) {
-            *errorMessage = QStringLiteral("Cannot store metadata without an open cache or valid asset ID");
-        }
-        return false;
+        return metadata;
     }
 
-    QJsonArray tagsArray;
-    for (const QString &tag : metadata.tags) {
-        tagsArray.append(tag);
+    QSqlQuery query(m_database);
+    query.prepare(QStringLiteral("SELECT iso, camera_make, camera_model, lens, capture_date FROM asset_metadata WHERE asset_id = ?"));
+    query.addBindValue(assetId);
+
+    if (query.exec() && query.next()) {
+        metadata.iso = query.value(0).toInt();
+        metadata.cameraMake = query.value(1).toString();
+        metadata.cameraModel = query.value(2).toString();
+        metadata.lens = query.value(3).toString();
+        const QString dateStr = query.value(4).toString();
+        if (!dateStr.isEmpty()) {
+            metadata.captureDate = QDateTime::fromString(dateStr, Qt::ISODate);
+        }
     }
-    const QString tagsJson = QJsonDocument(tagsArray).toJson(QJsonDocument::Compact);
+    // Tags can exist without an asset_metadata row.
+    metadata.tags = loadTags(assetId);
+
+    return metadata;
+}
+
+QStringList MetadataCache::loadTags(qint64 assetId) const
+{
+    QStringList tags;
 
     QSqlQuery query(m_database);
+    query.setForwardOnly(true);
     query.prepare(QStringLiteral(
-        "INSERT INTO asset_metadata (asset_id, iso, camera_make, camera_model, capture_date, tags) "
-        "VALUES (?, ?, ?, ?, ?, ?)"));
+        "SELECT t.name FROM asset_tags at JOIN tags t ON t.id = at.tag_id WHERE at.asset_id = ? ORDER BY t.name"));
     query.addBindValue(assetId);
-    query.addBindValue(metadata.iso);
-    query.addBindValue(metadata.cameraMake);
-    query.addBindValue(metadata.cameraModel);
-    query.addBindValue(metadata.captureDate.isValid() ? metadata.captureDate.toString(Qt::ISODate) : QString());
-    query.addBindValue(tagsJson);
-
     if (!query.exec()) {
-        if (errorMessage) {
-            *errorMessage = QStringLiteral("Failed to store metadata: %1").arg(query.lastError().text());
-        }
-        return false;
+        qWarning() << "Failed to load tags:" << query.lastError();
+        return tags;
     }
 
-    emit metadataUpdated(assetId);
-    return true;
+    while (query.next()) {
+        tags.append(query.value(0).toString());
+    }
+    return tags;
 }
 
-bool MetadataCache::updateMetadata(qint64 assetId, const AssetMetadata &metadata, QString *errorMessage)
+QVector<AssetMetadata> MetadataCache::loadAllMetadata(const QString &databasePath)
 {
-    QMutexLocker locker(&m_mutex);
-    if (!hasOpenCache() || assetId <= 0) {
-        if (errorMessage) {
-            *errorMessage = QStringLiteral("Cannot update metadata without an open cache or valid asset ID");
-        }
-        return false;
+    QVector<AssetMetadata> result;
+
+    QString connectionError;
+    QSqlQuery *query = DatabaseConnectionPool::instance().cachedQuery(
+        databasePath,
+        QStringLiteral("SELECT asset_id, iso, camera_make, camera_model, lens, capture_date FROM asset_metadata"),
+        &connectionError);
+    if (!query || !query->exec()) {
+        qWarning() << "Failed to load metadata:" << (query ? query->lastError().text() : connectionError);
+        return result;
     }
 
-    QJsonArray tagsArray;
-    for (const QString &tag : metadata.tags) {
-        tagsArray.append(tag);
+    QHash<qint64, int> rowByAsset;
+    while (query->next()) {
+        AssetMetadata metadata;
+        metadata.assetId = query->value(0).toLongLong();
+        metadata.iso = query->value(1).toInt();
+        metadata.cameraMake = query->value(2).toString();
+        metadata.cameraModel = query->value(3).toString();
+        metadata.lens = query->value(4).toString();
+        const QString dateStr = query->value(5).toString();
+        if (!dateStr.isEmpty()) {
+            metadata.captureDate = QDateTime::fromString(dateStr, Qt::ISODate);
+        }
+        rowByAsset.insert(metadata.assetId, result.size());
+        result.append(metadata);
+    }
+    query->finish();
+
+    QSqlQuery *tagQuery = DatabaseConnectionPool::instance().cachedQuery(
+        databasePath,
+        QStringLiteral("SELECT at.asset_id, t.name FROM asset_tags at JOIN tags t ON t.id = at.tag_id ORDER BY at.asset_id, t.name"),
+        &connectionError);
+    if (!tagQuery || !tagQuery->exec()) {
+        qWarning() << "Failed to load tags:" << (tagQuery ? tagQuery->lastError().text() : connectionError);
+        return result;
     }
-    const QString tagsJson = QJsonDocument(tagsArray).toJson(QJsonDocument::Compact);
-
-    QSqlQuery query(m_database);
-    query.prepare(QStringLiteral(
-        "INSERT INTO asset_metadata (asset_id, iso, camera_make, camera_model, capture_date, tags) "
-        "VALUES (?, ?, ?, ?, ?, ?) "
-        "ON CONFLICT(asset_id) DO UPDATE SET "
-        "iso = excluded.iso, "
-        "camera_make = excluded.camera_make, "
-        "camera_model = excluded.camera_model, "
-        "capture_date = excluded.capture_date, "
-        "tags = excluded.tags"));
-    query.addBindValue(assetId);
-    query.addBindValue(metadata.iso);
-    query.addBindValue(metadata.cameraMake);
-    query.addBindValue(metadata.cameraModel);
-    query.addBindValue(metadata.captureDate.isValid() ? metadata.captureDate.toString(Qt::ISODate) : QString());
-    query.addBindValue(tagsJson);
 
-    if (!query.exec()) {
-        if (errorMessage) {
-            *errorMessage = QStringLiteral("Failed to update metadata: %1").arg(query.lastError().text());
+    while (tagQuery->next()) {
+        const qint64 assetId = tagQuery->value(0).toLongLong();
+        int row = rowByAsset.value(assetId, -1);
+        if (row < 0) {
+            AssetMetadata metadata;
+            metadata.assetId = assetId;
+            row = result.size();
+            rowByAsset.insert(assetId, row);
+            result.append(metadata);
         }
-        return false;
+        result[row].tags.append(tagQuery->value(1).toString());
     }
+    tagQuery->finish();
 
-    emit metadataUpdated(assetId);
-    return true;
+    return result;
 }
 
-AssetMetadata MetadataCache::loadMetadata(qint64 assetId) const
+qint64 MetadataCache::backfillCaptureEpochs(const QSharedPointer<DatabaseWriter> &writer, qint64 afterAssetId, int batchSize)
 {
-    AssetMetadata metadata;
-    metadata.assetId = assetId;
+    QString connectionError;
+    QSqlQuery *select = DatabaseConnectionPool::instance().cachedQuery(
+        writer->databasePath(),
+        QStringLiteral("SELECT asset_id, capture_date FROM asset_metadata "
+                       "WHERE asset_id > ? AND capture_epoch IS NULL AND capture_date <> '' "
+                       "ORDER BY asset_id LIMIT ?"),
+        &connectionError);
+    if (!select) {
+        qWarning() << "Failed to prepare capture time backfill:" << connectionError;
+        return -1;
+    }
 
-    QMutexLocker locker(&m_mutex);
-    if (!hasOpenCache() || assetId <= 0) {
-        return metadata;
+    select->bindValue(0, afterAssetId);
+    select->bindValue(1, batchSize);
+    if (!select->exec()) {
+        qWarning() << "Failed to read capture dates:" << select->lastError();
+        return -1;
     }
 
-    QSqlQuery query(m_database);
-    query.prepare(QStringLiteral("SELECT iso, camera_make, camera_model, capture_date, tags FROM asset_metadata WHERE asset_id = ?"));
-    query.addBindValue(assetId);
+    // Parsed with QDateTime so backfilled values match what new writes store.
+    QVector<QPair<qint64, qint64>> epochs;
+    qint64 lastAssetId = -1;
+    while (select->next()) {
+        lastAssetId = select->value(0).toLongLong();
+        const QDateTime captureDate = QDateTime::fromString(select->value(1).toString(), Qt::ISODate);
+        if (captureDate.isValid()) {
+            epochs.append(qMakePair(lastAssetId, captureDate.toMSecsSinceEpoch()));
+        }
+    }
+    select->finish();
 
-    if (!query.exec() || !query.next()) {
-        return metadata;
+    if (epochs.isEmpty()) {
+        return lastAssetId;
     }
 
-    metadata.iso = query.value(0).toInt();
-    metadata.cameraMake = query.value(1).toString();
-    metadata.cameraModel = query.value(2).toString();
-    const QString dateStr = query.value(3).toString();
-    if (!dateStr.isEmpty()) {
-        metadata.captureDate = QDateTime::fromString(dateStr, Qt::ISODate);
-    }
-    const QString tagsJson = query.value(4).toString();
-    if (!tagsJson.isEmpty()) {
-        QJsonParseError error;
-        QJsonDocument doc = QJsonDocument::fromJson(tagsJson.toUtf8(), &error);
-        if (error.error == QJsonParseError::NoError && doc.isArray()) {
-            QJsonArray array = doc.array();
-            for (const QJsonValue &value : array) {
-                if (value.isString()) {
-                    metadata.tags.append(value.toString());
+    QFuture<bool> written = writer->submit([epochs](QSqlDatabase &db, QString *errorMessage) {
+        QSqlQuery *update = DatabaseConnectionPool::instance().cachedQuery(
+            db,
+            QStringLiteral("UPDATE asset_metadata SET capture_epoch = ? WHERE asset_id = ? AND capture_epoch IS NULL"),
+            errorMessage);
+        if (!update) {
+            return false;
+        }
+        for (const auto &entry : epochs) {
+            update->bindValue(0, entry.second);
+            update->bindValue(1, entry.first);
+            if (!update->exec()) {
+                if (errorMessage) {
+                    *errorMessage = QStringLiteral("Failed to backfill capture time: %1").arg(update->lastError().text());
                 }
+                update->finish();
+                return false;
             }
         }
+        update->finish();
+        return true;
+    });
+    // Callers run on a worker thread; the next batch is read after this one
+    // has landed.
+    written.waitForFinished();
+    return written.result() ? lastAssetId : -1;
+}
+
+qint64 MetadataCache::backfillFileNames(const QSharedPointer<DatabaseWriter> &writer,
+                                        const QString &libraryDatabasePath,
+                                        qint64 afterAssetId,
+                                        int batchSize)
+{
+    const QString databasePath = writer->databasePath();
+    DatabaseConnectionPool &pool = DatabaseConnectionPool::instance();
+    QString connectionError;
+    if (!pool.attachDatabase(databasePath, QStringLiteral("library"), libraryDatabasePath, &connectionError)) {
+        qWarning() << "Failed to attach library for file name backfill:" << connectionError;
+        return -1;
     }
 
-    return metadata;
+    // Assets imported before asset_names existed. Once every name is there
+    // this is a single pass of primary key lookups.
+    QSqlQuery *select = pool.cachedQuery(
+        databasePath,
+        QStringLiteral("SELECT a.id, a.file_name FROM library.assets a "
+                       "WHERE a.id > ? AND a.file_name <> '' "
+                       "AND NOT EXISTS (SELECT 1 FROM asset_names n WHERE n.asset_id = a.id) "
+                       "ORDER BY a.id LIMIT ?"),
+        &connectionError);
+    if (!select) {
+        qWarning() << "Failed to prepare file name backfill:" << connectionError;
+        return -1;
+    }
+
+    select->bindValue(0, afterAssetId);
+    select->bindValue(1, batchSize);
+    if (!select->exec()) {
+        qWarning() << "Failed to read assets without file names:" << select->lastError();
+        select->finish();
+        return -1;
+    }
+    QVector<QPair<qint64, QString>> names;
+    while (select->next()) {
+        names.append(qMakePair(select->value(0).toLongLong(), select->value(1).toString()));
+    }
+    select->finish();
+    if (names.isEmpty()) {
+        return -1;
+    }
+
+    QFuture<bool> written = storeFileNames(writer, names);
+    written.waitForFinished();
+    return written.result() ? names.constLast().first : -1;
 }
 
-bool MetadataCache::deleteMetadata(qint64 assetId, QString *errorMessage)
+QFuture<bool> MetadataCache::storeFileNames(const QSharedPointer<DatabaseWriter> &writer,
+                                            const QVector<QPair<qint64, QString>> &names)
 {
-    QMutexLocker locker(&m_mutex);
-    if (!hasOpenCache() || assetId <= 0) {
-        if (errorMessage) {
-            *errorMessage = QStringLiteral("Cannot delete metadata without an open cache or valid asset ID");
-        }
-        return false;
+    if (!writer || names.isEmpty()) {
+        return QtFuture::makeReadyFuture(names.isEmpty());
     }
 
-    QSqlQuery query(m_database);
-    query.prepare(QStringLiteral("DELETE FROM asset_metadata WHERE asset_id = ?"));
-    query.addBindValue(assetId);
+    return writer->submit([names](QSqlDatabase &db, QString *errorMessage) {
+        QSqlQuery *insert = DatabaseConnectionPool::instance().cachedQuery(
+            db,
+            QStringLiteral("INSERT INTO asset_names (asset_id, file_name) VALUES (?, ?) "
+                           "ON CONFLICT(asset_id) DO UPDATE SET file_name = excluded.file_name"),
+            errorMessage);
+        if (!insert) {
+            return false;
+        }
 
-    if (!query.exec()) {
-        if (errorMessage) {
-            *errorMessage = QStringLiteral("Failed to delete metadata: %1").arg(query.lastError().text());
+        for (const auto &name : names) {
+            insert->bindValue(0, name.first);
+            insert->bindValue(1, name.second);
+            if (!insert->exec()) {
+                if (errorMessage) {
+                    *errorMessage = QStringLiteral("Failed to store file name: %1").arg(insert->lastError().text());
+                }
+                insert->finish();
+                return false;
+            }
         }
+        insert->finish();
+        return true;
+    });
+}
+
+bool MetadataCache::searchAssetIds(const QString &databasePath, const QString &searchText, QVector<qint64> *assetIds)
+{
+    const QString match = searchMatchExpression(searchText);
+    if (match.isEmpty()) {
         return false;
     }
 
+    assetIds->clear();
+    QString connectionError;
+    QSqlQuery *query = DatabaseConnectionPool::instance().cachedQuery(
+        databasePath,
+        QStringLiteral("SELECT rowid FROM asset_search WHERE asset_search MATCH ?"),
+        &connectionError);
+    if (!query) {
+        qWarning() << "Failed to prepare search:" << connectionError;
+        return true;
+    }
+
+    query->bindValue(0, match);
+    if (!query->exec()) {
+        qWarning() << "Failed to search assets:" << query->lastError();
+        query->finish();
+        return true;
+    }
+    while (query->next()) {
+        assetIds->append(query->value(0).toLongLong());
+    }
+    query->finish();
     return true;
 }
 
+QFuture<bool> MetadataCache::deleteMetadata(qint64 assetId)
+{
+    return submitAssetWrite(assetId, [assetId](QSqlDatabase &db, QString *errorMessage) {
+        const QStringList statements = {
+            QStringLiteral("DELETE FROM asset_tags WHERE asset_id = ?"),
+            QStringLiteral("DELETE FROM asset_metadata WHERE asset_id = ?"),
+            QStringLiteral("DELETE FROM asset_names WHERE asset_id = ?"),
+        };
+
+        for (const QString &sql : statements) {
+            QSqlQuery query(db);
+            query.prepare(sql);
+            query.addBindValue(assetId);
+
+            if (!query.exec()) {
+                if (errorMessage) {
+                    *errorMessage = QStringLiteral("Failed to delete metadata: %1").arg(query.lastError().text());
+                }
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
 QVector<qint64> MetadataCache::filterAssets(const FilterOptions &options) const
 {
     QVector<qint64> result;
@@ -310,24 +995,54 @@ QVector<qint64> MetadataCache::filterAssets(const FilterOptions &options) const
         return result;
     }
 
-    QStringList conditions;
     QVariantList bindValues;
+    const QString whereClause = filterWhereClause(options, QString(), &bindValues);
+    const QString orderBy = filterOrderByClause(options, QString());
+
+    QSqlQuery query(m_database);
+    query.setForwardOnly(true);
+    query.prepare(QStringLiteral("SELECT asset_id FROM asset_metadata %1 %2").arg(whereClause, orderBy));
+
+    for (const QVariant &value : std::as_const(bindValues)) {
+        query.addBindValue(value);
+    }
+
+    if (!query.exec()) {
+        qWarning() << "Failed to filter assets:" << query.lastError();
+        return result;
+    }
+
+    while (query.next()) {
+        result.append(query.value(0).toLongLong());
+    }
+
+    return result;
+}
+
+QString MetadataCache::filterWhereClause(const FilterOptions &options,
+                                         const QString &columnPrefix,
+                                         QVariantList *bindValues,
+                                         const QString &assetIdColumn)
+{
+    // columnPrefix qualifies asset_metadata columns, e.g. "m." when the table
+    // is joined under an alias. Every %1 below is replaced by it.
+    QStringList conditions;
 
     // ISO range filter
     if (options.isoMin > 0 || options.isoMax > 0) {
         if (options.isoMin > 0 && options.isoMax > 0) {
             // Both min and max specified: range filter
-            conditions.append(QStringLiteral("CAST(iso AS INTEGER) >= ? AND CAST(iso AS INTEGER) <= ?"));
-            bindValues.append(options.isoMin);
-            bindValues.append(options.isoMax);
+            conditions.append(QStringLiteral("%1iso BETWEEN ? AND ?").arg(columnPrefix));
+            bindValues->append(options.isoMin);
+            bindValues->append(options.isoMax);
         } else if (options.isoMin > 0) {
             // Only min specified: >= filter
-            conditions.append(QStringLiteral("CAST(iso AS INTEGER) >= ?"));
-            bindValues.append(options.isoMin);
+            conditions.append(QStringLiteral("%1iso >= ?").arg(columnPrefix));
+            bindValues->append(options.isoMin);
         } else if (options.isoMax > 0) {
             // Only max specified (min is "Any"): <= filter, but exclude ISO 0 (no data)
-            conditions.append(QStringLiteral("CAST(iso AS INTEGER) > 0 AND CAST(iso AS INTEGER) <= ?"));
-            bindValues.append(options.isoMax);
+            conditions.append(QStringLiteral("%1iso > 0 AND %1iso <= ?").arg(columnPrefix));
+            bindValues->append(options.isoMax);
         }
     }
 
@@ -341,85 +1056,72 @@ QVector<qint64> MetadataCache::filterAssets(const FilterOptions &options) const
             // Assume first part is make, rest is model
             QString filterMake = parts.first();
             QString filterModel = parts.mid(1).join(QLatin1Char(' '));
-            conditions.append(QStringLiteral("(camera_make = ? AND camera_model = ?) OR (camera_make || ' ' || camera_model = ?)"));
-            bindValues.append(filterMake);
-            bindValues.append(filterModel);
-            bindValues.append(options.cameraMake);
+            conditions.append(QStringLiteral("((%1camera_make = ? AND %1camera_model = ?) OR (%1camera_make || ' ' || %1camera_model = ?))").arg(columnPrefix));
+            bindValues->append(filterMake);
+            bindValues->append(filterModel);
+            bindValues->append(options.cameraMake);
         } else {
             // Single value - match against either make or model
-            conditions.append(QStringLiteral("(camera_make = ? OR camera_model = ? OR camera_make || ' ' || camera_model = ?)"));
-            bindValues.append(options.cameraMake);
-            bindValues.append(options.cameraMake);
-            bindValues.append(options.cameraMake);
+            conditions.append(QStringLiteral("(%1camera_make = ? OR %1camera_model = ? OR %1camera_make || ' ' || %1camera_model = ?)").arg(columnPrefix));
+            bindValues->append(options.cameraMake);
+            bindValues->append(options.cameraMake);
+            bindValues->append(options.cameraMake);
         }
     }
 
-    // Tags filter
+    if (!options.lens.isEmpty()) {
+        conditions.append(QStringLiteral("%1lens = ?").arg(columnPrefix));
+        bindValues->append(options.lens);
+    }
+
+    // Tags filter: resolved through the (tag_id, asset_id) index
+    const QString idColumn = assetIdColumn.isEmpty() ? columnPrefix + QStringLiteral("asset_id") : assetIdColumn;
     if (!options.tags.isEmpty()) {
-        QStringList tagConditions;
-        for (const QString &tag : options.tags) {
-            tagConditions.append(QStringLiteral("tags LIKE ?"));
-            bindValues.append(QStringLiteral("%\"%1\"%").arg(tag));
-        }
-        if (!tagConditions.isEmpty()) {
-            conditions.append(QStringLiteral("(%1)").arg(tagConditions.join(QStringLiteral(" OR "))));
-        }
+        const bool requireAll = options.tagMatch == FilterOptions::MatchAllTags;
+        conditions.append(tagCondition(idColumn, options.tags, requireAll, false, bindValues));
+    }
+    if (!options.excludedTags.isEmpty()) {
+        conditions.append(tagCondition(idColumn, options.excludedTags, false, true, bindValues));
+    }
+
+    const QString match = searchMatchExpression(options.searchText);
+    if (!match.isEmpty()) {
+        conditions.append(QStringLiteral("%1 IN (SELECT rowid FROM asset_search WHERE asset_search MATCH ?)").arg(idColumn));
+        bindValues->append(match);
     }
 
-    QString whereClause;
-    if (!conditions.isEmpty()) {
-        whereClause = QStringLiteral("WHERE %1").arg(conditions.join(QStringLiteral(" AND ")));
+    if (conditions.isEmpty()) {
+        return {};
     }
+    return QStringLiteral("WHERE %1").arg(conditions.join(QStringLiteral(" AND ")));
+}
 
-    // Build ORDER BY clause
-    QString orderBy;
+QString MetadataCache::filterOrderByClause(const FilterOptions &options, const QString &columnPrefix)
+{
     switch (options.sortOrder) {
     case FilterOptions::SortByDateDesc:
-        // Use capture_date if available, otherwise fall back to asset_id (newer assets have higher IDs)
-        orderBy = QStringLiteral("ORDER BY CASE WHEN capture_date IS NULL OR capture_date = '' THEN 0 ELSE 1 END DESC, capture_date DESC, asset_id DESC");
-        break;
+        // NULL sorts last when descending, so undated assets follow dated ones
+        // and the order walks idx_metadata_capture_epoch backwards.
+        return QStringLiteral("ORDER BY %1capture_epoch DESC, %1asset_id DESC").arg(columnPrefix);
     case FilterOptions::SortByDateAsc:
-        orderBy = QStringLiteral("ORDER BY CASE WHEN capture_date IS NULL OR capture_date = '' THEN 1 ELSE 0 END ASC, capture_date ASC, asset_id ASC");
-        break;
+        return QStringLiteral("ORDER BY %1capture_epoch IS NULL ASC, %1capture_epoch ASC, %1asset_id ASC").arg(columnPrefix);
     case FilterOptions::SortByIsoDesc:
-        orderBy = QStringLiteral("ORDER BY CAST(iso AS INTEGER) DESC, asset_id DESC");
-        break;
+        return QStringLiteral("ORDER BY %1iso DESC, %1asset_id DESC").arg(columnPrefix);
     case FilterOptions::SortByIsoAsc:
-        orderBy = QStringLiteral("ORDER BY CAST(iso AS INTEGER) ASC, asset_id ASC");
-        break;
+        return QStringLiteral("ORDER BY %1iso ASC, %1asset_id ASC").arg(columnPrefix);
     case FilterOptions::SortByCameraMake:
-        orderBy = QStringLiteral("ORDER BY camera_make ASC, camera_model ASC, capture_date DESC");
-        break;
+        return QStringLiteral("ORDER BY %1camera_make ASC, %1camera_model ASC, %1capture_epoch DESC, %1asset_id DESC").arg(columnPrefix);
     case FilterOptions::SortByFileName:
-        // This would need to join with assets table, but for now we'll sort by asset_id
-        orderBy = QStringLiteral("ORDER BY asset_id ASC");
-        break;
-    }
-
-    QSqlQuery query(m_database);
-    const QString sql = QStringLiteral("SELECT asset_id FROM asset_metadata %1 %2").arg(whereClause, orderBy);
-    query.prepare(sql);
-
-    for (const QVariant &value : bindValues) {
-        query.addBindValue(value);
-    }
-
-    if (!query.exec()) {
-        qWarning() << "Failed to filter assets:" << query.lastError();
-        return result;
-    }
-
-    while (query.next()) {
-        result.append(query.value(0).toLongLong());
+        // File names live in library.db; callers that join the assets table
+        // order by it themselves.
+        return QStringLiteral("ORDER BY %1asset_id ASC").arg(columnPrefix);
     }
-
-    return result;
+    return {};
 }
 
-QStringList MetadataCache::getAllCameraMakes() const
+FacetCounts MetadataCache::facets() const
 {
-    QStringList result;
-    QSet<QString> cameraSet;
+    FacetCounts result;
 
     QMutexLocker locker(&m_mutex);
     if (!hasOpenCache()) {
@@ -427,145 +1129,93 @@ QStringList MetadataCache::getAllCameraMakes() const
     }
 
     QSqlQuery query(m_database);
-    if (!query.exec(QStringLiteral("SELECT DISTINCT camera_make, camera_model FROM asset_metadata WHERE (camera_make IS NOT NULL AND camera_make != '') OR (camera_model IS NOT NULL AND camera_model != '') ORDER BY camera_make, camera_model"))) {
-        qWarning() << "Failed to get camera makes:" << query.lastError();
+    query.setForwardOnly(true);
+    if (!query.exec(QStringLiteral(
+            "SELECT facet, value, count FROM facet_values "
+            "ORDER BY facet, CASE WHEN facet = 'iso' THEN CAST(value AS INTEGER) END, value"))) {
+        qWarning() << "Failed to read facets:" << query.lastError();
         return result;
     }
 
     while (query.next()) {
-        const QString make = query.value(0).toString().trimmed();
-        const QString model = query.value(1).toString().trimmed();
-        
-        QString camera;
-        if (!make.isEmpty() && !model.isEmpty()) {
-            camera = QStringLiteral("%1 %2").arg(make, model);
-        } else if (!make.isEmpty()) {
-            camera = make;
-        } else if (!model.isEmpty()) {
-            camera = model;
-        }
-        
-        if (!camera.isEmpty() && !cameraSet.contains(camera)) {
-            cameraSet.insert(camera);
-            result.append(camera);
+        const QString facet = query.value(0).toString();
+        FacetValue value;
+        value.value = query.value(1).toString();
+        value.count = query.value(2).toInt();
+
+        if (facet == QLatin1String("camera")) {
+            result.cameras.append(value);
+        } else if (facet == QLatin1String("lens")) {
+            result.lenses.append(value);
+        } else if (facet == QLatin1String("tag")) {
+            result.tags.append(value);
+        } else if (facet == QLatin1String("iso")) {
+            result.isoValues.append(value);
+        } else if (facet == QLatin1String("month")) {
+            result.captureMonths.append(value);
         }
     }
 
     return result;
 }
 
-QStringList MetadataCache::getAllTags() const
+QStringList MetadataCache::getAllCameraMakes() const
 {
     QStringList result;
-    QSet<QString> tagSet;
-
-    QMutexLocker locker(&m_mutex);
-    if (!hasOpenCache()) {
-        return result;
-    }
-
-    QSqlQuery query(m_database);
-    if (!query.exec(QStringLiteral("SELECT tags FROM asset_metadata WHERE tags IS NOT NULL AND tags != '' AND tags != '[]'"))) {
-        qWarning() << "Failed to get tags:" << query.lastError();
-        return result;
+    for (const FacetValue &camera : facets().cameras) {
+        result.append(camera.value);
     }
+    return result;
+}
 
-    while (query.next()) {
-        const QString tagsJson = query.value(0).toString();
-        if (tagsJson.isEmpty()) {
-            continue;
-        }
-
-        QJsonParseError error;
-        QJsonDocument doc = QJsonDocument::fromJson(tagsJson.toUtf8(), &error);
-        if (error.error == QJsonParseError::NoError && doc.isArray()) {
-            QJsonArray array = doc.array();
-            for (const QJsonValue &value : array) {
-                if (value.isString()) {
-                    tagSet.insert(value.toString());
-                }
-            }
-        }
+QStringList MetadataCache::getAllTags() const
+{
+    QStringList result;
+    for (const FacetValue &tag : facets().tags) {
+        result.append(tag.value);
     }
-
-    result = tagSet.values();
-    result.sort();
     return result;
 }
 
 int MetadataCache::getMinIso() const
 {
-    QMutexLocker locker(&m_mutex);
-    if (!hasOpenCache()) {
-        return 0;
-    }
-
-    QSqlQuery query(m_database);
-    if (!query.exec(QStringLiteral("SELECT MIN(iso) FROM asset_metadata WHERE iso > 0"))) {
-        return 0;
-    }
-
-    if (query.next()) {
-        return query.value(0).toInt();
-    }
-
-    return 0;
+    return facets().minIso();
 }
 
 int MetadataCache::getMaxIso() const
 {
-    QMutexLocker locker(&m_mutex);
-    if (!hasOpenCache()) {
-        return 0;
-    }
-
-    QSqlQuery query(m_database);
-    if (!query.exec(QStringLiteral("SELECT MAX(iso) FROM asset_metadata WHERE iso > 0"))) {
-        return 0;
-    }
-
-    if (query.next()) {
-        return query.value(0).toInt();
-    }
-
-    return 0;
+    return facets().maxIso();
 }
 
-bool MetadataCache::addTag(qint64 assetId, const QString &tag, QString *errorMessage)
+QFuture<bool> MetadataCache::addTag(qint64 assetId, const QString &tag)
 {
-    AssetMetadata metadata = loadMetadata(assetId);
-    if (metadata.assetId != assetId) {
-        metadata.assetId = assetId;
-    }
-
-    if (!metadata.tags.contains(tag)) {
-        metadata.tags.append(tag);
-    }
-
-    return updateMetadata(assetId, metadata, errorMessage);
+    return submitAssetWrite(assetId, [assetId, tag](QSqlDatabase &db, QString *errorMessage) {
+        return linkTags(db, assetId, QStringList{tag}, errorMessage);
+    });
 }
 
-bool MetadataCache::removeTag(qint64 assetId, const QString &tag, QString *errorMessage)
+QFuture<bool> MetadataCache::removeTag(qint64 assetId, const QString &tag)
 {
-    QMutexLocker locker(&m_mutex);
-    AssetMetadata metadata = loadMetadata(assetId);
-    if (metadata.assetId != assetId) {
-        return true; // No metadata exists, nothing to remove
-    }
-
-    metadata.tags.removeAll(tag);
-    return updateMetadata(assetId, metadata, errorMessage);
+    return submitAssetWrite(assetId, [assetId, tag](QSqlDatabase &db, QString *errorMessage) {
+        QSqlQuery query(db);
+        query.prepare(QStringLiteral(
+            "DELETE FROM asset_tags WHERE asset_id = ? AND tag_id = (SELECT id FROM tags WHERE name = ?)"));
+        query.addBindValue(assetId);
+        query.addBindValue(tag);
+
+        if (!query.exec()) {
+            if (errorMessage) {
+                *errorMessage = QStringLiteral("Failed to remove tag: %1").arg(query.lastError().text());
+            }
+            return false;
+        }
+        return true;
+    });
 }
 
-bool MetadataCache::setTags(qint64 assetId, const QStringList &tags, QString *errorMessage)
+QFuture<bool> MetadataCache::setTags(qint64 assetId, const QStringList &tags)
 {
-    QMutexLocker locker(&m_mutex);
-    AssetMetadata metadata = loadMetadata(assetId);
-    if (metadata.assetId != assetId) {
-        metadata.assetId = assetId;
-    }
-
-    metadata.tags = tags;
-    return updateMetadata(assetId, metadata, errorMessage);
+    return submitAssetWrite(assetId, [assetId, tags](QSqlDatabase &db, QString *errorMessage) {
+        return replaceAssetTags(db, assetId, tags, errorMessage);
+    });
 }
-
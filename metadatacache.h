@@ -1,22 +1,30 @@
 #ifndef METADATACACHE_H
 #define METADATACACHE_H
 
+#include <QFuture>
 #include <QObject>
+#include <QSharedPointer>
 #include <QSqlDatabase>
 #include <QString>
 #include <QStringList>
 #include <QDateTime>
+#include <QVariantList>
+#include <QPair>
 #include <QVector>
 #include <QRecursiveMutex>
 
+#include <functional>
+
 struct AssetMetadata
 {
     qint64 assetId = -1;
     int iso = 0;
     QString cameraMake;
     QString cameraModel;
+    QString lens;
     QDateTime captureDate;
     QStringList tags;
+    QString fileName; // copy of the library's file name, for text search
 };
 
 struct FilterOptions
@@ -30,13 +38,75 @@ struct FilterOptions
         SortByFileName
     };
 
+    enum TagMatch {
+        MatchAnyTag,
+        MatchAllTags
+    };
+
+    enum FlagFilter {
+        AnyFlag,
+        PickedOnly,
+        UnflaggedOnly,
+        RejectedOnly,
+        HideRejected
+    };
+
     SortOrder sortOrder = SortByDateDesc;
     int isoMin = 0;
     int isoMax = 0; // 0 means no max
     QString cameraMake;
+    QString lens; // Empty means any lens
     QStringList tags; // Empty means no tag filter
+    TagMatch tagMatch = MatchAnyTag;
+    QStringList excludedTags; // Assets with any of these are hidden
+    // Words that must each prefix-match the file name, camera, lens or tags.
+    QString searchText;
+    // Keeps assets whose perceptual hash is within similarityThreshold bits
+    // of this asset's, the asset itself included. -1 means no such filter.
+    qint64 similarToAssetId = -1;
+    int similarityThreshold = 10;
+    // Shows each burst (frames from one camera taken at most burstGapMsecs
+    // apart) as a single asset, the first of its frames in sort order.
+    bool collapseBursts = false;
+    int burstGapMsecs = 1000;
+    // Culling on the marks in assetmarks.h.
+    int minRating = 0; // 0 keeps unrated assets
+    FlagFilter flagFilter = AnyFlag;
+    quint8 colorLabels = 0; // bit n keeps label n; 0 keeps every label
+
+    // Restricts the result to a smart collection's members; -1 means none.
+    // See LibraryManager::smartCollections().
+    qint64 collectionId = -1;
+
+    bool filtersOnMarks() const
+    {
+        return minRating > 0 || flagFilter != AnyFlag || colorLabels != 0;
+    }
 };
 
+struct FacetValue
+{
+    QString value;
+    int count = 0;
+};
+
+// Distinct filter values with the number of assets carrying each, read from
+// the facet_values table that triggers keep current on every write.
+struct FacetCounts
+{
+    QVector<FacetValue> cameras; // "Make Model" labels, as used by FilterOptions::cameraMake
+    QVector<FacetValue> lenses;
+    QVector<FacetValue> tags;
+    QVector<FacetValue> isoValues;  // ascending by ISO
+    QVector<FacetValue> captureMonths; // "yyyy-MM"
+
+    int minIso() const { return isoValues.isEmpty() ? 0 : isoValues.first().value.toInt(); }
+    int maxIso() const { return isoValues.isEmpty() ? 0 : isoValues.last().value.toInt(); }
+};
+
+struct SchemaMigration;
+class DatabaseWriter;
+
 class MetadataCache : public QObject
 {
     Q_OBJECT
@@ -50,32 +120,76 @@ public:
     bool hasOpenCache() const;
     QString cachePath() const;
 
-    bool storeMetadata(qint64 assetId, const AssetMetadata &metadata, QString *errorMessage = nullptr);
-    bool updateMetadata(qint64 assetId, const AssetMetadata &metadata, QString *errorMessage = nullptr);
+    // Writes go through the cache's writer thread. metadataUpdated is
+    // emitted, and the future finishes, once the write has committed.
+    QFuture<bool> storeMetadata(qint64 assetId, const AssetMetadata &metadata);
+    // Keeps the asset's existing tags and adds metadata.tags to them; use
+    // setTags() to replace them.
+    QFuture<bool> updateMetadata(qint64 assetId, const AssetMetadata &metadata);
     AssetMetadata loadMetadata(qint64 assetId) const;
-    bool deleteMetadata(qint64 assetId, QString *errorMessage = nullptr);
+    // Reads every row through the calling thread's pooled connection.
+    static QVector<AssetMetadata> loadAllMetadata(const QString &databasePath);
+    QFuture<bool> deleteMetadata(qint64 assetId);
+    // The writer every write to the open cache goes through; null while no
+    // cache is open.
+    QSharedPointer<DatabaseWriter> writer() const;
+    // Fills capture_epoch for up to batchSize rows after afterAssetId that
+    // predate the column. Returns the last asset id examined, or -1 once no
+    // rows remain. Reads on the calling thread's pooled connection and waits
+    // for writer to commit, so it belongs on a worker thread.
+    static qint64 backfillCaptureEpochs(const QSharedPointer<DatabaseWriter> &writer, qint64 afterAssetId, int batchSize);
+    // Copies the names of up to batchSize library.db assets after
+    // afterAssetId that have none in asset_names yet, so they become
+    // searchable by name. Same conventions as backfillCaptureEpochs().
+    static qint64 backfillFileNames(const QSharedPointer<DatabaseWriter> &writer,
+                                    const QString &libraryDatabasePath,
+                                    qint64 afterAssetId,
+                                    int batchSize);
+    // Records (asset id, file name) pairs of newly imported assets for
+    // search, whether or not their metadata is ever extracted.
+    static QFuture<bool> storeFileNames(const QSharedPointer<DatabaseWriter> &writer,
+                                        const QVector<QPair<qint64, QString>> &names);
+
+    // Fills assetIds with the assets whose search document matches
+    // searchText, in no particular order. Returns false, leaving assetIds
+    // alone, when searchText has no searchable words and so filters nothing.
+    // Runs on the calling thread's pooled connection.
+    static bool searchAssetIds(const QString &databasePath, const QString &searchText, QVector<qint64> *assetIds);
 
     QVector<qint64> filterAssets(const FilterOptions &options) const;
-
+    // assetIdColumn is the column the tag subqueries compare against;
+    // defaults to columnPrefix + "asset_id".
+    static QString filterWhereClause(const FilterOptions &options,
+                                     const QString &columnPrefix,
+                                     QVariantList *bindValues,
+                                     const QString &assetIdColumn = QString());
+    static QString filterOrderByClause(const FilterOptions &options, const QString &columnPrefix);
+    static QString databasePath(const QString &libraryPath);
+
+    FacetCounts facets() const;
     QStringList getAllCameraMakes() const;
     QStringList getAllTags() const;
     int getMinIso() const;
     int getMaxIso() const;
 
-    bool addTag(qint64 assetId, const QString &tag, QString *errorMessage = nullptr);
-    bool removeTag(qint64 assetId, const QString &tag, QString *errorMessage = nullptr);
-    bool setTags(qint64 assetId, const QStringList &tags, QString *errorMessage = nullptr);
+    QFuture<bool> addTag(qint64 assetId, const QString &tag);
+    QFuture<bool> removeTag(qint64 assetId, const QString &tag);
+    QFuture<bool> setTags(qint64 assetId, const QStringList &tags);
 
 signals:
     void metadataUpdated(qint64 assetId);
 
 private:
     bool initializeSchema(QString *errorMessage);
+    QFuture<bool> submitAssetWrite(qint64 assetId, std::function<bool(QSqlDatabase &, QString *)> command);
+    static QVector<SchemaMigration> schemaMigrations();
+    QStringList loadTags(qint64 assetId) const;
     QString makeCachePath(const QString &libraryPath) const;
 
     QString m_cachePath;
     QString m_connectionName;
     QSqlDatabase m_database;
+    QSharedPointer<DatabaseWriter> m_writer;
     mutable QRecursiveMutex m_mutex;
 };
 
@@ -0,0 +1,175 @@
+#include "perceptualhash.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+constexpr double kPi = 3.14159265358979323846;
+constexpr int kSampleSize = 32;
+constexpr int kHashSize = 8;
+
+// cos((2x + 1) u pi / 2N) for the low frequencies only.
+const std::array<std::array<double, kSampleSize>, kHashSize> &dctTable()
+{
+    static const auto table = []() {
+        std::array<std::array<double, kSampleSize>, kHashSize> values{};
+        for (int u = 0; u < kHashSize; ++u) {
+            for (int x = 0; x < kSampleSize; ++x) {
+                values[u][x] = std::cos((2 * x + 1) * u * kPi / (2 * kSampleSize));
+            }
+        }
+        return values;
+    }();
+    return table;
+}
+
+// Calls visit with every 16-bit value within radius bits of key.
+template <typename Visit>
+void forEachChunkWithin(quint32 key, int radius, Visit visit)
+{
+    visit(key);
+    for (int a = 0; a < 16 && radius >= 1; ++a) {
+        const quint32 keyA = key ^ (1u << a);
+        visit(keyA);
+        for (int b = a + 1; b < 16 && radius >= 2; ++b) {
+            const quint32 keyB = keyA ^ (1u << b);
+            visit(keyB);
+            for (int c = b + 1; c < 16 && radius >= 3; ++c) {
+                visit(keyB ^ (1u << c));
+            }
+        }
+    }
+}
+
+// Beyond this chunk radius the probes outnumber what a scan would touch.
+constexpr int kMaxChunkRadius = 3;
+}
+
+namespace PerceptualHash {
+
+quint64 compute(const QImage &image)
+{
+    if (image.isNull()) {
+        return 0;
+    }
+
+    const QImage sample = image.scaled(kSampleSize, kSampleSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation)
+                              .convertToFormat(QImage::Format_Grayscale8);
+    const auto &table = dctTable();
+
+    // Separable 2D DCT-II, keeping only the 8x8 low-frequency corner.
+    std::array<std::array<double, kHashSize>, kSampleSize> rows{};
+    for (int y = 0; y < kSampleSize; ++y) {
+        const uchar *line = sample.constScanLine(y);
+        for (int u = 0; u < kHashSize; ++u) {
+            double sum = 0.0;
+            for (int x = 0; x < kSampleSize; ++x) {
+                sum += line[x] * table[u][x];
+            }
+            rows[y][u] = sum;
+        }
+    }
+
+    std::array<double, kHashSize * kHashSize> coefficients{};
+    for (int v = 0; v < kHashSize; ++v) {
+        for (int u = 0; u < kHashSize; ++u) {
+            double sum = 0.0;
+            for (int y = 0; y < kSampleSize; ++y) {
+                sum += rows[y][u] * table[v][y];
+            }
+            coefficients[v * kHashSize + u] = sum;
+        }
+    }
+
+    std::array<double, kHashSize * kHashSize> sorted = coefficients;
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    const double median = sorted[sorted.size() / 2];
+
+    quint64 hash = 0;
+    for (int i = 0; i < int(coefficients.size()); ++i) {
+        if (coefficients[i] > median) {
+            hash |= quint64(1) << i;
+        }
+    }
+    return hash;
+}
+
+} // namespace PerceptualHash
+
+PerceptualHashIndex::PerceptualHashIndex(const QVector<quint64> &hashes)
+    : m_hashes(hashes)
+{
+    const int count = m_hashes.size();
+    for (int c = 0; c < kChunks; ++c) {
+        // Counting sort of the rows by chunk value.
+        QVector<quint32> &start = m_bucketStart[c];
+        start.fill(0, (1 << kChunkBits) + 1);
+        for (int row = 0; row < count; ++row) {
+            if (m_hashes.at(row) != 0) {
+                ++start[chunk(m_hashes.at(row), c) + 1];
+            }
+        }
+        for (int v = 0; v < (1 << kChunkBits); ++v) {
+            start[v + 1] += start[v];
+        }
+
+        QVector<int> &rows = m_bucketRows[c];
+        rows.resize(int(start.constLast()));
+        QVector<quint32> next(start.cbegin(), start.cend() - 1);
+        for (int row = 0; row < count; ++row) {
+            if (m_hashes.at(row) != 0) {
+                rows[int(next[chunk(m_hashes.at(row), c)]++)] = row;
+            }
+        }
+    }
+}
+
+QVector<int> PerceptualHashIndex::rowsWithin(quint64 hash, int maxDistance) const
+{
+    if (hash == 0 || maxDistance < 0) {
+        return {};
+    }
+
+    const int chunkRadius = maxDistance / kChunks;
+    if (chunkRadius > kMaxChunkRadius) {
+        return scanWithin(hash, maxDistance);
+    }
+
+    QVector<int> result;
+    for (int c = 0; c < kChunks; ++c) {
+        const QVector<quint32> &start = m_bucketStart[c];
+        const QVector<int> &rows = m_bucketRows[c];
+        forEachChunkWithin(chunk(hash, c), chunkRadius, [&](quint32 key) {
+            for (quint32 i = start.at(key); i < start.at(key + 1); ++i) {
+                const int row = rows.at(int(i));
+                const quint64 candidate = m_hashes.at(row);
+                if (PerceptualHash::distance(candidate, hash) > maxDistance) {
+                    continue;
+                }
+                // Report each row from the first chunk that finds it.
+                bool seenEarlier = false;
+                for (int earlier = 0; earlier < c && !seenEarlier; ++earlier) {
+                    seenEarlier = int(qPopulationCount(chunk(candidate ^ hash, earlier))) <= chunkRadius;
+                }
+                if (!seenEarlier) {
+                    result.append(row);
+                }
+            }
+        });
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+QVector<int> PerceptualHashIndex::scanWithin(quint64 hash, int maxDistance) const
+{
+    QVector<int> result;
+    const quint64 *hashes = m_hashes.constData();
+    const int count = m_hashes.size();
+    for (int row = 0; row < count; ++row) {
+        if (hashes[row] != 0 && PerceptualHash::distance(hashes[row], hash) <= maxDistance) {
+            result.append(row);
+        }
+    }
+    return result;
+}
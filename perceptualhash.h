@@ -0,0 +1,62 @@
+#ifndef PERCEPTUALHASH_H
+#define PERCEPTUALHASH_H
+
+#include <QImage>
+#include <QtAlgorithms>
+#include <QVector>
+#include <QtGlobal>
+
+#include <array>
+
+namespace PerceptualHash {
+
+// 64-bit DCT hash: the image is reduced to 32x32 grey, and each of the 8x8
+// lowest-frequency DCT coefficients contributes one bit, set when it lies
+// above their median. Visually similar images differ in few bits. Returns 0
+// for a null image; 0 is treated as "no hash" throughout.
+quint64 compute(const QImage &image);
+
+inline int distance(quint64 a, quint64 b)
+{
+    return int(qPopulationCount(a ^ b));
+}
+
+} // namespace PerceptualHash
+
+// Multi-index hashing over a fixed set of hashes. Each hash is cut into four
+// 16-bit chunks and every chunk value has a bucket of rows. Two hashes
+// within r bits of each other agree to within r / 4 bits on at least one
+// chunk, so a query only probes the buckets near its own chunks and checks
+// the full distance of the rows found there. Radii too large for that to
+// pay off fall back to a linear popcount scan.
+class PerceptualHashIndex
+{
+public:
+    // hashes[row] is the hash of that row, 0 for rows without one.
+    explicit PerceptualHashIndex(const QVector<quint64> &hashes);
+
+    int size() const { return m_hashes.size(); }
+    quint64 hash(int row) const { return m_hashes.at(row); }
+
+    // Rows whose hash is within maxDistance bits of hash, ascending.
+    QVector<int> rowsWithin(quint64 hash, int maxDistance) const;
+
+private:
+    static constexpr int kChunks = 4;
+    static constexpr int kChunkBits = 16;
+
+    static quint32 chunk(quint64 hash, int index)
+    {
+        return quint32(hash >> (index * kChunkBits)) & 0xffffu;
+    }
+
+    QVector<int> scanWithin(quint64 hash, int maxDistance) const;
+
+    QVector<quint64> m_hashes;
+    // Per chunk, rows grouped by chunk value: bucket v holds
+    // rows[start[v] .. start[v + 1]).
+    std::array<QVector<quint32>, kChunks> m_bucketStart;
+    std::array<QVector<int>, kChunks> m_bucketRows;
+};
+
+#endif // PERCEPTUALHASH_H
@@ -1,6 +1,7 @@
 #include "previewgenerator.h"
 
 #include "imageloader.h"
+#include "perceptualhash.h"
 
 #include <QDebug>
 #include <QDir>
@@ -96,6 +97,8 @@ PreviewResult PreviewGenerator::processJob(const PreviewJob &job) const
 
     result.success = true;
     result.imageSize = image.size();
+    // Hashed from the preview so the original is only decoded once.
+    result.perceptualHash = PerceptualHash::compute(image);
     return result;
 }
 
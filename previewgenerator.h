@@ -22,6 +22,7 @@ struct PreviewResult
     qint64 assetId = -1;
     QString previewPath;
     QSize imageSize;
+    quint64 perceptualHash = 0; // of the preview, see PerceptualHash::compute()
     bool success = false;
     QString errorMessage;
 };
@@ -0,0 +1,332 @@
+#include "roaringbitmap.h"
+
+#include <algorithm>
+
+bool RoaringBitmap::Container::contains(quint16 low) const
+{
+    if (isBitmap()) {
+        return (bits.at(low >> 6) >> (low & 63)) & 1u;
+    }
+    return std::binary_search(array.cbegin(), array.cend(), low);
+}
+
+void RoaringBitmap::add(quint32 value)
+{
+    const quint16 key = quint16(value >> 16);
+    const quint16 low = quint16(value & 0xFFFF);
+
+    int index = findContainer(key);
+    if (index < 0) {
+        index = -index - 1;
+        Container container;
+        container.key = key;
+        m_containers.insert(index, container);
+    }
+
+    Container &container = m_containers[index];
+    if (container.isBitmap()) {
+        quint64 &word = container.bits[low >> 6];
+        const quint64 mask = quint64(1) << (low & 63);
+        if (!(word & mask)) {
+            word |= mask;
+            ++container.cardinality;
+        }
+        return;
+    }
+
+    auto it = std::lower_bound(container.array.begin(), container.array.end(), low);
+    if (it != container.array.end() && *it == low) {
+        return;
+    }
+    container.array.insert(it, low);
+    ++container.cardinality;
+    normalize(container);
+}
+
+void RoaringBitmap::remove(quint32 value)
+{
+    const int index = findContainer(quint16(value >> 16));
+    if (index < 0) {
+        return;
+    }
+
+    const quint16 low = quint16(value & 0xFFFF);
+    Container &container = m_containers[index];
+    if (container.isBitmap()) {
+        quint64 &word = container.bits[low >> 6];
+        const quint64 mask = quint64(1) << (low & 63);
+        if (word & mask) {
+            word &= ~mask;
+            --container.cardinality;
+        }
+    } else {
+        auto it = std::lower_bound(container.array.begin(), container.array.end(), low);
+        if (it == container.array.end() || *it != low) {
+            return;
+        }
+        container.array.erase(it);
+        --container.cardinality;
+    }
+
+    if (container.cardinality == 0) {
+        m_containers.removeAt(index);
+    } else {
+        normalize(container);
+    }
+}
+
+bool RoaringBitmap::contains(quint32 value) const
+{
+    const int index = findContainer(quint16(value >> 16));
+    return index >= 0 && m_containers.at(index).contains(quint16(value & 0xFFFF));
+}
+
+bool RoaringBitmap::isEmpty() const
+{
+    return m_containers.isEmpty();
+}
+
+quint64 RoaringBitmap::cardinality() const
+{
+    quint64 total = 0;
+    for (const Container &container : m_containers) {
+        total += container.cardinality;
+    }
+    return total;
+}
+
+void RoaringBitmap::clear()
+{
+    m_containers.clear();
+}
+
+RoaringBitmap &RoaringBitmap::operator|=(const RoaringBitmap &other)
+{
+    QVector<Container> merged;
+    merged.reserve(m_containers.size() + other.m_containers.size());
+
+    int i = 0;
+    int j = 0;
+    while (i < m_containers.size() || j < other.m_containers.size()) {
+        if (j >= other.m_containers.size()
+            || (i < m_containers.size() && m_containers.at(i).key < other.m_containers.at(j).key)) {
+            merged.append(m_containers.at(i++));
+        } else if (i >= m_containers.size() || other.m_containers.at(j).key < m_containers.at(i).key) {
+            merged.append(other.m_containers.at(j++));
+        } else {
+            Container container = m_containers.at(i++);
+            unite(container, other.m_containers.at(j++));
+            merged.append(container);
+        }
+    }
+
+    m_containers = merged;
+    return *this;
+}
+
+RoaringBitmap &RoaringBitmap::operator&=(const RoaringBitmap &other)
+{
+    QVector<Container> result;
+    int i = 0;
+    int j = 0;
+    while (i < m_containers.size() && j < other.m_containers.size()) {
+        const quint16 left = m_containers.at(i).key;
+        const quint16 right = other.m_containers.at(j).key;
+        if (left < right) {
+            ++i;
+        } else if (right < left) {
+            ++j;
+        } else {
+            Container container = m_containers.at(i++);
+            intersect(container, other.m_containers.at(j++));
+            if (container.cardinality > 0) {
+                result.append(container);
+            }
+        }
+    }
+
+    m_containers = result;
+    return *this;
+}
+
+RoaringBitmap &RoaringBitmap::operator-=(const RoaringBitmap &other)
+{
+    QVector<Container> result;
+    result.reserve(m_containers.size());
+
+    int j = 0;
+    for (int i = 0; i < m_containers.size(); ++i) {
+        const quint16 key = m_containers.at(i).key;
+        while (j < other.m_containers.size() && other.m_containers.at(j).key < key) {
+            ++j;
+        }
+        if (j < other.m_containers.size() && other.m_containers.at(j).key == key) {
+            Container container = m_containers.at(i);
+            subtract(container, other.m_containers.at(j));
+            if (container.cardinality > 0) {
+                result.append(container);
+            }
+        } else {
+            result.append(m_containers.at(i));
+        }
+    }
+
+    m_containers = result;
+    return *this;
+}
+
+QVector<quint32> RoaringBitmap::toVector() const
+{
+    QVector<quint32> values;
+    values.reserve(int(cardinality()));
+    forEach([&values](quint32 value) {
+        values.append(value);
+    });
+    return values;
+}
+
+int RoaringBitmap::findContainer(quint16 key) const
+{
+    auto it = std::lower_bound(m_containers.cbegin(), m_containers.cend(), key,
+                               [](const Container &container, quint16 value) {
+                                   return container.key < value;
+                               });
+    const int index = int(it - m_containers.cbegin());
+    if (it != m_containers.cend() && it->key == key) {
+        return index;
+    }
+    return -index - 1;
+}
+
+void RoaringBitmap::toBitmap(Container &container)
+{
+    if (container.isBitmap()) {
+        return;
+    }
+    container.bits = QVector<quint64>(kBitmapWords, 0);
+    for (quint16 low : std::as_const(container.array)) {
+        container.bits[low >> 6] |= quint64(1) << (low & 63);
+    }
+    container.array.clear();
+}
+
+// Picks the smaller representation for the container's cardinality.
+void RoaringBitmap::normalize(Container &container)
+{
+    if (container.isBitmap() && container.cardinality <= kArrayMaxSize) {
+        QVector<quint16> array;
+        array.reserve(container.cardinality);
+        for (int word = 0; word < kBitmapWords; ++word) {
+            quint64 bits = container.bits.at(word);
+            while (bits) {
+                array.append(quint16(word * 64 + qCountTrailingZeroBits(bits)));
+                bits &= bits - 1;
+            }
+        }
+        container.array = array;
+        container.bits.clear();
+    } else if (!container.isBitmap() && container.cardinality > kArrayMaxSize) {
+        toBitmap(container);
+    }
+}
+
+void RoaringBitmap::unite(Container &target, const Container &other)
+{
+    if (!target.isBitmap() && !other.isBitmap()
+        && target.array.size() + other.array.size() <= kArrayMaxSize) {
+        QVector<quint16> merged;
+        merged.reserve(target.array.size() + other.array.size());
+        std::set_union(target.array.cbegin(), target.array.cend(),
+                       other.array.cbegin(), other.array.cend(),
+                       std::back_inserter(merged));
+        target.array = merged;
+        target.cardinality = merged.size();
+        return;
+    }
+
+    toBitmap(target);
+    if (other.isBitmap()) {
+        for (int word = 0; word < kBitmapWords; ++word) {
+            target.bits[word] |= other.bits.at(word);
+        }
+    } else {
+        for (quint16 low : other.array) {
+            target.bits[low >> 6] |= quint64(1) << (low & 63);
+        }
+    }
+
+    int cardinality = 0;
+    for (quint64 word : std::as_const(target.bits)) {
+        cardinality += qPopulationCount(word);
+    }
+    target.cardinality = cardinality;
+    normalize(target);
+}
+
+void RoaringBitmap::intersect(Container &target, const Container &other)
+{
+    if (!target.isBitmap()) {
+        QVector<quint16> kept;
+        for (quint16 low : std::as_const(target.array)) {
+            if (other.contains(low)) {
+                kept.append(low);
+            }
+        }
+        target.array = kept;
+        target.cardinality = kept.size();
+        return;
+    }
+
+    if (!other.isBitmap()) {
+        QVector<quint16> kept;
+        for (quint16 low : other.array) {
+            if (target.contains(low)) {
+                kept.append(low);
+            }
+        }
+        target.bits.clear();
+        target.array = kept;
+        target.cardinality = kept.size();
+        return;
+    }
+
+    int cardinality = 0;
+    for (int word = 0; word < kBitmapWords; ++word) {
+        target.bits[word] &= other.bits.at(word);
+        cardinality += qPopulationCount(target.bits.at(word));
+    }
+    target.cardinality = cardinality;
+    normalize(target);
+}
+
+void RoaringBitmap::subtract(Container &target, const Container &other)
+{
+    if (!target.isBitmap()) {
+        QVector<quint16> kept;
+        for (quint16 low : std::as_const(target.array)) {
+            if (!other.contains(low)) {
+                kept.append(low);
+            }
+        }
+        target.array = kept;
+        target.cardinality = kept.size();
+        return;
+    }
+
+    if (other.isBitmap()) {
+        for (int word = 0; word < kBitmapWords; ++word) {
+            target.bits[word] &= ~other.bits.at(word);
+        }
+    } else {
+        for (quint16 low : other.array) {
+            target.bits[low >> 6] &= ~(quint64(1) << (low & 63));
+        }
+    }
+
+    int cardinality = 0;
+    for (quint64 word : std::as_const(target.bits)) {
+        cardinality += qPopulationCount(word);
+    }
+    target.cardinality = cardinality;
+    normalize(target);
+}
@@ -0,0 +1,80 @@
+#ifndef ROARINGBITMAP_H
+#define ROARINGBITMAP_H
+
+#include <QVector>
+#include <QtGlobal>
+
+// Compressed set of 32-bit values in the Roaring layout: values are grouped
+// by their high 16 bits into containers that hold either a sorted array of
+// low halves (sparse) or a 65536-bit bitmap (dense). Set operations work
+// container by container, so combining postings costs roughly the size of
+// the smaller operand rather than the value range.
+class RoaringBitmap
+{
+public:
+    void add(quint32 value);
+    void remove(quint32 value);
+    bool contains(quint32 value) const;
+    bool isEmpty() const;
+    quint64 cardinality() const;
+    void clear();
+
+    RoaringBitmap &operator|=(const RoaringBitmap &other);
+    RoaringBitmap &operator&=(const RoaringBitmap &other);
+    RoaringBitmap &operator-=(const RoaringBitmap &other); // and-not
+
+    friend RoaringBitmap operator|(RoaringBitmap lhs, const RoaringBitmap &rhs) { return lhs |= rhs; }
+    friend RoaringBitmap operator&(RoaringBitmap lhs, const RoaringBitmap &rhs) { return lhs &= rhs; }
+    friend RoaringBitmap operator-(RoaringBitmap lhs, const RoaringBitmap &rhs) { return lhs -= rhs; }
+
+    QVector<quint32> toVector() const;
+
+    // Calls visitor(value) for every value in ascending order.
+    template<typename Visitor>
+    void forEach(Visitor visitor) const
+    {
+        for (const Container &container : m_containers) {
+            const quint32 high = quint32(container.key) << 16;
+            if (container.isBitmap()) {
+                for (int word = 0; word < kBitmapWords; ++word) {
+                    quint64 bits = container.bits.at(word);
+                    while (bits) {
+                        const int bit = qCountTrailingZeroBits(bits);
+                        visitor(high | quint32(word * 64 + bit));
+                        bits &= bits - 1;
+                    }
+                }
+            } else {
+                for (quint16 low : container.array) {
+                    visitor(high | low);
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr int kArrayMaxSize = 4096; // past this a bitmap is smaller
+    static constexpr int kBitmapWords = 65536 / 64;
+
+    struct Container
+    {
+        quint16 key = 0;
+        int cardinality = 0;
+        QVector<quint16> array; // sorted, used while sparse
+        QVector<quint64> bits;  // kBitmapWords words, used while dense
+
+        bool isBitmap() const { return !bits.isEmpty(); }
+        bool contains(quint16 low) const;
+    };
+
+    int findContainer(quint16 key) const; // index, or -(insertion point) - 1
+    static void toBitmap(Container &container);
+    static void normalize(Container &container);
+    static void unite(Container &target, const Container &other);
+    static void intersect(Container &target, const Container &other);
+    static void subtract(Container &target, const Container &other);
+
+    QVector<Container> m_containers; // sorted by key
+};
+
+#endif // ROARINGBITMAP_H
@@ -0,0 +1,115 @@
+#include "schemamigrations.h"
+
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+
+int SchemaMigrator::userVersion(const QSqlDatabase &database)
+{
+    QSqlQuery query(database);
+    if (!query.exec(QStringLiteral("PRAGMA user_version")) || !query.next()) {
+        qWarning() << "Failed to read schema version:" << query.lastError();
+        return 0;
+    }
+    return query.value(0).toInt();
+}
+
+bool SchemaMigrator::migrate(QSqlDatabase &database,
+                             const QVector<SchemaMigration> &migrations,
+                             QString *errorMessage)
+{
+    const int current = userVersion(database);
+
+    for (const SchemaMigration &migration : migrations) {
+        if (migration.version <= current) {
+            continue;
+        }
+
+        if (!database.transaction()) {
+            if (errorMessage) {
+                *errorMessage = QStringLiteral("Failed to begin schema migration %1: %2")
+                                    .arg(migration.version)
+                                    .arg(database.lastError().text());
+            }
+            return false;
+        }
+
+        QString stepError;
+        bool ok = migration.apply(database, &stepError);
+        if (ok) {
+            // PRAGMA does not accept bound parameters.
+            QSqlQuery pragma(database);
+            ok = pragma.exec(QStringLiteral("PRAGMA user_version = %1").arg(migration.version));
+            if (!ok) {
+                stepError = pragma.lastError().text();
+            }
+        }
+
+        if (!ok || !database.commit()) {
+            if (stepError.isEmpty()) {
+                stepError = database.lastError().text();
+            }
+            database.rollback();
+            if (errorMessage) {
+                *errorMessage = QStringLiteral("Schema migration %1 (%2) failed: %3")
+                                    .arg(migration.version)
+                                    .arg(migration.description, stepError);
+            }
+            return false;
+        }
+
+        qInfo() << "Applied schema migration" << migration.version << migration.description;
+    }
+
+    return true;
+}
+
+bool SchemaMigrator::exec(QSqlDatabase &database, const QStringList &statements, QString *errorMessage)
+{
+    QSqlQuery query(database);
+    for (const QString &sql : statements) {
+        if (!query.exec(sql)) {
+            if (errorMessage) {
+                *errorMessage = query.lastError().text();
+            }
+            return false;
+        }
+        query.finish();
+    }
+    return true;
+}
+
+bool SchemaMigrator::hasColumn(const QSqlDatabase &database, const QString &table, const QString &column)
+{
+    QSqlQuery pragma(database);
+    if (!pragma.exec(QStringLiteral("PRAGMA table_info(%1)").arg(table))) {
+        return false;
+    }
+
+    while (pragma.next()) {
+        if (pragma.value(1).toString() == column) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SchemaMigrator::addColumn(QSqlDatabase &database,
+                               const QString &table,
+                               const QString &column,
+                               const QString &definition,
+                               QString *errorMessage)
+{
+    if (hasColumn(database, table, column)) {
+        return true;
+    }
+
+    QSqlQuery alter(database);
+    if (!alter.exec(QStringLiteral("ALTER TABLE %1 ADD COLUMN %2 %3").arg(table, column, definition))) {
+        if (errorMessage) {
+            *errorMessage = QStringLiteral("Failed to add %1 column: %2").arg(column, alter.lastError().text());
+        }
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef SCHEMAMIGRATIONS_H
+#define SCHEMAMIGRATIONS_H
+
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <functional>
+
+// One step of a database's schema history.
+struct SchemaMigration
+{
+    int version = 0;
+    QString description;
+    std::function<bool(QSqlDatabase &database, QString *errorMessage)> apply;
+};
+
+// Applies SchemaMigrations in version order. The database's PRAGMA
+// user_version records the last step applied, so opening an up-to-date
+// database costs a single pragma read. Each step runs in its own transaction
+// together with the version bump, so a failed step leaves the database at
+// the previous version.
+class SchemaMigrator
+{
+public:
+    static int userVersion(const QSqlDatabase &database);
+    static bool migrate(QSqlDatabase &database,
+                        const QVector<SchemaMigration> &migrations,
+                        QString *errorMessage = nullptr);
+
+    // Helpers for writing steps.
+    static bool exec(QSqlDatabase &database, const QStringList &statements, QString *errorMessage);
+    static bool hasColumn(const QSqlDatabase &database, const QString &table, const QString &column);
+    static bool addColumn(QSqlDatabase &database,
+                          const QString &table,
+                          const QString &column,
+                          const QString &definition,
+                          QString *errorMessage);
+};
+
+#endif // SCHEMAMIGRATIONS_H